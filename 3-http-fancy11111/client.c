@@ -1,6 +1,7 @@
 #include "shared.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -268,6 +269,50 @@ static void writeRequest(FILE *socketStream, request_info_t request_info)
   fflush(socketStream);
 }
 
+/**
+ * @brief copies a body with chunked transfer coding from in to out, without the chunk sizes and trailers
+ * 
+ * @param in the stream to read from, positioned at the first chunk size
+ * @param out the stream to write to
+ * @return int 0 on success, 1 if in ended early or a write failed, EXIT_PROTOCOL_ERROR on malformed chunks
+ */
+static int copyChunked(FILE *in, FILE *out)
+{
+  char *line = NULL, *endptr;
+  size_t len = 0;
+  int error = 0;
+  while (!error)
+  {
+    if (getline(&line, &len, in) == -1)
+    {
+      error = 1;
+      break;
+    }
+    // <hex size>[;extensions]\r\n
+    long long size = strtoll(line, &endptr, 16);
+    if (endptr == line || line[0] == '-' || line[0] == '+' || line[0] == ' ' ||
+        (*endptr != '\r' && *endptr != ';' && *endptr != ' ' && *endptr != '\t'))
+    {
+      error = EXIT_PROTOCOL_ERROR;
+      break;
+    }
+    if (size == 0)
+    {
+      // skip the trailer headers up to the empty line
+      error = skipHeaders(in, &line, &len) == -1;
+      break;
+    }
+    error = copyBytes(in, out, size);
+    // every chunk is followed by a CRLF
+    if (!error && (getline(&line, &len, in) == -1 || strcmp(line, "\r\n") != 0))
+    {
+      error = EXIT_PROTOCOL_ERROR;
+    }
+  }
+  free(line);
+  return error;
+}
+
 /**
  * @brief reads response from socketStream to either the output file or stdout
  * 
@@ -284,6 +329,9 @@ static int readResponse(FILE *socketStream, request_info_t request_info, prog_pa
   ssize_t nread;
   int foundContent = 0;
   int lineCount = 0;
+  // framing of the body, without both it ends with the connection
+  long long contentLength = -1;
+  int chunked = 0;
   int error = 0; // 0: no error, 1: protocol error, 2: non 200 header
 
   if (params.mode == S)
@@ -362,17 +410,36 @@ static int readResponse(FILE *socketStream, request_info_t request_info, prog_pa
     {
       foundContent = 1;
     }
+    else if (strncasecmp(line, "Content-Length:", strlen("Content-Length:")) == 0)
+    {
+      contentLength = strtoll(line + strlen("Content-Length:"), &endptr, 10);
+      if (contentLength < 0 || (*endptr != '\r' && *endptr != ' ' && *endptr != '\t'))
+      {
+        printf("Protocol error!\n");
+        error = EXIT_PROTOCOL_ERROR;
+        break;
+      }
+    }
+    else if (strncasecmp(line, "Transfer-Encoding:", strlen("Transfer-Encoding:")) == 0)
+    {
+      chunked = strstr(line, "chunked") != NULL;
+    }
     lineCount++;
   }
   if (!error && foundContent)
   {
-    char buffer[420];
-    while (!feof(socketStream))
+    // chunked transfer coding takes precedence over a Content-Length
+    int copyError = chunked ? copyChunked(socketStream, out) : copyBytes(socketStream, out, contentLength);
+    if (fflush(out) == EOF)
+    {
+      copyError = 1;
+    }
+    if (copyError)
     {
-      size_t read = fread(buffer, sizeof(char), 420, socketStream);
-      fwrite(buffer, sizeof(char), read, out);
+      fprintf(stderr, "[%s]: Error: %s\n", prog_name,
+              copyError == EXIT_PROTOCOL_ERROR ? "malformed chunked body" : "body incomplete or not written");
+      error = copyError;
     }
-    fflush(out);
   }
 
   free(line);
@@ -1,15 +1,24 @@
+// O_PATH and openat2() are Linux specific
+#define _GNU_SOURCE
 #include "shared.h"
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <netdb.h>
 #include <time.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
 
 #define DEBUG 0
 #define debug(format, error, ...) \
@@ -42,7 +51,7 @@ volatile sig_atomic_t quit = 0;
  */
 static void usage(void)
 {
-  printf("%s [-p PORT] [-i INDEX] DOC_ROOT\n", prog_name);
+  printf("%s [-p PORT] [-i INDEX] [-b BACKLOG] DOC_ROOT\n", prog_name);
 }
 
 /**
@@ -55,6 +64,154 @@ static void sig_handler(int signal)
   quit = 1;
 }
 
+/**
+ * @brief returns the value of a hex digit
+ * 
+ * @param c the hex digit
+ * @return value of the digit, -1 if c is no hex digit
+ */
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * @brief percent-decodes and normalizes a requested path
+ * 
+ * @details drops the query string, removes empty and "." segments and resolves ".." segments, so the result can
+ * never point above the document root. A trailing slash is kept. Encoded slashes and NUL bytes are rejected.
+ * 
+ * @param target requested path, has to start with '/'
+ * @param out buffer for the normalized path, starts with '/'
+ * @param cap size of out, strlen(target) + 2 is always enough
+ * @return 0 on success, -1 if the path is malformed or leaves the document root
+ */
+static int normalizePath(const char *target, char *out, size_t cap)
+{
+  if (target[0] != '/' || cap < 2)
+    return -1;
+  size_t len = 0;
+  int dirEnd = 1;
+  out[len++] = '/';
+
+  const char *p = target;
+  while (*p != '\0' && *p != '?' && *p != '#')
+  {
+    if (*p == '/')
+    {
+      p++;
+      continue;
+    }
+    size_t start = len;
+    while (*p != '\0' && *p != '?' && *p != '#' && *p != '/')
+    {
+      char c = *p++;
+      if (c == '%')
+      {
+        int hi = hexValue(p[0]);
+        int lo = hi == -1 ? -1 : hexValue(p[1]);
+        if (lo == -1)
+          return -1;
+        c = (char)(hi << 4 | lo);
+        p += 2;
+        if (c == '\0' || c == '/')
+          return -1;
+      }
+      if (len + 2 > cap)
+        return -1;
+      out[len++] = c;
+    }
+
+    size_t segmentLen = len - start;
+    if (segmentLen == 1 && out[start] == '.')
+    {
+      len = start;
+      dirEnd = 1;
+    }
+    else if (segmentLen == 2 && out[start] == '.' && out[start + 1] == '.')
+    {
+      // ".." in the root would leave the document root
+      len = start;
+      if (len == 1)
+        return -1;
+      len--;
+      while (out[len - 1] != '/')
+        len--;
+      dirEnd = 1;
+    }
+    else
+    {
+      out[len++] = '/';
+      dirEnd = *p == '/';
+    }
+  }
+  if (!dirEnd && len > 1)
+    len--;
+  out[len] = '\0';
+  return 0;
+}
+
+/**
+ * @brief checks if a string ends with a suffix
+ * 
+ * @param str the string
+ * @param suffix the suffix
+ * @return 1 if str ends with suffix, 0 otherwise
+ */
+static int endsWith(const char *str, const char *suffix)
+{
+  size_t strLen = strlen(str);
+  size_t suffixLen = strlen(suffix);
+  return strLen >= suffixLen && strcmp(str + strLen - suffixLen, suffix) == 0;
+}
+
+/**
+ * @brief opens a normalized path below the document root without following links out of it
+ * 
+ * @details uses openat2() with RESOLVE_BENEATH and RESOLVE_NO_MAGICLINKS, so symbolic links pointing outside of the
+ * document root can't be used to escape it. On kernels without openat2() the last component is opened with O_NOFOLLOW
+ * and the file is only accepted if /proc/self/fd names a path below the document root.
+ * 
+ * @param docRootFd descriptor of the document root
+ * @param docRootPath resolved path of the document root, only needed for the fallback
+ * @param relativePath normalized path relative to the document root
+ * @param flags flags for open, O_PATH if only the metadata is needed
+ * @return descriptor of the file, -1 if it doesn't exist or lies outside of the document root
+ */
+static int openBeneath(int docRootFd, const char *docRootPath, const char *relativePath, int flags)
+{
+#ifdef SYS_openat2
+  struct open_how how;
+  memset(&how, 0, sizeof(how));
+  how.flags = flags | O_CLOEXEC;
+  how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+  int beneathFd = (int)syscall(SYS_openat2, docRootFd, relativePath, &how, sizeof(how));
+  if (beneathFd != -1 || errno != ENOSYS)
+    return beneathFd;
+#endif
+  int fd = openat(docRootFd, relativePath, flags | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1)
+    return -1;
+  char procPath[32];
+  char filePath[PATH_MAX];
+  snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+  ssize_t pathLen = readlink(procPath, filePath, sizeof(filePath) - 1);
+  size_t rootLen = strlen(docRootPath);
+  if (pathLen == -1 || (size_t)pathLen < rootLen || strncmp(filePath, docRootPath, rootLen) != 0 ||
+      (rootLen > 1 && (size_t)pathLen > rootLen && filePath[rootLen] != '/'))
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
 /**
  * @brief "main method", opens socket, listens, handles requests, sends requests
  * 
@@ -63,19 +220,30 @@ static void sig_handler(int signal)
  * @param port port to start the server on
  * @param docRoot docRoot arguemnt
  * @param index index file argument
+ * @param backlog amount of pending connections queued by the kernel
  */
-static void run(char *port, char *docRoot, char *index)
+static void run(char *port, char *docRoot, char *index, int backlog)
 {
   int sockfd, connfd, addrInfoRes;
   FILE *socketStream, *requestedFile;
-  char *filePath = NULL;
   char method[256], requestedPath[256], protocol[256];
   char *line = NULL;
   size_t len = 0;
   ssize_t nread;
-  int docRootLen = strlen(docRoot);
   int indexLen = strlen(index);
 
+  // files are opened relative to the document root, neither normalized paths nor symbolic links can leave it
+  int docRootFd = open(docRoot, O_RDONLY | O_DIRECTORY);
+  if (!tryAndPrintOnErr(docRootFd, "Could not open document root"))
+  {
+    exit(EXIT_FAILURE);
+  }
+  char *docRootPath = realpath(docRoot, NULL);
+  if (!tryPointerAndPrintOnErr(docRootPath, "Could not resolve document root"))
+  {
+    exit(EXIT_FAILURE);
+  }
+
   struct addrinfo hints, *ai;
   memset(&hints, 0, sizeof hints);
   hints.ai_family = AF_INET;
@@ -111,7 +279,7 @@ static void run(char *port, char *docRoot, char *index)
   freeaddrinfo(ai);
 
   // mark socket as passive
-  if (!tryAndPrintOnErr(listen(sockfd, 1), "Could listen on socket"))
+  if (!tryAndPrintOnErr(listen(sockfd, backlog), "Could listen on socket"))
   {
     close(sockfd);
     exit(EXIT_FAILURE);
@@ -144,30 +312,18 @@ static void run(char *port, char *docRoot, char *index)
       fputs("HTTP/1.1 400 (Bad Request)\r\n", socketStream);
       fputs("Connection: close\r\n", socketStream);
     }
-    else if (sscanf(line, "%s %s %s", method, requestedPath, protocol) == EOF)
+    else if (sscanf(line, "%255s %255s %255s", method, requestedPath, protocol) == EOF)
     {
       debug("Bad Request, did not find expected first line %s", 0, "");
-      while ((nread = getline(&line, &len, socketStream)) != -1)
-      {
-        if (strncmp("\r\n", line, 2) == 0)
-        {
-          break;
-        }
-      }
+      skipHeaders(socketStream, &line, &len);
       // send 400 (Bad Request)
       fputs("HTTP/1.1 400 (Bad Request)\r\n", socketStream);
       fputs("Connection: close", socketStream);
     }
-    else if (strncmp("GET", method, 4) != 0)
+    else if (strcmp("GET", method) != 0 && strcmp("HEAD", method) != 0 && strcmp("OPTIONS", method) != 0)
     {
       debug("unsupported method: %s", 0, method);
-      while ((nread = getline(&line, &len, socketStream)) != -1)
-      {
-        if (strncmp("\r\n", line, 2) == 0)
-        {
-          break;
-        }
-      }
+      skipHeaders(socketStream, &line, &len);
       // send 501 (Not implemented)
       fputs("HTTP/1.1 501 (Not implemented)\r\n", socketStream);
       fputs("Connection: close", socketStream);
@@ -175,126 +331,136 @@ static void run(char *port, char *docRoot, char *index)
     else if (strcmp("HTTP/1.1", protocol) != 0)
     {
       debug("unsupported protocol: %s", 0, protocol);
-      while ((nread = getline(&line, &len, socketStream)) != -1)
-      {
-        if (strncmp("\r\n", line, 2) == 0)
-        {
-          break;
-        }
-      }
+      skipHeaders(socketStream, &line, &len);
       // send 400 (Bad Request)
       fputs("HTTP/1.1 400 (Bad Request)\r\n", socketStream);
       fputs("Connection: close", socketStream);
     }
-    else if (strlen(line) != (strlen(requestedPath) + 15))
+    else if (strlen(line) != (strlen(method) + strlen(requestedPath) + 12))
     {
-      debug("unexpected tokens in first line: expected length %zu, got length %zu", 0, strlen(line), strlen(requestedPath) + 15);
-      while ((nread = getline(&line, &len, socketStream)) != -1)
-      {
-        if (strncmp("\r\n", line, 2) == 0)
-        {
-          break;
-        }
-      }
+      debug("unexpected tokens in first line: expected length %zu, got length %zu", 0, strlen(line), strlen(method) + strlen(requestedPath) + 12);
+      skipHeaders(socketStream, &line, &len);
       // send 400 (Bad Request)
       fputs("HTTP/1.1 400 (Bad Request)\r\n", socketStream);
       fputs("Connection: close", socketStream);
     }
+    else if (strcmp("OPTIONS", method) == 0)
+    {
+      // answered without looking at the path, so "OPTIONS *" works as well
+      skipHeaders(socketStream, &line, &len);
+      fputs("HTTP/1.1 204 No Content\r\nAllow: GET, HEAD, OPTIONS\r\nConnection: close\r\n\r\n", socketStream);
+    }
     else
     {
       // open file
-      while ((nread = getline(&line, &len, socketStream)) != -1)
-      {
-        if (strncmp("\r\n", line, 2) == 0)
-        {
-          break;
-        }
-      }
-
-      debug("creating file path for requested file: %s", 0, requestedPath);
-      int fileSize = docRootLen;
-      int pathLen = strlen(requestedPath);
-      fileSize += pathLen;
-      int addIndex = requestedPath[pathLen - 1] == '/';
-      if (addIndex)
-      {
-        fileSize += indexLen;
-      }
-
-      filePath = calloc(fileSize, sizeof(char));
-      if (addIndex)
-      {
-        sprintf(filePath, "%s%s%s", docRoot, requestedPath + 1, index);
-      }
-      else
-      {
-        sprintf(filePath, "%s%s", docRoot, requestedPath + 1);
-      }
+      skipHeaders(socketStream, &line, &len);
 
-      debug("trying to open requested file: %s", 0, filePath);
-      requestedFile = fopen(filePath, "r");
-      if (requestedFile == NULL)
+      debug("normalizing path for requested file: %s", 0, requestedPath);
+      char filePath[sizeof(requestedPath) + 1 + indexLen];
+      if (normalizePath(requestedPath, filePath, sizeof(requestedPath) + 1) == -1)
       {
-        debug("could not open file %s", 1, filePath);
-        // send 404 (Not Found)
-        fputs("HTTP/1.1 404 (Not Found)\r\n", socketStream);
+        debug("invalid path or path outside of document root: %s", 0, requestedPath);
+        // send 400 (Bad Request)
+        fputs("HTTP/1.1 400 (Bad Request)\r\n", socketStream);
         fputs("Connection: close", socketStream);
       }
       else
       {
-        // send response
-
-        // calculating the size of the file
-        fseek(requestedFile, 0L, SEEK_END);
-        long int contentLength = ftell(requestedFile);
-        rewind(requestedFile);
-        debug("calculated content length: %ld", 0, contentLength);
-
-        // get time
-        time_t t;
-        struct tm *tmp;
-
-        t = time(NULL);
-        tmp = gmtime(&t);
-        char timeString[30];
-        strftime(timeString, 30, "%a, %d %b %y %T %Z", tmp);
-        debug("constructed time string: %s", 0, timeString);
-
-        // send required headers
-        fprintf(socketStream, "HTTP/1.1 200 OK\r\nDate: %s\r\nContent-Length: %ld\r\n",
-                timeString, contentLength);
-        if (strcmp(filePath + fileSize - 6, ".html") == 0 || strcmp(filePath + fileSize - 5, ".htm") == 0)
+        if (filePath[strlen(filePath) - 1] == '/')
         {
-          fputs("Content-Type: text/html\r\n", socketStream);
+          strcat(filePath, index);
         }
-        else if (strcmp(filePath + fileSize - 5, ".css") == 0)
+
+        // HEAD only needs the metadata, the file itself is never opened. Both only answer for regular files and take
+        // the size from the same fstat()
+        int headOnly = strcmp("HEAD", method) == 0;
+        const char *relativePath = filePath[1] == '\0' ? "." : filePath + 1;
+        struct stat fileStat;
+        int found;
+        requestedFile = NULL;
+        if (headOnly)
+        {
+          debug("looking up requested file: %s", 0, filePath);
+          int fileFd = openBeneath(docRootFd, docRootPath, relativePath, O_PATH);
+          found = fileFd != -1 && fstat(fileFd, &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+          if (fileFd != -1)
+            close(fileFd);
+        }
+        else
         {
-          fputs("Content-Type: text/css\r\n", socketStream);
+          debug("trying to open requested file: %s", 0, filePath);
+          int fileFd = openBeneath(docRootFd, docRootPath, relativePath, O_RDONLY);
+          found = fileFd != -1 && fstat(fileFd, &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+          requestedFile = found ? fdopen(fileFd, "r") : NULL;
+          if (requestedFile == NULL && fileFd != -1)
+            close(fileFd);
+          found = requestedFile != NULL;
         }
-        else if (strcmp(filePath + fileSize - 4, ".js") == 0)
+        if (!found)
         {
-          fputs("Content-Type: application/javascript\r\n", socketStream);
+          debug("could not open file %s", 1, filePath);
+          // send 404 (Not Found)
+          fputs("HTTP/1.1 404 (Not Found)\r\n", socketStream);
+          fputs("Connection: close", socketStream);
         }
+        else
+        {
+          // send response
 
-        fputs("Connection: close\r\n\r\n", socketStream);
-        debug("sent required headers %s", 0, "");
+          // size of the file, looked up the same way for GET and HEAD
+          long int contentLength = fileStat.st_size;
+          debug("calculated content length: %ld", 0, contentLength);
 
-        char buffer[420];
+          // get time
+          time_t t;
+          struct tm *tmp;
 
-        while (!feof(requestedFile))
-        {
-          size_t read = fread(buffer, sizeof(char), 420, requestedFile);
-          fwrite(buffer, sizeof(char), read, socketStream);
+          t = time(NULL);
+          tmp = gmtime(&t);
+          char timeString[30];
+          strftime(timeString, 30, "%a, %d %b %y %T %Z", tmp);
+          debug("constructed time string: %s", 0, timeString);
+
+          // send required headers
+          fprintf(socketStream, "HTTP/1.1 200 OK\r\nDate: %s\r\nContent-Length: %ld\r\n",
+                  timeString, contentLength);
+          if (endsWith(filePath, ".html") || endsWith(filePath, ".htm"))
+          {
+            fputs("Content-Type: text/html\r\n", socketStream);
+          }
+          else if (endsWith(filePath, ".css"))
+          {
+            fputs("Content-Type: text/css\r\n", socketStream);
+          }
+          else if (endsWith(filePath, ".js"))
+          {
+            fputs("Content-Type: application/javascript\r\n", socketStream);
+          }
+
+          fputs("Connection: close\r\n\r\n", socketStream);
+          debug("sent required headers %s", 0, "");
+
+          if (!headOnly)
+          {
+            if (copyBytes(requestedFile, socketStream, contentLength) != 0)
+            {
+              debug("could not send file %s", 1, filePath);
+            }
+            else
+            {
+              debug("sent file %s", 0, "");
+            }
+            fclose(requestedFile);
+          }
         }
-        debug("sent file %s", 0, "");
-        fclose(requestedFile);
       }
-      free(filePath);
     }
     fflush(socketStream);
     fclose(socketStream);
   }
   free(line);
+  free(docRootPath);
+  close(docRootFd);
   close(sockfd);
 }
 
@@ -309,11 +475,14 @@ int main(int argc, char *argv[])
   char *port = "8080";
   int opt_i = 0;
   int opt_p = 0;
+  int opt_b = 0;
+  int backlog = 128;
+  char *endptr;
   char c;
   char *docRoot;
   char *index = "index.html";
   prog_name = argv[0];
-  while ((c = getopt(argc, argv, "p:i:")) != -1)
+  while ((c = getopt(argc, argv, "p:i:b:")) != -1)
   {
     switch (c)
     {
@@ -325,6 +494,16 @@ int main(int argc, char *argv[])
       opt_i++;
       index = optarg;
       break;
+    case 'b':
+      opt_b++;
+      backlog = strtol(optarg, &endptr, 10);
+      if (*endptr || backlog < 1)
+      {
+        printf("[%s]: Error parsing -b argument\n", prog_name);
+        usage();
+        exit(EXIT_FAILURE);
+      }
+      break;
     default:
       usage();
       exit(EXIT_FAILURE);
@@ -332,7 +511,7 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (opt_p > 1 || opt_i > 1)
+  if (opt_p > 1 || opt_i > 1 || opt_b > 1)
   {
     usage();
     exit(EXIT_FAILURE);
@@ -346,6 +525,6 @@ int main(int argc, char *argv[])
   }
   docRoot = argv[optind];
 
-  debug("Port: %s; Index: %s, Doc Root: %s", 0, port, index, docRoot);
-  run(port, docRoot, index);
+  debug("Port: %s; Index: %s, Doc Root: %s, Backlog: %d", 0, port, index, docRoot, backlog);
+  run(port, docRoot, index, backlog);
 }
\ No newline at end of file
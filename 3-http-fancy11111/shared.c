@@ -87,4 +87,56 @@ void tryPointerAndExitPrintOnErr(void *ptr, char *msg)
   {
     printErrAndExit(msg);
   }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief reads header lines from stream up to and including the empty line that ends them
+ * 
+ * @param stream the stream to read from, positioned behind the start line
+ * @param line buffer for getline, reused between calls and freed by the caller
+ * @param len size of the buffer for getline
+ * @return int 0 if the empty line was found, -1 if the stream ended before it
+ */
+int skipHeaders(FILE *stream, char **line, size_t *len)
+{
+  while (getline(line, len, stream) != -1)
+  {
+    if (strcmp(*line, "\r\n") == 0)
+    {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief copies count bytes from in to out, or everything until EOF if count is negative
+ * 
+ * @param in the stream to read from
+ * @param out the stream to write to
+ * @param count the amount of bytes to copy, -1 to copy until EOF
+ * @return int 0 on success, 1 if in ended before count bytes or a read or write failed
+ */
+int copyBytes(FILE *in, FILE *out, long long count)
+{
+  char buffer[BODY_BUFFER_SIZE];
+  while (count != 0)
+  {
+    size_t want = count > 0 && count < BODY_BUFFER_SIZE ? (size_t)count : BODY_BUFFER_SIZE;
+    size_t read = fread(buffer, sizeof(char), want, in);
+    if (read == 0)
+    {
+      // only a body without length may end with the connection
+      return count > 0 || ferror(in) ? 1 : 0;
+    }
+    if (fwrite(buffer, sizeof(char), read, out) != read)
+    {
+      return 1;
+    }
+    if (count > 0)
+    {
+      count -= read;
+    }
+  }
+  return 0;
+}
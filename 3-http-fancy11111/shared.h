@@ -1,6 +1,11 @@
 #ifndef SHARED_LIB
 #define SHARED_LIB
 
+#include <stdio.h>
+
+// bodies are copied in blocks of this size, small blocks cost a read and a write syscall per few hundred bytes
+#define BODY_BUFFER_SIZE (64 * 1024)
+
 extern char *prog_name;
 
 void printErrAndExit(char *msg);
@@ -9,5 +14,7 @@ int tryAndPrintOnErr(int retVal, char *msg);
 int tryPointerAndPrintOnErr(void *ptr, char *msg);
 void tryAndPrintExitOnErr(int retVal, char *msg);
 void tryPointerAndPrintExitOnErr(void *ptr, char *msg);
+int skipHeaders(FILE *stream, char **line, size_t *len);
+int copyBytes(FILE *in, FILE *out, long long count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,180 @@
+/**
+ * @file access_log.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "access_log.h"
+
+int access_log_open(access_log_t *log, const char *path) {
+    memset(log, 0, sizeof(access_log_t));
+    if (strcmp(path, "-") == 0) {
+        log->fd = STDOUT_FILENO;
+        return 0;
+    }
+    log->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (log->fd < 0) return -1;
+    log->close_fd = true;
+    return 0;
+}
+
+access_ring_t *access_log_add_ring(access_log_t *log) {
+    access_ring_t **rings = realloc(log->rings, (log->ring_count + 1) * sizeof(access_ring_t *));
+    if (rings == NULL) return NULL;
+    log->rings = rings;
+
+    void *ring;
+    if (posix_memalign(&ring, 64, sizeof(access_ring_t)) != 0) return NULL;
+    memset(ring, 0, sizeof(access_ring_t));
+    log->rings[log->ring_count++] = ring;
+    return ring;
+}
+
+bool access_log_push(access_ring_t *ring, const access_entry_t *entry) {
+    unsigned long head = ring->head;
+    unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= ACCESS_LOG_RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+    ring->entries[head & (ACCESS_LOG_RING_SIZE - 1)] = *entry;
+    /** Publishes the entry, the consumer reads it only after seeing the new head */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Writes a buffer completely, retrying on short writes.
+ */
+static void write_all(int fd, const char *buff, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buff, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buff += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Appends a request target, quotes and control characters are escaped so a line can't be forged.
+ */
+static size_t format_target(char *buff, size_t cap, const char *target) {
+    static const char hex[] = "0123456789abcdef";
+    size_t len = 0;
+    for (const unsigned char *c = (const unsigned char *) target; *c != '\0' && len + 4 < cap; ++c) {
+        if (*c < 0x20 || *c == 0x7f || *c == '"' || *c == '\\') {
+            buff[len++] = '\\';
+            buff[len++] = 'x';
+            buff[len++] = hex[*c >> 4];
+            buff[len++] = hex[*c & 0xf];
+        } else {
+            buff[len++] = (char) *c;
+        }
+    }
+    return len;
+}
+
+/**
+ * @brief Formats one entry as a log line.
+ * @return Length of the line, 0 if it doesn't fit into the buffer.
+ */
+static size_t format_entry(char *buff, size_t cap, const access_entry_t *entry) {
+    char time_str[32];
+    struct tm tm;
+    gmtime_r(&entry->time, &tm);
+    strftime(time_str, sizeof(time_str), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+
+    char target[ACCESS_LOG_TARGET_MAX * 4];
+    target[format_target(target, sizeof(target), entry->target)] = '\0';
+    char protocol[ACCESS_LOG_PROTOCOL_MAX * 4];
+    protocol[format_target(protocol, sizeof(protocol), entry->protocol)] = '\0';
+    int len;
+    if (entry->method[0] == '\0') {
+        len = snprintf(buff, cap, "%s - - [%s] \"-\" %d %llu %ld\n", entry->client, time_str, entry->status,
+                       entry->bytes, entry->latency_us);
+    } else {
+        len = snprintf(buff, cap, "%s - - [%s] \"%s %s%s%s\" %d %llu %ld\n", entry->client, time_str, entry->method,
+                       target, protocol[0] != '\0' ? " " : "", protocol, entry->status, entry->bytes,
+                       entry->latency_us);
+    }
+    return len < 0 || (size_t) len >= cap ? 0 : (size_t) len;
+}
+
+/**
+ * @brief Moves all queued entries of the rings into batched writes.
+ * @return Amount of entries written.
+ */
+static size_t drain_rings(access_log_t *log, char *buff) {
+    size_t written = 0;
+    size_t len = 0;
+    for (size_t i = 0; i < log->ring_count; ++i) {
+        access_ring_t *ring = log->rings[i];
+        unsigned long tail = ring->tail;
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; ++tail) {
+            const access_entry_t *entry = &ring->entries[tail & (ACCESS_LOG_RING_SIZE - 1)];
+            size_t line = format_entry(buff + len, ACCESS_LOG_BUFF_SIZE - len, entry);
+            if (line == 0) {
+                /** Batch is full, flush it and format the entry again */
+                write_all(log->fd, buff, len);
+                len = 0;
+                line = format_entry(buff, ACCESS_LOG_BUFF_SIZE, entry);
+            }
+            len += line;
+            written++;
+            /** Hands the slot back to the producer */
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+    if (len > 0) write_all(log->fd, buff, len);
+    return written;
+}
+
+/**
+ * @brief Background writer, sleeps only while all rings are empty.
+ */
+static void *writer_thread(void *arg) {
+    access_log_t *log = arg;
+    static char buff[ACCESS_LOG_BUFF_SIZE];
+    struct timespec idle = {0, ACCESS_LOG_IDLE_MS * 1000000L};
+
+    while (!__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE)) {
+        if (drain_rings(log, buff) == 0) nanosleep(&idle, NULL);
+    }
+    /** Entries pushed before the stop */
+    drain_rings(log, buff);
+    return NULL;
+}
+
+int access_log_start(access_log_t *log) {
+    if (pthread_create(&log->thread, NULL, writer_thread, log) != 0) return -1;
+    log->running = true;
+    return 0;
+}
+
+void access_log_close(access_log_t *log, FILE *out, const char *name) {
+    if (log->running) {
+        __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(log->thread, NULL);
+    }
+
+    unsigned long long dropped = 0;
+    for (size_t i = 0; i < log->ring_count; ++i) {
+        dropped += log->rings[i]->dropped;
+        free(log->rings[i]);
+    }
+    if (dropped > 0) {
+        fprintf(out, "[%s] Access log dropped %llu entries because the writer fell behind \n", name, dropped);
+    }
+    free(log->rings);
+    if (log->close_fd) close(log->fd);
+    memset(log, 0, sizeof(access_log_t));
+}
@@ -0,0 +1,118 @@
+/**
+ * @file access_log.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Access log which never blocks the event loop.
+ * @details Every event loop owns a single-producer single-consumer ring of fixed size entries. Pushing an entry is a
+ * copy and one release store, no lock and no syscall. A background thread drains all rings, formats the entries and
+ * writes them in batches of up to ACCESS_LOG_BUFF_SIZE bytes with one write() each. If the writer falls behind and a
+ * ring is full, entries are dropped and counted instead of stalling requests.
+ *
+ * Lines use the Common Log Format with the latency in microseconds appended (like Apache's %D):
+ * 127.0.0.1 - - [18/Oct/2026:12:00:00 +0000] "GET /index.html HTTP/1.1" 200 4096 153
+ */
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/** Entries per ring, has to be a power of two */
+#define ACCESS_LOG_RING_SIZE 4096
+/** Longer request targets are truncated */
+#define ACCESS_LOG_TARGET_MAX 256
+#define ACCESS_LOG_METHOD_MAX 16
+#define ACCESS_LOG_PROTOCOL_MAX 16
+/** Size of the batches written by the background thread */
+#define ACCESS_LOG_BUFF_SIZE (64 * 1024)
+/** Time the background thread sleeps when all rings are empty */
+#define ACCESS_LOG_IDLE_MS 20
+
+/** One served request */
+typedef struct {
+    /** Wall clock time at which the response was complete */
+    time_t time;
+    char client[INET6_ADDRSTRLEN];
+    /** Empty if the request line couldn't be parsed */
+    char method[ACCESS_LOG_METHOD_MAX];
+    char target[ACCESS_LOG_TARGET_MAX];
+    /** "HTTP/1.1" or "HTTP/2.0", empty if the request line had none */
+    char protocol[ACCESS_LOG_PROTOCOL_MAX];
+    int status;
+    /** Body bytes sent */
+    unsigned long long bytes;
+    /** Time from the first byte of the request to the last byte of the response */
+    long latency_us;
+} access_entry_t;
+
+/** Ring of one producer, head and tail are on their own cache lines so producer and consumer don't share them */
+typedef struct {
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    /** Only written by the producer */
+    unsigned long long dropped __attribute__((aligned(64)));
+    access_entry_t entries[ACCESS_LOG_RING_SIZE];
+} access_ring_t;
+
+/** The log file with its rings and background writer */
+typedef struct {
+    int fd;
+    bool close_fd;
+    access_ring_t **rings;
+    size_t ring_count;
+    pthread_t thread;
+    bool running;
+    /** Set by access_log_close() to stop the background thread */
+    int stop;
+} access_log_t;
+
+/**
+ * @brief Opens the log file.
+ * @details Lines are appended to an existing file. Has to be closed with access_log_close().
+ *
+ * @param log Log to be initialized.
+ * @param path File to be written, "-" for stdout.
+ * @return 0 on success, -1 if the file couldn't be opened.
+ */
+int access_log_open(access_log_t *log, const char *path);
+
+/**
+ * @brief Creates the ring of one producer thread.
+ * @details Has to be called before access_log_start().
+ *
+ * @param log Log opened by access_log_open().
+ * @return Ring, owned by the log, or NULL on errors.
+ */
+access_ring_t *access_log_add_ring(access_log_t *log);
+
+/**
+ * @brief Starts the background writer.
+ * @param log Log with all of its rings added.
+ * @return 0 on success, -1 if the thread couldn't be created.
+ */
+int access_log_start(access_log_t *log);
+
+/**
+ * @brief Queues an entry, only ever called by the thread owning the ring.
+ * @param ring Ring of the calling thread.
+ * @param entry Entry to be copied into the ring.
+ * @return False if the ring is full and the entry was dropped.
+ */
+bool access_log_push(access_ring_t *ring, const access_entry_t *entry);
+
+/**
+ * @brief Writes all queued entries, stops the background writer and frees everything.
+ * @details The producers must not push anymore.
+ * @param log Log opened by access_log_open().
+ * @param out Stream for the report of dropped entries, e.g. stderr.
+ * @param name Program name used as prefix.
+ */
+void access_log_close(access_log_t *log, FILE *out, const char *name);
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * @file bundle.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bundle.h"
+
+uint64_t bundle_hash(const char *path) {
+    /** FNV-1a, 0 marks empty slots */
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *path != '\0'; ++path) hash = (hash ^ (unsigned char) *path) * 1099511628211ULL;
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * @brief Checks that a range lies inside the bundle.
+ */
+static bool in_bundle(const bundle_t *bundle, uint64_t offset, uint64_t len) {
+    return offset <= bundle->size && len <= bundle->size - offset;
+}
+
+/**
+ * @brief Checks every offset of the index once, so requests can trust the bundle.
+ * @return False if the bundle is truncated or corrupt.
+ */
+static bool validate(const bundle_t *bundle) {
+    const bundle_header_t *header = bundle->header;
+    if (header->magic != BUNDLE_MAGIC || header->version != BUNDLE_VERSION || header->slots == 0 ||
+        (header->slots & (header->slots - 1)) != 0 || header->count > header->slots / 2 ||
+        header->index_offset % sizeof(uint64_t) != 0 ||
+        !in_bundle(bundle, header->index_offset, (uint64_t) header->slots * sizeof(bundle_entry_t))) {
+        return false;
+    }
+    /** The count is checked against the slots actually used, lookups rely on empty slots to terminate */
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < header->slots; ++i) {
+        const bundle_entry_t *entry = &bundle->entries[i];
+        if (entry->key == 0) continue;
+        ++used;
+        if (!in_bundle(bundle, entry->path_offset, entry->path_len)) return false;
+        if (entry->variants[enc_identity].head_len == 0) return false;
+        for (int enc = 0; enc < ENCODING_COUNT; ++enc) {
+            const bundle_variant_t *variant = &entry->variants[enc];
+            if (variant->head_len == 0) continue;
+            if (variant->head_len > BUNDLE_HEAD_MAX || !in_bundle(bundle, variant->head_offset, variant->head_len) ||
+                !in_bundle(bundle, variant->body_offset, variant->body_len)) {
+                return false;
+            }
+        }
+    }
+    return used == header->count;
+}
+
+int bundle_open(bundle_t *bundle, const char *path) {
+    memset(bundle, 0, sizeof(bundle_t));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(bundle_header_t)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    /** The mapping stays valid without the descriptor */
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    bundle->map = map;
+    bundle->size = st.st_size;
+    bundle->header = map;
+    bundle->entries = (const bundle_entry_t *) ((const char *) map + bundle->header->index_offset);
+    if (!validate(bundle)) {
+        bundle_close(bundle);
+        return -1;
+    }
+    /** Served files should come from memory, not from page faults during requests */
+    madvise(map, st.st_size, MADV_WILLNEED);
+    return 0;
+}
+
+void bundle_close(bundle_t *bundle) {
+    if (bundle->map != NULL) munmap((void *) bundle->map, bundle->size);
+    memset(bundle, 0, sizeof(bundle_t));
+}
+
+const bundle_entry_t *bundle_find(const bundle_t *bundle, const char *path) {
+    uint64_t key = bundle_hash(path);
+    size_t path_len = strlen(path);
+    uint32_t mask = bundle->header->slots - 1;
+    for (uint32_t i = key & mask;; i = (i + 1) & mask) {
+        const bundle_entry_t *entry = &bundle->entries[i];
+        if (entry->key == 0) return NULL;
+        if (entry->key == key && entry->path_len == path_len &&
+            memcmp(bundle->map + entry->path_offset, path, path_len) == 0) {
+            return entry;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * @file bundle.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Asset bundles: a whole document root packed into one file which the server maps into memory.
+ * @details A document root of many small files costs a path resolution and an open() per request. The packer
+ * (pack.c) writes every file into one bundle together with its response headers and its compressed variants, the
+ * server maps the bundle once at startup and answers a request for a packed path with slices of the mapping: no
+ * syscall besides the send is left per request.
+ *
+ * Layout: a bundle_header_t, then the paths, header fragments and bodies, then the index. The index is an open
+ * addressing hash table of bundle_entry_t keyed by a hash of the normalized path ("/css/site.css"). Every entry has
+ * one variant per encoding, identity is always present, the others only if they are smaller. A header fragment holds
+ * the Content-Length, Content-Type, Content-Encoding and Vary lines and the empty line, the server puts the status
+ * line, Date and Connection in front of it. Numbers are stored in the byte order of the packing machine.
+ */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "compression.h"
+
+/** Identifies a bundle of this layout */
+#define BUNDLE_MAGIC 0x4c444e42u
+#define BUNDLE_VERSION 1
+/** Longest header fragment, it has to fit into the response head of the server */
+#define BUNDLE_HEAD_MAX 512
+
+/** Start of a bundle file */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /** Amount of packed files */
+    uint32_t count;
+    /** Slots of the index, a power of two and at least twice the count */
+    uint32_t slots;
+    uint64_t index_offset;
+} bundle_header_t;
+
+/** One encoding of a packed file, offsets are relative to the start of the bundle */
+typedef struct {
+    uint64_t head_offset;
+    uint64_t body_offset;
+    uint64_t body_len;
+    /** 0 if the file has no variant in this encoding */
+    uint32_t head_len;
+    uint32_t reserved;
+} bundle_variant_t;
+
+/** A packed file in the index */
+typedef struct {
+    /** Hash of the path, 0 for empty slots */
+    uint64_t key;
+    uint64_t path_offset;
+    uint32_t path_len;
+    uint32_t reserved;
+    bundle_variant_t variants[ENCODING_COUNT];
+} bundle_entry_t;
+
+/** A bundle mapped by the server */
+typedef struct {
+    const char *map;
+    size_t size;
+    const bundle_header_t *header;
+    const bundle_entry_t *entries;
+} bundle_t;
+
+/**
+ * @brief Hashes a normalized path for the index.
+ * @param path Null-terminated path.
+ * @return Hash, never 0.
+ */
+uint64_t bundle_hash(const char *path);
+
+/**
+ * @brief Maps a bundle and checks that all of its offsets lie inside the file.
+ * @details Has to be closed with bundle_close().
+ *
+ * @param bundle Bundle to be opened.
+ * @param path Path of the bundle file.
+ * @return 0 on success, -1 if the file can't be mapped or isn't a valid bundle.
+ */
+int bundle_open(bundle_t *bundle, const char *path);
+
+/**
+ * @brief Unmaps a bundle.
+ * @param bundle Bundle from bundle_open(), or zeroed.
+ */
+void bundle_close(bundle_t *bundle);
+
+/**
+ * @brief Looks up a packed file.
+ * @param bundle Opened bundle.
+ * @param path Normalized request path.
+ * @return Entry of the file, NULL if the path isn't packed.
+ */
+const bundle_entry_t *bundle_find(const bundle_t *bundle, const char *path);
+
+#endif
@@ -4,25 +4,56 @@
 * @date 11.01.2021
 *
 * @brief Can request files over http from a remote or local host.
-* @details Binary data is supported.
+* @details Binary data is supported. Several URLs (or -f, -c) are downloaded concurrently into a directory, see
+* downloader.h. With -n or -t it generates load instead, see loadgen.h. With -r a single large file is downloaded in
+* parallel byte ranges, see ranged.h. With -C downloads are kept in a cache and revalidated, see http_cache.h.
 *
 */
 
+/** splice and fallocate are Linux specific */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <netdb.h>
-#include <zlib.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <pthread.h>
+#include "compression.h"
+#include "loadgen.h"
+#include "downloader.h"
+#include "ranged.h"
+#include "http_response.h"
+#include "http_cache.h"
+#include "http_io.h"
 
-/** Buffer size constant  for binary reading and writing */
-#define BUFF_SIZE 128
-/** Enable gzip encoding */
-#define GZIP true
+/** Receive buffer for bodies which aren't spliced, e.g. chunked or compressed ones */
+#define BODY_BUFF_SIZE (64 * 1024)
+/** Bytes moved per splice call, also the requested pipe capacity */
+#define SPLICE_SIZE (1024 * 1024)
+/** Buffers of encoded data between the receiving and the decoding thread (-D) */
+#define DECODE_QUEUE_LEN 4
+/** Accept-Encoding sent to the server, zstd decompresses fastest so it gets the highest q-value */
+#ifdef HAVE_ZSTD
+#define ACCEPT_ZSTD "zstd, "
+#else
+#define ACCEPT_ZSTD ""
+#endif
+#ifdef HAVE_BROTLI
+#define ACCEPT_BROTLI "br;q=0.9, "
+#else
+#define ACCEPT_BROTLI ""
+#endif
+#define ACCEPT_ENCODING ACCEPT_ZSTD ACCEPT_BROTLI "gzip;q=0.8"
 
 /** Enum for storing output type. */
 typedef enum {
@@ -39,9 +70,59 @@ typedef struct {
     char *path_appendix;
     char *hostname;
     char *relative_path;
+    /** Load generator mode, set by -n or -t */
+    bool load;
+    /** Concurrent download of several URLs, set by more than one URL, -f or -c */
+    bool many;
+    size_t connections;
+    unsigned long long requests;
+    long duration_ms;
+    /** File with one URL (or path for the load generator) per line */
+    char *url_file;
+    /** URLs to be downloaded or replayed, from argv */
+    char **urls;
+    int url_count;
+    /** Byte ranges a single download is split into, set by -r */
+    size_t parts;
+    /** Decode a compressed body on a second thread while the next data is received, set by -D */
+    bool decode_thread;
+    /** Cache directory set by -C, NULL if downloads aren't cached, and the limit of its size set by -m */
+    char *cache_dir;
+    long long cache_max;
 } options_t;
 
+/** Body of the response, received from the socket and stripped of its framing */
+typedef struct {
+    int fd;
+    http_response_t res;
+    /** Received bytes, the ones before pos have been handed out already */
+    io_buffer_t in;
+    size_t pos;
+    bool complete;
+} body_t;
+
+/** Encoded body data handed from the receiving to the decoding thread, a ring of DECODE_QUEUE_LEN buffers */
+typedef struct {
+    char *buffs[DECODE_QUEUE_LEN];
+    size_t lens[DECODE_QUEUE_LEN];
+    /** First filled buffer and amount of filled buffers */
+    size_t first;
+    size_t count;
+    /** Set by the receiver after its last buffer */
+    bool done;
+    /** Set by the decoder once it needs no more data, because the encoding ended or on errors */
+    bool stopped;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    decompressor_t *dec;
+    int out_fd;
+    /** Result of the decoder, see decode_data() */
+    int ret;
+} decode_queue_t;
+
 static char *prog_name;
+/** Set by SIGINT and SIGTERM during a ranged download, which then stops resumable */
+static volatile sig_atomic_t interrupted = false;
 
 /**
  * @brief Prints the usage with an extra error message.
@@ -53,7 +134,11 @@ static void print_usage(char *str) {
     if (str != NULL) {
         fprintf(stderr, "[%s] Error: %s\n", prog_name, str);
     }
-    fprintf(stderr, "[%s] Usage: %s [-p PORT] [ -o FILE | -d DIR ] URL\n", prog_name, prog_name);
+    fprintf(stderr, "[%s] Usage: %s [-p PORT] [-D] [-C CACHE_DIR [-m CACHE_MB]] [-r PARTS] [ -o FILE | -d DIR ] URL\n",
+            prog_name, prog_name);
+    fprintf(stderr, "[%s]        %s [-p PORT] [-c CONNECTIONS] [-f URL_FILE] -d DIR URL...\n", prog_name, prog_name);
+    fprintf(stderr, "[%s]        %s [-p PORT] [-c CONNECTIONS] [-n REQUESTS] [-t SECONDS] [-f URL_FILE] URL...\n",
+            prog_name, prog_name);
     exit(EXIT_FAILURE);
 }
 
@@ -67,6 +152,46 @@ static void print_error(char *str) {
     exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief Parses a positive number of a command line option.
+ * @details Terminates the program with the usage on errors.
+ *
+ * @param arg Argument of the option.
+ * @param msg Error message if the argument isn't a positive number.
+ * @return The number.
+ */
+static unsigned long long parse_count(const char *arg, char *msg) {
+    char *endptr;
+    errno = 0;
+    unsigned long long val = strtoull(arg, &endptr, 10);
+    if (errno != 0 || endptr == arg || *endptr != '\0' || val == 0 || arg[0] == '-') print_usage(msg);
+    return val;
+}
+
+/**
+ * @brief Splits an URL into hostname and relative path.
+ * @details The URL is modified, the hostname is terminated in place. Terminates the program with the usage if the URL
+ * doesn't start with 'http://'.
+ *
+ * @param url URL to be split.
+ * @param hostname Set to the hostname.
+ * @param relative_path Set to the path after the hostname, without the leading slash.
+ */
+static void split_url(char *url, char **hostname, char **relative_path) {
+    if (strncmp(url, "http://", strlen("http://")) != 0) print_usage("URL has to start with 'http://'.");
+
+    /** Check for correct protocol and extract hostname as well as the relative path */
+    *hostname = url + strlen("http://");
+    char *ptr = strpbrk(*hostname, ";/?:@=&");
+    char *slash_ptr = strpbrk(*hostname, "/");
+    if (ptr != NULL) {
+        *ptr = '\0';
+        *relative_path = slash_ptr != NULL ? ++slash_ptr : "";
+    } else {
+        *relative_path = "";
+    }
+}
+
 /**
  * @brief Handles arguments.
  * @details Everything is handled as stated in the exercise.
@@ -90,7 +215,7 @@ static void handle_args(int argc, char **argv, options_t *options) {
     /** Parse all command line options and arguments */
     int c;
     opterr = 0;
-    while ((c = getopt(argc, argv, "p:o:d:")) != -1) {
+    while ((c = getopt(argc, argv, "p:o:d:c:n:t:f:r:DC:m:")) != -1) {
         switch (c) {
             case 'p':
                 if (p_set) print_usage("The positional argument -p is only allowed once.");
@@ -128,30 +253,83 @@ static void handle_args(int argc, char **argv, options_t *options) {
                 options->path = optarg;
                 options->output_type = directory;
                 break;
+            case 'c':
+                options->connections = parse_count(optarg, "The argument -c must be a positive number of connections.");
+                break;
+            case 'n':
+                options->load = true;
+                options->requests = parse_count(optarg, "The argument -n must be a positive number of requests.");
+                break;
+            case 't':
+                options->load = true;
+                options->duration_ms = (long) parse_count(optarg, "The argument -t must be a positive number of seconds.")
+                                       * 1000L;
+                break;
+            case 'f':
+                options->url_file = optarg;
+                break;
+            case 'r':
+                options->parts = parse_count(optarg, "The argument -r must be a positive number of parts.");
+                break;
+            case 'D':
+                options->decode_thread = true;
+                break;
+            case 'C':
+                options->cache_dir = optarg;
+                break;
+            case 'm':
+                options->cache_max = (long long) parse_count(optarg, "The argument -m must be a positive number of MB.")
+                                     * 1024 * 1024;
+                break;
             case '?':
                 if (optopt == 'p') print_usage("The positional argument -p must be followed by an integer. (0-65535)");
                 if (optopt == 'o') print_usage("The positional argument -o must be followed by a string.");
                 if (optopt == 'd') print_usage("The positional argument -o must be followed by a string.");
+                if (optopt == 'c' || optopt == 'n' || optopt == 't' || optopt == 'r') print_usage("Option is missing its number.");
+                if (optopt == 'f') print_usage("The argument -f must be followed by a file name.");
+                if (optopt == 'C') print_usage("The argument -C must be followed by a directory.");
+                if (optopt == 'm') print_usage("Option is missing its number.");
             default:
                 print_usage("Unknown options received.");
         }
     }
 
-    /** Get final URl as parameter */
-    options->hostname = argv[optind];
-    if (options->hostname == NULL) print_usage("URL missing as argument.");
-    if (strncmp(options->hostname, "http://", strlen("http://")) != 0) print_usage("URL has to start with 'http://'.");
-
-    /** Check for correct protocol and extract hostname as well as the relative path */
-    options->hostname += strlen("http://");
-    char *ptr = strpbrk(options->hostname, ";/?:@=&");
-    char *slash_ptr = strpbrk(options->hostname, "/");
-    if (ptr != NULL) {
-        *ptr = '\0';
-        options->relative_path = slash_ptr != NULL ? ++slash_ptr : "";
-    } else {
-        options->relative_path = "";
+    options->urls = &argv[optind];
+    options->url_count = argc - optind;
+    if (options->load) {
+        if (output_file_set || output_dir_set || options->parts > 0 || options->decode_thread ||
+            options->cache_dir != NULL) {
+            print_usage("The load generator doesn't write any output.");
+        }
+        if (options->connections == 0) options->connections = LOADGEN_DEFAULT_CONNECTIONS;
+        if (options->url_count == 0 && options->url_file == NULL) print_usage("URL missing as argument.");
+        return;
+    }
+    if (options->parts > 0) {
+        if (options->url_count > 1 || options->url_file != NULL || options->connections > 0) {
+            print_usage("Ranged downloads (-r) fetch a single URL.");
+        }
+        if (!output_file_set && !output_dir_set) print_usage("Ranged downloads are written to a file given with -o or -d.");
+    }
+    options->many = options->url_count > 1 || options->url_file != NULL || options->connections > 0;
+    if (options->decode_thread && (options->many || options->parts > 0)) {
+        print_usage("A second decoding thread (-D) is only used for a single download.");
     }
+    if (options->cache_dir != NULL && (options->many || options->parts > 0)) {
+        print_usage("The cache (-C) is only used for a single download.");
+    }
+    if (options->cache_max > 0 && options->cache_dir == NULL) print_usage("The argument -m needs a cache given with -C.");
+    if (options->cache_max == 0) options->cache_max = HTTP_CACHE_DEFAULT_MAX;
+    if (options->many) {
+        if (!output_dir_set) print_usage("Several URLs are downloaded into a directory given with -d.");
+        if (options->connections == 0) options->connections = DOWNLOAD_DEFAULT_CONNECTIONS;
+        if (options->url_count == 0 && options->url_file == NULL) print_usage("URL missing as argument.");
+        return;
+    }
+
+    /** Get final URl as parameter */
+    if (argv[optind] == NULL) print_usage("URL missing as argument.");
+    split_url(argv[optind], &options->hostname, &options->relative_path);
 
     /** Extract correct file name */
     options->path_appendix = "index.html";
@@ -167,13 +345,26 @@ static void handle_args(int argc, char **argv, options_t *options) {
 }
 
 /**
- * @brief Creates the connection to the server.
- * @details The connection details are used which were parsed in handle_args().
+ * @brief Builds the name of the output file for -d, the file name of the URL inside the directory.
  * @param options Options which should be parsed and filled up by handle_args() beforehand.
- * @return File descriptor for socket or -1 for errors.
+ * @return Path to be freed, NULL if out of memory.
  */
-static int create_connection(options_t *options) {
-    /** Create addrinfo */
+static char *output_path(options_t *options) {
+    size_t dir_len = strlen(options->path);
+    char *path = malloc(dir_len + strlen(options->path_appendix) + 2);
+    if (path == NULL) return NULL;
+    strcpy(path, options->path);
+    if (dir_len == 0 || options->path[dir_len - 1] != '/') strcat(path, "/");
+    strcat(path, options->path_appendix);
+    return path;
+}
+
+/**
+ * @brief Looks up the address of the server.
+ * @param options Options which should be parsed and filled up by handle_args() beforehand.
+ * @return Address to be freed with freeaddrinfo() or NULL for errors.
+ */
+static struct addrinfo *resolve(options_t *options) {
     struct addrinfo hints, *ai;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
@@ -182,8 +373,20 @@ static int create_connection(options_t *options) {
     int res = getaddrinfo(options->hostname, options->port, &hints, &ai);
     if (res != 0) {
         fprintf(stderr, "[%s] Error: getaddrinfo: %s \n", prog_name, gai_strerror(res));
-        return -1;
+        return NULL;
     }
+    return ai;
+}
+
+/**
+ * @brief Creates the connection to the server.
+ * @details The connection details are used which were parsed in handle_args().
+ * @param options Options which should be parsed and filled up by handle_args() beforehand.
+ * @return File descriptor for socket or -1 for errors.
+ */
+static int create_connection(options_t *options) {
+    struct addrinfo *ai = resolve(options);
+    if (ai == NULL) return -1;
 
     int sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
     if (sockfd < 0) {
@@ -201,156 +404,704 @@ static int create_connection(options_t *options) {
     return sockfd;
 }
 
+/**
+ * @brief Receives the status line and the headers into the receive buffer of the body and parses them in place.
+ * @details Whatever arrived behind the empty line stays in the buffer as the start of the body.
+ * @param body Body of the response, its buffer is allocated here.
+ * @param sockfd Socket where the response should be read from.
+ * @return 0 on success, -1 if the connection ended before the empty line and -2 on protocol errors.
+ */
+static int read_head(body_t *body, int sockfd) {
+    body->fd = sockfd;
+    body->pos = 0;
+    body->complete = false;
+    if (io_buffer_init(&body->in, BODY_BUFF_SIZE) < 0) return -1;
+    for (;;) {
+        ssize_t head_len = http_response_head(&body->res, body->in.data, body->in.len, false);
+        if (head_len < 0) return -2;
+        if (head_len > 0) {
+            body->pos = head_len;
+            return 0;
+        }
+        /** The headers have to fit into the buffer */
+        if (body->in.len == body->in.cap) return -2;
+        ssize_t n = io_buffer_read(&body->in, sockfd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+    }
+}
+
 /**
  * @brief Checks the response gotten from the local / remote host.
  * @details To be a valid response, the HTTP version must be 1.1 and the HTTP status code must be 200.
  *
- * @param sockfile Socket where the headers should be read from.
+ * @param body Body of the response, whose head has been parsed.
  * @return Status of validation.
  */
-static int validate_response(FILE *sockfile) {
-    /** Get top level header from socket */
-    char *buffer = NULL;
-    size_t buff_size = 0;
-    if (getline(&buffer, &buff_size, sockfile) == -1) {
-        fprintf(stderr, "[%s] Error: couldn't get first line of http response \n", prog_name);
-        free(buffer);
-        return -1;
-    }
-
+static int validate_response(const body_t *body) {
     /** Check if http version matches */
-    if (strncmp(buffer, "HTTP/1.1", strlen("HTTP/1.1")) != 0) {
+    if (strncmp(body->in.data, "HTTP/1.1", strlen("HTTP/1.1")) != 0) {
         fprintf(stderr, "[%s] Protocol error! \n", prog_name);
-        free(buffer);
         return -2;
     }
 
     /** Check if status code is 200 */
-    char *buffer_wo_http = buffer + strlen("HTTP/1.1");
-    char *endptr = NULL;
-    long val = strtol(buffer_wo_http, &endptr, 10);
-    if ((errno == ERANGE && (val == LONG_MAX || val == LONG_MIN)) || (errno != 0 && val == 0) || *endptr != ' ') {
-        fprintf(stderr, "[%s] Protocol error! \n", prog_name);
-        free(buffer);
-        return -2;
-    }
-
-    if (val != 200) {
+    if (body->res.status != 200) {
         fprintf(stderr, "[%s] Error: Gotten non 200 status code \n", prog_name);
-        free(buffer);
         return -3;
     }
-
-    free(buffer);
     return 0;
 }
 
 /**
- * @brief Empties header until only a newline is found.
- * @param sockfile
+ * @brief Hands out the next piece of body data, chunk sizes and trailers are skipped.
+ * @details The data points into the receive buffer and is valid until the next call.
+ * @param body Body of the response.
+ * @param data Set to the data.
+ * @return Amount of data, 0 at the end of the body and -1 on errors, e.g. a body cut short.
  */
-static void empty_headers(FILE *sockfile) {
-    /** Empty out headers and skip to body */
-    size_t buff_size = 0;
-    char *buff = NULL;
-    while (getline(&buff, &buff_size, sockfile) != -1) {
-        if (strcmp(buff, "\r\n") == 0) break;
-    }
-    free(buff);
+static ssize_t body_next(body_t *body, const char **data) {
+    for (;;) {
+        if (body->complete) return 0;
+        size_t used, data_len;
+        int ret = http_response_body(&body->res, body->in.data + body->pos, body->in.len - body->pos, &used,
+                                     data, &data_len);
+        if (ret < 0) return -1;
+        body->pos += used;
+        body->complete = ret > 0;
+        if (data_len > 0) return (ssize_t) data_len;
+        if (used > 0 || body->complete) continue;
+
+        /** An incomplete chunk header is kept, everything else has been handed out */
+        io_buffer_consume(&body->in, body->pos);
+        body->pos = 0;
+        if (body->in.len == body->in.cap) return -1;
+        ssize_t n = io_buffer_read(&body->in, body->fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            /** Only a body delimited by the end of the connection may end here */
+            if (body->res.framing != framing_close) return -1;
+            body->complete = true;
+            continue;
+        }
+    }
+}
+
+/**
+ * @brief Moves the rest of the body from the socket to the output inside the kernel.
+ * @details Files are fed through a pipe, a pipe as output is spliced into directly.
+ * @param left Bytes left of the body, -1 if it ends with the connection.
+ * @return 0 on success, 1 if splice isn't supported before anything was moved, -1 on errors.
+ */
+static int splice_body(int sockfd, int out_fd, bool out_is_pipe, long long left) {
+    int pipefd[2] = {-1, out_fd};
+    if (!out_is_pipe) {
+        if (pipe(pipefd) < 0) return 1;
+        /** A larger pipe means fewer round trips, the default capacity is used if it can't be raised */
+        fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_SIZE);
+    }
+    bool moved = false;
+    int ret = 0;
+    while (left != 0) {
+        size_t count = left > 0 && left < SPLICE_SIZE ? (size_t) left : SPLICE_SIZE;
+        ssize_t n = splice(sockfd, NULL, pipefd[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) ret = !moved && (errno == EINVAL || errno == ENOSYS) ? 1 : -1;
+        /** A body with a length must not end before it */
+        if (n == 0 && left > 0) ret = -1;
+        if (n <= 0) break;
+        moved = true;
+        if (left > 0) left -= n;
+        while (!out_is_pipe && n > 0) {
+            ssize_t m = splice(pipefd[0], NULL, out_fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) {
+                ret = -1;
+                break;
+            }
+            n -= m;
+        }
+        if (ret < 0) break;
+    }
+    if (!out_is_pipe) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    return ret;
 }
 
 /**
  * @brief Prints response to specified output.
- * @details Uses fread and fwrite, so images and binary stuff also works fine.
- * @param sockfile Socket to be read from.
+ * @details A body with a Content-Length or one delimited by the end of the connection isn't copied through user space:
+ * after the bytes read ahead with the headers it is spliced from the socket into the output. Chunked bodies and
+ * outputs splice doesn't support, like a terminal, go through the receive buffer.
+ * @param body Body to be read.
  * @param output Output to be written to e.g. stdout or a file.
+ * @param preallocate True if output is a new file whose space may be reserved for the Content-Length.
  */
-static int write_response(FILE *sockfile, FILE *output) {
-    empty_headers(sockfile);
-    /** Read content in chunks of 128 bytes and write to output */
-    char buffer[BUFF_SIZE];
-    size_t read;
-    /** Use size as 1 and nmemb as BUFF_SIZE since if used the other way around, you either get BUFF_SIZE bytes or nothing */
-    while ((read = fread(buffer, 1, BUFF_SIZE, sockfile)) > 0) {
-        fwrite(buffer, 1, read, output);
+static int write_response(body_t *body, FILE *output, bool preallocate) {
+    http_response_t *res = &body->res;
+    int out_fd = fileno(output);
+    if (fflush(output) == EOF) {
+        fprintf(stderr, "[%s] Error: couldn't write response \n", prog_name);
+        return -1;
     }
-    return 0;
+
+    /** Reserve the blocks of the file at once instead of growing it with every write, without changing its size */
+    if (preallocate && res->framing == framing_length && res->content_length > 0) {
+        fallocate(out_fd, FALLOC_FL_KEEP_SIZE, 0, res->content_length);
+    }
+
+    const char *data;
+    ssize_t n = 0;
+    int ret = 1;
+    bool write_failed = false;
+    if (res->framing == framing_length || res->framing == framing_close) {
+        n = body->pos < body->in.len ? body_next(body, &data) : 0;
+        if (n > 0) write_failed = io_write_all(out_fd, data, n) < 0;
+        if (n < 0 || write_failed) {
+            ret = -1;
+        } else if (body->complete) {
+            ret = 0;
+        } else {
+            struct stat st;
+            bool out_is_pipe = fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+            ret = splice_body(body->fd, out_fd, out_is_pipe,
+                              res->framing == framing_length ? (long long) res->remaining : -1);
+        }
+    }
+    if (ret == 1) {
+        ret = 0;
+        while (!write_failed && (n = body_next(body, &data)) > 0) write_failed = io_write_all(out_fd, data, n) < 0;
+        if (n < 0 || write_failed) ret = -1;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "[%s] Error: %s \n", prog_name,
+                write_failed ? "couldn't write response" : "couldn't receive the whole response");
+    }
+    return ret;
 }
 
+/**
+ * @brief Decodes a piece of the body and writes the decoded data.
+ * @details Data behind the end of the encoding is ignored.
+ * @return 0 on success, -1 on corrupt data and -2 if the output couldn't be written.
+ */
+static int decode_data(decompressor_t *dec, const char *data, size_t len, int out_fd) {
+    const unsigned char *in = (const unsigned char *) data;
+    unsigned char *out;
+    ssize_t n;
+    while ((n = decompressor_next(dec, &in, &len, &out)) > 0) {
+        if (io_write_all(out_fd, (const char *) out, n) < 0) return -2;
+    }
+    return n < 0 ? -1 : 0;
+}
 
 /**
- * @brief Prints response to specified output.
- * @details Uses fread and fwrite, so images and binary stuff also works fine.
- * @param sockfile Socket to be read from.
+ * @brief Decodes the buffers of the queue until the receiver is done or the encoding ended.
+ * @param arg Queue of type decode_queue_t.
+ */
+static void *decode_thread(void *arg) {
+    decode_queue_t *q = arg;
+    pthread_mutex_lock(&q->lock);
+    while (!q->stopped) {
+        while (q->count == 0 && !q->done) pthread_cond_wait(&q->changed, &q->lock);
+        if (q->count == 0) break;
+        size_t slot = q->first;
+        pthread_mutex_unlock(&q->lock);
+        int ret = decode_data(q->dec, q->buffs[slot], q->lens[slot], q->out_fd);
+        pthread_mutex_lock(&q->lock);
+        q->first = (q->first + 1) % DECODE_QUEUE_LEN;
+        q->count--;
+        q->ret = ret;
+        q->stopped = ret < 0 || q->dec->finished;
+        pthread_cond_signal(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+/**
+ * @brief Receives the body into the queue while the decoding thread empties it.
+ * @details Slices of the body are gathered into full BODY_BUFF_SIZE buffers, so the threads meet once per 64KB.
+ * @return 0 on success, -3 if the body couldn't be received.
+ */
+static int receive_queued(body_t *body, decode_queue_t *q) {
+    size_t fill = 0;
+    size_t slot = 0;
+    const char *data;
+    ssize_t n;
+    bool stopped = false;
+    while (!stopped && (n = body_next(body, &data)) > 0) {
+        while (n > 0) {
+            if (fill == 0) {
+                /** Wait for a free buffer, only this thread adds buffers so it stays free */
+                pthread_mutex_lock(&q->lock);
+                while (q->count == DECODE_QUEUE_LEN && !q->stopped) pthread_cond_wait(&q->changed, &q->lock);
+                stopped = q->stopped;
+                slot = (q->first + q->count) % DECODE_QUEUE_LEN;
+                pthread_mutex_unlock(&q->lock);
+                if (stopped) break;
+            }
+            size_t copy = (size_t) n < BODY_BUFF_SIZE - fill ? (size_t) n : BODY_BUFF_SIZE - fill;
+            memcpy(q->buffs[slot] + fill, data, copy);
+            fill += copy;
+            data += copy;
+            n -= copy;
+            if (fill == BODY_BUFF_SIZE || (n == 0 && body->complete)) {
+                pthread_mutex_lock(&q->lock);
+                q->lens[slot] = fill;
+                q->count++;
+                pthread_cond_signal(&q->changed);
+                pthread_mutex_unlock(&q->lock);
+                fill = 0;
+            }
+        }
+    }
+    pthread_mutex_lock(&q->lock);
+    /** A partly filled buffer of a body which ended early still goes to the decoder */
+    if (fill > 0 && !q->stopped) {
+        q->lens[slot] = fill;
+        q->count++;
+    }
+    q->done = true;
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return stopped || n == 0 ? 0 : -3;
+}
+
+/**
+ * @brief Decodes the body on a second thread while the next data is received.
+ * @return 0 on success, -3 if receiving failed, otherwise the result of decode_data(), 1 if no thread could be started
+ * before anything was received.
+ */
+static int decode_threaded(body_t *body, decompressor_t *dec, int out_fd) {
+    decode_queue_t q;
+    memset(&q, 0, sizeof(decode_queue_t));
+    q.dec = dec;
+    q.out_fd = out_fd;
+    bool ok = true;
+    for (size_t i = 0; i < DECODE_QUEUE_LEN; ++i) ok = ok && (q.buffs[i] = malloc(BODY_BUFF_SIZE)) != NULL;
+    pthread_t thread;
+    int ret = 1;
+    if (ok && pthread_mutex_init(&q.lock, NULL) == 0) {
+        if (pthread_cond_init(&q.changed, NULL) == 0) {
+            if (pthread_create(&thread, NULL, decode_thread, &q) == 0) {
+                ret = receive_queued(body, &q);
+                pthread_join(thread, NULL);
+                if (q.ret < 0) ret = q.ret;
+            }
+            pthread_cond_destroy(&q.changed);
+        }
+        pthread_mutex_destroy(&q.lock);
+    }
+    for (size_t i = 0; i < DECODE_QUEUE_LEN; ++i) free(q.buffs[i]);
+    return ret;
+}
+
+/**
+ * @brief Prints a compressed response to specified output.
+ * @details The decoder is chosen by the Content-Encoding of the response. The compressed data is decoded straight out
+ * of the receive buffer after its framing has been removed, into 64KB at a time. With threaded set it is decoded on
+ * a second thread instead, overlapped with receiving the following data.
+ * @param body Body to be read.
  * @param output Output to be written to e.g. stdout or a file.
+ * @param threaded True to decode on a second thread.
  */
-static int write_response_gzip(FILE *sockfile, FILE *output) {
-    /** Empty out headers and skip to body */
-    empty_headers(sockfile);
-
-    /** Parse gzip */
-    int status;
-    unsigned int size_inflate;
-    /** Create zstream to pass metadata to zlib routines */
-    z_stream zs;
-    /** In and output buffers for deflate() */
-    Bytef in[BUFF_SIZE];
-    Bytef out[BUFF_SIZE];
-
-    zs.zalloc = Z_NULL;
-    zs.zfree = Z_NULL;
-    zs.opaque = Z_NULL;
-    zs.avail_in = 0;
-    zs.next_in = Z_NULL;
-    /** MAX_WBITS | 16 for Gzip */
-    status = inflateInit2(&zs, MAX_WBITS | 16);
-    if (status != Z_OK) {
-        fprintf(stderr, "[%s] Error: couldn't inflateInit() \n", prog_name);
+static int write_response_decoded(body_t *body, FILE *output, bool threaded) {
+    decompressor_t dec;
+    if (decompressor_init(&dec) < 0 || decompressor_start(&dec, body->res.encoding) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't set up the %s decoder \n", prog_name, encoding_name(body->res.encoding));
+        decompressor_free(&dec);
         return -1;
     }
+    int out_fd = fileno(output);
+    int ret = fflush(output) == EOF ? -2 : 1;
+    if (ret == 1 && threaded) ret = decode_threaded(body, &dec, out_fd);
+    if (ret == 1) {
+        const char *data;
+        ssize_t n;
+        ret = 0;
+        while (ret == 0 && !dec.finished && (n = body_next(body, &data)) > 0) ret = decode_data(&dec, data, n, out_fd);
+        if (ret == 0 && n < 0) ret = -3;
+    }
+    /** The body must not end before its encoding */
+    if (ret == 0 && !dec.finished) ret = -1;
+    if (ret == -1) fprintf(stderr, "[%s] Error: Couldn't decompress \n", prog_name);
+    if (ret == -2) fprintf(stderr, "[%s] Error: couldn't write to destination \n", prog_name);
+    if (ret == -3) fprintf(stderr, "[%s] Error: couldn't receive the whole response \n", prog_name);
+    decompressor_free(&dec);
+    return ret == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Adds an URL or absolute path to the paths replayed by the load generator.
+ * @details All URLs have to name the same host, which is stored in the options by the first one.
+ *
+ * @param options Options, the hostname is set by the first URL.
+ * @param paths Array of paths, grown as needed.
+ * @param count Amount of paths in the array.
+ * @param url URL starting with 'http://' or a path starting with '/', modified in place.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_load_path(options_t *options, char ***paths, size_t *count, char *url) {
+    char *relative_path;
+    if (url[0] == '/') {
+        relative_path = url + 1;
+    } else {
+        char *hostname;
+        split_url(url, &hostname, &relative_path);
+        if (options->hostname == NULL) options->hostname = hostname;
+        else if (strcmp(options->hostname, hostname) != 0) print_usage("All URLs have to name the same host.");
+    }
+
+    char **grown = realloc(*paths, (*count + 1) * sizeof(char *));
+    if (grown == NULL) return -1;
+    *paths = grown;
+    if ((grown[*count] = malloc(strlen(relative_path) + 2)) == NULL) return -1;
+    grown[*count][0] = '/';
+    strcpy(grown[*count] + 1, relative_path);
+    (*count)++;
+    return 0;
+}
+
+/**
+ * @brief Reads the URL file given with -f.
+ * @details Empty lines and lines starting with '#' are skipped.
+ *
+ * @param path Path of the file.
+ * @param lines Set to the lines allocated with malloc(), each line too.
+ * @param count Set to the amount of lines.
+ * @return 0 on success, -1 on errors, the lines read so far have to be freed anyway.
+ */
+static int read_url_file(const char *path, char ***lines, size_t *count) {
+    *lines = NULL;
+    *count = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "[%s] Error: Couldn't open file %s \n", prog_name, path);
+        return -1;
+    }
+    int ret = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, f) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char **grown = realloc(*lines, (*count + 1) * sizeof(char *));
+        if (grown == NULL) {
+            ret = -1;
+            break;
+        }
+        *lines = grown;
+        if ((grown[*count] = strdup(line)) == NULL) {
+            ret = -1;
+            break;
+        }
+        (*count)++;
+    }
+    free(line);
+    fclose(f);
+    return ret;
+}
+
+static void free_lines(char **lines, size_t count) {
+    for (size_t i = 0; i < count; ++i) free(lines[i]);
+    free(lines);
+}
+
+/**
+ * @brief Runs the load generator and prints its report to stdout.
+ * @param options Options parsed by handle_args() in load generator mode.
+ * @return Exit code.
+ */
+static int run_load(options_t *options) {
+    char **paths = NULL;
+    size_t count = 0;
+    int ret = 0;
+    for (int i = 0; i < options->url_count && ret == 0; ++i) ret = add_load_path(options, &paths, &count, options->urls[i]);
 
-    /** Outer loops runs until there is no more content to be read */
+    /** Lines of the URL file, kept until the end since the hostname may point into one of them */
+    char **lines = NULL;
+    size_t line_count = 0;
+    if (options->url_file != NULL && ret == 0) ret = read_url_file(options->url_file, &lines, &line_count);
+    for (size_t i = 0; i < line_count && ret == 0; ++i) ret = add_load_path(options, &paths, &count, lines[i]);
+
+    if (ret == 0 && (count == 0 || options->hostname == NULL)) {
+        fprintf(stderr, "[%s] Error: No URL naming the host to be loaded \n", prog_name);
+        ret = -1;
+    }
+    struct addrinfo *ai = ret == 0 ? resolve(options) : NULL;
+    if (ai != NULL) {
+        loadgen_options_t load = {ai->ai_addr, ai->ai_addrlen, options->hostname, paths, count,
+                                  ACCEPT_ENCODING, options->connections, options->requests,
+                                  options->duration_ms};
+        loadgen_result_t *result = malloc(sizeof(loadgen_result_t));
+        if (result == NULL || loadgen_run(&load, result) < 0) {
+            fprintf(stderr, "[%s] Error: couldn't set up the load generator \n", prog_name);
+            ret = -1;
+        } else {
+            printf("%zu connections, %zu URLs @ %s:%s\n", options->connections, count, options->hostname, options->port);
+            loadgen_report(result, stdout);
+            if (result->metrics.latency.count == 0) ret = -1;
+        }
+        free(result);
+        freeaddrinfo(ai);
+    } else {
+        ret = -1;
+    }
+
+    free_lines(paths, count);
+    free_lines(lines, line_count);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Maps an URL to a file below the output directory, like a mirror of the site.
+ * @details Every host gets its own directory, so equal paths of different hosts don't overwrite each other. The query
+ * string is dropped, empty, "." and ".." segments are skipped so nothing ends up outside of the directory, and paths
+ * ending with '/' get index.html appended. Missing directories below the output directory are created.
+ *
+ * @param dir Output directory.
+ * @param hostname Hostname of the URL.
+ * @param relative_path Path of the URL without the leading slash.
+ * @return Path allocated with malloc(), NULL on errors or if the hostname can't name a directory.
+ */
+static char *mirror_file(const char *dir, const char *hostname, const char *relative_path) {
+    if (hostname[0] == '\0' || strcmp(hostname, ".") == 0 || strcmp(hostname, "..") == 0) return NULL;
+    size_t dir_len = strlen(dir);
+    size_t host_len = strlen(hostname);
+    char *file = malloc(dir_len + 1 + host_len + strlen(relative_path) + strlen("/index.html") + 1);
+    if (file == NULL) return NULL;
+    memcpy(file, dir, dir_len);
+    file[dir_len] = '/';
+    memcpy(file + dir_len + 1, hostname, host_len);
+    size_t len = dir_len + 1 + host_len;
+
+    const char *path = relative_path;
+    size_t path_len = strcspn(path, "?#");
+    bool dir_end;
+    size_t i = 0;
     do {
-        zs.avail_in = fread(in, 1, BUFF_SIZE, sockfile);
-        if (ferror(sockfile)) {
-            inflateEnd(&zs);
-            fprintf(stderr, "[%s] Error: Couldn't read from sockfile \n", prog_name);
-            return Z_ERRNO;
+        size_t seg_len = 0;
+        while (i + seg_len < path_len && path[i + seg_len] != '/') seg_len++;
+        const char *seg = path + i;
+        dir_end = seg_len == 0 || (seg_len == 1 && seg[0] == '.') || (seg_len == 2 && seg[0] == '.' && seg[1] == '.');
+        if (!dir_end) {
+            file[len++] = '/';
+            memcpy(file + len, seg, seg_len);
+            len += seg_len;
+        }
+        i += seg_len + 1;
+    } while (i <= path_len);
+    strcpy(file + len, dir_end ? "/index.html" : "");
+
+    /** Create every directory between the output directory and the file */
+    for (char *slash = strchr(file + dir_len + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int res = mkdir(file, 0755);
+        *slash = '/';
+        if (res < 0 && errno != EEXIST) {
+            free(file);
+            return NULL;
         }
-        if (zs.avail_in == 0)
+    }
+    return file;
+}
+
+/**
+ * @brief Downloads all URLs concurrently into the output directory.
+ * @param options Options parsed by handle_args() with several URLs.
+ * @return Exit code.
+ */
+static int run_downloads(options_t *options) {
+    char **lines = NULL;
+    size_t line_count = 0;
+    int ret = 0;
+    if (options->url_file != NULL) ret = read_url_file(options->url_file, &lines, &line_count);
+
+    size_t count = options->url_count + line_count;
+    download_t *downloads = calloc(count, sizeof(download_t));
+    char **paths = calloc(count, sizeof(char *));
+    char **files = calloc(count, sizeof(char *));
+    if (downloads == NULL || paths == NULL || files == NULL) ret = -1;
+    for (size_t i = 0; i < count && ret == 0; ++i) {
+        char *url = i < (size_t) options->url_count ? options->urls[i] : lines[i - options->url_count];
+        char *hostname, *relative_path;
+        split_url(url, &hostname, &relative_path);
+        if ((paths[i] = malloc(strlen(relative_path) + 2)) == NULL) {
+            ret = -1;
             break;
-        zs.next_in = in;
-
-        /** Run until all bytes from the BUFF_SIZE big buffer are read */
-        do {
-            zs.avail_out = BUFF_SIZE;
-            zs.next_out = out;
-            status = inflate(&zs, Z_NO_FLUSH);
-            /** Check of inflate status code */
-            switch (status) {
-                case Z_NEED_DICT:
-                    status = Z_DATA_ERROR;
-                case Z_DATA_ERROR:
-                case Z_MEM_ERROR:
-                    inflateEnd(&zs);
-                    fprintf(stderr, "[%s] Error: Couldn't inflate \n", prog_name);
-                    return -1;
-                default:
-                    break;
-            }
-            /** How much did we inflate? */
-            size_inflate = BUFF_SIZE - zs.avail_out;
-            if (fwrite(out, 1, size_inflate, output) != size_inflate || ferror(output)) {
-                inflateEnd(&zs);
-                fprintf(stderr, "[%s] Error: couldn't write to destination \n", prog_name);
-                return Z_ERRNO;
-            }
-        } while (zs.avail_out == 0);
-    } while (status != Z_STREAM_END);
+        }
+        paths[i][0] = '/';
+        strcpy(paths[i] + 1, relative_path);
+        if ((files[i] = mirror_file(options->path, hostname, relative_path)) == NULL) {
+            fprintf(stderr, "[%s] Error: Couldn't create a file for http://%s%s \n", prog_name, hostname, paths[i]);
+            ret = -1;
+            break;
+        }
+        downloads[i].host = hostname;
+        downloads[i].path = paths[i];
+        downloads[i].file = files[i];
+    }
+
+    if (ret == 0) {
+        downloader_options_t download = {options->port, downloads, count, options->connections,
+                                         ACCEPT_ENCODING, stderr, prog_name};
+        long failed = downloader_run(&download);
+        if (failed < 0) fprintf(stderr, "[%s] Error: couldn't set up the downloader \n", prog_name);
+        if (failed != 0) ret = -1;
+    }
+
+    if (paths != NULL) free_lines(paths, count);
+    if (files != NULL) free_lines(files, count);
+    free(downloads);
+    free_lines(lines, line_count);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void handle_interrupt(int sig) { interrupted = true; }
+
+/**
+ * @brief Downloads the URL in parallel byte ranges into the output file.
+ * @details SIGINT and SIGTERM stop the download without losing its progress, running the same command again resumes
+ * it.
+ * @param options Options which should be parsed and filled up by handle_args() beforehand.
+ * @return Exit code.
+ */
+static int run_ranged(options_t *options) {
+    char *file = options->output_type == directory ? output_path(options) : options->path;
+    char *path = malloc(strlen(options->relative_path) + 2);
+    struct addrinfo *ai = file != NULL && path != NULL ? resolve(options) : NULL;
+    int ret = -1;
+    if (ai != NULL) {
+        path[0] = '/';
+        strcpy(path + 1, options->relative_path);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_interrupt;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        ranged_options_t ranged = {ai->ai_addr, ai->ai_addrlen, options->hostname, path, file, options->parts,
+                                   &interrupted, stderr, prog_name};
+        ret = ranged_run(&ranged);
+        freeaddrinfo(ai);
+    } else if (file == NULL || path == NULL) {
+        fprintf(stderr, "[%s] Error: Out of memory \n", prog_name);
+    }
+
+    if (options->output_type == directory) free(file);
+    free(path);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    /** Clean up and return */
-    inflateEnd(&zs);
-    return status == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
+/**
+ * @brief Opens the output given by the options.
+ * @return Output stream, NULL if the file couldn't be opened.
+ */
+static FILE *open_output(options_t *options) {
+    if (options->output_type == std) return stdout;
+    /** If a directory is specified, we have to use the file name as our file where we should write our output to.  */
+    char *path = options->output_type == file ? options->path : output_path(options);
+    if (path == NULL) print_error("Out of memory.\n");
+    FILE *f = fopen(path, "w");
+    if (f == NULL) fprintf(stderr, "[%s] Error: Couldn't open file %s \n", prog_name, path);
+    if (path != options->path) free(path);
+    return f;
+}
+
+/**
+ * @brief Writes the body to the output, decoded according to its Content-Encoding.
+ * @param preallocate True if output is a new file whose space may be reserved for the Content-Length.
+ */
+static int write_body(body_t *body, FILE *output, bool preallocate, bool threaded) {
+    if (body->res.encoding == enc_identity) return write_response(body, output, preallocate);
+    return write_response_decoded(body, output, threaded);
+}
+
+/**
+ * @brief Copies a file to the output inside the kernel.
+ * @param in_fd File to be copied from its start.
+ * @param output Output to be written to e.g. stdout or a file.
+ */
+static int copy_file(int in_fd, FILE *output) {
+    int out_fd = fileno(output);
+    off_t offset = 0;
+    ssize_t n = fflush(output) == EOF ? -1 : 1;
+    while (n > 0) {
+        n = sendfile(out_fd, in_fd, &offset, SPLICE_SIZE);
+        if (n < 0 && errno == EINTR) n = 1;
+    }
+    /** Outputs sendfile doesn't support are written to from user space */
+    if (n < 0 && offset == 0 && (errno == EINVAL || errno == ENOSYS)) {
+        char buff[BODY_BUFF_SIZE];
+        while ((n = pread(in_fd, buff, sizeof(buff), offset)) > 0 && io_write_all(out_fd, buff, n) == 0) offset += n;
+    }
+    if (n != 0) fprintf(stderr, "[%s] Error: couldn't write response \n", prog_name);
+    return n == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Copies a header of the response into a null-terminated buffer of HTTP_CACHE_VALIDATOR_LEN bytes.
+ * @return True if the header was sent and fits, otherwise out is empty.
+ */
+static bool copy_header(const body_t *body, size_t head_len, const char *name, char *out) {
+    size_t len;
+    const char *value = http_response_header(body->in.data, head_len, name, &len);
+    out[0] = '\0';
+    if (value == NULL || len >= HTTP_CACHE_VALIDATOR_LEN) return false;
+    memcpy(out, value, len);
+    out[len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Receives the body into the cache and copies it from there to the output.
+ * @details Responses without ETag and Last-Modified can't be revalidated, they and responses marked no-store are
+ * written straight to the output.
+ * @param body Body to be read, whose head is still in the receive buffer.
+ * @param head_len Length of the head.
+ * @param url URL the body is cached for.
+ * @param output Output to be written to e.g. stdout or a file.
+ * @param threaded True to decode on a second thread.
+ */
+static int write_response_cached(body_t *body, size_t head_len, http_cache_t *cache, const char *url, FILE *output,
+                                 bool threaded) {
+    char etag[HTTP_CACHE_VALIDATOR_LEN];
+    char last_modified[HTTP_CACHE_VALIDATOR_LEN];
+    bool validated = copy_header(body, head_len, "ETag", etag);
+    validated = copy_header(body, head_len, "Last-Modified", last_modified) || validated;
+    size_t len;
+    const char *control = http_response_header(body->in.data, head_len, "Cache-Control", &len);
+    bool no_store = control != NULL && memmem(control, len, "no-store", strlen("no-store")) != NULL;
+
+    char *temp_path = NULL;
+    int temp_fd = validated && !no_store ? http_cache_create_temp(cache, &temp_path) : -1;
+    FILE *temp = temp_fd >= 0 ? fdopen(temp_fd, "w+") : NULL;
+    if (temp == NULL) {
+        if (temp_fd >= 0) {
+            close(temp_fd);
+            unlink(temp_path);
+        }
+        free(temp_path);
+        return write_body(body, output, true, threaded);
+    }
+
+    int ret = write_body(body, temp, true, threaded);
+    if (ret == 0 && fflush(temp) == EOF) ret = -1;
+    int stored = ret < 0 ? -1 : http_cache_store(cache, url, temp_fd, temp_path, etag[0] != '\0' ? etag : NULL,
+                                                 strlen(etag), last_modified[0] != '\0' ? last_modified : NULL,
+                                                 strlen(last_modified));
+    if (ret == 0 && stored < 0) fprintf(stderr, "[%s] Error: couldn't store the response in the cache \n", prog_name);
+    if (stored != 0) unlink(temp_path);
+    /** The descriptor still refers to the body, whether it was renamed into the cache or not */
+    if (ret == 0) ret = copy_file(temp_fd, output);
+    fclose(temp);
+    free(temp_path);
+    return ret;
 }
 
 /**
@@ -365,66 +1116,97 @@ int main(int argc, char **argv) {
     /** Parse cli args */
     options_t options = {"80", std};
     handle_args(argc, argv, &options);
+    if (options.load) return run_load(&options);
+    if (options.many) return run_downloads(&options);
+    if (options.parts > 0) return run_ranged(&options);
+
+    /** Cached URLs are requested conditionally, a 304 is then answered from the cache */
+    http_cache_t cache;
+    http_cache_entry_t entry;
+    bool use_cache = false;
+    bool cached = false;
+    char cache_url[HTTP_CACHE_URL_LEN];
+    char conditional[2 * HTTP_CACHE_VALIDATOR_LEN + 64] = "";
+    if (options.cache_dir != NULL) {
+        int len = snprintf(cache_url, sizeof(cache_url), "http://%s:%s/%s", options.hostname, options.port,
+                           options.relative_path);
+        use_cache = len >= 0 && len < (int) sizeof(cache_url);
+        if (use_cache && http_cache_open(&cache, options.cache_dir, options.cache_max) < 0) {
+            fprintf(stderr, "[%s] Error: couldn't open the cache %s \n", prog_name, options.cache_dir);
+            exit(EXIT_FAILURE);
+        }
+        cached = use_cache && http_cache_lookup(&cache, cache_url, &entry);
+    }
+    if (cached && entry.etag[0] != '\0') sprintf(conditional, "If-None-Match: %s\r\n", entry.etag);
+    if (cached && entry.last_modified[0] != '\0') {
+        sprintf(conditional + strlen(conditional), "If-Modified-Since: %s\r\n", entry.last_modified);
+    }
 
     /** Setup socket */
     int sockfd = create_connection(&options);
     if (sockfd == -1) {
         exit(EXIT_FAILURE);
     }
-    FILE *sockfile = fdopen(sockfd, "r+");
-    if (sockfile == NULL) print_error("Error opening socket descriptor.\n");
 
     /** Send HTTP request */
-    fprintf(sockfile, "GET /%s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n", options.relative_path,
-            options.hostname);
-    if (GZIP) fprintf(sockfile, "Accept-Encoding: gzip\r\n");
-    fprintf(sockfile, "\r\n");
-    fflush(sockfile);
-
-    /** Validate response from server */
-    int ret = validate_response(sockfile);
+    if (dprintf(sockfd, "GET /%s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\nAccept-Encoding: %s\r\n%s\r\n",
+                options.relative_path, options.hostname, ACCEPT_ENCODING, conditional) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't send the http request \n", prog_name);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    /** Validate response from server, the bytes read behind the headers are the start of the body */
+    body_t body;
+    int ret = read_head(&body, sockfd);
+    size_t head_len = body.pos;
+    bool not_modified = false;
+    if (ret == -1) {
+        fprintf(stderr, "[%s] Error: couldn't get the headers of the http response \n", prog_name);
+    } else if (ret == -2) {
+        fprintf(stderr, "[%s] Protocol error! \n", prog_name);
+    } else if (cached && body.res.status == 304) {
+        not_modified = true;
+    } else {
+        ret = validate_response(&body);
+    }
     if (ret < 0) {
-        fclose(sockfile);
-        exit(-ret);
+        io_buffer_free(&body.in);
+        close(sockfd);
+        exit(ret == -1 ? EXIT_FAILURE : -ret);
+    }
+
+    /** The body is decoded according to the Content-Encoding of the server and read according to its framing */
+    int encoding = body.res.encoding;
+    if (!not_modified && (encoding < 0 || !encoding_available(encoding))) {
+        fprintf(stderr, "[%s] Error: unsupported Content-Encoding \n", prog_name);
+        io_buffer_free(&body.in);
+        close(sockfd);
+        exit(EXIT_FAILURE);
     }
 
     /** Write response to specified output */
-    FILE *f;
-    switch (options.output_type) {
-        case std:
-            f = stdout;
-            break;
-        case file:
-            f = fopen(options.path, "w");
-            if (f == NULL) {
-                fprintf(stderr, "[%s] Error: Couldn't open file %s \n", prog_name, options.path);
-                fclose(sockfile);
-                exit(EXIT_FAILURE);
-            }
-            break;
-        case directory: {
-            /** If a directory is specified, we have to use the file name as our file where we should write our output to.  */
-            char dir_path[strlen(options.path) + strlen(options.path_appendix) + 2];
-            strcpy(dir_path, options.path);
-            if (options.path[strlen(options.path)] != '/') strcat(dir_path, "/");
-            strcat(dir_path, options.path_appendix);
-
-            f = fopen(dir_path, "w");
-            if (f == NULL) {
-                fprintf(stderr, "[%s] Error: Couldn't open file %s \n", prog_name, dir_path);
-                fclose(sockfile);
-                exit(EXIT_FAILURE);
-            }
-            break;
-        }
-        default:
-            f = stdout;
-            break;
+    FILE *f = open_output(&options);
+    if (f == NULL) {
+        io_buffer_free(&body.in);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    if (not_modified) {
+        int cached_fd = http_cache_open_body(&cache, &entry);
+        ret = cached_fd >= 0 ? copy_file(cached_fd, f) : -1;
+        if (cached_fd < 0) fprintf(stderr, "[%s] Error: the cached body has been evicted \n", prog_name);
+        if (cached_fd >= 0) close(cached_fd);
+    } else if (use_cache) {
+        ret = write_response_cached(&body, head_len, &cache, cache_url, f, options.decode_thread);
+    } else {
+        ret = write_body(&body, f, options.output_type != std, options.decode_thread);
     }
-    GZIP ? write_response_gzip(sockfile, f) : write_response(sockfile, f);
 
     /** Close everything before exiting */
+    io_buffer_free(&body.in);
+    if (use_cache) http_cache_close(&cache);
     if (options.output_type != std) fclose(f);
-    fclose(sockfile);
-    return EXIT_SUCCESS;
+    close(sockfd);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,470 @@
+/**
+ * @file compression.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include "compression.h"
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#include <brotli/decode.h>
+#endif
+
+/** Brotli quality used for on the fly compression if no level is given, 11 is far too slow for responses */
+#define ONLINE_BROTLI_QUALITY 5
+
+static const char *encoding_names[ENCODING_COUNT] = {NULL, "gzip", "br", "zstd"};
+static const char *encoding_extensions[ENCODING_COUNT] = {NULL, ".gz", ".br", ".zst"};
+
+/** CPU time of the calling thread in seconds, wall time would also count time spent waiting for slow clients */
+static double thread_cpu_seconds(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char *encoding_name(encoding_e enc) {
+    return encoding_names[enc];
+}
+
+const char *encoding_extension(encoding_e enc) {
+    return encoding_extensions[enc];
+}
+
+int encoding_from_name(const char *name, size_t len) {
+    if (len == strlen("identity") && strncasecmp(name, "identity", len) == 0) return enc_identity;
+    /** x-gzip is an alias for gzip */
+    if (len == strlen("x-gzip") && strncasecmp(name, "x-gzip", len) == 0) return enc_gzip;
+    for (int i = 1; i < ENCODING_COUNT; ++i) {
+        if (len == strlen(encoding_names[i]) && strncasecmp(name, encoding_names[i], len) == 0) return i;
+    }
+    return -1;
+}
+
+bool encoding_available(encoding_e enc) {
+    switch (enc) {
+        case enc_identity:
+        case enc_gzip:
+            return true;
+#ifdef HAVE_BROTLI
+        case enc_br:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case enc_zstd:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Parses a q-value like "0.8" into thousandths.
+ * @details Invalid values count as 0, so a malformed parameter never makes an encoding preferred.
+ */
+static int parse_qvalue(const char *str, size_t len) {
+    if (len == 0 || (str[0] != '0' && str[0] != '1')) return 0;
+    int q = (str[0] - '0') * 1000;
+    if (len == 1) return q;
+    if (str[1] != '.') return 0;
+    int factor = 100;
+    for (size_t i = 2; i < len && i < 5; ++i) {
+        if (str[i] < '0' || str[i] > '9') return 0;
+        q += (str[i] - '0') * factor;
+        factor /= 10;
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+void parse_accept_encoding(const char *value, accept_encoding_t *accepted) {
+    for (int i = 0; i < ENCODING_COUNT; ++i) accepted->q[i] = -1;
+    accepted->wildcard = -1;
+
+    const char *ptr = value;
+    while (*ptr != '\0') {
+        /** One element is "coding *( OWS ; OWS param )" and ends at the next comma */
+        const char *end = strchr(ptr, ',');
+        if (end == NULL) end = ptr + strlen(ptr);
+
+        while (ptr < end && (*ptr == ' ' || *ptr == '\t')) ptr++;
+        const char *name = ptr;
+        while (ptr < end && *ptr != ';' && *ptr != ' ' && *ptr != '\t' && *ptr != '\r' && *ptr != '\n') ptr++;
+        size_t name_len = ptr - name;
+
+        int q = 1000;
+        const char *param = memchr(ptr, ';', end - ptr);
+        while (param != NULL) {
+            param++;
+            while (param < end && (*param == ' ' || *param == '\t')) param++;
+            const char *param_end = memchr(param, ';', end - param);
+            const char *value_end = param_end != NULL ? param_end : end;
+            while (value_end > param && (value_end[-1] == ' ' || value_end[-1] == '\t' || value_end[-1] == '\r'
+                                         || value_end[-1] == '\n'))
+                value_end--;
+            if (value_end - param >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                q = parse_qvalue(param + 2, value_end - param - 2);
+            }
+            param = param_end;
+        }
+
+        if (name_len == 1 && name[0] == '*') {
+            accepted->wildcard = q;
+        } else if (name_len > 0) {
+            int enc = encoding_from_name(name, name_len);
+            if (enc >= 0) accepted->q[enc] = q;
+        }
+
+        ptr = *end == ',' ? end + 1 : end;
+    }
+}
+
+int accept_encoding_q(const accept_encoding_t *accepted, encoding_e enc) {
+    if (accepted->q[enc] >= 0) return accepted->q[enc];
+    if (accepted->wildcard >= 0) return accepted->wildcard;
+    return enc == enc_identity ? 1 : 0;
+}
+
+/**
+ * @brief Allocates a compressor with all encoder states available in this build.
+ */
+static compressor_t *compressor_create(compressor_pool_t *pool) {
+    compressor_t *comp = calloc(1, sizeof(compressor_t));
+    if (comp == NULL) return NULL;
+    comp->pool = pool;
+    comp->in = malloc(COMPRESS_CHUNK);
+    comp->out = malloc(COMPRESS_CHUNK);
+    if (comp->in == NULL || comp->out == NULL) goto error;
+
+    comp->zs.zalloc = Z_NULL;
+    comp->zs.zfree = Z_NULL;
+    comp->zs.opaque = Z_NULL;
+    /** MAX_WBITS | 16 for Gzip */
+    if (deflateInit2(&comp->zs, pool->level, Z_DEFLATED, MAX_WBITS | 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) goto error;
+    comp->initialized = true;
+
+#ifdef HAVE_ZSTD
+    comp->zstd = ZSTD_createCCtx();
+    if (comp->zstd == NULL) goto error;
+    ZSTD_CCtx_setParameter(comp->zstd, ZSTD_c_compressionLevel, pool->level < 0 ? ZSTD_CLEVEL_DEFAULT : pool->level);
+#endif
+    return comp;
+
+    error:
+    if (comp->initialized) deflateEnd(&comp->zs);
+    free(comp->in);
+    free(comp->out);
+    free(comp);
+    return NULL;
+}
+
+/**
+ * @brief Frees a compressor and all of its encoder states.
+ */
+static void compressor_destroy(compressor_t *comp) {
+    if (comp->initialized) deflateEnd(&comp->zs);
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(comp->zstd);
+#endif
+#ifdef HAVE_BROTLI
+    if (comp->brotli != NULL) BrotliEncoderDestroyInstance(comp->brotli);
+#endif
+    free(comp->in);
+    free(comp->out);
+    free(comp);
+}
+
+void compressor_pool_init(compressor_pool_t *pool, int level, size_t min_size) {
+    memset(pool, 0, sizeof(*pool));
+    pool->level = level;
+    pool->min_size = min_size;
+}
+
+void compressor_pool_free(compressor_pool_t *pool) {
+    for (size_t i = 0; i < pool->idle_count; ++i) {
+        compressor_destroy(pool->idle[i]);
+    }
+    free(pool->idle);
+    pool->idle = NULL;
+    pool->idle_count = pool->idle_cap = 0;
+}
+
+bool compressor_should_compress(compressor_pool_t *pool, bool compressible, size_t size) {
+    return compressible && pool->level != 0 && size >= pool->min_size;
+}
+
+compressor_t *compressor_acquire(compressor_pool_t *pool, encoding_e enc) {
+    if (!encoding_available(enc) || enc == enc_identity) return NULL;
+    compressor_t *comp = pool->idle_count > 0 ? pool->idle[--pool->idle_count] : compressor_create(pool);
+    if (comp == NULL) return NULL;
+
+#ifdef HAVE_BROTLI
+    /** Brotli has no reset function, so its encoder is created per stream */
+    if (enc == enc_br) {
+        comp->brotli = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+        if (comp->brotli == NULL) {
+            compressor_destroy(comp);
+            return NULL;
+        }
+        BrotliEncoderSetParameter(comp->brotli, BROTLI_PARAM_QUALITY,
+                                  pool->level < 0 ? ONLINE_BROTLI_QUALITY : pool->level);
+    }
+#endif
+    comp->encoding = enc;
+    comp->next_in = comp->in;
+    comp->avail_in = 0;
+    comp->offset = 0;
+    comp->eof = false;
+    comp->finished = false;
+    pool->responses++;
+    return comp;
+}
+
+void compressor_release(compressor_t *comp) {
+    if (comp == NULL) return;
+    compressor_pool_t *pool = comp->pool;
+
+    /** Keep the allocated state for the next response instead of deflateEnd() */
+    deflateReset(&comp->zs);
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx_reset(comp->zstd, ZSTD_reset_session_only);
+#endif
+#ifdef HAVE_BROTLI
+    if (comp->brotli != NULL) BrotliEncoderDestroyInstance(comp->brotli);
+    comp->brotli = NULL;
+#endif
+
+    if (pool->idle_count == pool->idle_cap) {
+        size_t cap = pool->idle_cap == 0 ? 8 : pool->idle_cap * 2;
+        compressor_t **idle = realloc(pool->idle, cap * sizeof(compressor_t *));
+        if (idle == NULL) {
+            compressor_destroy(comp);
+            return;
+        }
+        pool->idle = idle;
+        pool->idle_cap = cap;
+    }
+    pool->idle[pool->idle_count++] = comp;
+}
+
+/**
+ * @brief Runs the encoder of the current stream once on the pending input.
+ * @param comp Compressor with input in next_in / avail_in.
+ * @param produced Set to the amount of bytes written to comp->out.
+ * @return 0 on success, -1 on errors.
+ */
+static int compress_step(compressor_t *comp, size_t *produced) {
+    switch (comp->encoding) {
+        case enc_gzip: {
+            z_stream *zs = &comp->zs;
+            zs->next_in = comp->next_in;
+            zs->avail_in = comp->avail_in;
+            zs->next_out = comp->out;
+            zs->avail_out = COMPRESS_CHUNK;
+            int ret = deflate(zs, comp->eof ? Z_FINISH : Z_NO_FLUSH);
+            assert(ret != Z_STREAM_ERROR); /** Shouldn't happen */
+            comp->next_in = zs->next_in;
+            comp->avail_in = zs->avail_in;
+            *produced = COMPRESS_CHUNK - zs->avail_out;
+            comp->finished = ret == Z_STREAM_END;
+            return 0;
+        }
+#ifdef HAVE_ZSTD
+        case enc_zstd: {
+            ZSTD_inBuffer input = {comp->next_in, comp->avail_in, 0};
+            ZSTD_outBuffer output = {comp->out, COMPRESS_CHUNK, 0};
+            size_t remaining = ZSTD_compressStream2(comp->zstd, &output, &input,
+                                                    comp->eof ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) return -1;
+            comp->next_in += input.pos;
+            comp->avail_in -= input.pos;
+            *produced = output.pos;
+            /** With ZSTD_e_end the frame is complete once the return value is 0 */
+            comp->finished = comp->eof && remaining == 0;
+            return 0;
+        }
+#endif
+#ifdef HAVE_BROTLI
+        case enc_br: {
+            size_t avail_out = COMPRESS_CHUNK;
+            uint8_t *next_out = comp->out;
+            const uint8_t *next_in = comp->next_in;
+            if (!BrotliEncoderCompressStream(comp->brotli, comp->eof ? BROTLI_OPERATION_FINISH
+                                                                      : BROTLI_OPERATION_PROCESS,
+                                             &comp->avail_in, &next_in, &avail_out, &next_out, NULL))
+                return -1;
+            comp->next_in = (unsigned char *) next_in;
+            *produced = COMPRESS_CHUNK - avail_out;
+            comp->finished = BrotliEncoderIsFinished(comp->brotli);
+            return 0;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+ssize_t compressor_next(compressor_t *comp, int fd, unsigned char **out) {
+    compressor_pool_t *pool = comp->pool;
+    double start = thread_cpu_seconds();
+    ssize_t result = 0;
+    *out = comp->out;
+
+    while (!comp->finished) {
+        /** Refill the input once the encoder consumed everything */
+        if (comp->avail_in == 0 && !comp->eof) {
+            ssize_t n = pread(fd, comp->in, COMPRESS_CHUNK, comp->offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                result = -1;
+                break;
+            }
+            comp->next_in = comp->in;
+            comp->avail_in = n;
+            comp->offset += n;
+            comp->eof = n == 0;
+            pool->bytes_in += n;
+        }
+        size_t produced;
+        if (compress_step(comp, &produced) != 0) {
+            result = -1;
+            break;
+        }
+        if (produced > 0) {
+            pool->bytes_out += produced;
+            result = produced;
+            break;
+        }
+    }
+
+    pool->cpu_seconds += thread_cpu_seconds() - start;
+    return result;
+}
+
+int decompressor_init(decompressor_t *dec) {
+    memset(dec, 0, sizeof(decompressor_t));
+    dec->out = malloc(COMPRESS_CHUNK);
+    return dec->out == NULL ? -1 : 0;
+}
+
+int decompressor_start(decompressor_t *dec, encoding_e enc) {
+    if (!encoding_available(enc) || enc == enc_identity) return -1;
+    dec->encoding = enc;
+    dec->finished = false;
+    switch (enc) {
+        case enc_gzip:
+            if (dec->initialized) return inflateReset(&dec->zs) == Z_OK ? 0 : -1;
+            dec->zs.zalloc = Z_NULL;
+            dec->zs.zfree = Z_NULL;
+            dec->zs.opaque = Z_NULL;
+            dec->zs.avail_in = 0;
+            dec->zs.next_in = Z_NULL;
+            /** MAX_WBITS | 16 for Gzip */
+            if (inflateInit2(&dec->zs, MAX_WBITS | 16) != Z_OK) return -1;
+            dec->initialized = true;
+            return 0;
+#ifdef HAVE_ZSTD
+        case enc_zstd:
+            if (dec->zstd != NULL) return ZSTD_isError(ZSTD_DCtx_reset(dec->zstd, ZSTD_reset_session_only)) ? -1 : 0;
+            dec->zstd = ZSTD_createDCtx();
+            return dec->zstd == NULL ? -1 : 0;
+#endif
+#ifdef HAVE_BROTLI
+        case enc_br:
+            /** Brotli has no reset function, so its decoder is created per body */
+            if (dec->brotli != NULL) BrotliDecoderDestroyInstance(dec->brotli);
+            dec->brotli = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+            return dec->brotli == NULL ? -1 : 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Runs the decoder of the current body once.
+ * @return Amount of decoded bytes in dec->out, -1 on corrupt data.
+ */
+static ssize_t decompress_step(decompressor_t *dec, const unsigned char **in, size_t *avail_in) {
+    switch (dec->encoding) {
+        case enc_gzip: {
+            z_stream *zs = &dec->zs;
+            zs->next_in = (Bytef *) *in;
+            zs->avail_in = *avail_in;
+            zs->next_out = dec->out;
+            zs->avail_out = COMPRESS_CHUNK;
+            int ret = inflate(zs, Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR) return -1;
+            *in = zs->next_in;
+            *avail_in = zs->avail_in;
+            dec->finished = ret == Z_STREAM_END;
+            return COMPRESS_CHUNK - zs->avail_out;
+        }
+#ifdef HAVE_ZSTD
+        case enc_zstd: {
+            ZSTD_inBuffer input = {*in, *avail_in, 0};
+            ZSTD_outBuffer output = {dec->out, COMPRESS_CHUNK, 0};
+            size_t remaining = ZSTD_decompressStream(dec->zstd, &output, &input);
+            if (ZSTD_isError(remaining)) return -1;
+            *in += input.pos;
+            *avail_in -= input.pos;
+            /** 0 once a frame has been decoded completely */
+            dec->finished = remaining == 0;
+            return output.pos;
+        }
+#endif
+#ifdef HAVE_BROTLI
+        case enc_br: {
+            size_t avail_out = COMPRESS_CHUNK;
+            uint8_t *next_out = dec->out;
+            BrotliDecoderResult result = BrotliDecoderDecompressStream(dec->brotli, avail_in, in, &avail_out,
+                                                                       &next_out, NULL);
+            if (result == BROTLI_DECODER_RESULT_ERROR) return -1;
+            dec->finished = result == BROTLI_DECODER_RESULT_SUCCESS;
+            return COMPRESS_CHUNK - avail_out;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+ssize_t decompressor_next(decompressor_t *dec, const unsigned char **in, size_t *avail_in, unsigned char **out) {
+    *out = dec->out;
+    /** A decoder may consume input without producing output, e.g. the gzip header */
+    while (!dec->finished) {
+        size_t before = *avail_in;
+        ssize_t produced = decompress_step(dec, in, avail_in);
+        if (produced != 0) return produced;
+        if (*avail_in == 0 || *avail_in == before) return 0;
+    }
+    return 0;
+}
+
+void decompressor_free(decompressor_t *dec) {
+    if (dec->initialized) inflateEnd(&dec->zs);
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(dec->zstd);
+#endif
+#ifdef HAVE_BROTLI
+    if (dec->brotli != NULL) BrotliDecoderDestroyInstance(dec->brotli);
+#endif
+    free(dec->out);
+    memset(dec, 0, sizeof(decompressor_t));
+}
+
+void compressor_report(compressor_pool_t *pool, FILE *out, const char *name) {
+    if (pool->responses == 0) return;
+    double mb_in = pool->bytes_in / (1024.0 * 1024.0);
+    double mb_out = pool->bytes_out / (1024.0 * 1024.0);
+    double ratio = pool->bytes_in > 0 ? (double) pool->bytes_out / pool->bytes_in : 0;
+    fprintf(out, "[%s] Compression: %llu responses, %.2f MB -> %.2f MB (ratio %.3f), %.2f MB/s per core\n", name,
+            pool->responses, mb_in, mb_out, ratio, pool->cpu_seconds > 0 ? mb_in / pool->cpu_seconds : 0);
+}
@@ -0,0 +1,253 @@
+/**
+ * @file compression.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Content encodings and reusable compression contexts for the server and the client.
+ * @details Compressors are pooled per worker and reset between responses (deflateReset(), ZSTD_CCtx_reset()),
+ * so the encoder state (~256KB for gzip with the default window and memory level) is not allocated and torn down for
+ * every request. Throughput statistics are collected so the server can report how many MB/s a single core compresses.
+ * Decompressors are the client side counterpart, they decode a body in pieces as it arrives and are reset per body.
+ *
+ * gzip is always available, zstd and brotli are optional and compiled in with HAVE_ZSTD and HAVE_BROTLI
+ * (make ZSTD=1 BROTLI=1).
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/** Chunk size for reading the source and writing compressed data (64KB) */
+#define COMPRESS_CHUNK (64 * 1024)
+
+/** Files smaller than this are sent uncompressed by default since the compression overhead eats the gain */
+#define COMPRESS_DEFAULT_MIN_SIZE 1024
+
+/** Content encodings known to client and server, ordered by preference on equal q-values (highest last) */
+typedef enum {
+    enc_identity = 0,
+    enc_gzip = 1,
+    enc_br = 2,
+    enc_zstd = 3
+} encoding_e;
+
+#define ENCODING_COUNT 4
+
+/** q-values of an Accept-Encoding header in thousandths, -1 if an encoding was not listed */
+typedef struct {
+    int q[ENCODING_COUNT];
+    /** q-value of "*", -1 if not listed */
+    int wildcard;
+} accept_encoding_t;
+
+/** Compression context, owned by one connection while its response is streamed */
+typedef struct compressor {
+    z_stream zs;
+    bool initialized;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+#ifdef HAVE_BROTLI
+    struct BrotliEncoderStateStruct *brotli;
+#endif
+    /** Encoding of the current stream */
+    encoding_e encoding;
+    unsigned char *in;
+    unsigned char *out;
+    /** Unconsumed input of the current stream */
+    unsigned char *next_in;
+    size_t avail_in;
+    /** Read position in the source, pread() is used so the file descriptor may be shared between responses */
+    off_t offset;
+    bool eof;
+    bool finished;
+    struct compressor_pool *pool;
+} compressor_t;
+
+/** Decompression context, reset between bodies so a connection downloading many files allocates it once */
+typedef struct {
+    z_stream zs;
+    bool initialized;
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+#ifdef HAVE_BROTLI
+    struct BrotliDecoderStateStruct *brotli;
+#endif
+    /** Encoding of the current body */
+    encoding_e encoding;
+    /** Decoded data of the last call, COMPRESS_CHUNK bytes */
+    unsigned char *out;
+    bool finished;
+} decompressor_t;
+
+/** Pool of reusable compressors of one worker, it only grows to the amount of concurrently compressed responses */
+typedef struct compressor_pool {
+    int level;
+    size_t min_size;
+    compressor_t **idle;
+    size_t idle_count;
+    size_t idle_cap;
+    /** Statistics for compressor_report() */
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long responses;
+    double cpu_seconds;
+} compressor_pool_t;
+
+/**
+ * @brief Name of an encoding as used in Content-Encoding, e.g. "gzip".
+ * @param enc Encoding.
+ * @return Static string, NULL for identity.
+ */
+const char *encoding_name(encoding_e enc);
+
+/**
+ * @brief File extension of precompressed variants, e.g. ".gz" for "index.html.gz".
+ * @param enc Encoding.
+ * @return Static string, NULL for identity.
+ */
+const char *encoding_extension(encoding_e enc);
+
+/**
+ * @brief Parses a single encoding name (case insensitive).
+ * @param name Name of the encoding, does not have to be null-terminated.
+ * @param len Length of the name.
+ * @return Encoding or -1 if the encoding is unknown.
+ */
+int encoding_from_name(const char *name, size_t len);
+
+/**
+ * @brief Checks if responses can be compressed on the fly with this encoding in this build.
+ * @param enc Encoding.
+ * @return True if the library for the encoding was compiled in.
+ */
+bool encoding_available(encoding_e enc);
+
+/**
+ * @brief Parses the value of an Accept-Encoding header including q-values.
+ * @details E.g. "gzip;q=0.8, zstd, *;q=0". Unlisted encodings take the q-value of "*" if present.
+ *
+ * @param value Header value after the colon.
+ * @param accepted Parsed q-values.
+ */
+void parse_accept_encoding(const char *value, accept_encoding_t *accepted);
+
+/**
+ * @brief Returns the q-value the client assigned to an encoding.
+ * @details identity is acceptable unless explicitly refused (RFC 7231 5.3.4).
+ *
+ * @param accepted Parsed header from parse_accept_encoding().
+ * @param enc Encoding.
+ * @return q-value in thousandths, 0 means not acceptable.
+ */
+int accept_encoding_q(const accept_encoding_t *accepted, encoding_e enc);
+
+/**
+ * @brief Sets up an empty compressor pool with the given level and size threshold.
+ * @details Has to be freed with compressor_pool_free().
+ *
+ * @param pool Pool to be initialized.
+ * @param level Compression level (0-9) or Z_DEFAULT_COMPRESSION for the default of each encoding.
+ * @param min_size Responses smaller than this amount of bytes are not compressed.
+ */
+void compressor_pool_init(compressor_pool_t *pool, int level, size_t min_size);
+
+/**
+ * @brief Frees all idle compressors of a pool.
+ * @details Compressors still acquired by connections have to be released before.
+ * @param pool Pool set up by compressor_pool_init().
+ */
+void compressor_pool_free(compressor_pool_t *pool);
+
+/**
+ * @brief Decides if a response should be compressed at all.
+ * @details Responses below the size threshold and already compressed content (images, archives, ...) are skipped.
+ *
+ * @param pool Pool which holds the threshold.
+ * @param compressible Flag of the MIME-Type, false for already compressed formats.
+ * @param size Size of the uncompressed response body.
+ * @return True if compressing is worth it.
+ */
+bool compressor_should_compress(compressor_pool_t *pool, bool compressible, size_t size);
+
+/**
+ * @brief Takes an idle compressor out of the pool (or creates one) and starts a new stream.
+ * @details Has to be given back with compressor_release().
+ *
+ * @param pool Pool of the worker.
+ * @param enc Encoding, must be available according to encoding_available().
+ * @return Compressor or NULL on errors.
+ */
+compressor_t *compressor_acquire(compressor_pool_t *pool, encoding_e enc);
+
+/**
+ * @brief Compresses the next chunk of the source file.
+ * @details Reads the source in COMPRESS_CHUNK blocks until the encoder produces output, so every call returns at
+ * most COMPRESS_CHUNK bytes, which fits an event loop that only writes while the socket is writable.
+ *
+ * @param comp Compressor from compressor_acquire().
+ * @param fd File descriptor of the source, read from the start with pread() so its file position is not changed.
+ * @param out Set to the compressed bytes, valid until the next call.
+ * @return Amount of compressed bytes, 0 once the stream is complete and -1 on errors.
+ */
+ssize_t compressor_next(compressor_t *comp, int fd, unsigned char **out);
+
+/**
+ * @brief Resets a compressor and puts it back into its pool.
+ * @param comp Compressor from compressor_acquire(), may be NULL.
+ */
+void compressor_release(compressor_t *comp);
+
+/**
+ * @brief Allocates the buffers of a decompressor, the decoder states are created on first use.
+ * @details Has to be freed with decompressor_free().
+ *
+ * @param dec Decompressor to be initialized.
+ * @return 0 on success, -1 if out of memory.
+ */
+int decompressor_init(decompressor_t *dec);
+
+/**
+ * @brief Starts decoding a new body.
+ * @param dec Decompressor from decompressor_init().
+ * @param enc Encoding of the body, must be available according to encoding_available() and not identity.
+ * @return 0 on success, -1 on errors.
+ */
+int decompressor_start(decompressor_t *dec, encoding_e enc);
+
+/**
+ * @brief Decodes the next piece of a body.
+ * @details Consumes input until COMPRESS_CHUNK bytes are decoded or the input is used up. The caller repeats the call
+ * until it returns 0, then all of the input has been consumed or the body is finished (see dec->finished).
+ *
+ * @param dec Decompressor with a started body.
+ * @param in Encoded data, advanced by the consumed bytes.
+ * @param avail_in Amount of encoded data, decreased by the consumed bytes.
+ * @param out Set to the decoded bytes, valid until the next call.
+ * @return Amount of decoded bytes, 0 if the input is used up or the body is finished and -1 on corrupt data.
+ */
+ssize_t decompressor_next(decompressor_t *dec, const unsigned char **in, size_t *avail_in, unsigned char **out);
+
+/**
+ * @brief Frees all decoder states and buffers of a decompressor.
+ * @param dec Decompressor from decompressor_init().
+ */
+void decompressor_free(decompressor_t *dec);
+
+/**
+ * @brief Prints the collected throughput statistics.
+ * @param pool Pool to be reported.
+ * @param out Stream to be written to, e.g. stderr.
+ * @param name Program name used as prefix.
+ */
+void compressor_report(compressor_pool_t *pool, FILE *out, const char *name);
+
+#endif
@@ -0,0 +1,324 @@
+/**
+ * @file dir_listing.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "dir_listing.h"
+
+/** Changes of a directory which change its listing */
+#define LISTING_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB \
+                            | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/** One entry of a directory */
+typedef struct {
+    char *name;
+    bool dir;
+    off_t size;
+    time_t mtime;
+} dir_item_t;
+
+/** Page being rendered, grows as needed */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} html_t;
+
+static void append(html_t *html, const char *str, size_t len) {
+    if (html->failed) return;
+    if (html->len + len + 1 > html->cap) {
+        size_t cap = html->cap * 2 + len + 1;
+        char *data = realloc(html->data, cap);
+        if (data == NULL) {
+            html->failed = true;
+            return;
+        }
+        html->data = data;
+        html->cap = cap;
+    }
+    memcpy(html->data + html->len, str, len);
+    html->len += len;
+    html->data[html->len] = '\0';
+}
+
+static void append_str(html_t *html, const char *str) {
+    append(html, str, strlen(str));
+}
+
+static void appendf(html_t *html, const char *format, ...) {
+    char buff[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buff, sizeof(buff), format, args);
+    va_end(args);
+    if (n < 0) html->failed = true;
+    else append(html, buff, (size_t) n < sizeof(buff) ? (size_t) n : sizeof(buff) - 1);
+}
+
+/**
+ * @brief Appends text with the HTML special characters escaped.
+ */
+static void append_escaped(html_t *html, const char *str) {
+    for (; *str != '\0'; ++str) {
+        switch (*str) {
+            case '&':
+                append(html, "&amp;", 5);
+                break;
+            case '<':
+                append(html, "&lt;", 4);
+                break;
+            case '>':
+                append(html, "&gt;", 4);
+                break;
+            case '"':
+                append(html, "&quot;", 6);
+                break;
+            case '\'':
+                append(html, "&#39;", 5);
+                break;
+            default:
+                append(html, str, 1);
+        }
+    }
+}
+
+/**
+ * @brief Appends a file name percent-encoded for a link, only unreserved characters stay as they are.
+ */
+static void append_url_encoded(html_t *html, const char *str) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (const unsigned char *c = (const unsigned char *) str; *c != '\0'; ++c) {
+        if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9')
+            || *c == '-' || *c == '.' || *c == '_' || *c == '~') {
+            append(html, (const char *) c, 1);
+        } else {
+            char encoded[3] = {'%', hex[*c >> 4], hex[*c & 0xf]};
+            append(html, encoded, 3);
+        }
+    }
+}
+
+/** Directories first, then by name */
+static int compare_items(const void *a, const void *b) {
+    const dir_item_t *x = a;
+    const dir_item_t *y = b;
+    if (x->dir != y->dir) return x->dir ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+/**
+ * @brief Reads all entries of a directory.
+ * @return Entries allocated with malloc(), NULL on errors.
+ */
+static dir_item_t *read_items(const char *dir_path, size_t *count) {
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) return NULL;
+
+    size_t cap = 32;
+    dir_item_t *items = malloc(cap * sizeof(dir_item_t));
+    *count = 0;
+    struct dirent *ent;
+    while (items != NULL && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        struct stat st;
+        /** Entries vanishing while listing are skipped */
+        if (fstatat(dirfd(dir), ent->d_name, &st, 0) < 0) continue;
+        if (*count == cap) {
+            dir_item_t *grown = realloc(items, cap * 2 * sizeof(dir_item_t));
+            if (grown == NULL) break;
+            items = grown;
+            cap *= 2;
+        }
+        dir_item_t *item = &items[*count];
+        item->name = strdup(ent->d_name);
+        if (item->name == NULL) break;
+        item->dir = S_ISDIR(st.st_mode);
+        item->size = st.st_size;
+        item->mtime = st.st_mtime;
+        (*count)++;
+    }
+    closedir(dir);
+    return items;
+}
+
+/**
+ * @brief Renders the listing of a directory.
+ * @return Page with one reference or NULL on errors.
+ */
+static listing_t *render(const char *dir_path, const char *title) {
+    size_t count;
+    dir_item_t *items = read_items(dir_path, &count);
+    if (items == NULL) return NULL;
+    qsort(items, count, sizeof(dir_item_t), compare_items);
+
+    html_t html = {malloc(4096), 0, 4096, false};
+    if (html.data == NULL) html.failed = true;
+    append_str(&html, "<!DOCTYPE html>\n<html>\n<head><meta charset=\"utf-8\"><title>Index of ");
+    append_escaped(&html, title);
+    append_str(&html, "</title></head>\n<body>\n<h1>Index of ");
+    append_escaped(&html, title);
+    append_str(&html, "</h1>\n<table>\n<tr><th>Name</th><th>Size</th><th>Last modified</th></tr>\n");
+    if (strcmp(title, "/") != 0) {
+        append_str(&html, "<tr><td><a href=\"../\">../</a></td><td>-</td><td></td></tr>\n");
+    }
+    for (size_t i = 0; i < count; ++i) {
+        char mtime[32];
+        struct tm tm;
+        gmtime_r(&items[i].mtime, &tm);
+        strftime(mtime, sizeof(mtime), "%Y-%m-%d %H:%M", &tm);
+
+        append_str(&html, "<tr><td><a href=\"");
+        append_url_encoded(&html, items[i].name);
+        if (items[i].dir) append(&html, "/", 1);
+        append(&html, "\">", 2);
+        append_escaped(&html, items[i].name);
+        if (items[i].dir) append(&html, "/", 1);
+        if (items[i].dir) appendf(&html, "</a></td><td>-</td><td>%s</td></tr>\n", mtime);
+        else appendf(&html, "</a></td><td>%lld</td><td>%s</td></tr>\n", (long long) items[i].size, mtime);
+        free(items[i].name);
+    }
+    free(items);
+    append_str(&html, "</table>\n</body>\n</html>\n");
+
+    listing_t *listing = malloc(sizeof(listing_t));
+    if (html.failed || listing == NULL) {
+        free(html.data);
+        free(listing);
+        return NULL;
+    }
+    listing->html = html.data;
+    listing->len = html.len;
+    listing->refs = 1;
+    return listing;
+}
+
+static size_t hash_path(const char *path) {
+    size_t hash = 5381;
+    for (; *path != '\0'; ++path) hash = hash * 33 + (unsigned char) *path;
+    return hash & (LISTING_BUCKETS - 1);
+}
+
+/**
+ * @brief Removes an entry from the cache and drops its reference to the page.
+ * @details The inotify watch is removed unless another entry (the same directory under another path) still uses it.
+ */
+static void remove_entry(listing_cache_t *cache, listing_entry_t *entry) {
+    listing_entry_t **link = &cache->buckets[hash_path(entry->path)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+
+    if (entry->older != NULL) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+    if (entry->newer != NULL) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+    cache->count--;
+
+    bool shared = false;
+    for (listing_entry_t *e = cache->oldest; e != NULL && !shared; e = e->newer) shared = e->wd == entry->wd;
+    if (entry->wd >= 0 && !shared) inotify_rm_watch(cache->inotify_fd, entry->wd);
+
+    listing_release(entry->listing);
+    free(entry->path);
+    free(entry);
+}
+
+void listing_cache_init(listing_cache_t *cache) {
+    memset(cache, 0, sizeof(listing_cache_t));
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+void listing_cache_free(listing_cache_t *cache) {
+    while (cache->oldest != NULL) remove_entry(cache, cache->oldest);
+    if (cache->inotify_fd >= 0) close(cache->inotify_fd);
+    cache->inotify_fd = -1;
+}
+
+listing_t *listing_get(listing_cache_t *cache, const char *dir_path, const char *title, bool *hit) {
+    size_t bucket = hash_path(dir_path);
+    for (listing_entry_t *e = cache->buckets[bucket]; e != NULL; e = e->next) {
+        if (strcmp(e->path, dir_path) == 0) {
+            *hit = true;
+            e->listing->refs++;
+            return e->listing;
+        }
+    }
+    *hit = false;
+
+    /** Watch before reading, so a change during rendering invalidates the page right away */
+    int wd = cache->inotify_fd >= 0 ? inotify_add_watch(cache->inotify_fd, dir_path, LISTING_WATCH_MASK) : -1;
+    listing_t *listing = render(dir_path, title);
+    if (listing == NULL && wd >= 0) {
+        bool shared = false;
+        for (listing_entry_t *e = cache->oldest; e != NULL && !shared; e = e->newer) shared = e->wd == wd;
+        if (!shared) inotify_rm_watch(cache->inotify_fd, wd);
+    }
+    if (listing == NULL || wd < 0) return listing;
+
+    listing_entry_t *entry = malloc(sizeof(listing_entry_t));
+    if (entry == NULL || (entry->path = strdup(dir_path)) == NULL) {
+        free(entry);
+        return listing;
+    }
+    if (cache->count >= LISTING_CACHE_MAX) remove_entry(cache, cache->oldest);
+    entry->wd = wd;
+    entry->listing = listing;
+    listing->refs++;
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest != NULL) cache->newest->newer = entry;
+    else cache->oldest = entry;
+    cache->newest = entry;
+    cache->count++;
+    return listing;
+}
+
+void listing_release(listing_t *listing) {
+    if (listing == NULL || --listing->refs > 0) return;
+    free(listing->html);
+    free(listing);
+}
+
+void listing_cache_process(listing_cache_t *cache) {
+    char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(cache->inotify_fd, buff, sizeof(buff));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+
+        for (char *ptr = buff; ptr < buff + n;) {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                /** Events were lost, nothing cached can be trusted anymore */
+                while (cache->oldest != NULL) remove_entry(cache, cache->oldest);
+                continue;
+            }
+            /** The same directory may be cached under several paths */
+            listing_entry_t *e = cache->oldest;
+            while (e != NULL) {
+                listing_entry_t *newer = e->newer;
+                if (e->wd == event->wd) {
+                    /** The kernel removes the watch itself after IN_IGNORED */
+                    if (event->mask & IN_IGNORED) e->wd = -1;
+                    remove_entry(cache, e);
+                }
+                e = newer;
+            }
+        }
+    }
+}
@@ -0,0 +1,95 @@
+/**
+ * @file dir_listing.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Rendered HTML directory listings with a cache invalidated by inotify.
+ * @details A listing is rendered once per directory: entries are read, sorted (directories first, then by name) and
+ * written as an HTML table with size and modification time. The rendered page is kept in the cache and every
+ * following request sends it straight from that buffer. Each cached directory is watched with inotify, any change of
+ * its entries drops the page, so the next request renders it again.
+ *
+ * Pages are reference counted: a connection still sending an invalidated or evicted page keeps it alive until it is
+ * done. The cache belongs to one event loop and is not thread-safe.
+ */
+
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/** Amount of cached directories, the oldest is evicted beyond that */
+#define LISTING_CACHE_MAX 256
+/** Hash buckets of the cache, a power of two */
+#define LISTING_BUCKETS 256
+
+/** A rendered page */
+typedef struct {
+    char *html;
+    size_t len;
+    int refs;
+} listing_t;
+
+/** A cached directory */
+typedef struct listing_entry {
+    char *path;
+    /** inotify watch of the directory, -1 if it couldn't be watched */
+    int wd;
+    listing_t *listing;
+    /** Next entry in the same hash bucket */
+    struct listing_entry *next;
+    /** Insertion order for eviction */
+    struct listing_entry *older;
+    struct listing_entry *newer;
+} listing_entry_t;
+
+/** Cache of one event loop */
+typedef struct {
+    /** Non-blocking inotify instance, -1 if inotify is unavailable and nothing is cached */
+    int inotify_fd;
+    listing_entry_t *buckets[LISTING_BUCKETS];
+    listing_entry_t *oldest;
+    listing_entry_t *newest;
+    size_t count;
+} listing_cache_t;
+
+/**
+ * @brief Sets up an empty cache with its inotify instance.
+ * @details Without inotify the cache still works but renders every listing again.
+ * @param cache Cache to be initialized.
+ */
+void listing_cache_init(listing_cache_t *cache);
+
+/**
+ * @brief Frees all cached pages and closes the inotify instance.
+ * @param cache Cache set up by listing_cache_init().
+ */
+void listing_cache_free(listing_cache_t *cache);
+
+/**
+ * @brief Returns the rendered listing of a directory, from the cache if possible.
+ * @details Has to be given back with listing_release().
+ *
+ * @param cache Cache of the event loop.
+ * @param dir_path Path of the directory in the file system.
+ * @param title Path shown as heading, e.g. the request target.
+ * @param hit Set to true if the page came from the cache.
+ * @return Page or NULL if the directory couldn't be read.
+ */
+listing_t *listing_get(listing_cache_t *cache, const char *dir_path, const char *title, bool *hit);
+
+/**
+ * @brief Gives back a page from listing_get().
+ * @param listing Page, may be NULL.
+ */
+void listing_release(listing_t *listing);
+
+/**
+ * @brief Reads pending inotify events and drops the pages of changed directories.
+ * @details Call whenever the inotify instance is readable.
+ * @param cache Cache of the event loop.
+ */
+void listing_cache_process(listing_cache_t *cache);
+
+#endif
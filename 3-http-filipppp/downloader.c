@@ -0,0 +1,529 @@
+/**
+ * @file downloader.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+/** fallocate is Linux specific */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "downloader.h"
+#include "http_response.h"
+#include "compression.h"
+#include "http_io.h"
+
+/** Events fetched per epoll_wait() */
+#define DOWNLOAD_EVENTS 64
+
+typedef enum {
+    /** Slot without a host */
+    dl_idle = 0,
+    dl_connecting = 1,
+    dl_writing = 2,
+    dl_headers = 3,
+    dl_body = 4
+} dl_state_e;
+
+/** A host with its queue of downloads */
+typedef struct {
+    const char *name;
+    /** NULL if the host couldn't be resolved */
+    struct addrinfo *ai;
+    /** Indices of the downloads, the ones before next are assigned to connections already */
+    size_t *queue;
+    size_t queue_len;
+    size_t queue_cap;
+    size_t next;
+} dl_host_t;
+
+/** One slot of the connection pool */
+typedef struct {
+    int fd;
+    /** Events registered with epoll, 0 if the fd isn't registered */
+    unsigned int events;
+    dl_state_e state;
+    dl_host_t *host;
+    download_t *download;
+    /** True once a response has been received over the fd, a close before the next response is then no error */
+    bool reused;
+    bool retried;
+    char *request;
+    size_t request_len;
+    size_t request_cap;
+    size_t written;
+    http_response_t res;
+    /** File being written, -1 while the body is discarded */
+    int out_fd;
+    /** Reason the current download failed, its body is still received to keep the connection */
+    const char *error;
+    char error_buff[64];
+    bool decoding;
+    bool dec_initialized;
+    decompressor_t dec;
+    io_buffer_t in;
+} dl_conn_t;
+
+typedef struct {
+    const downloader_options_t *options;
+    int epoll_fd;
+    dl_host_t *hosts;
+    size_t host_count;
+    /** Host which gets the next free slot */
+    size_t cursor;
+    dl_conn_t *conns;
+    /** Slots with a host */
+    size_t active;
+    long failed;
+} downloader_t;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * @brief Changes the events a connection waits for, without a syscall if they stay the same.
+ */
+static int conn_watch(downloader_t *dl, dl_conn_t *c, unsigned int events) {
+    if (c->events == events) return 0;
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    if (epoll_ctl(dl->epoll_fd, c->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ev) < 0) return -1;
+    c->events = events;
+    return 0;
+}
+
+static void conn_close(dl_conn_t *c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->events = 0;
+    c->reused = false;
+}
+
+/**
+ * @brief Gives the slot of a connection free for another host.
+ */
+static void conn_release(downloader_t *dl, dl_conn_t *c) {
+    conn_close(c);
+    c->host = NULL;
+    c->state = dl_idle;
+    dl->active--;
+}
+
+static void report_failure(downloader_t *dl, download_t *d, const char *error) {
+    const downloader_options_t *options = dl->options;
+    fprintf(options->errors, "[%s] Error: http://%s:%s%s: %s \n", options->name, d->host, options->port, d->path, error);
+    d->done = true;
+    d->failed = true;
+    dl->failed++;
+}
+
+/**
+ * @brief Ends the current download of a connection, a failed download is reported and its file removed.
+ */
+static void finish_download(downloader_t *dl, dl_conn_t *c, const char *error) {
+    download_t *d = c->download;
+    if (c->out_fd >= 0) {
+        close(c->out_fd);
+        if (error != NULL) unlink(d->file);
+    }
+    c->out_fd = -1;
+    if (error != NULL) report_failure(dl, d, error);
+    d->done = true;
+    c->download = NULL;
+    c->error = NULL;
+}
+
+static int conn_connect(downloader_t *dl, dl_conn_t *c) {
+    struct addrinfo *ai = c->host->ai;
+    c->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) || conn_watch(dl, c, EPOLLOUT) < 0) {
+        conn_close(c);
+        return -1;
+    }
+    c->state = dl_connecting;
+    return 0;
+}
+
+static void conn_write(downloader_t *dl, dl_conn_t *c);
+
+/**
+ * @brief Builds the request of a download into the request buffer of the connection.
+ */
+static int build_request(downloader_t *dl, dl_conn_t *c, download_t *d) {
+    const char *encoding = dl->options->accept_encoding;
+    /** Without Accept-Encoding the last argument is simply not used by the format */
+    const char *fmt = encoding != NULL ? "GET %s HTTP/1.1\r\nHost: %s\r\nAccept-Encoding: %s\r\n\r\n"
+                                       : "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n";
+    int len = snprintf(NULL, 0, fmt, d->path, d->host, encoding);
+    if (len < 0) return -1;
+    if ((size_t) len + 1 > c->request_cap) {
+        char *request = realloc(c->request, len + 1);
+        if (request == NULL) return -1;
+        c->request = request;
+        c->request_cap = len + 1;
+    }
+    snprintf(c->request, len + 1, fmt, d->path, d->host, encoding);
+    c->request_len = len;
+    return 0;
+}
+
+/**
+ * @brief Starts the next queued download of the host of a connection, or frees the slot if there is none.
+ * @details The open connection is reused if the server kept it alive. Downloads whose connection can't be opened
+ * fail and the next one is tried.
+ */
+static void conn_next(downloader_t *dl, dl_conn_t *c) {
+    dl_host_t *host = c->host;
+    while (host->next < host->queue_len) {
+        c->download = &dl->options->downloads[host->queue[host->next++]];
+        c->written = 0;
+        c->retried = false;
+        c->out_fd = -1;
+        c->error = NULL;
+        io_buffer_consume(&c->in, c->in.len);
+        if (build_request(dl, c, c->download) < 0) {
+            finish_download(dl, c, "out of memory");
+            continue;
+        }
+        if (c->fd >= 0) {
+            c->state = dl_writing;
+            conn_write(dl, c);
+            return;
+        }
+        if (conn_connect(dl, c) == 0) return;
+        finish_download(dl, c, "couldn't create connection");
+    }
+    conn_release(dl, c);
+}
+
+static void conn_fail(downloader_t *dl, dl_conn_t *c, const char *error) {
+    finish_download(dl, c, c->error != NULL ? c->error : error);
+    conn_close(c);
+    conn_next(dl, c);
+}
+
+/**
+ * @brief Sends the request again over a new connection.
+ * @details Servers close idle kept alive connections at any time, a request which found its connection closed before
+ * any byte of the response arrived is therefore retried once.
+ */
+static void conn_retry(downloader_t *dl, dl_conn_t *c) {
+    conn_close(c);
+    c->retried = true;
+    c->written = 0;
+    if (conn_connect(dl, c) < 0) conn_fail(dl, c, "couldn't create connection");
+}
+
+/**
+ * @brief Opens the file and the decoder of a download once its headers arrived.
+ */
+static void start_body(dl_conn_t *c) {
+    download_t *d = c->download;
+    http_response_t *res = &c->res;
+    c->decoding = false;
+    if (res->status != 200) {
+        snprintf(c->error_buff, sizeof(c->error_buff), "status %d", res->status);
+        c->error = c->error_buff;
+        return;
+    }
+    if (res->encoding < 0 || !encoding_available(res->encoding)) {
+        c->error = "unsupported Content-Encoding";
+        return;
+    }
+    if (res->encoding != enc_identity) {
+        if (!c->dec_initialized && decompressor_init(&c->dec) < 0) {
+            c->error = "out of memory";
+            return;
+        }
+        c->dec_initialized = true;
+        if (decompressor_start(&c->dec, res->encoding) < 0) {
+            c->error = "couldn't set up the decoder";
+            return;
+        }
+        c->decoding = true;
+    }
+    c->out_fd = open(d->file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (c->out_fd < 0) {
+        c->error = "couldn't open file";
+        return;
+    }
+    /** The size of a plain body is known, so its blocks are reserved at once instead of with every write */
+    if (!c->decoding && res->framing == framing_length && res->content_length > 0) {
+        fallocate(c->out_fd, FALLOC_FL_KEEP_SIZE, 0, res->content_length);
+    }
+}
+
+/**
+ * @brief Decodes and writes a piece of the body, unless the download already failed.
+ */
+static void body_data(dl_conn_t *c, const char *data, size_t len) {
+    if (c->error != NULL || len == 0) return;
+    if (!c->decoding) {
+        if (io_write_all(c->out_fd, data, len) < 0) c->error = "couldn't write file";
+        return;
+    }
+    const unsigned char *in = (const unsigned char *) data;
+    size_t avail = len;
+    unsigned char *out;
+    ssize_t n;
+    while ((n = decompressor_next(&c->dec, &in, &avail, &out)) > 0) {
+        if (io_write_all(c->out_fd, out, n) < 0) {
+            c->error = "couldn't write file";
+            return;
+        }
+    }
+    if (n < 0) c->error = "couldn't decode body";
+}
+
+static void response_done(downloader_t *dl, dl_conn_t *c) {
+    if (c->error == NULL && c->decoding && !c->dec.finished) c->error = "truncated body";
+    finish_download(dl, c, c->error);
+    /** Nothing is pipelined, so bytes after the response are garbage */
+    io_buffer_consume(&c->in, c->in.len);
+    c->reused = true;
+    if (!c->res.keep_alive) conn_close(c);
+    conn_next(dl, c);
+}
+
+/**
+ * @brief Parses what has been received so far and writes the body data.
+ * @return 1 if the response is complete, 0 if more data is needed and -1 on protocol errors.
+ */
+static int parse_response(dl_conn_t *c) {
+    size_t off = 0;
+    if (c->state == dl_headers) {
+        ssize_t head = http_response_head(&c->res, c->in.data, c->in.len, false);
+        if (head <= 0) return head < 0 || c->in.len == c->in.cap ? -1 : 0;
+        off = head;
+        c->state = dl_body;
+        start_body(c);
+    }
+    for (;;) {
+        size_t used, data_len;
+        const char *data;
+        int ret = http_response_body(&c->res, c->in.data + off, c->in.len - off, &used, &data, &data_len);
+        if (ret < 0) return -1;
+        body_data(c, data, data_len);
+        if (ret > 0) return 1;
+        off += used;
+        if (used == 0) break;
+    }
+    /** Keep an incomplete chunk header for the next read */
+    io_buffer_consume(&c->in, off);
+    return c->in.len == c->in.cap ? -1 : 0;
+}
+
+static void conn_write(downloader_t *dl, dl_conn_t *c) {
+    int ret = io_send(c->fd, c->request, c->request_len, &c->written);
+    if (ret == 0) {
+        if (conn_watch(dl, c, EPOLLOUT) < 0) conn_fail(dl, c, "couldn't wait for the connection");
+        return;
+    }
+    if (ret < 0) {
+        if (c->reused && !c->retried && c->written == 0) conn_retry(dl, c);
+        else conn_fail(dl, c, "couldn't send request");
+        return;
+    }
+    c->state = dl_headers;
+    io_buffer_consume(&c->in, c->in.len);
+    if (conn_watch(dl, c, EPOLLIN) < 0) conn_fail(dl, c, "couldn't wait for the connection");
+}
+
+static void conn_read(downloader_t *dl, dl_conn_t *c) {
+    for (;;) {
+        ssize_t n = io_buffer_read(&c->in, c->fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            bool nothing_received = c->state == dl_headers && c->in.len == 0;
+            if (n == 0 && c->state == dl_body && c->res.framing == framing_close) response_done(dl, c);
+            else if (nothing_received && c->reused && !c->retried) conn_retry(dl, c);
+            else conn_fail(dl, c, "connection closed before the response was complete");
+            return;
+        }
+        int ret = parse_response(c);
+        if (ret < 0) {
+            conn_fail(dl, c, "protocol error");
+            return;
+        }
+        if (ret > 0) {
+            response_done(dl, c);
+            return;
+        }
+    }
+}
+
+static void conn_event(downloader_t *dl, dl_conn_t *c) {
+    switch (c->state) {
+        case dl_connecting: {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+                conn_fail(dl, c, "couldn't create connection");
+                return;
+            }
+            c->state = dl_writing;
+            conn_write(dl, c);
+            break;
+        }
+        case dl_writing:
+            conn_write(dl, c);
+            break;
+        case dl_headers:
+        case dl_body:
+            conn_read(dl, c);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Hands free slots to hosts with queued downloads, round robin.
+ */
+static void fill_slots(downloader_t *dl) {
+    for (size_t i = 0; i < dl->options->connections; ++i) {
+        dl_conn_t *c = &dl->conns[i];
+        while (c->state == dl_idle) {
+            dl_host_t *host = NULL;
+            for (size_t n = 0; n < dl->host_count && host == NULL; ++n) {
+                dl_host_t *candidate = &dl->hosts[(dl->cursor + n) % dl->host_count];
+                if (candidate->next < candidate->queue_len) host = candidate;
+            }
+            if (host == NULL) return;
+            dl->cursor = (host - dl->hosts + 1) % dl->host_count;
+            c->host = host;
+            c->state = dl_connecting;
+            dl->active++;
+            conn_next(dl, c);
+        }
+    }
+}
+
+/**
+ * @brief Groups the downloads by host and resolves every host once.
+ */
+static int build_hosts(downloader_t *dl) {
+    const downloader_options_t *options = dl->options;
+    dl->hosts = calloc(options->count, sizeof(dl_host_t));
+    if (dl->hosts == NULL) return -1;
+    for (size_t i = 0; i < options->count; ++i) {
+        download_t *d = &options->downloads[i];
+        dl_host_t *host = NULL;
+        for (size_t h = 0; h < dl->host_count && host == NULL; ++h) {
+            if (strcmp(dl->hosts[h].name, d->host) == 0) host = &dl->hosts[h];
+        }
+        if (host == NULL) {
+            host = &dl->hosts[dl->host_count++];
+            host->name = d->host;
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            int res = getaddrinfo(d->host, options->port, &hints, &host->ai);
+            if (res != 0) {
+                fprintf(options->errors, "[%s] Error: getaddrinfo: %s \n", options->name, gai_strerror(res));
+                host->ai = NULL;
+            }
+        }
+        if (host->ai == NULL) {
+            report_failure(dl, d, "couldn't resolve host");
+            continue;
+        }
+        if (host->queue_len == host->queue_cap) {
+            size_t cap = host->queue_cap == 0 ? 16 : host->queue_cap * 2;
+            size_t *queue = realloc(host->queue, cap * sizeof(size_t));
+            if (queue == NULL) return -1;
+            host->queue = queue;
+            host->queue_cap = cap;
+        }
+        host->queue[host->queue_len++] = i;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fails every download which hasn't finished.
+ */
+static void fail_remaining(downloader_t *dl, const char *error) {
+    for (size_t i = 0; i < dl->options->connections; ++i) {
+        dl_conn_t *c = &dl->conns[i];
+        if (c->download != NULL) finish_download(dl, c, error);
+        if (c->state != dl_idle) conn_release(dl, c);
+    }
+    for (size_t h = 0; h < dl->host_count; ++h) {
+        dl_host_t *host = &dl->hosts[h];
+        for (; host->next < host->queue_len; ++host->next) {
+            report_failure(dl, &dl->options->downloads[host->queue[host->next]], error);
+        }
+    }
+}
+
+static void free_downloader(downloader_t *dl) {
+    for (size_t i = 0; dl->conns != NULL && i < dl->options->connections; ++i) {
+        dl_conn_t *c = &dl->conns[i];
+        conn_close(c);
+        if (c->dec_initialized) decompressor_free(&c->dec);
+        free(c->request);
+        io_buffer_free(&c->in);
+    }
+    free(dl->conns);
+    for (size_t h = 0; dl->hosts != NULL && h < dl->host_count; ++h) {
+        if (dl->hosts[h].ai != NULL) freeaddrinfo(dl->hosts[h].ai);
+        free(dl->hosts[h].queue);
+    }
+    free(dl->hosts);
+    if (dl->epoll_fd >= 0) close(dl->epoll_fd);
+}
+
+long downloader_run(const downloader_options_t *options) {
+    downloader_t dl = {options, epoll_create1(EPOLL_CLOEXEC)};
+    dl.conns = calloc(options->connections, sizeof(dl_conn_t));
+    bool ok = dl.epoll_fd >= 0 && dl.conns != NULL;
+    for (size_t i = 0; dl.conns != NULL && i < options->connections; ++i) {
+        dl.conns[i].fd = -1;
+        dl.conns[i].out_fd = -1;
+    }
+    for (size_t i = 0; ok && i < options->connections; ++i) {
+        ok = io_buffer_init(&dl.conns[i].in, DOWNLOAD_BUFF_SIZE) == 0;
+    }
+    if (!ok || build_hosts(&dl) < 0) {
+        free_downloader(&dl);
+        return -1;
+    }
+
+    fill_slots(&dl);
+    struct epoll_event events[DOWNLOAD_EVENTS];
+    long last_progress = now_ms();
+    while (dl.active > 0) {
+        long timeout = DOWNLOAD_STALL_MS - (now_ms() - last_progress);
+        int n = timeout > 0 ? epoll_wait(dl.epoll_fd, events, DOWNLOAD_EVENTS, (int) timeout) : 0;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fail_remaining(&dl, n == 0 ? "timed out" : "epoll_wait failed");
+            break;
+        }
+        last_progress = now_ms();
+        for (int i = 0; i < n; ++i) conn_event(&dl, events[i].data.ptr);
+        fill_slots(&dl);
+    }
+
+    long failed = dl.failed;
+    free_downloader(&dl);
+    return failed;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file downloader.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Concurrent download of many files over a bounded pool of keep-alive connections.
+ * @details A single epoll loop runs up to a fixed amount of connections. Downloads are queued per host and a
+ * connection keeps taking the next download of its host as long as there is one, so a host is only connected to once
+ * per connection instead of once per file. A connection whose host has nothing left is closed and its slot goes to
+ * the next host with queued downloads, round robin. Bodies are decoded according to their Content-Encoding while they
+ * arrive and written straight into their files.
+ */
+
+#ifndef DOWNLOADER_H
+#define DOWNLOADER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/** Concurrent connections if none are given */
+#define DOWNLOAD_DEFAULT_CONNECTIONS 8
+/** Size of the receive buffer of a connection, the response headers have to fit in */
+#define DOWNLOAD_BUFF_SIZE (64 * 1024)
+/** Time without any progress on any connection after which the remaining downloads fail */
+#define DOWNLOAD_STALL_MS 30000
+
+/** One file to be downloaded */
+typedef struct {
+    /** Host the file is downloaded from, downloads of the same host share connections */
+    const char *host;
+    /** Request target, starting with '/' */
+    const char *path;
+    /** File the body is written to, it is removed again if the download fails */
+    const char *file;
+    /** Set once the download finished */
+    bool done;
+    bool failed;
+} download_t;
+
+/** What to download */
+typedef struct {
+    /** Port of all hosts */
+    const char *port;
+    download_t *downloads;
+    size_t count;
+    /** Concurrent connections, over all hosts */
+    size_t connections;
+    /** Value of the Accept-Encoding header, NULL to not send one */
+    const char *accept_encoding;
+    /** Stream failed downloads are reported to, prefixed with name */
+    FILE *errors;
+    const char *name;
+} downloader_options_t;
+
+/**
+ * @brief Downloads all files.
+ * @param options What to download.
+ * @return Amount of failed downloads, -1 if the event loop couldn't be set up.
+ */
+long downloader_run(const downloader_options_t *options);
+
+#endif
@@ -0,0 +1,806 @@
+/**
+ * @file h2.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "h2.h"
+#include "http_io.h"
+
+/** Frame types */
+typedef enum {
+    frame_data = 0x0,
+    frame_headers = 0x1,
+    frame_priority = 0x2,
+    frame_rst_stream = 0x3,
+    frame_settings = 0x4,
+    frame_push_promise = 0x5,
+    frame_ping = 0x6,
+    frame_goaway = 0x7,
+    frame_window_update = 0x8,
+    frame_continuation = 0x9
+} frame_type_e;
+
+/** Frame flags, ACK shares its bit with END_STREAM */
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+/** Settings */
+typedef enum {
+    setting_header_table_size = 0x1,
+    setting_enable_push = 0x2,
+    setting_max_concurrent_streams = 0x3,
+    setting_initial_window_size = 0x4,
+    setting_max_frame_size = 0x5,
+    setting_max_header_list_size = 0x6
+} setting_e;
+
+/** Error codes of RST_STREAM and GOAWAY */
+typedef enum {
+    error_none = 0x0,
+    error_protocol = 0x1,
+    error_internal = 0x2,
+    error_flow_control = 0x3,
+    error_stream_closed = 0x5,
+    error_frame_size = 0x6,
+    error_refused_stream = 0x7,
+    error_compression = 0x9,
+    error_enhance_your_calm = 0xb
+} error_e;
+
+/** Initial flow control window and the largest one allowed */
+#define DEFAULT_WINDOW 65535L
+#define MAX_WINDOW 0x7fffffffL
+/** Largest frame size a client may announce */
+#define MAX_FRAME_SIZE 0xffffff
+
+/** Fields which only make sense for a single HTTP/1.1 connection, they are malformed in HTTP/2 */
+static const char *const hop_by_hop[] = {"connection", "keep-alive", "proxy-connection", "transfer-encoding",
+                                         "upgrade", NULL};
+/** Response fields whose values differ with every response, they would only evict useful entries from the table */
+static const char *const unindexed[] = {"content-length", "content-range", "location", NULL};
+
+/** Request being decoded from a header block */
+typedef struct {
+    size_t max_len;
+    char *method;
+    char *path;
+    char *authority;
+    bool scheme;
+    /** Regular fields in HTTP/1.1 form */
+    char *fields;
+    size_t len;
+    bool regular;
+    bool malformed;
+    bool too_large;
+} request_t;
+
+static uint32_t read_u32(const unsigned char *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void write_u32(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/**
+ * @brief Checks whether a name is one of a NULL-terminated list.
+ */
+static bool name_in(const char *name, size_t len, const char *const *names) {
+    for (; *names != NULL; ++names) {
+        if (strlen(*names) == len && memcmp(*names, name, len) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Makes room for n more bytes in the output buffer, moving the unsent bytes to its start first.
+ * @return 0 on success, -1 if the buffer would exceed H2_OUT_MAX.
+ */
+static int reserve(h2_session_t *session, size_t n) {
+    if (session->out_len + n <= session->out_cap) return 0;
+    memmove(session->out, session->out + session->out_pos, session->out_len - session->out_pos);
+    session->out_len -= session->out_pos;
+    session->out_pos = 0;
+    if (session->out_len + n <= session->out_cap) return 0;
+
+    size_t cap = session->out_cap;
+    while (cap < session->out_len + n) cap *= 2;
+    if (cap > H2_OUT_MAX) return -1;
+    unsigned char *out = realloc(session->out, cap);
+    if (out == NULL) return -1;
+    session->out = out;
+    session->out_cap = cap;
+    return 0;
+}
+
+static void write_frame_header(unsigned char *p, size_t len, frame_type_e type, int flags, uint32_t stream) {
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    write_u32(p + 5, stream);
+}
+
+/**
+ * @brief Appends a frame to the output buffer.
+ * @return 0 on success, -1 if the buffer is full.
+ */
+static int queue_frame(h2_session_t *session, frame_type_e type, int flags, uint32_t stream,
+                       const unsigned char *payload, size_t len) {
+    if (reserve(session, H2_FRAME_HEADER + len) < 0) return -1;
+    write_frame_header(session->out + session->out_len, len, type, flags, stream);
+    if (len > 0) memcpy(session->out + session->out_len + H2_FRAME_HEADER, payload, len);
+    session->out_len += H2_FRAME_HEADER + len;
+    return 0;
+}
+
+/**
+ * @brief Queues the GOAWAY of a connection error, afterwards nothing but the queued frames is sent.
+ * @return Always -1.
+ */
+static int connection_error(h2_session_t *session, error_e error) {
+    if (session->failed) return -1;
+    unsigned char payload[8];
+    write_u32(payload, session->last_stream);
+    write_u32(payload + 4, error);
+    queue_frame(session, frame_goaway, 0, 0, payload, sizeof(payload));
+    session->goaway = true;
+    session->failed = true;
+    return -1;
+}
+
+static int reset_stream(h2_session_t *session, uint32_t id, error_e error) {
+    unsigned char payload[4];
+    write_u32(payload, error);
+    if (queue_frame(session, frame_rst_stream, 0, id, payload, sizeof(payload)) < 0) {
+        return connection_error(session, error_enhance_your_calm);
+    }
+    return 0;
+}
+
+static int window_update(h2_session_t *session, uint32_t id, uint32_t increment) {
+    unsigned char payload[4];
+    write_u32(payload, increment);
+    if (queue_frame(session, frame_window_update, 0, id, payload, sizeof(payload)) < 0) {
+        return connection_error(session, error_enhance_your_calm);
+    }
+    return 0;
+}
+
+static h2_stream_t *find_stream(h2_session_t *session, uint32_t id) {
+    for (h2_stream_t *stream = session->first; stream != NULL; stream = stream->next) {
+        if (stream->id == id) return stream;
+    }
+    return NULL;
+}
+
+static void unlink_stream(h2_session_t *session, h2_stream_t *stream) {
+    if (stream->prev != NULL) stream->prev->next = stream->next;
+    else session->first = stream->next;
+    if (stream->next != NULL) stream->next->prev = stream->prev;
+    else session->last = stream->prev;
+    stream->prev = stream->next = NULL;
+}
+
+static void append_stream(h2_session_t *session, h2_stream_t *stream) {
+    stream->prev = session->last;
+    if (session->last != NULL) session->last->next = stream;
+    else session->first = stream;
+    session->last = stream;
+}
+
+static h2_stream_t *open_stream(h2_session_t *session, uint32_t id, bool remote_closed) {
+    h2_stream_t *stream = calloc(1, sizeof(h2_stream_t));
+    if (stream == NULL) return NULL;
+    stream->id = id;
+    stream->remote_closed = remote_closed;
+    stream->window = session->peer_window;
+    stream->recv_window = DEFAULT_WINDOW;
+    append_stream(session, stream);
+    session->stream_count++;
+    return stream;
+}
+
+/**
+ * @brief Removes a stream and lets the server free its data.
+ */
+static void close_stream(h2_session_t *session, h2_stream_t *stream) {
+    unlink_stream(session, stream);
+    session->stream_count--;
+    session->cb->close(session->arg, stream);
+    free(stream);
+}
+
+/**
+ * @brief Closes a stream whose response is completely queued.
+ * @details A client still sending its request body is told to stop, the response doesn't depend on it.
+ */
+static void finish_stream(h2_session_t *session, h2_stream_t *stream) {
+    if (!stream->remote_closed) reset_stream(session, stream->id, error_none);
+    close_stream(session, stream);
+}
+
+/**
+ * @brief Applies the settings of a SETTINGS frame or of the HTTP2-Settings header.
+ * @return 0 on success, -1 on connection errors.
+ */
+static int apply_settings(h2_session_t *session, const unsigned char *payload, size_t len) {
+    for (size_t i = 0; i + 6 <= len; i += 6) {
+        int id = payload[i] << 8 | payload[i + 1];
+        uint32_t value = read_u32(payload + i + 2);
+        switch (id) {
+            case setting_header_table_size:
+                hpack_table_resize(&session->encoder, value);
+                break;
+            case setting_enable_push:
+                if (value > 1) return connection_error(session, error_protocol);
+                break;
+            case setting_initial_window_size: {
+                if (value > MAX_WINDOW) return connection_error(session, error_flow_control);
+                /** The difference applies to all open streams */
+                long delta = (long) value - session->peer_window;
+                for (h2_stream_t *stream = session->first; stream != NULL; stream = stream->next) {
+                    if (stream->window + delta > MAX_WINDOW) return connection_error(session, error_flow_control);
+                    stream->window += delta;
+                }
+                session->peer_window = value;
+                break;
+            }
+            case setting_max_frame_size:
+                if (value < H2_FRAME_SIZE || value > MAX_FRAME_SIZE) return connection_error(session, error_protocol);
+                break;
+            default:
+                /** Unknown settings and those a server has no use for are ignored */
+                break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decodes base64url, padding or not, the encoding of the HTTP2-Settings header.
+ * @return Amount of decoded bytes, -1 on invalid characters.
+ */
+static ssize_t base64url_decode(const char *in, unsigned char *out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (; *in != '\0' && *in != '='; ++in) {
+        int value;
+        if (*in >= 'A' && *in <= 'Z') value = *in - 'A';
+        else if (*in >= 'a' && *in <= 'z') value = *in - 'a' + 26;
+        else if (*in >= '0' && *in <= '9') value = *in - '0' + 52;
+        else if (*in == '-' || *in == '+') value = 62;
+        else if (*in == '_' || *in == '/') value = 63;
+        else return -1;
+        acc = (acc << 6) | value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = (unsigned char) (acc >> bits);
+        }
+    }
+    return (ssize_t) n;
+}
+
+int h2_session_init(h2_session_t *session, const h2_callbacks_t *cb, void *arg, size_t max_header_bytes,
+                    const char *upgrade) {
+    memset(session, 0, sizeof(h2_session_t));
+    session->cb = cb;
+    session->arg = arg;
+    session->max_header_bytes = max_header_bytes;
+    hpack_table_init(&session->decoder);
+    hpack_table_init(&session->encoder);
+    session->peer_window = DEFAULT_WINDOW;
+    session->window = DEFAULT_WINDOW;
+    session->recv_window = DEFAULT_WINDOW;
+    /** Enough for a full buffer and one more DATA frame, so filling it never reallocates */
+    session->out_cap = H2_OUT_SIZE + H2_FRAME_HEADER + H2_FRAME_SIZE;
+    session->out = malloc(session->out_cap);
+    if (session->out == NULL) return -1;
+
+    if (upgrade != NULL) {
+        /** The 101 response acknowledges the settings of the header */
+        unsigned char payload[strlen(upgrade) + 1];
+        ssize_t n = base64url_decode(upgrade, payload);
+        if (n < 0 || n % 6 != 0 || apply_settings(session, payload, n) < 0) {
+            free(session->out);
+            return -1;
+        }
+        static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\n"
+                                        "Upgrade: h2c\r\n\r\n";
+        memcpy(session->out, switching, sizeof(switching) - 1);
+        session->out_len = sizeof(switching) - 1;
+    }
+
+    unsigned char settings[12];
+    settings[0] = 0;
+    settings[1] = setting_max_concurrent_streams;
+    write_u32(settings + 2, H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = setting_max_header_list_size;
+    write_u32(settings + 8, max_header_bytes);
+    queue_frame(session, frame_settings, 0, 0, settings, sizeof(settings));
+    return 0;
+}
+
+void h2_session_free(h2_session_t *session) {
+    while (session->first != NULL) close_stream(session, session->first);
+    hpack_table_free(&session->decoder);
+    hpack_table_free(&session->encoder);
+    free(session->block);
+    free(session->out);
+    session->block = NULL;
+    session->out = NULL;
+}
+
+/**
+ * @brief Hands a new stream to the server and closes it right away if the response has no body.
+ */
+static void start_stream(h2_session_t *session, h2_stream_t *stream, char *head, size_t len) {
+    session->cb->request(session->arg, stream, head, len);
+    if (stream->responded && !stream->sending) finish_stream(session, stream);
+}
+
+void h2_session_upgrade(h2_session_t *session, char *head, size_t len) {
+    session->last_stream = 1;
+    h2_stream_t *stream = open_stream(session, 1, true);
+    if (stream == NULL) {
+        free(head);
+        connection_error(session, error_internal);
+        return;
+    }
+    start_stream(session, stream, head, len);
+}
+
+/**
+ * @brief Field callback of the decoder for a request, builds its head in HTTP/1.1 form.
+ * @details Malformed requests only get their stream reset, so decoding goes on to keep the table in sync.
+ */
+static int request_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len) {
+    request_t *req = arg;
+    /** Line breaks and null bytes would smuggle extra lines into the head */
+    if (name_len == 0 || strcspn(name, "\r\n") != name_len || strcspn(value, "\r\n") != value_len) {
+        req->malformed = true;
+        return 0;
+    }
+    if (name[0] == ':') {
+        char **slot = NULL;
+        if (strcmp(name, ":method") == 0) slot = &req->method;
+        else if (strcmp(name, ":path") == 0) slot = &req->path;
+        else if (strcmp(name, ":authority") == 0) slot = &req->authority;
+        if (req->regular || (slot == NULL && (strcmp(name, ":scheme") != 0 || req->scheme)) ||
+            (slot != NULL && *slot != NULL)) {
+            req->malformed = true;
+            return 0;
+        }
+        if (slot == NULL) {
+            req->scheme = true;
+            return 0;
+        }
+        *slot = strdup(value);
+        return *slot != NULL ? 0 : -1;
+    }
+
+    req->regular = true;
+    for (size_t i = 0; i < name_len; ++i) {
+        if ((name[i] >= 'A' && name[i] <= 'Z') || name[i] == ':') req->malformed = true;
+    }
+    if (name_in(name, name_len, hop_by_hop)) req->malformed = true;
+    if (req->len + name_len + value_len + 4 > req->max_len) {
+        req->too_large = true;
+        return 0;
+    }
+    req->len += sprintf(req->fields + req->len, "%s: %s\r\n", name, value);
+    return 0;
+}
+
+static int ignore_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len) {
+    (void) arg;
+    (void) name;
+    (void) name_len;
+    (void) value;
+    (void) value_len;
+    return 0;
+}
+
+/**
+ * @brief Turns a decoded request into its head, an empty string if it is too large.
+ */
+static char *request_head(request_t *req, size_t *len) {
+    size_t max_len = strlen(req->method) + strlen(req->path) + req->len + 32 +
+                     (req->authority != NULL ? strlen(req->authority) : 0);
+    char *head = malloc(max_len);
+    if (head == NULL) return NULL;
+    *len = sprintf(head, "%s %s HTTP/1.1\r\n", req->method, req->path);
+    if (req->authority != NULL) *len += sprintf(head + *len, "Host: %s\r\n", req->authority);
+    *len += sprintf(head + *len, "%s\r\n", req->fields);
+    if (req->too_large || *len > req->max_len) {
+        head[0] = '\0';
+        *len = 0;
+    }
+    return head;
+}
+
+/**
+ * @brief Processes a complete header block, a new request or the trailers of one.
+ * @return 0 on success, -1 on connection errors.
+ */
+static int process_block(h2_session_t *session, const unsigned char *block, size_t len) {
+    uint32_t id = session->block_stream;
+    bool end_stream = session->block_end_stream;
+    if (id <= session->last_stream) {
+        /** Trailers of a request, the server has no use for them */
+        h2_stream_t *stream = find_stream(session, id);
+        if (hpack_decode(&session->decoder, block, len, session->max_header_bytes, ignore_field, NULL) < 0) {
+            return connection_error(session, error_compression);
+        }
+        if (stream == NULL || stream->remote_closed) return connection_error(session, error_stream_closed);
+        if (!end_stream) {
+            close_stream(session, stream);
+            return reset_stream(session, id, error_protocol);
+        }
+        stream->remote_closed = true;
+        return 0;
+    }
+
+    request_t req;
+    memset(&req, 0, sizeof(req));
+    req.max_len = session->max_header_bytes;
+    req.fields = malloc(req.max_len + 1);
+    if (req.fields == NULL) return connection_error(session, error_internal);
+    req.fields[0] = '\0';
+    int ret = hpack_decode(&session->decoder, block, len, session->max_header_bytes, request_field, &req);
+    if (ret < 0) {
+        ret = connection_error(session, error_compression);
+    } else if (!session->goaway) {
+        /** Streams arriving after GOAWAY are ignored, the client retries them on a new connection */
+        session->last_stream = id;
+        if (req.malformed || req.method == NULL || req.path == NULL || !req.scheme) {
+            ret = reset_stream(session, id, error_protocol);
+        } else if (session->stream_count >= H2_MAX_STREAMS) {
+            ret = reset_stream(session, id, error_refused_stream);
+        } else {
+            size_t head_len;
+            char *head = request_head(&req, &head_len);
+            h2_stream_t *stream = head != NULL ? open_stream(session, id, end_stream) : NULL;
+            if (stream == NULL) {
+                free(head);
+                ret = connection_error(session, error_internal);
+            } else {
+                start_stream(session, stream, head, head_len);
+                ret = session->failed ? -1 : 0;
+            }
+        }
+    }
+    free(req.method);
+    free(req.path);
+    free(req.authority);
+    free(req.fields);
+    return ret;
+}
+
+/**
+ * @brief Strips the padding of a DATA or HEADERS frame.
+ * @return 0 on success, -1 if the padding is longer than the frame.
+ */
+static int strip_padding(int flags, const unsigned char **payload, size_t *len) {
+    if (!(flags & FLAG_PADDED)) return 0;
+    if (*len < 1 || (*payload)[0] >= *len) return -1;
+    *len -= 1 + (*payload)[0];
+    (*payload)++;
+    return 0;
+}
+
+static int on_data(h2_session_t *session, int flags, uint32_t id, const unsigned char *payload, size_t len) {
+    /** Padding counts against the windows as well */
+    long frame_len = (long) len;
+    if (id == 0 || id > session->last_stream || strip_padding(flags, &payload, &len) < 0) {
+        return connection_error(session, error_protocol);
+    }
+    if (frame_len > session->recv_window) return connection_error(session, error_flow_control);
+    session->recv_window -= frame_len;
+    /** The data is dropped right away, the connection window is given back once half of it is used, so a client
+     * sending a body gets one WINDOW_UPDATE per 32KB instead of one per frame */
+    if (session->recv_window <= DEFAULT_WINDOW / 2) {
+        long increment = DEFAULT_WINDOW - session->recv_window;
+        session->recv_window = DEFAULT_WINDOW;
+        if (window_update(session, 0, increment) < 0) return -1;
+    }
+
+    h2_stream_t *stream = find_stream(session, id);
+    if (stream == NULL || stream->remote_closed) return 0;
+    /** Request bodies aren't used, so stream windows aren't refilled, the stream is reset with NO_ERROR once its
+     * response is complete, which tells the client to stop sending */
+    if (frame_len > stream->recv_window) {
+        close_stream(session, stream);
+        return reset_stream(session, id, error_flow_control);
+    }
+    stream->recv_window -= frame_len;
+    if (flags & FLAG_END_STREAM) stream->remote_closed = true;
+    return 0;
+}
+
+static int on_headers(h2_session_t *session, int flags, uint32_t id, const unsigned char *payload, size_t len) {
+    if (id == 0 || id % 2 == 0 || strip_padding(flags, &payload, &len) < 0) {
+        return connection_error(session, error_protocol);
+    }
+    /** Priorities are ignored, every stream gets the same share */
+    if (flags & FLAG_PRIORITY) {
+        if (len < 5) return connection_error(session, error_protocol);
+        payload += 5;
+        len -= 5;
+    }
+    session->block_stream = id;
+    session->block_end_stream = (flags & FLAG_END_STREAM) != 0;
+    if (flags & FLAG_END_HEADERS) return process_block(session, payload, len);
+
+    session->block = malloc(len > 0 ? len : 1);
+    if (session->block == NULL) return connection_error(session, error_internal);
+    memcpy(session->block, payload, len);
+    session->block_len = len;
+    return 0;
+}
+
+static int on_continuation(h2_session_t *session, int flags, const unsigned char *payload, size_t len) {
+    if (session->block_len + len > H2_BLOCK_MAX) return connection_error(session, error_enhance_your_calm);
+    unsigned char *block = realloc(session->block, session->block_len + len + 1);
+    if (block == NULL) return connection_error(session, error_internal);
+    memcpy(block + session->block_len, payload, len);
+    session->block = block;
+    session->block_len += len;
+    if (!(flags & FLAG_END_HEADERS)) return 0;
+
+    int ret = process_block(session, session->block, session->block_len);
+    free(session->block);
+    session->block = NULL;
+    session->block_len = 0;
+    return ret;
+}
+
+static int on_settings(h2_session_t *session, int flags, uint32_t id, const unsigned char *payload, size_t len) {
+    if (id != 0) return connection_error(session, error_protocol);
+    if (flags & FLAG_ACK) return len == 0 ? 0 : connection_error(session, error_frame_size);
+    if (len % 6 != 0) return connection_error(session, error_frame_size);
+    if (apply_settings(session, payload, len) < 0) return -1;
+    session->settings = true;
+    if (queue_frame(session, frame_settings, FLAG_ACK, 0, NULL, 0) < 0) {
+        return connection_error(session, error_enhance_your_calm);
+    }
+    return 0;
+}
+
+static int on_window_update(h2_session_t *session, uint32_t id, const unsigned char *payload, size_t len) {
+    if (len != 4) return connection_error(session, error_frame_size);
+    long increment = read_u32(payload) & MAX_WINDOW;
+    if (id == 0) {
+        if (increment == 0) return connection_error(session, error_protocol);
+        if (session->window + increment > MAX_WINDOW) return connection_error(session, error_flow_control);
+        session->window += increment;
+        return 0;
+    }
+    if (id > session->last_stream) return connection_error(session, error_protocol);
+    h2_stream_t *stream = find_stream(session, id);
+    /** Updates for streams closed in the meantime are expected */
+    if (stream == NULL) return 0;
+    if (increment == 0 || stream->window + increment > MAX_WINDOW) {
+        close_stream(session, stream);
+        return reset_stream(session, id, increment == 0 ? error_protocol : error_flow_control);
+    }
+    stream->window += increment;
+    return 0;
+}
+
+/**
+ * @brief Processes one frame.
+ * @return 0 on success, -1 on connection errors.
+ */
+static int process_frame(h2_session_t *session, frame_type_e type, int flags, uint32_t id,
+                         const unsigned char *payload, size_t len) {
+    /** The first frame of the client is its SETTINGS, a header block may only be continued */
+    if (!session->settings && type != frame_settings) return connection_error(session, error_protocol);
+    if ((session->block != NULL) != (type == frame_continuation) ||
+        (session->block != NULL && id != session->block_stream)) {
+        return connection_error(session, error_protocol);
+    }
+
+    switch (type) {
+        case frame_data:
+            return on_data(session, flags, id, payload, len);
+        case frame_headers:
+            return on_headers(session, flags, id, payload, len);
+        case frame_continuation:
+            return on_continuation(session, flags, payload, len);
+        case frame_priority:
+            if (id == 0) return connection_error(session, error_protocol);
+            return len == 5 ? 0 : reset_stream(session, id, error_frame_size);
+        case frame_rst_stream: {
+            if (id == 0 || id > session->last_stream) return connection_error(session, error_protocol);
+            if (len != 4) return connection_error(session, error_frame_size);
+            h2_stream_t *stream = find_stream(session, id);
+            if (stream != NULL) close_stream(session, stream);
+            return 0;
+        }
+        case frame_settings:
+            return on_settings(session, flags, id, payload, len);
+        case frame_ping:
+            if (id != 0) return connection_error(session, error_protocol);
+            if (len != 8) return connection_error(session, error_frame_size);
+            if (flags & FLAG_ACK) return 0;
+            if (queue_frame(session, frame_ping, FLAG_ACK, 0, payload, len) < 0) {
+                return connection_error(session, error_enhance_your_calm);
+            }
+            return 0;
+        case frame_goaway:
+            /** The client closes the connection itself once it has its responses */
+            return id == 0 ? 0 : connection_error(session, error_protocol);
+        case frame_window_update:
+            return on_window_update(session, id, payload, len);
+        case frame_push_promise:
+            /** Only servers push */
+            return connection_error(session, error_protocol);
+        default:
+            /** Unknown frame types are ignored */
+            return 0;
+    }
+}
+
+ssize_t h2_session_receive(h2_session_t *session, const unsigned char *data, size_t len) {
+    if (session->failed) return -1;
+    size_t pos = 0;
+    if (!session->preface) {
+        size_t n = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+        if (memcmp(data, H2_PREFACE, n) != 0) return connection_error(session, error_protocol);
+        if (n < H2_PREFACE_LEN) return 0;
+        session->preface = true;
+        pos = H2_PREFACE_LEN;
+    }
+
+    while (len - pos >= H2_FRAME_HEADER) {
+        const unsigned char *frame = data + pos;
+        size_t frame_len = (size_t) frame[0] << 16 | (size_t) frame[1] << 8 | frame[2];
+        if (frame_len > H2_FRAME_SIZE) return connection_error(session, error_frame_size);
+        if (len - pos < H2_FRAME_HEADER + frame_len) break;
+        uint32_t id = read_u32(frame + 5) & MAX_WINDOW;
+        if (process_frame(session, frame[3], frame[4], id, frame + H2_FRAME_HEADER, frame_len) < 0) return -1;
+        pos += H2_FRAME_HEADER + frame_len;
+    }
+    return (ssize_t) pos;
+}
+
+int h2_respond(h2_session_t *session, h2_stream_t *stream, const char *head, size_t len, bool has_body) {
+    if (session->failed) return -1;
+    const char *end = head + len;
+    const char *status = memchr(head, ' ', len);
+    const char *line = memchr(head, '\n', len);
+    if (status == NULL || line == NULL || line - status < 4) return connection_error(session, error_internal);
+
+    /** Every field costs at most a few bytes on top of its name and value, so the block fits for sure */
+    unsigned char block[2 * len + 64];
+    ssize_t n = hpack_encode_start(&session->encoder, block, sizeof(block));
+    ssize_t m = n < 0 ? -1 : hpack_encode(&session->encoder, block + n, sizeof(block) - n, ":status", 7, status + 1, 3,
+                                          true);
+    if (m < 0) return connection_error(session, error_internal);
+    n += m;
+    for (line++; line < end; ) {
+        const char *eol = memchr(line, '\r', end - line);
+        if (eol == NULL || eol == line) break;
+        const char *colon = memchr(line, ':', eol - line);
+        if (colon != NULL) {
+            /** Field names are lower case in HTTP/2 */
+            size_t name_len = colon - line;
+            char name[name_len + 1];
+            for (size_t i = 0; i < name_len; ++i) {
+                name[i] = line[i] >= 'A' && line[i] <= 'Z' ? (char) (line[i] - 'A' + 'a') : line[i];
+            }
+            name[name_len] = '\0';
+            const char *value = colon + 1;
+            while (value < eol && (*value == ' ' || *value == '\t')) value++;
+            if (!name_in(name, name_len, hop_by_hop)) {
+                m = hpack_encode(&session->encoder, block + n, sizeof(block) - n, name, name_len, value, eol - value,
+                                 !name_in(name, name_len, unindexed));
+                if (m < 0) return connection_error(session, error_internal);
+                n += m;
+            }
+        }
+        line = eol + 2;
+    }
+
+    /** Blocks beyond the frame size continue in CONTINUATION frames */
+    size_t pos = 0;
+    do {
+        size_t part = (size_t) n - pos < H2_FRAME_SIZE ? (size_t) n - pos : H2_FRAME_SIZE;
+        int flags = pos + part == (size_t) n ? FLAG_END_HEADERS : 0;
+        if (pos == 0 && !has_body) flags |= FLAG_END_STREAM;
+        if (queue_frame(session, pos == 0 ? frame_headers : frame_continuation, flags, stream->id, block + pos,
+                        part) < 0) {
+            return connection_error(session, error_enhance_your_calm);
+        }
+        pos += part;
+    } while (pos < (size_t) n);
+
+    stream->responded = true;
+    stream->sending = has_body;
+    return 0;
+}
+
+/**
+ * @brief Queues DATA frames, one per stream in turn, until the buffer is full or no stream can send.
+ */
+static void fill_data(h2_session_t *session) {
+    size_t blocked = 0;
+    while (!session->failed && blocked < session->stream_count && session->out_len < H2_OUT_SIZE) {
+        /** The stream goes last after its turn */
+        h2_stream_t *stream = session->first;
+        unlink_stream(session, stream);
+        append_stream(session, stream);
+        long max = H2_FRAME_SIZE;
+        if (stream->window < max) max = stream->window;
+        if (session->window < max) max = session->window;
+        if (!stream->sending || max <= 0) {
+            blocked++;
+            continue;
+        }
+        if (reserve(session, H2_FRAME_HEADER + max) < 0) {
+            connection_error(session, error_internal);
+            return;
+        }
+
+        bool end = false;
+        unsigned char *frame = session->out + session->out_len;
+        ssize_t n = session->cb->body(session->arg, stream, frame + H2_FRAME_HEADER, max, &end);
+        if (n < 0 || n > max || (n == 0 && !end)) {
+            uint32_t id = stream->id;
+            close_stream(session, stream);
+            reset_stream(session, id, error_internal);
+            continue;
+        }
+        write_frame_header(frame, n, frame_data, end ? FLAG_END_STREAM : 0, stream->id);
+        session->out_len += H2_FRAME_HEADER + n;
+        stream->window -= n;
+        session->window -= n;
+        blocked = 0;
+        if (end) finish_stream(session, stream);
+    }
+}
+
+int h2_session_send(h2_session_t *session, int fd, size_t quantum) {
+    size_t sent = 0;
+    for (;;) {
+        if (session->out_pos < session->out_len) {
+            size_t before = session->out_pos;
+            int status = io_send(fd, session->out, session->out_len, &session->out_pos);
+            sent += session->out_pos - before;
+            if (status != 1) return status;
+        }
+        session->out_len = session->out_pos = 0;
+        fill_data(session);
+        if (session->out_len == 0) return 1;
+        /** Leaving with frames queued lets the other connections have their turn first */
+        if (sent >= quantum) return 0;
+    }
+}
+
+void h2_session_shutdown(h2_session_t *session) {
+    if (session->goaway) return;
+    unsigned char payload[8];
+    write_u32(payload, session->last_stream);
+    write_u32(payload + 4, error_none);
+    queue_frame(session, frame_goaway, 0, 0, payload, sizeof(payload));
+    session->goaway = true;
+}
+
+bool h2_session_idle(const h2_session_t *session) {
+    return session->stream_count == 0 && session->out_pos == session->out_len;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file h2.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Server side of HTTP/2 over cleartext TCP (h2c, RFC 9113).
+ * @details A session is the HTTP/2 state of one connection: it checks the client preface, parses frames, keeps both
+ * HPACK tables (hpack.c), the stream states and the flow control windows, and queues everything it has to send in
+ * one output buffer. It doesn't touch the socket except in h2_session_send(), the event loop feeds it the received
+ * bytes and writes whenever the socket is writable.
+ *
+ * Requests are handed to the server as the head of an equivalent HTTP/1.1 request ("GET /path HTTP/1.1", a Host
+ * header from :authority and the header fields), so the request parsing of HTTP/1.1 connections serves both. The
+ * answer comes back the same way: the server formats an HTTP/1.1 response head, which is compressed into a HEADERS
+ * frame without the hop-by-hop fields, and the body is pulled through a callback whenever the flow control windows
+ * allow. Streams with a body get one DATA frame each in turn, so many small responses share the connection with a
+ * big one instead of queueing behind it.
+ *
+ * Connections start either with the preface (prior knowledge) or as HTTP/1.1 request with "Upgrade: h2c", which
+ * becomes stream 1 after the 101 response. The server never pushes.
+ */
+
+#ifndef H2_H
+#define H2_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "hpack.h"
+
+/** Connection preface of the client */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+/** Length of a frame header */
+#define H2_FRAME_HEADER 9
+/** Largest frame payload the server accepts, the default of the protocol */
+#define H2_FRAME_SIZE 16384
+/** Streams a client may have open at once, further ones are refused */
+#define H2_MAX_STREAMS 100
+/** Output is generated until this many bytes are queued */
+#define H2_OUT_SIZE (64 * 1024)
+/** Limit of the output buffer, a client which keeps sending pings or requests without reading is dropped */
+#define H2_OUT_MAX (1024 * 1024)
+/** Largest compressed header block accepted */
+#define H2_BLOCK_MAX (64 * 1024)
+
+/** A stream the server is answering */
+typedef struct h2_stream {
+    uint32_t id;
+    /** True once the client ended its side of the stream */
+    bool remote_closed;
+    /** True once the response headers are queued, sending while body frames follow */
+    bool responded;
+    bool sending;
+    /** Flow control window for sending, may become negative when the client shrinks the initial window */
+    long window;
+    /** Bytes the client may still send on the stream, bodies aren't used so the window is never refilled */
+    long recv_window;
+    /** Data of the server for this stream */
+    void *data;
+    struct h2_stream *prev;
+    struct h2_stream *next;
+} h2_stream_t;
+
+/** Callbacks of the server */
+typedef struct {
+    /**
+     * @brief Called for every complete request, which has to be answered with h2_respond() before returning.
+     * @param head Request head in HTTP/1.1 form ending with the empty line, null-terminated and owned by the callee,
+     * which frees it with free(). Empty if the headers exceed the limit of the session.
+     * @param len Length of the head.
+     */
+    void (*request)(void *arg, h2_stream_t *stream, char *head, size_t len);
+    /**
+     * @brief Called for the next part of the body of a stream.
+     * @param buff Buffer for the body.
+     * @param max Most bytes the stream may send now, at least 1.
+     * @param end Set to true once the body is complete.
+     * @return Amount of bytes written to buff, -1 on errors, which reset the stream.
+     */
+    ssize_t (*body)(void *arg, h2_stream_t *stream, unsigned char *buff, size_t max, bool *end);
+    /**
+     * @brief Called when a stream is done, because its response is queued completely, it has been reset or the
+     * connection closes, its data can be freed.
+     */
+    void (*close)(void *arg, h2_stream_t *stream);
+} h2_callbacks_t;
+
+/** HTTP/2 state of a connection */
+typedef struct {
+    const h2_callbacks_t *cb;
+    void *arg;
+    size_t max_header_bytes;
+    /** Received preface and first SETTINGS frame */
+    bool preface;
+    bool settings;
+    hpack_table_t decoder;
+    hpack_table_t encoder;
+    /** Initial stream window the client set, frames are never bigger than H2_FRAME_SIZE regardless of its limit */
+    long peer_window;
+    /** Flow control window of the connection for sending */
+    long window;
+    /** Bytes the client may still send on the connection, it gets a FLOW_CONTROL_ERROR if it sends more */
+    long recv_window;
+    /** Highest stream the client opened, the server only takes higher ones */
+    uint32_t last_stream;
+    /** Open streams, the next to send a DATA frame first */
+    h2_stream_t *first;
+    h2_stream_t *last;
+    size_t stream_count;
+    /** Header block of a HEADERS frame whose CONTINUATION frames are still missing */
+    unsigned char *block;
+    size_t block_len;
+    uint32_t block_stream;
+    bool block_end_stream;
+    /** Frames to be sent, out[out_pos..out_len) */
+    unsigned char *out;
+    size_t out_len;
+    size_t out_pos;
+    size_t out_cap;
+    /** Set once GOAWAY is queued, no new streams are accepted then */
+    bool goaway;
+    /** Set after a connection error, only the GOAWAY is sent */
+    bool failed;
+} h2_session_t;
+
+/**
+ * @brief Starts a session and queues the SETTINGS of the server.
+ * @param session Session to be initialized, freed with h2_session_free().
+ * @param cb Callbacks of the server.
+ * @param arg Passed to the callbacks.
+ * @param max_header_bytes Longest request head (in HTTP/1.1 form) accepted.
+ * @param upgrade Value of the HTTP2-Settings header if the connection upgrades from HTTP/1.1, the 101 response is
+ * queued then, NULL for prior knowledge.
+ * @return 0 on success, -1 if out of memory or the HTTP2-Settings are invalid.
+ */
+int h2_session_init(h2_session_t *session, const h2_callbacks_t *cb, void *arg, size_t max_header_bytes,
+                    const char *upgrade);
+
+/**
+ * @brief Frees a session, the close callback is called for the open streams.
+ * @param session Session from h2_session_init().
+ */
+void h2_session_free(h2_session_t *session);
+
+/**
+ * @brief Turns the request of an upgraded connection into stream 1 and hands it to the request callback.
+ * @param session Session started with HTTP2-Settings.
+ * @param head Request head, owned by the session from now on.
+ * @param len Length of the head.
+ */
+void h2_session_upgrade(h2_session_t *session, char *head, size_t len);
+
+/**
+ * @brief Processes received bytes, starting with the preface.
+ * @details Only complete frames are processed, the rest has to be passed again with the bytes following it.
+ *
+ * @param session Session.
+ * @param data Received bytes.
+ * @param len Amount of received bytes.
+ * @return Amount of bytes processed, -1 on connection errors. The GOAWAY is queued then, the connection should be
+ * closed after sending it.
+ */
+ssize_t h2_session_receive(h2_session_t *session, const unsigned char *data, size_t len);
+
+/**
+ * @brief Queues the response headers of a stream.
+ * @param session Session.
+ * @param stream Stream passed to the request callback.
+ * @param head HTTP/1.1 response head ending with the empty line.
+ * @param len Length of the head.
+ * @param has_body True if a body follows, it is pulled with the body callback.
+ * @return 0 on success, -1 if the session failed.
+ */
+int h2_respond(h2_session_t *session, h2_stream_t *stream, const char *head, size_t len, bool has_body);
+
+/**
+ * @brief Sends queued frames and DATA frames of the streams, one frame per stream in turn.
+ * @param session Session.
+ * @param fd Non-blocking socket.
+ * @param quantum Bytes to send at most before the other connections get their turn.
+ * @return 1 if nothing is left to send for now, 0 if the socket is full or the quantum is used up and -1 on errors.
+ */
+int h2_session_send(h2_session_t *session, int fd, size_t quantum);
+
+/**
+ * @brief Queues a GOAWAY, streams already opened are still answered but no new ones are accepted.
+ * @param session Session.
+ */
+void h2_session_shutdown(h2_session_t *session);
+
+/**
+ * @brief Checks whether a session has neither open streams nor frames to send.
+ * @param session Session.
+ * @return True if the session is idle.
+ */
+bool h2_session_idle(const h2_session_t *session);
+
+#endif
@@ -0,0 +1,431 @@
+/**
+ * @file hpack.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hpack.h"
+
+/** Entries of the static table, dynamic entries follow them */
+#define STATIC_ENTRIES 61
+/** Longest code of the Huffman table, the one of EOS */
+#define HUFFMAN_MAX_BITS 30
+/** Symbol which must not appear in a string, its start pads the last byte */
+#define HUFFMAN_EOS 256
+
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[STATIC_ENTRIES] = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+        {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+        {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+        {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+        {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+        {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+        {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+        {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+        {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+        {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+        {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+        {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""}
+};
+
+/** Huffman code of every byte and of EOS, Appendix B of the RFC */
+static const uint32_t huffman_codes[257] = {
+        0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+        0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+        0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+        0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+        0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+        0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+        0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+        0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+        0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+        0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+        0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+        0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+        0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+        0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+        0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+        0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+        0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+        0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+        0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+        0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+        0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+        0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+        0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+        0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+        0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+        0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+        0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+        0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+        0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+        0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+        0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+        0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+        0x3fffffff
+};
+static const uint8_t huffman_lengths[257] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+        5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+        13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+        15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+        6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+        30
+};
+/** The code is canonical, so symbols sorted by code length and value plus the amount of codes per length are enough
+ * to decode it */
+static const uint16_t huffman_symbols[257] = {
+        48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+        52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+        110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+        77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+        119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+        43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+        195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+        179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+        163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+        233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+        158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+        144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+        200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+        212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+        2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+        21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+        256
+};
+static const uint16_t huffman_count[31] = {
+        0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+        0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+void hpack_table_init(hpack_table_t *table) {
+    memset(table, 0, sizeof(hpack_table_t));
+    table->max_size = HPACK_TABLE_SIZE;
+    table->pending_min = -1;
+}
+
+/**
+ * @brief Returns an entry of the dynamic table, 0 is the newest.
+ */
+static hpack_entry_t *entry_at(const hpack_table_t *table, size_t i) {
+    return table->entries[(table->first + i) % HPACK_TABLE_ENTRIES];
+}
+
+/**
+ * @brief Drops the oldest entries until the table fits into limit.
+ */
+static void evict(hpack_table_t *table, size_t limit) {
+    while (table->size > limit && table->count > 0) {
+        hpack_entry_t *oldest = entry_at(table, table->count - 1);
+        table->size -= oldest->name_len + oldest->value_len + HPACK_ENTRY_OVERHEAD;
+        table->count--;
+        free(oldest);
+    }
+}
+
+void hpack_table_free(hpack_table_t *table) {
+    evict(table, 0);
+}
+
+void hpack_table_resize(hpack_table_t *table, size_t size) {
+    if (size > HPACK_TABLE_SIZE) size = HPACK_TABLE_SIZE;
+    if (size == table->max_size) return;
+    if (table->pending_min < 0 || (long) size < table->pending_min) table->pending_min = (long) size;
+    table->max_size = size;
+    evict(table, size);
+}
+
+/**
+ * @brief Adds a field as newest entry.
+ * @details Name and value may point into an entry which is evicted to make room, so they are copied first.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_entry(hpack_table_t *table, const char *name, size_t name_len, const char *value, size_t value_len) {
+    size_t cost = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+    if (cost > table->max_size) {
+        /** A field bigger than the table empties it */
+        evict(table, 0);
+        return 0;
+    }
+    hpack_entry_t *entry = malloc(sizeof(hpack_entry_t) + name_len + value_len + 2);
+    if (entry == NULL) return -1;
+    entry->name_len = name_len;
+    entry->value_len = value_len;
+    memcpy(entry->data, name, name_len);
+    entry->data[name_len] = '\0';
+    memcpy(entry->data + name_len + 1, value, value_len);
+    entry->data[name_len + 1 + value_len] = '\0';
+
+    evict(table, table->max_size - cost);
+    table->first = (table->first + HPACK_TABLE_ENTRIES - 1) % HPACK_TABLE_ENTRIES;
+    table->entries[table->first] = entry;
+    table->count++;
+    table->size += cost;
+    return 0;
+}
+
+/**
+ * @brief Looks up a field by its index, 1 is the first static entry.
+ * @return 0 on success, -1 if there is no such entry.
+ */
+static int lookup(const hpack_table_t *table, size_t index, const char **name, size_t *name_len, const char **value,
+                  size_t *value_len) {
+    if (index == 0) return -1;
+    if (index <= STATIC_ENTRIES) {
+        *name = static_table[index - 1].name;
+        *value = static_table[index - 1].value;
+        *name_len = strlen(*name);
+        *value_len = strlen(*value);
+        return 0;
+    }
+    if (index - STATIC_ENTRIES > table->count) return -1;
+    const hpack_entry_t *entry = entry_at(table, index - STATIC_ENTRIES - 1);
+    *name = entry->data;
+    *name_len = entry->name_len;
+    *value = entry->data + entry->name_len + 1;
+    *value_len = entry->value_len;
+    return 0;
+}
+
+/**
+ * @brief Decodes an integer with a prefix of the given amount of bits.
+ * @return 0 on success, -1 if the block ends or the value is unreasonably big.
+ */
+static int decode_int(const unsigned char **p, const unsigned char *end, int prefix, size_t *value) {
+    if (*p == end) return -1;
+    size_t mask = (1u << prefix) - 1;
+    *value = *(*p)++ & mask;
+    if (*value < mask) return 0;
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (*p == end) return -1;
+        unsigned char b = *(*p)++;
+        *value += (size_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Decodes a Huffman-coded string, bit by bit through the canonical code.
+ * @return Length of the decoded string, -1 if it is malformed or longer than cap.
+ */
+static ssize_t huffman_decode(const unsigned char *src, size_t len, char *out, size_t cap) {
+    size_t n = 0;
+    int code = 0, first = 0, index = 0, bits = 0;
+    for (size_t i = 0; i < len; ++i) {
+        for (int b = 7; b >= 0; --b) {
+            code |= (src[i] >> b) & 1;
+            bits++;
+            int count = huffman_count[bits];
+            if (code - count < first) {
+                int symbol = huffman_symbols[index + (code - first)];
+                if (symbol == HUFFMAN_EOS || n == cap) return -1;
+                out[n++] = (char) symbol;
+                code = first = index = bits = 0;
+                continue;
+            }
+            if (bits == HUFFMAN_MAX_BITS) return -1;
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+    }
+    /** The padding is shorter than a byte and consists of the first bits of EOS, which are all ones */
+    if (bits > 7 || code >> 1 != (1 << bits) - 1) return -1;
+    return (ssize_t) n;
+}
+
+/**
+ * @brief Decodes a string literal into a buffer of cap + 1 bytes, null-terminated.
+ * @return Length of the string, -1 on errors.
+ */
+static ssize_t decode_string(const unsigned char **p, const unsigned char *end, char *out, size_t cap) {
+    if (*p == end) return -1;
+    bool huffman = (**p & 0x80) != 0;
+    size_t len;
+    if (decode_int(p, end, 7, &len) < 0 || len > (size_t) (end - *p)) return -1;
+    ssize_t n;
+    if (huffman) {
+        n = huffman_decode(*p, len, out, cap);
+    } else {
+        if (len > cap) return -1;
+        memcpy(out, *p, len);
+        n = (ssize_t) len;
+    }
+    *p += len;
+    if (n >= 0) out[n] = '\0';
+    return n;
+}
+
+int hpack_decode(hpack_table_t *table, const unsigned char *block, size_t len, size_t max_string,
+                 hpack_field_cb field, void *arg) {
+    const unsigned char *p = block;
+    const unsigned char *end = block + len;
+    char *buff = malloc(2 * (max_string + 1));
+    if (buff == NULL) return -1;
+    int ret = 0;
+    while (ret == 0 && p < end) {
+        unsigned char first = *p;
+        size_t index;
+        const char *name, *value;
+        size_t name_len, value_len;
+        if (first & 0x80) {
+            /** Indexed field */
+            ret = decode_int(&p, end, 7, &index) < 0 ||
+                  lookup(table, index, &name, &name_len, &value, &value_len) < 0 ||
+                  field(arg, name, name_len, value, value_len) < 0 ? -1 : 0;
+            continue;
+        }
+        if ((first & 0xe0) == 0x20) {
+            /** Dynamic table size update, up to the size of our SETTINGS */
+            size_t size;
+            ret = decode_int(&p, end, 5, &size) < 0 || size > HPACK_TABLE_SIZE ? -1 : 0;
+            if (ret == 0) {
+                table->max_size = size;
+                evict(table, size);
+            }
+            continue;
+        }
+
+        /** Literal, with incremental indexing (01), without indexing (0000) or never indexed (0001) */
+        bool indexing = (first & 0xc0) == 0x40;
+        if (decode_int(&p, end, indexing ? 6 : 4, &index) < 0) {
+            ret = -1;
+            continue;
+        }
+        char *name_buff = buff;
+        char *value_buff = buff + max_string + 1;
+        if (index > 0) {
+            ret = lookup(table, index, &name, &name_len, &value, &value_len);
+        } else {
+            ssize_t n = decode_string(&p, end, name_buff, max_string);
+            ret = n < 0 ? -1 : 0;
+            name = name_buff;
+            name_len = (size_t) n;
+        }
+        ssize_t n = ret == 0 ? decode_string(&p, end, value_buff, max_string) : -1;
+        if (n < 0) {
+            ret = -1;
+            continue;
+        }
+        ret = field(arg, name, name_len, value_buff, (size_t) n);
+        if (ret == 0 && indexing) ret = add_entry(table, name, name_len, value_buff, (size_t) n);
+    }
+    free(buff);
+    return ret;
+}
+
+/**
+ * @brief Encodes an integer with a prefix of the given amount of bits, flags are the bits above the prefix.
+ * @return Bytes written, -1 if they don't fit.
+ */
+static ssize_t encode_int(unsigned char *out, size_t cap, size_t value, int prefix, unsigned char flags) {
+    size_t mask = (1u << prefix) - 1;
+    if (cap == 0) return -1;
+    if (value < mask) {
+        out[0] = flags | (unsigned char) value;
+        return 1;
+    }
+    out[0] = flags | (unsigned char) mask;
+    value -= mask;
+    size_t n = 1;
+    for (; value >= 0x80; value >>= 7) {
+        if (n == cap) return -1;
+        out[n++] = (unsigned char) ((value & 0x7f) | 0x80);
+    }
+    if (n == cap) return -1;
+    out[n++] = (unsigned char) value;
+    return (ssize_t) n;
+}
+
+/**
+ * @brief Encodes a string literal, Huffman-coded if that is shorter.
+ * @return Bytes written, -1 if they don't fit.
+ */
+static ssize_t encode_string(unsigned char *out, size_t cap, const char *str, size_t len) {
+    size_t bits = 0;
+    for (size_t i = 0; i < len; ++i) bits += huffman_lengths[(unsigned char) str[i]];
+    size_t huffman_len = (bits + 7) / 8;
+    bool huffman = huffman_len < len;
+    size_t data_len = huffman ? huffman_len : len;
+    ssize_t n = encode_int(out, cap, data_len, 7, huffman ? 0x80 : 0);
+    if (n < 0 || data_len > cap - n) return -1;
+    out += n;
+    if (!huffman) {
+        memcpy(out, str, len);
+        return n + (ssize_t) len;
+    }
+
+    uint64_t acc = 0;
+    int pending = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char) str[i];
+        acc = (acc << huffman_lengths[c]) | huffman_codes[c];
+        pending += huffman_lengths[c];
+        while (pending >= 8) {
+            pending -= 8;
+            *out++ = (unsigned char) (acc >> pending);
+        }
+    }
+    /** Pad with the first bits of EOS */
+    if (pending > 0) *out = (unsigned char) ((acc << (8 - pending)) | (0xff >> pending));
+    return n + (ssize_t) huffman_len;
+}
+
+ssize_t hpack_encode_start(hpack_table_t *table, unsigned char *out, size_t cap) {
+    if (table->pending_min < 0) return 0;
+    ssize_t n = 0;
+    if ((size_t) table->pending_min < table->max_size) {
+        n = encode_int(out, cap, (size_t) table->pending_min, 5, 0x20);
+        if (n < 0) return -1;
+    }
+    ssize_t m = encode_int(out + n, cap - n, table->max_size, 5, 0x20);
+    if (m < 0) return -1;
+    table->pending_min = -1;
+    return n + m;
+}
+
+ssize_t hpack_encode(hpack_table_t *table, unsigned char *out, size_t cap, const char *name, size_t name_len,
+                     const char *value, size_t value_len, bool index) {
+    /** Full match or at least the name, static entries first */
+    size_t name_index = 0;
+    for (size_t i = 1; i <= STATIC_ENTRIES + table->count; ++i) {
+        const char *entry_name, *entry_value;
+        size_t entry_name_len, entry_value_len;
+        lookup(table, i, &entry_name, &entry_name_len, &entry_value, &entry_value_len);
+        if (entry_name_len != name_len || memcmp(entry_name, name, name_len) != 0) continue;
+        if (entry_value_len == value_len && memcmp(entry_value, value, value_len) == 0) {
+            return encode_int(out, cap, i, 7, 0x80);
+        }
+        if (name_index == 0) name_index = i;
+    }
+
+    ssize_t n = encode_int(out, cap, name_index, index ? 6 : 4, index ? 0x40 : 0);
+    if (n < 0) return -1;
+    if (name_index == 0) {
+        ssize_t m = encode_string(out + n, cap - n, name, name_len);
+        if (m < 0) return -1;
+        n += m;
+    }
+    ssize_t m = encode_string(out + n, cap - n, value, value_len);
+    if (m < 0) return -1;
+    if (index && add_entry(table, name, name_len, value, value_len) < 0) return -1;
+    return n + m;
+}
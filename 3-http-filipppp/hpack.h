@@ -0,0 +1,121 @@
+/**
+ * @file hpack.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief HPACK header compression of HTTP/2 (RFC 7541).
+ * @details Header fields are sent as indices into a static table of common fields and a dynamic table of the fields
+ * sent recently, or as literals which may be added to the dynamic table. Both ends keep their own copy of the dynamic
+ * table of each direction, so every header block has to be decoded (and encoded) in the order it is sent.
+ *
+ * The dynamic table is a ring of entries, the newest entry has the lowest index. Every entry costs the length of its
+ * name and value plus 32 bytes, the oldest entries are evicted once the size exceeds the limit, which is at most
+ * HPACK_TABLE_SIZE here. Literal strings are Huffman-coded with the static code of the RFC whenever that is shorter.
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** Default and maximum size of a dynamic table in bytes */
+#define HPACK_TABLE_SIZE 4096
+/** Most entries a table of HPACK_TABLE_SIZE bytes can hold, every entry costs at least 32 bytes */
+#define HPACK_TABLE_ENTRIES (HPACK_TABLE_SIZE / 32)
+/** Overhead of an entry on top of its name and value */
+#define HPACK_ENTRY_OVERHEAD 32
+
+/** Entry of the dynamic table, name and value follow the struct */
+typedef struct {
+    size_t name_len;
+    size_t value_len;
+    char data[];
+} hpack_entry_t;
+
+/** Dynamic table of one direction of a connection */
+typedef struct {
+    hpack_entry_t *entries[HPACK_TABLE_ENTRIES];
+    /** Ring position of the newest entry and amount of entries */
+    size_t first;
+    size_t count;
+    /** Size of all entries and the limit they have to stay below */
+    size_t size;
+    size_t max_size;
+    /** Smallest limit since the last header block and the current one, the encoder announces both at the start of the
+     * next block so the decoder evicts the same entries, pending_min is -1 if the limit didn't change */
+    long pending_min;
+} hpack_table_t;
+
+/**
+ * @brief Called for every decoded header field.
+ * @details Name and value are null-terminated and only valid during the call.
+ * @return 0 to go on, -1 to stop decoding with an error.
+ */
+typedef int (*hpack_field_cb)(void *arg, const char *name, size_t name_len, const char *value, size_t value_len);
+
+/**
+ * @brief Initializes an empty table.
+ * @param table Table to be initialized, freed with hpack_table_free().
+ */
+void hpack_table_init(hpack_table_t *table);
+
+/**
+ * @brief Frees all entries of a table.
+ * @param table Table from hpack_table_init().
+ */
+void hpack_table_free(hpack_table_t *table);
+
+/**
+ * @brief Changes the size limit of the table of an encoder, e.g. after the peer sent SETTINGS_HEADER_TABLE_SIZE.
+ * @details The limit is capped at HPACK_TABLE_SIZE and announced with the next header block.
+ * @param table Table of the encoder.
+ * @param size Limit the peer allows.
+ */
+void hpack_table_resize(hpack_table_t *table, size_t size);
+
+/**
+ * @brief Decodes a complete header block.
+ * @param table Dynamic table of the decoder.
+ * @param block Header block, i.e. the fragments of a HEADERS frame and its CONTINUATION frames.
+ * @param len Length of the block.
+ * @param max_string Longest name or value accepted.
+ * @param field Called for every field in order.
+ * @param arg Passed to field.
+ * @return 0 on success, -1 if the block is malformed or a field is rejected. The table is undefined after errors, so
+ * they are connection errors (COMPRESSION_ERROR).
+ */
+int hpack_decode(hpack_table_t *table, const unsigned char *block, size_t len, size_t max_string,
+                 hpack_field_cb field, void *arg);
+
+/**
+ * @brief Starts a header block, the dynamic table size update is written if the limit changed.
+ * @param table Dynamic table of the encoder.
+ * @param out Buffer of the block.
+ * @param cap Free space in the buffer.
+ * @return Bytes written, -1 if they don't fit.
+ */
+ssize_t hpack_encode_start(hpack_table_t *table, unsigned char *out, size_t cap);
+
+/**
+ * @brief Encodes one header field.
+ * @details A field which is in one of the tables is sent as its index. Otherwise it is sent as literal and, if index
+ * is set, added to the dynamic table, so the same field costs a single byte in the next responses. Values which
+ * change with every response, like Content-Length, shouldn't be indexed, they would only evict the useful entries.
+ *
+ * @param table Dynamic table of the encoder.
+ * @param out Buffer of the block.
+ * @param cap Free space in the buffer.
+ * @param name Name in lower case.
+ * @param name_len Length of the name.
+ * @param value Value.
+ * @param value_len Length of the value.
+ * @param index True if the field may be added to the dynamic table.
+ * @return Bytes written, -1 if they don't fit. The table is unchanged if the field doesn't fit.
+ */
+ssize_t hpack_encode(hpack_table_t *table, unsigned char *out, size_t cap, const char *name, size_t name_len,
+                     const char *value, size_t value_len, bool index);
+
+#endif
@@ -0,0 +1,311 @@
+/**
+ * @file http_cache.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "http_cache.h"
+
+/** Identifies an index file of this layout */
+#define HTTP_CACHE_MAGIC 0x48434932u
+/** Longest name of a file inside the cache directory */
+#define HTTP_CACHE_NAME_LEN 48
+
+static uint64_t hash_url(const char *url) {
+    /** FNV-1a, 0 marks empty slots */
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *url != '\0'; ++url) hash = (hash ^ (unsigned char) *url) * 1099511628211ULL;
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * @brief Builds the path of a file inside the cache directory.
+ * @return Path to be freed, NULL if out of memory.
+ */
+static char *cache_path(const http_cache_t *cache, const char *name) {
+    char *path = malloc(strlen(cache->dir) + strlen(name) + 2);
+    if (path != NULL) sprintf(path, "%s/%s", cache->dir, name);
+    return path;
+}
+
+static char *body_path(const http_cache_t *cache, uint32_t crc, long long size, uint32_t variant) {
+    char name[HTTP_CACHE_NAME_LEN];
+    snprintf(name, sizeof(name), "%08x-%lld-%u", (unsigned int) crc, size, (unsigned int) variant);
+    return cache_path(cache, name);
+}
+
+/**
+ * @brief Checks whether a name is that of a body, "CRC-SIZE" or "CRC-SIZE-VARIANT".
+ * @details Only such files are removed when an index is reset, the directory may hold anything else.
+ */
+static bool is_body_name(const char *name) {
+    for (int i = 0; i < 8; ++i) {
+        if (!isxdigit((unsigned char) name[i])) return false;
+    }
+    name += 8;
+    for (int part = 0; part < 2 && *name == '-'; ++part) {
+        size_t digits = strspn(++name, "0123456789");
+        if (digits == 0) return false;
+        name += digits;
+    }
+    return *name == '\0';
+}
+
+/**
+ * @brief Removes the bodies of an index that is reset, they aren't counted in its total size anymore.
+ */
+static void remove_bodies(const http_cache_t *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (dir == NULL) return;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (is_body_name(ent->d_name)) unlinkat(dirfd(dir), ent->d_name, 0);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Finds the slot of a URL, the index has to be locked.
+ * @return Slot of the URL, -1 if it isn't cached.
+ */
+static long find_slot(const http_cache_t *cache, const char *url, uint64_t key) {
+    for (size_t i = key & (HTTP_CACHE_SLOTS - 1);; i = (i + 1) & (HTTP_CACHE_SLOTS - 1)) {
+        const http_cache_entry_t *entry = &cache->entries[i];
+        if (entry->key == 0) return -1;
+        if (entry->key == key && strcmp(entry->url, url) == 0) return (long) i;
+    }
+}
+
+/**
+ * @brief Removes an entry from the index and deletes its body unless another URL shares it.
+ * @details Entries behind it are shifted back into the gap, so probing never needs tombstones.
+ */
+static void evict(http_cache_t *cache, size_t slot) {
+    http_cache_entry_t *entry = &cache->entries[slot];
+    bool shared = false;
+    for (size_t i = 0; i < HTTP_CACHE_SLOTS && !shared; ++i) {
+        const http_cache_entry_t *other = &cache->entries[i];
+        shared = i != slot && other->key != 0 && other->crc == entry->crc && other->size == entry->size &&
+                 other->variant == entry->variant;
+    }
+    if (!shared) {
+        char *path = body_path(cache, entry->crc, entry->size, entry->variant);
+        if (path != NULL) unlink(path);
+        free(path);
+    }
+    cache->header->total_size -= entry->size;
+    cache->header->count--;
+
+    size_t gap = slot;
+    for (size_t i = (gap + 1) & (HTTP_CACHE_SLOTS - 1); cache->entries[i].key != 0;
+         i = (i + 1) & (HTTP_CACHE_SLOTS - 1)) {
+        size_t home = cache->entries[i].key & (HTTP_CACHE_SLOTS - 1);
+        /** An entry whose home lies between the gap and itself has to stay */
+        bool stays = gap <= i ? gap < home && home <= i : gap < home || home <= i;
+        if (stays) continue;
+        cache->entries[gap] = cache->entries[i];
+        gap = i;
+    }
+    memset(&cache->entries[gap], 0, sizeof(http_cache_entry_t));
+}
+
+/** Evicts the least recently used URL */
+static void evict_oldest(http_cache_t *cache) {
+    size_t oldest = HTTP_CACHE_SLOTS;
+    for (size_t i = 0; i < HTTP_CACHE_SLOTS; ++i) {
+        if (cache->entries[i].key == 0) continue;
+        if (oldest == HTTP_CACHE_SLOTS || cache->entries[i].last_used < cache->entries[oldest].last_used) oldest = i;
+    }
+    if (oldest < HTTP_CACHE_SLOTS) evict(cache, oldest);
+}
+
+int http_cache_open(http_cache_t *cache, const char *dir, long long max_size) {
+    memset(cache, 0, sizeof(http_cache_t));
+    cache->fd = -1;
+    cache->max_size = max_size;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) return -1;
+    if ((cache->dir = strdup(dir)) == NULL) return -1;
+    char *path = cache_path(cache, "index");
+    if (path == NULL) {
+        http_cache_close(cache);
+        return -1;
+    }
+    cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(path);
+    if (cache->fd < 0 || flock(cache->fd, LOCK_EX) < 0) {
+        http_cache_close(cache);
+        return -1;
+    }
+
+    /** A new or foreign index is set up empty */
+    cache->map_len = sizeof(http_cache_header_t) + HTTP_CACHE_SLOTS * sizeof(http_cache_entry_t);
+    struct stat st;
+    bool fresh = fstat(cache->fd, &st) < 0 || (size_t) st.st_size != cache->map_len;
+    if (fresh && (ftruncate(cache->fd, 0) < 0 || ftruncate(cache->fd, cache->map_len) < 0)) {
+        http_cache_close(cache);
+        return -1;
+    }
+    void *map = mmap(NULL, cache->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (map == MAP_FAILED) {
+        http_cache_close(cache);
+        return -1;
+    }
+    cache->header = map;
+    cache->entries = (http_cache_entry_t *) ((char *) map + sizeof(http_cache_header_t));
+    if (cache->header->magic != HTTP_CACHE_MAGIC || cache->header->slots != HTTP_CACHE_SLOTS) {
+        remove_bodies(cache);
+        memset(map, 0, cache->map_len);
+        cache->header->magic = HTTP_CACHE_MAGIC;
+        cache->header->slots = HTTP_CACHE_SLOTS;
+    }
+    flock(cache->fd, LOCK_UN);
+    return 0;
+}
+
+void http_cache_close(http_cache_t *cache) {
+    if (cache->header != NULL) munmap(cache->header, cache->map_len);
+    if (cache->fd >= 0) close(cache->fd);
+    free(cache->dir);
+    memset(cache, 0, sizeof(http_cache_t));
+    cache->fd = -1;
+}
+
+int http_cache_lookup(http_cache_t *cache, const char *url, http_cache_entry_t *entry) {
+    if (strlen(url) >= HTTP_CACHE_URL_LEN || flock(cache->fd, LOCK_SH) < 0) return 0;
+    long slot = find_slot(cache, url, hash_url(url));
+    if (slot >= 0) *entry = cache->entries[slot];
+    flock(cache->fd, LOCK_UN);
+    return slot >= 0;
+}
+
+int http_cache_open_body(http_cache_t *cache, const http_cache_entry_t *entry) {
+    char *path = body_path(cache, entry->crc, entry->size, entry->variant);
+    if (path == NULL) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0 || flock(cache->fd, LOCK_EX) < 0) return fd;
+    long slot = find_slot(cache, entry->url, entry->key);
+    if (slot >= 0) cache->entries[slot].last_used = ++cache->header->clock;
+    flock(cache->fd, LOCK_UN);
+    return fd;
+}
+
+int http_cache_create_temp(http_cache_t *cache, char **path) {
+    *path = cache_path(cache, "tmp.XXXXXX");
+    if (*path == NULL) return -1;
+    int fd = mkstemp(*path);
+    /** Bodies are shared with other users of the cache */
+    if (fd >= 0) fchmod(fd, 0644);
+    if (fd < 0) {
+        free(*path);
+        *path = NULL;
+    }
+    return fd;
+}
+
+/**
+ * @brief Computes the CRC-32 of a file through a read-only mapping.
+ * @return 0 on success, -1 on errors.
+ */
+static int file_crc(int fd, long long size, uint32_t *crc) {
+    uLong value = crc32(0L, Z_NULL, 0);
+    if (size > 0) {
+        unsigned char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) return -1;
+        madvise(map, size, MADV_SEQUENTIAL);
+        for (long long pos = 0; pos < size;) {
+            uInt len = size - pos < UINT_MAX ? (uInt) (size - pos) : UINT_MAX;
+            value = crc32(value, map + pos, len);
+            pos += len;
+        }
+        munmap(map, size);
+    }
+    *crc = (uint32_t) value;
+    return 0;
+}
+
+/**
+ * @brief Compares a received body with a cached one of the same size.
+ * @return 1 if they are equal, 0 if not and -1 on errors.
+ */
+static int same_content(int fd, const char *path, long long size) {
+    if (size == 0) return 1;
+    int other_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (other_fd < 0) return -1;
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    unsigned char *other = mmap(NULL, size, PROT_READ, MAP_SHARED, other_fd, 0);
+    close(other_fd);
+    int ret = map == MAP_FAILED || other == MAP_FAILED ? -1 : memcmp(map, other, size) == 0;
+    if (map != MAP_FAILED) munmap(map, size);
+    if (other != MAP_FAILED) munmap(other, size);
+    return ret;
+}
+
+int http_cache_store(http_cache_t *cache, const char *url, int temp_fd, const char *temp_path, const char *etag,
+                     size_t etag_len, const char *last_modified, size_t last_modified_len) {
+    struct stat st;
+    if (fstat(temp_fd, &st) < 0) return -1;
+    if (strlen(url) >= HTTP_CACHE_URL_LEN || etag_len >= HTTP_CACHE_VALIDATOR_LEN ||
+        last_modified_len >= HTTP_CACHE_VALIDATOR_LEN || st.st_size > cache->max_size) {
+        return 1;
+    }
+    uint32_t crc;
+    if (file_crc(temp_fd, st.st_size, &crc) < 0 || flock(cache->fd, LOCK_EX) < 0) return -1;
+
+    /** Make room, a replaced body of the URL goes first */
+    uint64_t key = hash_url(url);
+    long slot = find_slot(cache, url, key);
+    if (slot >= 0) evict(cache, slot);
+    while (cache->header->count > 0 && (cache->header->total_size + st.st_size > cache->max_size ||
+                                        cache->header->count + 1 > HTTP_CACHE_SLOTS / 4 * 3)) {
+        evict_oldest(cache);
+    }
+
+    /** The same content may be cached for another URL already, or different content with the same CRC-32 */
+    int ret = 1;
+    uint32_t variant;
+    for (variant = 0; variant < HTTP_CACHE_VARIANTS && ret > 0; ++variant) {
+        char *path = body_path(cache, crc, st.st_size, variant);
+        if (path == NULL) {
+            ret = -1;
+        } else if (access(path, F_OK) != 0) {
+            ret = rename(temp_path, path);
+        } else {
+            int same = same_content(temp_fd, path, st.st_size);
+            ret = same < 0 ? -1 : same ? unlink(temp_path) : 1;
+        }
+        free(path);
+    }
+    if (ret == 0) {
+        size_t i = key & (HTTP_CACHE_SLOTS - 1);
+        while (cache->entries[i].key != 0) i = (i + 1) & (HTTP_CACHE_SLOTS - 1);
+        http_cache_entry_t *entry = &cache->entries[i];
+        memset(entry, 0, sizeof(http_cache_entry_t));
+        entry->key = key;
+        entry->last_used = ++cache->header->clock;
+        entry->size = st.st_size;
+        entry->crc = crc;
+        entry->variant = variant - 1;
+        strcpy(entry->url, url);
+        if (etag != NULL) memcpy(entry->etag, etag, etag_len);
+        if (last_modified != NULL) memcpy(entry->last_modified, last_modified, last_modified_len);
+        cache->header->total_size += st.st_size;
+        cache->header->count++;
+    }
+    flock(cache->fd, LOCK_UN);
+    return ret;
+}
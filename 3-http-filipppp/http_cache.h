@@ -0,0 +1,140 @@
+/**
+ * @file http_cache.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief On-disk cache of downloaded files for the client, shared by all clients using the same directory.
+ * @details Bodies are stored decoded and content addressed: the file name is the CRC-32 and the size of the body, so
+ * URLs serving the same content share one file. A CRC-32 isn't collision resistant, so a body is only shared after
+ * comparing the contents, different bodies with the same CRC-32 and size get a variant number in their name. An index maps URLs to their body and the ETag and Last-Modified the
+ * server sent. Cached URLs are requested with If-None-Match / If-Modified-Since, a 304 is then served from the cache.
+ *
+ * The index is a fixed size open addressing hash table in a file (DIR/index) which is mmapped, so a lookup touches a
+ * few pages instead of reading anything. Processes sharing the directory serialize index updates with flock(), bodies
+ * are received into temporary files and renamed into place, so readers never see a partial body. Once the bodies
+ * exceed the size limit or the table fills up, the least recently used URLs are evicted.
+ */
+
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Slots of the index, a power of two, at most three quarters are used */
+#define HTTP_CACHE_SLOTS 4096
+/** Longest URL which is cached */
+#define HTTP_CACHE_URL_LEN 512
+/** Longest ETag or Last-Modified which is kept, a URL with a longer one isn't cached */
+#define HTTP_CACHE_VALIDATOR_LEN 128
+/** Different bodies with the same CRC-32 and size that are kept, further ones aren't cached */
+#define HTTP_CACHE_VARIANTS 16
+/** Default limit of the total size of the bodies */
+#define HTTP_CACHE_DEFAULT_MAX (1024LL * 1024 * 1024)
+
+/** A cached URL as stored in the index */
+typedef struct {
+    /** Hash of the URL, 0 for empty slots */
+    uint64_t key;
+    /** Value of the clock of the index when the URL was used last */
+    uint64_t last_used;
+    /** Size, CRC-32 and variant of the body, its file name */
+    long long size;
+    uint32_t crc;
+    uint32_t variant;
+    char url[HTTP_CACHE_URL_LEN];
+    /** Validators of the body, empty if the server sent none */
+    char etag[HTTP_CACHE_VALIDATOR_LEN];
+    char last_modified[HTTP_CACHE_VALIDATOR_LEN];
+} http_cache_entry_t;
+
+/** Start of the index file, followed by HTTP_CACHE_SLOTS entries */
+typedef struct {
+    uint32_t magic;
+    uint32_t slots;
+    /** Incremented by every use, orders the entries for eviction */
+    uint64_t clock;
+    /** Sum of the sizes of all entries */
+    long long total_size;
+    uint32_t count;
+} http_cache_header_t;
+
+/** An opened cache directory */
+typedef struct {
+    char *dir;
+    /** Index file, also the lock */
+    int fd;
+    http_cache_header_t *header;
+    http_cache_entry_t *entries;
+    size_t map_len;
+    long long max_size;
+} http_cache_t;
+
+/**
+ * @brief Opens a cache directory, the directory and its index are created if they don't exist.
+ * @details An index of another layout is reset, the bodies it referenced are removed then so they don't escape the
+ * size limit. Has to be closed with http_cache_close().
+ *
+ * @param cache Cache to be opened.
+ * @param dir Cache directory.
+ * @param max_size Limit of the total size of the bodies.
+ * @return 0 on success, -1 on errors.
+ */
+int http_cache_open(http_cache_t *cache, const char *dir, long long max_size);
+
+/**
+ * @brief Unmaps the index and frees the cache.
+ * @param cache Cache from http_cache_open().
+ */
+void http_cache_close(http_cache_t *cache);
+
+/**
+ * @brief Looks up a URL.
+ * @details The entry is copied since another process may change the index right after.
+ *
+ * @param cache Opened cache.
+ * @param url URL to look up.
+ * @param entry Set to the entry of the URL.
+ * @return 1 if the URL is cached, 0 if not.
+ */
+int http_cache_lookup(http_cache_t *cache, const char *url, http_cache_entry_t *entry);
+
+/**
+ * @brief Opens the body of an entry for reading and marks the URL as recently used.
+ * @param cache Opened cache.
+ * @param entry Entry from http_cache_lookup().
+ * @return File descriptor, -1 if the body has been evicted in the meantime.
+ */
+int http_cache_open_body(http_cache_t *cache, const http_cache_entry_t *entry);
+
+/**
+ * @brief Creates a temporary file in the cache directory for receiving a body.
+ * @param cache Opened cache.
+ * @param path Set to the path of the file, to be freed.
+ * @return File descriptor open for reading and writing, -1 on errors.
+ */
+int http_cache_create_temp(http_cache_t *cache, char **path);
+
+/**
+ * @brief Stores a completely received body for a URL, replacing an older one.
+ * @details The temporary file is renamed to its content address, or removed if the same content is cached already,
+ * which is checked byte by byte.
+ * Its descriptor stays valid either way. Least recently used URLs are evicted to make room.
+ *
+ * @param cache Opened cache.
+ * @param url URL of the body.
+ * @param temp_fd Descriptor from http_cache_create_temp().
+ * @param temp_path Path from http_cache_create_temp().
+ * @param etag ETag of the response, NULL if there is none, does not have to be null-terminated.
+ * @param etag_len Length of the ETag.
+ * @param last_modified Last-Modified of the response, NULL if there is none.
+ * @param last_modified_len Length of the Last-Modified value.
+ * @return 0 on success, 1 if the body or its URL or validators exceed the limits of the cache or too many bodies share
+ * its CRC-32 and size, -1 on errors. Unless
+ * 0 is returned the temporary file is left to the caller.
+ */
+int http_cache_store(http_cache_t *cache, const char *url, int temp_fd, const char *temp_path, const char *etag,
+                     size_t etag_len, const char *last_modified, size_t last_modified_len);
+
+#endif
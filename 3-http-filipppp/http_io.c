@@ -0,0 +1,146 @@
+/**
+ * @file http_io.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "http_io.h"
+
+int io_buffer_init(io_buffer_t *buf, size_t cap) {
+    memset(buf, 0, sizeof(io_buffer_t));
+    buf->data = malloc(cap + 1);
+    if (buf->data == NULL) return -1;
+    buf->data[0] = '\0';
+    buf->cap = cap;
+    return 0;
+}
+
+void io_buffer_free(io_buffer_t *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(io_buffer_t));
+}
+
+ssize_t io_buffer_read(io_buffer_t *buf, int fd) {
+    if (buf->len == buf->cap) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t n = read(fd, buf->data + buf->len, buf->cap - buf->len);
+    if (n > 0) {
+        buf->len += n;
+        buf->data[buf->len] = '\0';
+    }
+    return n;
+}
+
+void io_buffer_consume(io_buffer_t *buf, size_t n) {
+    memmove(buf->data, buf->data + n, buf->len - n);
+    buf->len -= n;
+    buf->data[buf->len] = '\0';
+    buf->scanned = 0;
+}
+
+size_t io_buffer_head(io_buffer_t *buf) {
+    size_t head_len = http_head_length(buf->data, buf->len, buf->scanned);
+    /** The last three bytes may be the start of the terminator */
+    if (head_len == 0) buf->scanned = buf->len > 3 ? buf->len - 3 : 0;
+    return head_len;
+}
+
+size_t http_head_length(const char *buff, size_t len, size_t from) {
+    /** Jump from CR to CR instead of comparing at every position */
+    for (const char *p = buff + from; len >= 4 && p <= buff + len - 4; ++p) {
+        p = memchr(p, '\r', buff + len - 3 - p);
+        if (p == NULL) return 0;
+        if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') return p + 4 - buff;
+    }
+    return 0;
+}
+
+const char *http_header_value(const char *line, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    if (len <= name_len || line[name_len] != ':' || strncasecmp(line, name, name_len) != 0) return NULL;
+    const char *value = line + name_len + 1;
+    while (value < line + len && (*value == ' ' || *value == '\t')) value++;
+    return value;
+}
+
+long long http_content_length(const char *value, const char *end) {
+    while (end > value && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (value == end) return -1;
+    long long length = 0;
+    for (; value < end; ++value) {
+        if (*value < '0' || *value > '9' || length > (LLONG_MAX - (*value - '0')) / 10) return -1;
+        length = length * 10 + *value - '0';
+    }
+    return length;
+}
+
+bool http_has_token(const char *value, const char *end, const char *token, size_t token_len) {
+    while (value < end) {
+        const char *comma = memchr(value, ',', end - value);
+        const char *element_end = comma != NULL ? comma : end;
+        while (value < element_end && (*value == ' ' || *value == '\t')) value++;
+        const char *last = element_end;
+        while (last > value && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) last--;
+        if ((size_t) (last - value) == token_len && strncasecmp(value, token, token_len) == 0) return true;
+        value = element_end + 1;
+    }
+    return false;
+}
+
+int io_sendv(int fd, const struct iovec *parts, int count, size_t *pos, int flags) {
+    for (;;) {
+        /** Skip what is already sent */
+        struct iovec iov[count];
+        int iov_count = 0;
+        size_t skip = *pos;
+        for (int i = 0; i < count; ++i) {
+            if (skip >= parts[i].iov_len) {
+                skip -= parts[i].iov_len;
+                continue;
+            }
+            iov[iov_count].iov_base = (char *) parts[i].iov_base + skip;
+            iov[iov_count].iov_len = parts[i].iov_len - skip;
+            iov_count++;
+            skip = 0;
+        }
+        if (iov_count == 0) return 1;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | flags);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        *pos += n;
+    }
+}
+
+int io_send(int fd, const void *buff, size_t len, size_t *pos) {
+    struct iovec part = {(void *) buff, len};
+    return io_sendv(fd, &part, 1, pos, 0);
+}
+
+int io_write_all(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = write(fd, ptr, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file http_io.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Buffered connection layer shared by the server and the client side tools.
+ * @details Every HTTP connection of the server, the proxy, the load generator and the downloaders does the same
+ * things: receive into a buffer until a head ending with an empty line is complete, hand the head to a parser,
+ * consume it and keep whatever follows, and send heads and bodies without blocking. This module does them once:
+ *
+ * - io_buffer_t is a receive buffer whose end of head search resumes where the last one stopped, so a head arriving
+ *   in many small reads is scanned only once.
+ * - io_sendv() sends several buffers with one sendmsg() and remembers how far it got, it is the write queue of a
+ *   non-blocking connection. io_write_all() writes to blocking files and pipes.
+ * - http_header_value() matches one header line, the request parser of the server, the response parser
+ *   (http_response.c) and the proxy (proxy.c) all use it, as well as the strict parsing of Content-Length and of
+ *   token lists like Connection in http_content_length() and http_has_token().
+ *
+ * The body framing (Content-Length, chunked, end of connection) lives in http_response.c.
+ */
+
+#ifndef HTTP_IO_H
+#define HTTP_IO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/** Receive buffer, data[0..len) is received and not consumed yet */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    /** Where the search for the end of the head continues */
+    size_t scanned;
+} io_buffer_t;
+
+/**
+ * @brief Allocates an empty buffer.
+ * @details The data is always followed by a null byte, so text can be parsed with string functions.
+ *
+ * @param buf Buffer to be initialized, freed with io_buffer_free().
+ * @param cap Capacity in bytes, the terminating null byte comes on top.
+ * @return 0 on success, -1 if the memory can't be allocated.
+ */
+int io_buffer_init(io_buffer_t *buf, size_t cap);
+
+/**
+ * @brief Frees the memory of a buffer.
+ * @param buf Buffer from io_buffer_init(), or zeroed.
+ */
+void io_buffer_free(io_buffer_t *buf);
+
+/**
+ * @brief Reads once from a file descriptor into the free space of the buffer.
+ * @param buf Buffer.
+ * @param fd Socket, pipe or file, blocking or not.
+ * @return Amount of bytes read, 0 at the end of the data and -1 on errors with errno set, EAGAIN if a non-blocking
+ * descriptor has nothing to read, EINTR if a signal arrived (so callers can check for interruptions) and ENOBUFS if
+ * the buffer is full.
+ */
+ssize_t io_buffer_read(io_buffer_t *buf, int fd);
+
+/**
+ * @brief Removes bytes from the start of the buffer, e.g. a parsed head, the rest is moved to the front.
+ * @param buf Buffer.
+ * @param n Amount of bytes, at most len.
+ */
+void io_buffer_consume(io_buffer_t *buf, size_t n);
+
+/**
+ * @brief Checks whether the buffer starts with a complete head, i.e. a start line and headers up to the empty line.
+ * @details The search resumes where the previous call stopped, consuming starts it over.
+ *
+ * @param buf Buffer.
+ * @return Length of the head including the empty line, 0 if it is incomplete.
+ */
+size_t io_buffer_head(io_buffer_t *buf);
+
+/**
+ * @brief Finds the end of a head.
+ * @param buff Received data, starting with the start line.
+ * @param len Amount of received data.
+ * @param from Offset before which no "\r\n\r\n" can end, 0 if unknown.
+ * @return Length of the head including the empty line, 0 if it is incomplete.
+ */
+size_t http_head_length(const char *buff, size_t len, size_t from);
+
+/**
+ * @brief Returns the value of a header line if it has the given name.
+ * @param line Header line, not necessarily null-terminated.
+ * @param len Length of the line without its line break.
+ * @param name Header name, compared case-insensitively.
+ * @return Value without leading whitespace, pointing into the line, NULL if the line has another name.
+ */
+const char *http_header_value(const char *line, size_t len, const char *name);
+
+/**
+ * @brief Parses the value of a Content-Length header.
+ * @details Only plain digits are accepted, no sign, no list and nothing behind them but whitespace, so every hop
+ * reading the header finds the same length. Anything lenient here lets a client hide a request in a body.
+ *
+ * @param value Value returned by http_header_value().
+ * @param end End of the line, a trailing CR is ignored.
+ * @return Length, -1 if the value is malformed or too big.
+ */
+long long http_content_length(const char *value, const char *end);
+
+/**
+ * @brief Checks whether a comma-separated header value contains a token, e.g. "close" in Connection.
+ * @param value Value returned by http_header_value().
+ * @param end End of the line, a trailing CR is ignored.
+ * @param token Token, compared case-insensitively.
+ * @param token_len Length of the token.
+ * @return True if one of the elements is the token.
+ */
+bool http_has_token(const char *value, const char *end, const char *token, size_t token_len);
+
+/**
+ * @brief Sends several buffers as one without blocking.
+ * @details Uses one sendmsg() for all parts, so e.g. a chunk header, the chunk and its trailing CRLF end up in the
+ * same segment.
+ *
+ * @param fd Socket.
+ * @param parts Buffers to be sent, they are not modified.
+ * @param count Amount of buffers.
+ * @param pos Amount of bytes of all buffers together which are already sent, advanced by this function.
+ * @param flags Flags for sendmsg() besides MSG_NOSIGNAL, e.g. MSG_MORE if more data follows right away.
+ * @return 1 if everything is sent, 0 if the socket is full and -1 on errors.
+ */
+int io_sendv(int fd, const struct iovec *parts, int count, size_t *pos, int flags);
+
+/**
+ * @brief Sends one buffer without blocking, see io_sendv().
+ */
+int io_send(int fd, const void *buff, size_t len, size_t *pos);
+
+/**
+ * @brief Writes all data to a blocking file descriptor.
+ * @param fd File, pipe or socket.
+ * @param data Data to be written.
+ * @param len Amount of data.
+ * @return 0 on success, -1 on errors.
+ */
+int io_write_all(int fd, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,180 @@
+/**
+ * @file http_response.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "http_response.h"
+#include "compression.h"
+#include "http_io.h"
+
+/** Chunk sizes with more hex digits would overflow */
+#define CHUNK_SIZE_DIGITS 15
+
+static const char *find(const char *buff, size_t len, const char *needle) {
+    size_t needle_len = strlen(needle);
+    for (size_t i = 0; i + needle_len <= len; ++i) {
+        if (memcmp(buff + i, needle, needle_len) == 0) return buff + i;
+    }
+    return NULL;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+ssize_t http_response_head(http_response_t *res, const char *buff, size_t len, bool head_request) {
+    size_t head_len = http_head_length(buff, len, 0);
+    if (head_len == 0) return 0;
+    /** Behind the line break of the last header */
+    const char *end = buff + head_len - 2;
+
+    if (end - buff < 12 || strncmp(buff, "HTTP/1.", 7) != 0 || buff[8] != ' ') return -1;
+    res->status = 0;
+    for (int i = 9; i < 12; ++i) {
+        if (buff[i] < '0' || buff[i] > '9') return -1;
+        res->status = res->status * 10 + buff[i] - '0';
+    }
+    /** HTTP/1.0 closes the connection unless asked otherwise */
+    res->keep_alive = buff[7] == '1';
+    res->encoding = enc_identity;
+    res->content_length = -1;
+    bool chunked = false;
+    bool transfer_encoding = false;
+
+    for (const char *line = (const char *) memchr(buff, '\n', end - buff) + 1; line < end;) {
+        const char *eol = memchr(line, '\n', end - line);
+        size_t line_len = eol - line;
+        const char *value;
+        if ((value = http_header_value(line, line_len, "Content-Length")) != NULL) {
+            /** The proxy relays the head as it is, so the client must find the same end of the body as we do */
+            long long length = http_content_length(value, eol);
+            if (length < 0 || (res->content_length >= 0 && length != res->content_length)) return -1;
+            res->content_length = length;
+        } else if ((value = http_header_value(line, line_len, "Transfer-Encoding")) != NULL) {
+            transfer_encoding = true;
+            chunked = http_has_token(value, eol, "chunked", strlen("chunked"));
+        } else if ((value = http_header_value(line, line_len, "Connection")) != NULL) {
+            if (http_has_token(value, eol, "close", strlen("close"))) res->keep_alive = false;
+            else if (http_has_token(value, eol, "keep-alive", strlen("keep-alive"))) res->keep_alive = true;
+        } else if ((value = http_header_value(line, line_len, "Content-Encoding")) != NULL) {
+            res->encoding = encoding_from_name(value, strcspn(value, " \t\r\n"));
+        }
+        line = eol + 1;
+    }
+
+    /** Framed both ways, which is how responses are split for caches and clients behind a proxy */
+    if (transfer_encoding && res->content_length >= 0) return -1;
+
+    res->chunk = chunk_size;
+    res->remaining = 0;
+    if (head_request || (res->status >= 100 && res->status < 200) || res->status == 204 || res->status == 304) {
+        res->framing = framing_none;
+    } else if (chunked) {
+        res->framing = framing_chunked;
+    } else if (res->content_length >= 0) {
+        res->framing = framing_length;
+        res->remaining = res->content_length;
+    } else {
+        res->framing = framing_close;
+        res->keep_alive = false;
+    }
+    return end + 2 - buff;
+}
+
+const char *http_response_header(const char *buff, size_t head_len, const char *name, size_t *len) {
+    const char *end = buff + head_len - 2;
+    for (const char *line = (const char *) memchr(buff, '\n', head_len) + 1; line < end;) {
+        const char *eol = memchr(line, '\n', end - line);
+        const char *value = http_header_value(line, eol - line, name);
+        if (value != NULL) {
+            const char *value_end = eol;
+            while (value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                value_end--;
+            }
+            *len = value_end - value;
+            return value;
+        }
+        line = eol + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hands out up to the remaining amount of body bytes.
+ */
+static void take_data(http_response_t *res, const char *buff, size_t len, size_t *consumed, const char **data,
+                      size_t *data_len) {
+    size_t n = res->remaining < len ? (size_t) res->remaining : len;
+    res->remaining -= n;
+    *consumed += n;
+    *data = n > 0 ? buff : NULL;
+    *data_len = n;
+}
+
+int http_response_body(http_response_t *res, const char *buff, size_t len, size_t *consumed, const char **data,
+                       size_t *data_len) {
+    *consumed = 0;
+    *data = NULL;
+    *data_len = 0;
+    switch (res->framing) {
+        case framing_none:
+            return 1;
+        case framing_close:
+            *consumed = len;
+            *data = len > 0 ? buff : NULL;
+            *data_len = len;
+            return 0;
+        case framing_length:
+            take_data(res, buff, len, consumed, data, data_len);
+            return res->remaining == 0;
+        case framing_chunked:
+            break;
+        default:
+            return -1;
+    }
+
+    /** Skip framing until there is chunk data to hand out */
+    for (;;) {
+        const char *p = buff + *consumed;
+        size_t avail = len - *consumed;
+        switch (res->chunk) {
+            case chunk_size:
+            case chunk_trailer: {
+                const char *eol = find(p, avail, "\r\n");
+                if (eol == NULL) return 0;
+                size_t line_len = eol - p;
+                *consumed += line_len + 2;
+                if (res->chunk == chunk_trailer) {
+                    if (line_len == 0) return 1;
+                    break;
+                }
+                res->remaining = 0;
+                size_t i = 0;
+                for (int v; i < line_len && i < CHUNK_SIZE_DIGITS && (v = hex_value(p[i])) >= 0; ++i) {
+                    res->remaining = res->remaining << 4 | v;
+                }
+                /** Chunk extensions after ';' are ignored */
+                if (i == 0 || (i < line_len && p[i] != ';' && p[i] != ' ' && p[i] != '\t')) return -1;
+                res->chunk = res->remaining == 0 ? chunk_trailer : chunk_data;
+                break;
+            }
+            case chunk_data:
+                if (avail == 0) return 0;
+                take_data(res, p, avail, consumed, data, data_len);
+                if (res->remaining == 0) res->chunk = chunk_crlf;
+                return 0;
+            case chunk_crlf:
+                if (avail < 2) return 0;
+                if (p[0] != '\r' || p[1] != '\n') return -1;
+                *consumed += 2;
+                res->chunk = chunk_size;
+                break;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file http_response.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Incremental parser for HTTP/1.x responses of the client side tools and the reverse proxy.
+ * @details The parser works on the caller's receive buffer and never copies: http_response_head() parses the status
+ * line and headers once they are complete, http_response_body() then walks through the body framing
+ * (Content-Length, chunked transfer coding or the end of the connection) and hands out slices of body data that point
+ * into the buffer. Chunk sizes and trailers are skipped without ever reaching the caller.
+ */
+
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** How the end of a response body is found */
+typedef enum {
+    framing_none = 0,
+    framing_length = 1,
+    framing_chunked = 2,
+    framing_close = 3
+} framing_e;
+
+/** Position inside a chunked body */
+typedef enum {
+    chunk_size = 0,
+    chunk_data = 1,
+    chunk_crlf = 2,
+    chunk_trailer = 3
+} chunk_e;
+
+/** A response being received */
+typedef struct {
+    int status;
+    /** False if the server closes the connection after this response */
+    bool keep_alive;
+    /** Encoding from Content-Encoding (encoding_e of compression.h), -1 if unknown */
+    int encoding;
+    /** Content-Length, -1 if not sent */
+    long long content_length;
+    framing_e framing;
+    chunk_e chunk;
+    /** Bytes left of the body or of the current chunk */
+    unsigned long long remaining;
+} http_response_t;
+
+/**
+ * @brief Parses the status line and the headers.
+ * @details Responses to HEAD requests have no body even if they carry a Content-Length, head_request covers that.
+ *
+ * @param res Response to be filled.
+ * @param buff Received data, starting with the status line.
+ * @param len Amount of received data.
+ * @param head_request True if the request was a HEAD request.
+ * @return Length of the status line and headers including the empty line, 0 if they are incomplete and -1 on protocol
+ * errors, including a Content-Length that isn't plain digits, duplicates that disagree or one together with
+ * Transfer-Encoding.
+ */
+ssize_t http_response_head(http_response_t *res, const char *buff, size_t len, bool head_request);
+
+/**
+ * @brief Looks up a header of a response whose head has been parsed.
+ * @param buff Received data, starting with the status line.
+ * @param head_len Length returned by http_response_head().
+ * @param name Header name, compared case-insensitively.
+ * @param len Set to the length of the value without trailing whitespace.
+ * @return Value of the first header with that name, pointing into buff, NULL if there is none.
+ */
+const char *http_response_header(const char *buff, size_t head_len, const char *name, size_t *len);
+
+/**
+ * @brief Takes the next slice of body data out of received data.
+ * @details The caller repeats the call on the data after the consumed bytes until the body is complete or nothing is
+ * consumed anymore, then the remaining bytes are an incomplete chunk header and have to be kept for the next call.
+ *
+ * @param res Response whose head has been parsed.
+ * @param buff Received data after the bytes consumed so far.
+ * @param len Amount of received data.
+ * @param consumed Set to the amount of bytes consumed, framing and body data.
+ * @param data Set to the body data among them, NULL if there is none.
+ * @param data_len Set to the amount of body data.
+ * @return 1 if the body is complete, 0 if it continues and -1 on protocol errors.
+ */
+int http_response_body(http_response_t *res, const char *buff, size_t len, size_t *consumed, const char **data,
+                       size_t *data_len);
+
+#endif
@@ -0,0 +1,360 @@
+/**
+ * @file loadgen.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "loadgen.h"
+#include "http_response.h"
+#include "http_io.h"
+
+/** Events fetched per epoll_wait() */
+#define LOADGEN_EVENTS 256
+
+typedef enum {
+    /** No request in flight, the connection may still be open */
+    lg_idle = 0,
+    lg_connecting = 1,
+    lg_writing = 2,
+    lg_headers = 3,
+    lg_body = 4
+} lg_state_e;
+
+/** One connection with the response being received */
+typedef struct {
+    int fd;
+    /** Events registered with epoll, 0 if the fd isn't registered */
+    unsigned int events;
+    lg_state_e state;
+    size_t path;
+    size_t written;
+    /** True once a response has been received over the fd, a close before the next response is then no error */
+    bool reused;
+    bool retried;
+    long started_us;
+    http_response_t res;
+    unsigned long long body_bytes;
+    io_buffer_t in;
+} lg_conn_t;
+
+typedef struct {
+    const loadgen_options_t *options;
+    loadgen_result_t *result;
+    int epoll_fd;
+    lg_conn_t *conns;
+    /** Complete request of every path */
+    char **requests;
+    size_t *request_lens;
+    unsigned long long issued;
+    /** Connections with a request in flight */
+    size_t active;
+    long deadline_us;
+} loadgen_t;
+
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/**
+ * @brief Changes the events a connection waits for, without a syscall if they stay the same.
+ */
+static int conn_watch(loadgen_t *lg, lg_conn_t *c, unsigned int events) {
+    if (c->events == events) return 0;
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    if (epoll_ctl(lg->epoll_fd, c->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ev) < 0) return -1;
+    c->events = events;
+    return 0;
+}
+
+static void conn_close(lg_conn_t *c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->events = 0;
+    c->reused = false;
+}
+
+static void conn_stop(loadgen_t *lg, lg_conn_t *c) {
+    conn_close(c);
+    if (c->state != lg_idle) lg->active--;
+    c->state = lg_idle;
+}
+
+/**
+ * @brief Starts a non-blocking connect, the connection becomes writable once it is established.
+ */
+static int conn_connect(loadgen_t *lg, lg_conn_t *c) {
+    c->fd = socket(lg->options->addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((connect(c->fd, lg->options->addr, lg->options->addr_len) < 0 && errno != EINPROGRESS)
+        || conn_watch(lg, c, EPOLLOUT) < 0) {
+        conn_close(c);
+        return -1;
+    }
+    c->state = lg_connecting;
+    return 0;
+}
+
+static bool may_issue(loadgen_t *lg) {
+    if (lg->options->requests > 0 && lg->issued >= lg->options->requests) return false;
+    return lg->deadline_us == 0 || now_us() < lg->deadline_us;
+}
+
+static void conn_write(loadgen_t *lg, lg_conn_t *c);
+
+/**
+ * @brief Sends the next request over a connection, or stops it if no more requests are to be sent.
+ * @details A request whose connection can't be opened counts as an error and the next one is tried.
+ */
+static void conn_next(loadgen_t *lg, lg_conn_t *c) {
+    while (may_issue(lg)) {
+        if (c->state == lg_idle) lg->active++;
+        c->path = lg->issued++ % lg->options->path_count;
+        c->written = 0;
+        c->retried = false;
+        c->started_us = now_us();
+        if (c->fd >= 0) {
+            c->state = lg_writing;
+            conn_write(lg, c);
+            return;
+        }
+        if (conn_connect(lg, c) == 0) return;
+        lg->result->errors++;
+    }
+    conn_stop(lg, c);
+}
+
+static void conn_fail(loadgen_t *lg, lg_conn_t *c) {
+    lg->result->errors++;
+    conn_close(c);
+    conn_next(lg, c);
+}
+
+/**
+ * @brief Sends the request again over a new connection.
+ * @details Servers close idle kept alive connections at any time, a request which found its connection closed before
+ * any byte of the response arrived is therefore retried once.
+ */
+static void conn_retry(loadgen_t *lg, lg_conn_t *c) {
+    conn_close(c);
+    c->retried = true;
+    c->written = 0;
+    if (conn_connect(lg, c) < 0) conn_fail(lg, c);
+}
+
+static void response_done(loadgen_t *lg, lg_conn_t *c) {
+    long latency = now_us() - c->started_us;
+    metrics_record_request(&lg->result->metrics, c->res.status, c->body_bytes, latency);
+    if ((unsigned long long) latency > lg->result->max_latency_us) lg->result->max_latency_us = latency;
+    /** Nothing is pipelined, so bytes after the response are garbage */
+    io_buffer_consume(&c->in, c->in.len);
+    c->reused = true;
+    if (!c->res.keep_alive) conn_close(c);
+    conn_next(lg, c);
+}
+
+/**
+ * @brief Parses what has been received so far, body data is only counted.
+ * @return 1 if the response is complete, 0 if more data is needed and -1 on protocol errors.
+ */
+static int parse_response(lg_conn_t *c) {
+    size_t off = 0;
+    if (c->state == lg_headers) {
+        ssize_t head = http_response_head(&c->res, c->in.data, c->in.len, false);
+        if (head <= 0) return head < 0 || c->in.len == c->in.cap ? -1 : 0;
+        off = head;
+        c->body_bytes = 0;
+        c->state = lg_body;
+    }
+    for (;;) {
+        size_t used, data_len;
+        const char *data;
+        int ret = http_response_body(&c->res, c->in.data + off, c->in.len - off, &used, &data, &data_len);
+        /** The last slice comes with the end of the body */
+        c->body_bytes += data_len;
+        if (ret != 0) return ret;
+        off += used;
+        if (used == 0) break;
+    }
+    /** Keep an incomplete chunk header for the next read */
+    io_buffer_consume(&c->in, off);
+    return c->in.len == c->in.cap ? -1 : 0;
+}
+
+static void conn_write(loadgen_t *lg, lg_conn_t *c) {
+    int ret = io_send(c->fd, lg->requests[c->path], lg->request_lens[c->path], &c->written);
+    if (ret == 0) {
+        if (conn_watch(lg, c, EPOLLOUT) < 0) conn_fail(lg, c);
+        return;
+    }
+    if (ret < 0) {
+        if (c->reused && !c->retried && c->written == 0) conn_retry(lg, c);
+        else conn_fail(lg, c);
+        return;
+    }
+    c->state = lg_headers;
+    io_buffer_consume(&c->in, c->in.len);
+    if (conn_watch(lg, c, EPOLLIN) < 0) conn_fail(lg, c);
+}
+
+static void conn_read(loadgen_t *lg, lg_conn_t *c) {
+    for (;;) {
+        ssize_t n = io_buffer_read(&c->in, c->fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            bool nothing_received = c->state == lg_headers && c->in.len == 0;
+            if (n == 0 && c->state == lg_body && c->res.framing == framing_close) response_done(lg, c);
+            else if (nothing_received && c->reused && !c->retried) conn_retry(lg, c);
+            else conn_fail(lg, c);
+            return;
+        }
+        lg->result->bytes_read += n;
+        int ret = parse_response(c);
+        if (ret < 0) {
+            conn_fail(lg, c);
+            return;
+        }
+        if (ret > 0) {
+            response_done(lg, c);
+            return;
+        }
+    }
+}
+
+static void conn_event(loadgen_t *lg, lg_conn_t *c) {
+    switch (c->state) {
+        case lg_connecting: {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+                conn_fail(lg, c);
+                return;
+            }
+            c->state = lg_writing;
+            conn_write(lg, c);
+            break;
+        }
+        case lg_writing:
+            conn_write(lg, c);
+            break;
+        case lg_headers:
+        case lg_body:
+            conn_read(lg, c);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Builds the request of every path once, so sending one is a single write().
+ */
+static int build_requests(loadgen_t *lg) {
+    const loadgen_options_t *options = lg->options;
+    lg->requests = calloc(options->path_count, sizeof(char *));
+    lg->request_lens = calloc(options->path_count, sizeof(size_t));
+    if (lg->requests == NULL || lg->request_lens == NULL) return -1;
+    for (size_t i = 0; i < options->path_count; ++i) {
+        /** Without Accept-Encoding the last argument is simply not used by the format */
+        const char *fmt = options->accept_encoding != NULL ? "GET %s HTTP/1.1\r\nHost: %s\r\nAccept-Encoding: %s\r\n\r\n"
+                                                           : "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n";
+        int len = snprintf(NULL, 0, fmt, options->paths[i], options->host, options->accept_encoding);
+        if (len < 0 || (lg->requests[i] = malloc(len + 1)) == NULL) return -1;
+        snprintf(lg->requests[i], len + 1, fmt, options->paths[i], options->host, options->accept_encoding);
+        lg->request_lens[i] = len;
+    }
+    return 0;
+}
+
+static void free_loadgen(loadgen_t *lg) {
+    if (lg->conns != NULL) {
+        for (size_t i = 0; i < lg->options->connections; ++i) {
+            conn_close(&lg->conns[i]);
+            io_buffer_free(&lg->conns[i].in);
+        }
+    }
+    if (lg->requests != NULL) {
+        for (size_t i = 0; i < lg->options->path_count; ++i) free(lg->requests[i]);
+    }
+    free(lg->requests);
+    free(lg->request_lens);
+    free(lg->conns);
+    if (lg->epoll_fd >= 0) close(lg->epoll_fd);
+}
+
+int loadgen_run(const loadgen_options_t *options, loadgen_result_t *result) {
+    memset(result, 0, sizeof(loadgen_result_t));
+    loadgen_t lg = {options, result, epoll_create1(EPOLL_CLOEXEC)};
+    lg.conns = calloc(options->connections, sizeof(lg_conn_t));
+    bool ok = lg.epoll_fd >= 0 && lg.conns != NULL;
+    for (size_t i = 0; lg.conns != NULL && i < options->connections; ++i) lg.conns[i].fd = -1;
+    for (size_t i = 0; ok && i < options->connections; ++i) ok = io_buffer_init(&lg.conns[i].in, LOADGEN_BUFF_SIZE) == 0;
+    if (!ok || build_requests(&lg) < 0) {
+        free_loadgen(&lg);
+        return -1;
+    }
+
+    long started = now_us();
+    if (options->duration_ms > 0) lg.deadline_us = started + options->duration_ms * 1000L;
+    for (size_t i = 0; i < options->connections; ++i) conn_next(&lg, &lg.conns[i]);
+
+    struct epoll_event events[LOADGEN_EVENTS];
+    long last_progress = started;
+    while (lg.active > 0) {
+        long now = now_us();
+        long timeout = LOADGEN_STALL_MS - (now - last_progress) / 1000L;
+        if (lg.deadline_us > 0 && (lg.deadline_us - now) / 1000L + 1 < timeout) timeout = (lg.deadline_us - now) / 1000L + 1;
+        int n = timeout > 0 ? epoll_wait(lg.epoll_fd, events, LOADGEN_EVENTS, (int) timeout) : 0;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+
+        now = now_us();
+        if (lg.deadline_us > 0 && now >= lg.deadline_us) break;
+        if (n == 0 && now - last_progress >= LOADGEN_STALL_MS * 1000L) {
+            /** The server stopped answering, whatever is still in flight failed */
+            result->errors += lg.active;
+            break;
+        }
+        if (n > 0) last_progress = now;
+        for (int i = 0; i < n; ++i) conn_event(&lg, events[i].data.ptr);
+    }
+
+    result->elapsed_us = now_us() - started;
+    free_loadgen(&lg);
+    return 0;
+}
+
+void loadgen_report(const loadgen_result_t *result, FILE *out) {
+    const metrics_t *m = &result->metrics;
+    unsigned long long responses = m->latency.count;
+    double seconds = result->elapsed_us > 0 ? result->elapsed_us / 1e6 : 1e-6;
+
+    fprintf(out, "%llu responses, %llu errors in %.2fs\n", responses, result->errors, seconds);
+    fprintf(out, "Requests/sec: %.2f\n", responses / seconds);
+    fprintf(out, "Transfer/sec: %.2f MB\n", result->bytes_read / seconds / (1024.0 * 1024.0));
+    if (responses > 0) {
+        fprintf(out, "Latency:      mean %.3fms, max %.3fms\n", (double) m->latency.sum_us / responses / 1e3,
+                result->max_latency_us / 1e3);
+        static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+            fprintf(out, "  p%-6g %.3fms\n", quantiles[i] * 100, histogram_quantile(&m->latency, quantiles[i]) / 1e3);
+        }
+    }
+    fprintf(out, "Status codes:");
+    for (size_t i = 0; i <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; ++i) {
+        if (m->requests[i] > 0) fprintf(out, " %zu: %llu", i + METRICS_STATUS_MIN, m->requests[i]);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,78 @@
+/**
+ * @file loadgen.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Load generator for benchmarking HTTP servers.
+ * @details A single epoll loop drives a fixed amount of concurrent keep-alive connections. Each connection sends one
+ * request at a time and replays the list of paths round robin, a connection closed by the server is opened again.
+ * Responses are parsed with http_response.h, bodies are counted but not decoded. Latencies are measured from issuing
+ * the request (including the connect of a new connection) to the last byte of the response and recorded in the
+ * log-linear histogram of metrics.h, so the reported percentiles have the same ~6% precision as the server's.
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include "metrics.h"
+
+/** Concurrent connections if none are given */
+#define LOADGEN_DEFAULT_CONNECTIONS 16
+/** Size of the receive buffer of a connection, the response headers have to fit in */
+#define LOADGEN_BUFF_SIZE (16 * 1024)
+/** Time without any progress on any connection after which the run is aborted */
+#define LOADGEN_STALL_MS 10000
+
+/** What to run */
+typedef struct {
+    /** Address of the server */
+    const struct sockaddr *addr;
+    socklen_t addr_len;
+    /** Value of the Host header */
+    const char *host;
+    /** Request targets, each starting with '/' */
+    char **paths;
+    size_t path_count;
+    /** Value of the Accept-Encoding header, NULL to not send one */
+    const char *accept_encoding;
+    /** Concurrent connections */
+    size_t connections;
+    /** Requests to be sent in total, 0 for no limit */
+    unsigned long long requests;
+    /** Duration of the run in ms, 0 for no limit */
+    long duration_ms;
+} loadgen_options_t;
+
+/** Outcome of a run */
+typedef struct {
+    /** Status codes, request counts and latencies of all complete responses */
+    metrics_t metrics;
+    /** Requests which failed because of connection or protocol errors */
+    unsigned long long errors;
+    /** Bytes received including headers and framing */
+    unsigned long long bytes_read;
+    unsigned long long max_latency_us;
+    long elapsed_us;
+} loadgen_result_t;
+
+/**
+ * @brief Runs the load until the amount of requests has been answered or the duration is over.
+ * @details Responses still in flight when the duration is over are neither counted as responses nor as errors.
+ *
+ * @param options What to run.
+ * @param result Filled with the outcome.
+ * @return 0 on success, -1 if the event loop couldn't be set up.
+ */
+int loadgen_run(const loadgen_options_t *options, loadgen_result_t *result);
+
+/**
+ * @brief Prints throughput, latency percentiles and status codes of a run.
+ * @param result Outcome of loadgen_run().
+ * @param out Stream to print to.
+ */
+void loadgen_report(const loadgen_result_t *result, FILE *out);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ * @file metrics.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "metrics.h"
+
+/** Bucket bounds of the exported Prometheus histogram in us */
+static const unsigned long long le_bounds_us[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+                                                  250000, 500000, 1000000, 2500000, 5000000, 10000000};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static const char *cache_names[METRICS_CACHE_COUNT] = {"precompressed", "listing", "path"};
+
+/** Text being formatted, grows as needed */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} text_t;
+
+/**
+ * @brief Adds to a counter which only the calling thread writes, readers on other threads never see torn values.
+ */
+static void add(unsigned long long *counter, unsigned long long n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static unsigned long long load(const unsigned long long *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Index of the histogram bucket holding a value.
+ */
+static size_t bucket_index(unsigned long long value) {
+    if (value < HIST_SUB_BUCKETS) return value;
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HIST_MAX_BITS) return HIST_BUCKETS - 1;
+    int shift = msb - HIST_SUB_BITS;
+    return (size_t) (shift + 1) * HIST_SUB_BUCKETS + (size_t) ((value >> shift) - HIST_SUB_BUCKETS);
+}
+
+/**
+ * @brief Exclusive upper bound of the values in a bucket.
+ */
+static unsigned long long bucket_upper(size_t index) {
+    if (index < HIST_SUB_BUCKETS) return index + 1;
+    int shift = (int) (index / HIST_SUB_BUCKETS) - 1;
+    unsigned long long lower = (unsigned long long) (HIST_SUB_BUCKETS + index % HIST_SUB_BUCKETS) << shift;
+    return lower + (1ULL << shift);
+}
+
+void metrics_record_request(metrics_t *m, int status, unsigned long long bytes, long latency_us) {
+    if (status < METRICS_STATUS_MIN || status > METRICS_STATUS_MAX) status = 500;
+    add(&m->requests[status - METRICS_STATUS_MIN], 1);
+    add(&m->bytes_sent, bytes);
+
+    unsigned long long value = latency_us < 0 ? 0 : (unsigned long long) latency_us;
+    add(&m->latency.buckets[bucket_index(value)], 1);
+    add(&m->latency.sum_us, value);
+    add(&m->latency.count, 1);
+}
+
+void metrics_record_cache(metrics_t *m, metrics_cache_e cache, bool hit) {
+    add(hit ? &m->cache_hits[cache] : &m->cache_misses[cache], 1);
+}
+
+void metrics_record_compression(metrics_t *m, unsigned long long in, unsigned long long out) {
+    add(&m->compress_in, in);
+    add(&m->compress_out, out);
+}
+
+void metrics_add(unsigned long long *counter, unsigned long long n) {
+    add(counter, n);
+}
+
+void metrics_set_connections(metrics_t *m, long long connections) {
+    __atomic_store_n(&m->connections, connections, __ATOMIC_RELAXED);
+}
+
+unsigned long long histogram_quantile(const latency_histogram_t *hist, double q) {
+    unsigned long long count = load(&hist->count);
+    if (count == 0) return 0;
+    unsigned long long rank = (unsigned long long) (q * count + 0.5);
+    if (rank < 1) rank = 1;
+
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += load(&hist->buckets[i]);
+        if (seen >= rank) return bucket_upper(i);
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+/**
+ * @brief Appends formatted text, a failed allocation is remembered and reported by metrics_format().
+ */
+static void appendf(text_t *text, const char *format, ...) {
+    if (text->failed) return;
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, text->cap - text->len, format, args);
+        va_end(args);
+        if (n < 0) {
+            text->failed = true;
+            return;
+        }
+        if ((size_t) n < text->cap - text->len) {
+            text->len += n;
+            return;
+        }
+        char *data = realloc(text->data, text->cap * 2 + n);
+        if (data == NULL) {
+            text->failed = true;
+            return;
+        }
+        text->data = data;
+        text->cap = text->cap * 2 + n;
+    }
+}
+
+/**
+ * @brief Appends a counter without labels.
+ */
+static void append_counter(text_t *text, const char *name, const char *help, unsigned long long value) {
+    appendf(text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
+
+char *metrics_format(metrics_t *const *workers, size_t count, size_t *len) {
+    /** Sum up all workers first, so every metric of the output stems from the same snapshot */
+    metrics_t *sum = calloc(1, sizeof(metrics_t));
+    if (sum == NULL) return NULL;
+    for (size_t w = 0; w < count; ++w) {
+        const metrics_t *m = workers[w];
+        for (size_t i = 0; i <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; ++i) sum->requests[i] += load(&m->requests[i]);
+        for (size_t i = 0; i < METRICS_CACHE_COUNT; ++i) {
+            sum->cache_hits[i] += load(&m->cache_hits[i]);
+            sum->cache_misses[i] += load(&m->cache_misses[i]);
+        }
+        for (size_t i = 0; i < HIST_BUCKETS; ++i) sum->latency.buckets[i] += load(&m->latency.buckets[i]);
+        sum->latency.count += load(&m->latency.count);
+        sum->latency.sum_us += load(&m->latency.sum_us);
+        sum->bytes_sent += load(&m->bytes_sent);
+        sum->compress_in += load(&m->compress_in);
+        sum->compress_out += load(&m->compress_out);
+        sum->shed += load(&m->shed);
+        sum->timed_out += load(&m->timed_out);
+        sum->connections += __atomic_load_n(&m->connections, __ATOMIC_RELAXED);
+    }
+
+    text_t text = {malloc(8192), 0, 8192, false};
+    if (text.data == NULL) {
+        free(sum);
+        return NULL;
+    }
+
+    appendf(&text, "# HELP http_requests_total Responses sent, by status code.\n"
+                   "# TYPE http_requests_total counter\n");
+    for (size_t i = 0; i <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; ++i) {
+        if (sum->requests[i] > 0) {
+            appendf(&text, "http_requests_total{code=\"%zu\"} %llu\n", i + METRICS_STATUS_MIN, sum->requests[i]);
+        }
+    }
+    append_counter(&text, "http_response_bytes_total", "Body bytes sent.", sum->bytes_sent);
+
+    appendf(&text, "# HELP http_cache_hits_total Cache hits.\n# TYPE http_cache_hits_total counter\n");
+    for (size_t i = 0; i < METRICS_CACHE_COUNT; ++i) {
+        appendf(&text, "http_cache_hits_total{cache=\"%s\"} %llu\n", cache_names[i], sum->cache_hits[i]);
+    }
+    appendf(&text, "# HELP http_cache_misses_total Cache misses.\n# TYPE http_cache_misses_total counter\n");
+    for (size_t i = 0; i < METRICS_CACHE_COUNT; ++i) {
+        appendf(&text, "http_cache_misses_total{cache=\"%s\"} %llu\n", cache_names[i], sum->cache_misses[i]);
+    }
+
+    append_counter(&text, "http_compression_input_bytes_total", "Bytes before compressing on the fly.",
+                   sum->compress_in);
+    append_counter(&text, "http_compression_output_bytes_total", "Bytes after compressing on the fly.",
+                   sum->compress_out);
+    appendf(&text, "# HELP http_compression_ratio Uncompressed divided by compressed size.\n"
+                   "# TYPE http_compression_ratio gauge\nhttp_compression_ratio %.3f\n",
+            sum->compress_out > 0 ? (double) sum->compress_in / (double) sum->compress_out : 0.0);
+
+    append_counter(&text, "http_connections_shed_total", "Connections answered with 503 over the limit.", sum->shed);
+    append_counter(&text, "http_connections_timed_out_total", "Connections closed by a timeout.", sum->timed_out);
+    appendf(&text, "# HELP http_connections_open Currently open connections.\n"
+                   "# TYPE http_connections_open gauge\nhttp_connections_open %lld\n", sum->connections);
+
+    /** Cumulative buckets of the Prometheus histogram, from the finer HDR buckets */
+    appendf(&text, "# HELP http_request_duration_seconds Time from the first request byte to the last response "
+                   "byte.\n# TYPE http_request_duration_seconds histogram\n");
+    size_t bucket = 0;
+    unsigned long long cumulative = 0;
+    for (size_t i = 0; i < sizeof(le_bounds_us) / sizeof(le_bounds_us[0]); ++i) {
+        for (; bucket < HIST_BUCKETS && bucket_upper(bucket) <= le_bounds_us[i] + 1; ++bucket) {
+            cumulative += sum->latency.buckets[bucket];
+        }
+        appendf(&text, "http_request_duration_seconds_bucket{le=\"%g\"} %llu\n", le_bounds_us[i] / 1e6, cumulative);
+    }
+    appendf(&text, "http_request_duration_seconds_bucket{le=\"+Inf\"} %llu\n", sum->latency.count);
+    appendf(&text, "http_request_duration_seconds_sum %.6f\n", sum->latency.sum_us / 1e6);
+    appendf(&text, "http_request_duration_seconds_count %llu\n", sum->latency.count);
+
+    /** Quantiles straight from the HDR buckets, more precise than interpolating the coarse histogram */
+    appendf(&text, "# HELP http_request_duration_quantiles_seconds Latency quantiles.\n"
+                   "# TYPE http_request_duration_quantiles_seconds summary\n");
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+        appendf(&text, "http_request_duration_quantiles_seconds{quantile=\"%g\"} %.6f\n", quantiles[i],
+                histogram_quantile(&sum->latency, quantiles[i]) / 1e6);
+    }
+    appendf(&text, "http_request_duration_quantiles_seconds_sum %.6f\n", sum->latency.sum_us / 1e6);
+    appendf(&text, "http_request_duration_quantiles_seconds_count %llu\n", sum->latency.count);
+
+    free(sum);
+    if (text.failed) {
+        free(text.data);
+        return NULL;
+    }
+    *len = text.len;
+    return text.data;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file metrics.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Request counters and latency histograms in Prometheus text format.
+ * @details Every worker owns one metrics_t and is the only thread writing it, so recording is a handful of relaxed
+ * atomic stores without any lock or read-modify-write contention. metrics_format() sums the metrics of all workers
+ * with relaxed loads, a scrape may therefore see a request counted but its latency not yet, which is fine for
+ * monitoring.
+ *
+ * Latencies are kept in an HDR-style log-linear histogram: values below 2^HIST_SUB_BITS us get a bucket each, every
+ * further power of two is split into 2^HIST_SUB_BITS equal buckets. Every value is recorded with a relative error of
+ * at most 1/2^HIST_SUB_BITS (~6%) from 1us up to over an hour, in a fixed amount of memory.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+/** Highest power of two covered, 2^32us are ~71 minutes, longer latencies go into the last bucket */
+#define HIST_MAX_BITS 32
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/** Status codes are counted individually in this range */
+#define METRICS_STATUS_MIN 100
+#define METRICS_STATUS_MAX 599
+
+/** Caches whose hits and misses are counted */
+typedef enum {
+    /** Precompressed variant served (hit) or body compressed on the fly (miss) */
+    cache_precompressed = 0,
+    /** Rendered directory listing served from the cache (hit) or rendered (miss) */
+    cache_listing = 1,
+    /** Resolved request path with its open file */
+    cache_path = 2
+} metrics_cache_e;
+
+#define METRICS_CACHE_COUNT 3
+
+/** Log-linear latency histogram in microseconds */
+typedef struct {
+    unsigned long long buckets[HIST_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum_us;
+} latency_histogram_t;
+
+/** Metrics of one worker */
+typedef struct {
+    unsigned long long requests[METRICS_STATUS_MAX - METRICS_STATUS_MIN + 1];
+    /** Body bytes sent */
+    unsigned long long bytes_sent;
+    unsigned long long cache_hits[METRICS_CACHE_COUNT];
+    unsigned long long cache_misses[METRICS_CACHE_COUNT];
+    /** Bytes before and after compressing on the fly */
+    unsigned long long compress_in;
+    unsigned long long compress_out;
+    /** Connections answered with 503 or closed by a timeout */
+    unsigned long long shed;
+    unsigned long long timed_out;
+    /** Gauge of the currently open connections */
+    long long connections;
+    latency_histogram_t latency;
+} metrics_t;
+
+/**
+ * @brief Records a finished response.
+ * @param m Metrics of the calling worker.
+ * @param status HTTP status code.
+ * @param bytes Body bytes sent.
+ * @param latency_us Time from the first byte of the request to the last byte of the response.
+ */
+void metrics_record_request(metrics_t *m, int status, unsigned long long bytes, long latency_us);
+
+/**
+ * @brief Records a cache lookup.
+ * @param m Metrics of the calling worker.
+ * @param cache Cache which has been looked up.
+ * @param hit True on a hit.
+ */
+void metrics_record_cache(metrics_t *m, metrics_cache_e cache, bool hit);
+
+/**
+ * @brief Records a response which was compressed on the fly.
+ * @param m Metrics of the calling worker.
+ * @param in Uncompressed size.
+ * @param out Compressed size.
+ */
+void metrics_record_compression(metrics_t *m, unsigned long long in, unsigned long long out);
+
+/**
+ * @brief Adds to a counter of a worker, e.g. shed or timed_out, so concurrent scrapes read consistent values.
+ * @param counter Counter inside a metrics_t of the calling worker.
+ * @param n Amount to be added.
+ */
+void metrics_add(unsigned long long *counter, unsigned long long n);
+
+/**
+ * @brief Updates the gauge of open connections.
+ * @param m Metrics of the calling worker.
+ * @param connections Currently open connections.
+ */
+void metrics_set_connections(metrics_t *m, long long connections);
+
+/**
+ * @brief Estimates a quantile from a histogram.
+ * @param hist Histogram.
+ * @param q Quantile between 0 and 1, e.g. 0.99.
+ * @return Upper bound of the bucket containing the quantile in us, 0 if the histogram is empty.
+ */
+unsigned long long histogram_quantile(const latency_histogram_t *hist, double q);
+
+/**
+ * @brief Formats the sum of the metrics of all workers in Prometheus text format (version 0.0.4).
+ * @param workers Metrics of the workers.
+ * @param count Amount of workers.
+ * @param len Set to the length of the text.
+ * @return Text allocated with malloc(), NULL on errors.
+ */
+char *metrics_format(metrics_t *const *workers, size_t count, size_t *len);
+
+#endif
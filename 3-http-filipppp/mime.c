@@ -0,0 +1,51 @@
+/**
+ * @file mime.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "mime.h"
+
+static const mime_entry_t mime_types[] = {
+        {".html",  "text/html",              true},
+        {".htm",   "text/html",              true},
+        {".css",   "text/css",               true},
+        {".js",    "application/javascript", true},
+        {".mjs",   "application/javascript", true},
+        {".map",   "application/json",       true},
+        {".json",  "application/json",       true},
+        {".txt",   "text/plain",             true},
+        {".md",    "text/markdown",          true},
+        {".csv",   "text/csv",               true},
+        {".wasm",  "application/wasm",       true},
+        {".svg",   "image/svg+xml",          true},
+        {".xml",   "application/xml",        true},
+        {".png",   "image/png",              false},
+        {".jpg",   "image/jpeg",             false},
+        {".jpeg",  "image/jpeg",             false},
+        {".gif",   "image/gif",              false},
+        {".webp",  "image/webp",             false},
+        {".ico",   "image/x-icon",           true},
+        {".woff",  "font/woff",              false},
+        {".woff2", "font/woff2",             false},
+        {".pdf",   "application/pdf",        false},
+        {".zip",   "application/zip",        false},
+        {".gz",    "application/gzip",       false},
+        {".zst",   "application/zstd",       false},
+        {".br",    "application/x-brotli",   false},
+        {".mp3",   "audio/mpeg",             false},
+        {".mp4",   "video/mp4",              false},
+        {".webm",  "video/webm",             false},
+};
+
+const mime_entry_t *mime_lookup(const char *path) {
+    /** Only the last dot of the file name counts */
+    const char *ext = strrchr(path, '.');
+    if (ext == NULL || strchr(ext, '/') != NULL) return NULL;
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); ++i) {
+        if (strcasecmp(ext, mime_types[i].ext) == 0) return &mime_types[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file mime.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief MIME types by file extension, shared by the server and the bundle packer.
+ * @details Every type also tells whether the format is worth compressing, images, archives, fonts and video are
+ * compressed already and are always sent as they are.
+ */
+
+#ifndef MIME_H
+#define MIME_H
+
+#include <stdbool.h>
+
+/** MIME-Type lookup table entry, compressible is false for formats which are already compressed */
+typedef struct {
+    const char *ext;
+    char *mime;
+    bool compressible;
+} mime_entry_t;
+
+/**
+ * @brief Looks up the type of a file.
+ * @param path File name or path, only the extension after its last dot counts.
+ * @return Entry of the extension, NULL if it is unknown or the file has none.
+ */
+const mime_entry_t *mime_lookup(const char *path);
+
+#endif
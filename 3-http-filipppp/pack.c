@@ -0,0 +1,348 @@
+/**
+ * @file pack.c
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Packs a document root into an asset bundle which the server serves with -B.
+ * @details Every regular file below DOC_ROOT is stored with its header fragment, and with a compressed variant for
+ * every available encoding if that one turns out smaller. The same encoders as for compression on the fly are used,
+ * but at the highest level by default since a bundle is packed once and served many times. The bundle is written
+ * to BUNDLE.tmp and renamed, so a server restarted meanwhile never maps a half written bundle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "compression.h"
+#include "mime.h"
+#include "bundle.h"
+
+/** Buffer for copying file contents */
+#define COPY_BUFF_SIZE (64 * 1024)
+
+static char *prog_name;
+
+/** State of the bundle being written */
+typedef struct {
+    int fd;
+    /** Write position, the end of everything written so far */
+    uint64_t offset;
+    compressor_pool_t compressors;
+    /** Index entries of the packed files, hashed into the table at the end */
+    bundle_entry_t *entries;
+    size_t count;
+    size_t cap;
+    /** Statistics for the report */
+    unsigned long long variants;
+} packer_t;
+
+/**
+ * @brief Prints the usage with an extra error message.
+ * @details Also terminates the program.
+ *
+ * @param str Error message to be printed.
+ */
+static void print_usage(char *str) {
+    if (str != NULL) {
+        fprintf(stderr, "[%s] Error: %s\n", prog_name, str);
+    }
+    fprintf(stderr, "[%s] Usage: %s [-l LEVEL] [-m MIN_SIZE] DOC_ROOT BUNDLE\n", prog_name, prog_name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Appends data to the bundle.
+ * @return 0 on success, -1 on errors.
+ */
+static int write_all(packer_t *packer, const void *buff, size_t len) {
+    const char *p = buff;
+    while (len > 0) {
+        ssize_t n = write(packer->fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+        packer->offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies a file into the bundle as its identity body.
+ * @return 0 on success, -1 on errors or if the file changed its size while it was packed.
+ */
+static int write_identity(packer_t *packer, int fd, off_t size, bundle_variant_t *variant) {
+    char buff[COPY_BUFF_SIZE];
+    variant->body_offset = packer->offset;
+    off_t pos = 0;
+    for (;;) {
+        ssize_t n = pread(fd, buff, sizeof(buff), pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        if (write_all(packer, buff, n) < 0) return -1;
+        pos += n;
+    }
+    variant->body_len = pos;
+    return pos == size ? 0 : -1;
+}
+
+/**
+ * @brief Compresses a file into the bundle, the output is dropped again if it isn't smaller than the file.
+ * @return 0 on success, also if the variant was dropped, -1 on errors.
+ */
+static int write_compressed(packer_t *packer, int fd, off_t size, encoding_e enc, bundle_variant_t *variant) {
+    compressor_t *comp = compressor_acquire(&packer->compressors, enc);
+    if (comp == NULL) return -1;
+    uint64_t start = packer->offset;
+    int ret = 0;
+    unsigned char *out;
+    ssize_t n;
+    while ((n = compressor_next(comp, fd, &out)) > 0 && packer->offset - start < (uint64_t) size) {
+        if (write_all(packer, out, n) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    compressor_release(comp);
+    if (n < 0) ret = -1;
+    if (ret == 0 && packer->offset - start < (uint64_t) size) {
+        variant->body_offset = start;
+        variant->body_len = packer->offset - start;
+        return 0;
+    }
+
+    /** Not worth it, the next write overwrites it */
+    if (lseek(packer->fd, start, SEEK_SET) < 0) return -1;
+    packer->offset = start;
+    return ret;
+}
+
+/**
+ * @brief Writes the header fragment of a variant.
+ * @return 0 on success, -1 on errors.
+ */
+static int write_head(packer_t *packer, bundle_variant_t *variant, encoding_e enc, const mime_entry_t *type,
+                      bool vary) {
+    char head[BUNDLE_HEAD_MAX];
+    int len = snprintf(head, sizeof(head), "Content-Length: %llu\r\n", (unsigned long long) variant->body_len);
+    if (type != NULL) len += snprintf(head + len, sizeof(head) - len, "Content-Type: %s\r\n", type->mime);
+    if (enc != enc_identity) {
+        len += snprintf(head + len, sizeof(head) - len, "Content-Encoding: %s\r\n", encoding_name(enc));
+    }
+    if (vary) len += snprintf(head + len, sizeof(head) - len, "Vary: Accept-Encoding\r\n");
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+    variant->head_offset = packer->offset;
+    variant->head_len = len;
+    return write_all(packer, head, len);
+}
+
+/**
+ * @brief Packs one file with all of its variants.
+ * @param packer Bundle being written.
+ * @param file Path of the file on disk.
+ * @param path Request path of the file, e.g. "/css/site.css".
+ * @return 0 on success, -1 on errors.
+ */
+static int pack_file(packer_t *packer, const char *file, const char *path) {
+    if (packer->count == packer->cap) {
+        size_t cap = packer->cap == 0 ? 256 : packer->cap * 2;
+        bundle_entry_t *entries = realloc(packer->entries, cap * sizeof(bundle_entry_t));
+        if (entries == NULL) return -1;
+        packer->entries = entries;
+        packer->cap = cap;
+    }
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    bundle_entry_t *entry = &packer->entries[packer->count];
+    memset(entry, 0, sizeof(bundle_entry_t));
+    entry->key = bundle_hash(path);
+    entry->path_offset = packer->offset;
+    entry->path_len = strlen(path);
+    int ret = write_all(packer, path, entry->path_len);
+    if (ret == 0) ret = write_identity(packer, fd, st.st_size, &entry->variants[enc_identity]);
+
+    const mime_entry_t *type = mime_lookup(path);
+    bool compressible = type != NULL ? type->compressible : true;
+    bool vary = false;
+    if (compressor_should_compress(&packer->compressors, compressible, st.st_size)) {
+        for (int enc = enc_gzip; enc < ENCODING_COUNT && ret == 0; ++enc) {
+            if (!encoding_available(enc)) continue;
+            ret = write_compressed(packer, fd, st.st_size, enc, &entry->variants[enc]);
+            vary = vary || entry->variants[enc].body_len > 0;
+        }
+    }
+    close(fd);
+
+    /** Heads last, the Vary header depends on whether any variant was kept */
+    for (int enc = 0; enc < ENCODING_COUNT && ret == 0; ++enc) {
+        if (enc != enc_identity && entry->variants[enc].body_len == 0) continue;
+        ret = write_head(packer, &entry->variants[enc], enc, type, vary);
+        if (enc != enc_identity) packer->variants++;
+    }
+    if (ret == 0) packer->count++;
+    return ret;
+}
+
+/**
+ * @brief Packs all regular files below a directory, in sorted order so the same tree gives the same bundle.
+ * @param packer Bundle being written.
+ * @param dir Directory on disk.
+ * @param path Request path of the directory, "" for the document root.
+ * @return 0 on success, -1 on errors.
+ */
+static int pack_dir(packer_t *packer, const char *dir, const char *path) {
+    struct dirent **names;
+    int count = scandir(dir, &names, NULL, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "[%s] Error: couldn't read directory %s \n", prog_name, dir);
+        return -1;
+    }
+    int ret = 0;
+    for (int i = 0; i < count; ++i) {
+        const char *name = names[i]->d_name;
+        if (ret == 0 && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            char file[PATH_MAX];
+            char child[PATH_MAX];
+            snprintf(file, sizeof(file), "%s/%s", dir, name);
+            snprintf(child, sizeof(child), "%s/%s", path, name);
+            struct stat st;
+            if (stat(file, &st) < 0) {
+                fprintf(stderr, "[%s] Error: couldn't stat %s \n", prog_name, file);
+                ret = -1;
+            } else if (S_ISDIR(st.st_mode)) {
+                ret = pack_dir(packer, file, child);
+            } else if (S_ISREG(st.st_mode) && pack_file(packer, file, child) < 0) {
+                fprintf(stderr, "[%s] Error: couldn't pack %s \n", prog_name, file);
+                ret = -1;
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+/**
+ * @brief Hashes the entries into the index and writes it and the header.
+ * @return 0 on success, -1 on errors.
+ */
+static int write_index(packer_t *packer) {
+    uint32_t slots = 16;
+    while (slots < packer->count * 2) slots *= 2;
+    bundle_entry_t *table = calloc(slots, sizeof(bundle_entry_t));
+    if (table == NULL) return -1;
+    for (size_t i = 0; i < packer->count; ++i) {
+        uint32_t slot = packer->entries[i].key & (slots - 1);
+        while (table[slot].key != 0) slot = (slot + 1) & (slots - 1);
+        table[slot] = packer->entries[i];
+    }
+
+    /** The index is read in place, so it is aligned */
+    static const char padding[sizeof(uint64_t)];
+    int ret = write_all(packer, padding, (sizeof(uint64_t) - packer->offset % sizeof(uint64_t)) % sizeof(uint64_t));
+    bundle_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BUNDLE_MAGIC;
+    header.version = BUNDLE_VERSION;
+    header.count = packer->count;
+    header.slots = slots;
+    header.index_offset = packer->offset;
+    if (ret == 0) ret = write_all(packer, table, slots * sizeof(bundle_entry_t));
+    free(table);
+    if (ret == 0 && (ftruncate(packer->fd, packer->offset) < 0 ||
+                     pwrite(packer->fd, &header, sizeof(header), 0) != sizeof(header))) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Main entry point
+ * @details Parses the options, packs DOC_ROOT and renames the finished bundle into place.
+ *
+ * @param argc
+ * @param argv
+ * @return exit code
+ */
+int main(int argc, char **argv) {
+    prog_name = argv[0];
+    int level = Z_BEST_COMPRESSION;
+    long min_size = COMPRESS_DEFAULT_MIN_SIZE;
+    char *endptr;
+
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "l:m:")) != -1) {
+        switch (c) {
+            case 'l':
+                errno = 0;
+                level = (int) strtol(optarg, &endptr, 10);
+                if (errno != 0 || endptr == optarg || *endptr != '\0' || level < 1 || level > 9)
+                    print_usage("The positional argument -l must be a compression level in the range: (1-9)");
+                break;
+            case 'm':
+                errno = 0;
+                min_size = strtol(optarg, &endptr, 10);
+                if (errno != 0 || endptr == optarg || *endptr != '\0' || min_size < 0)
+                    print_usage("The positional argument -m must be a positive amount of bytes.");
+                break;
+            case '?':
+                if (optopt == 'l' || optopt == 'm')
+                    print_usage("The positional arguments -l and -m must be followed by an integer.");
+            default:
+                print_usage("Unknown options received.");
+        }
+    }
+    if (argc - optind != 2) print_usage("DOC_ROOT and BUNDLE are required.");
+    char *doc_root = argv[optind];
+    char *bundle_path = argv[optind + 1];
+    if (strlen(doc_root) > 1 && doc_root[strlen(doc_root) - 1] == '/') doc_root[strlen(doc_root) - 1] = '\0';
+
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", bundle_path);
+    packer_t packer;
+    memset(&packer, 0, sizeof(packer));
+    compressor_pool_init(&packer.compressors, level, min_size);
+    packer.fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (packer.fd < 0) {
+        fprintf(stderr, "[%s] Error: couldn't create %s \n", prog_name, temp_path);
+        exit(EXIT_FAILURE);
+    }
+
+    /** The header is written last, once the index offset is known */
+    bundle_header_t placeholder;
+    memset(&placeholder, 0, sizeof(placeholder));
+    int ret = write_all(&packer, &placeholder, sizeof(placeholder));
+    if (ret == 0) ret = pack_dir(&packer, doc_root, "");
+    if (ret == 0 && write_index(&packer) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't write the index \n", prog_name);
+        ret = -1;
+    }
+    if (close(packer.fd) < 0) ret = -1;
+    if (ret == 0 && rename(temp_path, bundle_path) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't rename %s to %s \n", prog_name, temp_path, bundle_path);
+        ret = -1;
+    }
+    if (ret < 0) unlink(temp_path);
+    else fprintf(stderr, "[%s] Packed %zu files with %llu compressed variants into %s (%llu bytes)\n", prog_name,
+                 packer.count, packer.variants, bundle_path, (unsigned long long) packer.offset);
+
+    free(packer.entries);
+    compressor_pool_free(&packer.compressors);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file path_cache.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+/** O_PATH is Linux specific */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+#include "path_cache.h"
+
+/** Flags for opening files, O_NONBLOCK so a FIFO in the document root can't block the event loop */
+#define PATH_OPEN_FLAGS (O_RDONLY | O_NONBLOCK | O_CLOEXEC)
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int normalize_path(const char *target, char *out, size_t cap) {
+    if (target[0] != '/' || cap < 2) return -1;
+    size_t len = 0;
+    out[len++] = '/';
+    /** True if the path ends with a directory, so the trailing slash is kept */
+    bool dir_end = true;
+
+    const char *p = target;
+    while (*p != '\0' && *p != '?' && *p != '#') {
+        if (*p == '/') {
+            p++;
+            continue;
+        }
+
+        /** Decode one segment, the output ends with '/' before each segment */
+        size_t start = len;
+        while (*p != '\0' && *p != '?' && *p != '#' && *p != '/') {
+            char c = *p++;
+            if (c == '%') {
+                int hi = hex_value(p[0]);
+                int lo = hi < 0 ? -1 : hex_value(p[1]);
+                if (lo < 0) return -1;
+                c = (char) (hi << 4 | lo);
+                p += 2;
+                /** An encoded NUL would cut the path, an encoded slash would smuggle in a separator */
+                if (c == '\0' || c == '/') return -1;
+            }
+            if (len + 2 > cap) return -1;
+            out[len++] = c;
+        }
+
+        size_t seg_len = len - start;
+        if (seg_len == 1 && out[start] == '.') {
+            len = start;
+            dir_end = true;
+        } else if (seg_len == 2 && out[start] == '.' && out[start + 1] == '.') {
+            len = start;
+            if (len == 1) return -1;
+            /** Drop the previous segment including its slash */
+            len--;
+            while (out[len - 1] != '/') len--;
+            dir_end = true;
+        } else {
+            out[len++] = '/';
+            dir_end = *p == '/';
+        }
+    }
+
+    if (!dir_end && len > 1) len--;
+    out[len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Opens a path relative to the document root without escaping it.
+ */
+static int open_beneath(int root_fd, const char *path) {
+#ifdef SYS_openat2
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = PATH_OPEN_FLAGS;
+    how.resolve = RESOLVE_BENEATH;
+    int fd = (int) syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) return fd;
+#endif
+    return openat(root_fd, path, PATH_OPEN_FLAGS);
+}
+
+/**
+ * @brief Gets the metadata of a path relative to the document root without opening the file itself.
+ * @details An O_PATH descriptor resolves the path with the same guarantees as open_beneath(), a plain fstatat()
+ * would follow symbolic links out of the document root.
+ */
+static int stat_beneath(int root_fd, const char *path, struct stat *st) {
+#ifdef SYS_openat2
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = O_PATH | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH;
+    int fd = (int) syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (fd >= 0) {
+        int ret = fstat(fd, st);
+        int error = errno;
+        close(fd);
+        errno = error;
+        return ret;
+    }
+    if (errno != ENOSYS) return -1;
+#endif
+    return fstatat(root_fd, path, st, 0);
+}
+
+static size_t hash_path(const char *path) {
+    size_t hash = 5381;
+    for (; *path != '\0'; ++path) hash = hash * 33 + (unsigned char) *path;
+    return hash & (PATH_CACHE_BUCKETS - 1);
+}
+
+static void lru_unlink(path_cache_t *cache, cached_file_t *file) {
+    if (file->lru_prev != NULL) file->lru_prev->lru_next = file->lru_next;
+    else cache->lru_head = file->lru_next;
+    if (file->lru_next != NULL) file->lru_next->lru_prev = file->lru_prev;
+    else cache->lru_tail = file->lru_prev;
+    file->lru_prev = file->lru_next = NULL;
+}
+
+static void lru_push(path_cache_t *cache, cached_file_t *file) {
+    file->lru_prev = NULL;
+    file->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) cache->lru_head->lru_prev = file;
+    else cache->lru_tail = file;
+    cache->lru_head = file;
+}
+
+/**
+ * @brief Takes an entry out of the cache and drops the reference of the cache.
+ */
+static void remove_file(path_cache_t *cache, cached_file_t *file) {
+    cached_file_t **link = &cache->buckets[hash_path(file->path)];
+    while (*link != file) link = &(*link)->next;
+    *link = file->next;
+    lru_unlink(cache, file);
+    cache->count--;
+    path_cache_release(file);
+}
+
+/**
+ * @brief Checks if an entry still describes what is at its path.
+ */
+static bool still_valid(const cached_file_t *file, int error, const struct stat *st) {
+    if (error != 0 || file->error != 0) return error == file->error;
+    return st->st_dev == file->dev && st->st_ino == file->ino && (size_t) st->st_size == file->size
+           && st->st_mtim.tv_sec == file->mtime.tv_sec && st->st_mtim.tv_nsec == file->mtime.tv_nsec
+           && S_ISDIR(st->st_mode) == file->dir;
+}
+
+/**
+ * @brief Looks a path up in the file system.
+ * @param open_file True if a regular file is opened, otherwise only its metadata is read.
+ * @return Entry with one reference or NULL if out of memory.
+ */
+static cached_file_t *load_file(path_cache_t *cache, const char *path, bool open_file) {
+    cached_file_t *file = calloc(1, sizeof(cached_file_t));
+    if (file == NULL || (file->path = strdup(path)) == NULL) {
+        free(file);
+        return NULL;
+    }
+    file->refs = 1;
+    file->fd = -1;
+    struct stat st;
+    if (open_file) {
+        file->fd = open_beneath(cache->root_fd, path);
+        if (file->fd < 0 || fstat(file->fd, &st) < 0) {
+            file->error = errno;
+            if (file->fd >= 0) close(file->fd);
+            file->fd = -1;
+            return file;
+        }
+    } else if (stat_beneath(cache->root_fd, path, &st) < 0) {
+        file->error = errno;
+        return file;
+    }
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->size = st.st_size;
+    file->mtime = st.st_mtim;
+    file->dir = S_ISDIR(st.st_mode);
+    file->regular = S_ISREG(st.st_mode);
+    if (!file->regular) {
+        /** Only regular files are served, directories are only listed */
+        if (!file->dir) file->error = EACCES;
+        if (file->fd >= 0) close(file->fd);
+        file->fd = -1;
+    }
+    return file;
+}
+
+int path_cache_init(path_cache_t *cache, const char *doc_root) {
+    memset(cache, 0, sizeof(path_cache_t));
+    cache->root_fd = open(doc_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return cache->root_fd < 0 ? -1 : 0;
+}
+
+void path_cache_free(path_cache_t *cache) {
+    while (cache->lru_head != NULL) remove_file(cache, cache->lru_head);
+    if (cache->root_fd >= 0) close(cache->root_fd);
+    cache->root_fd = -1;
+}
+
+/**
+ * @brief Looks up a path, see path_cache_open() and path_cache_stat().
+ * @param open_file True if the descriptor of a regular file is needed.
+ */
+static cached_file_t *lookup(path_cache_t *cache, const char *path, long now_ms, bool *hit, bool open_file) {
+    while (*path == '/') path++;
+    if (*path == '\0') path = ".";
+
+    size_t bucket = hash_path(path);
+    cached_file_t *file = cache->buckets[bucket];
+    while (file != NULL && strcmp(file->path, path) != 0) file = file->next;
+
+    if (file != NULL) {
+        bool valid = now_ms < file->valid_until;
+        if (!valid) {
+            /** Expired, one stat tells if the file behind the path is still the same */
+            struct stat st;
+            int error = fstatat(cache->root_fd, path, &st, 0) < 0 ? errno : 0;
+            valid = still_valid(file, error, &st);
+        }
+        /** Only the metadata was looked up, the file still has to be opened */
+        if (open_file && file->regular && file->fd < 0) valid = false;
+        if (valid) {
+            if (now_ms >= file->valid_until) file->valid_until = now_ms + PATH_CACHE_VALID_MS;
+            lru_unlink(cache, file);
+            lru_push(cache, file);
+            file->refs++;
+            *hit = true;
+            return file;
+        }
+        remove_file(cache, file);
+    }
+
+    *hit = false;
+    file = load_file(cache, path, open_file);
+    if (file == NULL) return NULL;
+    /** Running out of descriptors or memory says nothing about the path, so that is not cached */
+    if (file->error == EMFILE || file->error == ENFILE || file->error == ENOMEM) return file;
+
+    if (cache->count >= PATH_CACHE_MAX) remove_file(cache, cache->lru_tail);
+    file->valid_until = now_ms + PATH_CACHE_VALID_MS;
+    file->next = cache->buckets[bucket];
+    cache->buckets[bucket] = file;
+    lru_push(cache, file);
+    file->refs++;
+    cache->count++;
+    return file;
+}
+
+cached_file_t *path_cache_open(path_cache_t *cache, const char *path, long now_ms, bool *hit) {
+    return lookup(cache, path, now_ms, hit, true);
+}
+
+cached_file_t *path_cache_stat(path_cache_t *cache, const char *path, long now_ms, bool *hit) {
+    return lookup(cache, path, now_ms, hit, false);
+}
+
+void path_cache_release(cached_file_t *file) {
+    if (file == NULL || --file->refs > 0) return;
+    if (file->fd >= 0) close(file->fd);
+    free(file->path);
+    free(file);
+}
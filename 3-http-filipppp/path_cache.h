@@ -0,0 +1,130 @@
+/**
+ * @file path_cache.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Safe request path resolution below the document root with a cache of open files.
+ * @details Request targets are percent-decoded and normalized ("//", "." and ".." are resolved) before they touch
+ * the file system, a target climbing above the root is rejected. Files are opened relative to a pre-opened file
+ * descriptor of the document root with openat2(RESOLVE_BENEATH), so symbolic links can't lead outside of it either
+ * (plain openat() is used on kernels before 5.6).
+ *
+ * Lookups are cached: path -> open file descriptor, size and type, including failed lookups, so repeated requests
+ * and the probing for precompressed variants cost no syscall at all. An entry is trusted for PATH_CACHE_VALID_MS,
+ * afterwards one fstatat() checks that the path still refers to the same inode, size and mtime. Entries are
+ * reference counted, so an entry evicted or replaced while a response is sent keeps its file open until it is done.
+ * The cache belongs to one event loop and is not thread-safe.
+ */
+
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+/** Amount of cached paths, each holds at most one file descriptor */
+#define PATH_CACHE_MAX 256
+/** Hash buckets of the cache, a power of two */
+#define PATH_CACHE_BUCKETS 512
+/** Time an entry is used without checking the file system again */
+#define PATH_CACHE_VALID_MS 1000
+
+/** Result of a lookup */
+typedef struct cached_file {
+    /** Path relative to the document root, "." for the root itself */
+    char *path;
+    /** Opened regular file, -1 for directories, other file types, failed lookups and files only looked up with
+     * path_cache_stat() */
+    int fd;
+    /** True for regular files, even if they aren't opened */
+    bool regular;
+    /** errno of the failed lookup, 0 if the path exists */
+    int error;
+    bool dir;
+    size_t size;
+    /** Identity of the file to notice replacements */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    /** Time in ms after which the entry has to be checked again */
+    long valid_until;
+    int refs;
+    /** Next entry in the same hash bucket */
+    struct cached_file *next;
+    /** Least recently used order, only while the entry is cached */
+    struct cached_file *lru_prev;
+    struct cached_file *lru_next;
+} cached_file_t;
+
+/** Cache of one event loop */
+typedef struct {
+    int root_fd;
+    cached_file_t *buckets[PATH_CACHE_BUCKETS];
+    /** Most recently used first */
+    cached_file_t *lru_head;
+    cached_file_t *lru_tail;
+    size_t count;
+} path_cache_t;
+
+/**
+ * @brief Percent-decodes and normalizes a request target.
+ * @details The query string and fragment are dropped, "//" and "." segments are removed and ".." removes the previous
+ * segment. A trailing slash is kept. E.g. "/a/./b/../%63.txt?x=1" becomes "/a/c.txt".
+ *
+ * @param target Request target, has to start with '/'.
+ * @param out Buffer for the normalized path, which always starts with '/'.
+ * @param cap Size of the buffer, strlen(target) + 2 is always enough.
+ * @return 0 on success, -1 if the target is malformed (bad escape, NUL byte) or climbs above the root.
+ */
+int normalize_path(const char *target, char *out, size_t cap);
+
+/**
+ * @brief Opens the document root.
+ * @param cache Cache to be initialized.
+ * @param doc_root Path of the document root.
+ * @return 0 on success, -1 if the document root couldn't be opened.
+ */
+int path_cache_init(path_cache_t *cache, const char *doc_root);
+
+/**
+ * @brief Closes all cached files and the document root.
+ * @details Entries still referenced are closed once they are released.
+ * @param cache Cache set up by path_cache_init().
+ */
+void path_cache_free(path_cache_t *cache);
+
+/**
+ * @brief Looks up a normalized path below the document root.
+ * @details The result has to be given back with path_cache_release().
+ *
+ * @param cache Cache of the event loop.
+ * @param path Normalized path from normalize_path(), the leading slash is optional.
+ * @param now_ms Current time of a monotonic clock in ms.
+ * @param hit Set to true if the cached entry could be used.
+ * @return Entry with fd >= 0 for regular files, dir set for directories and error set otherwise. NULL if out of memory.
+ */
+cached_file_t *path_cache_open(path_cache_t *cache, const char *path, long now_ms, bool *hit);
+
+/**
+ * @brief Looks up the metadata of a normalized path below the document root, e.g. for HEAD requests.
+ * @details Works like path_cache_open(), but a regular file that isn't cached is not opened, the entry only tells its
+ * size and type and has no descriptor. path_cache_open() opens the file once the same path needs its contents.
+ *
+ * @param cache Cache of the event loop.
+ * @param path Normalized path from normalize_path(), the leading slash is optional.
+ * @param now_ms Current time of a monotonic clock in ms.
+ * @param hit Set to true if the cached entry could be used.
+ * @return Entry with regular set for regular files, dir set for directories and error set otherwise. NULL if out of
+ * memory.
+ */
+cached_file_t *path_cache_stat(path_cache_t *cache, const char *path, long now_ms, bool *hit);
+
+/**
+ * @brief Gives back an entry from path_cache_open().
+ * @param file Entry, may be NULL.
+ */
+void path_cache_release(cached_file_t *file);
+
+#endif
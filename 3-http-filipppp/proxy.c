@@ -0,0 +1,236 @@
+/**
+ * @file proxy.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "proxy.h"
+#include "http_io.h"
+
+/** Headers which only concern one connection and are never forwarded */
+static const char *hop_by_hop[] = {"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade"};
+
+/** Connection headers of a head, more are treated as malformed */
+#define MAX_CONNECTION_HEADERS 8
+
+/** Values of the Connection headers of a head, the headers they name are hop-by-hop as well */
+typedef struct {
+    const char *value[MAX_CONNECTION_HEADERS];
+    const char *end[MAX_CONNECTION_HEADERS];
+    size_t count;
+} connection_options_t;
+
+/**
+ * @brief Collects the Connection headers of a head.
+ * @param headers Header lines, separated by LF or CRLF.
+ * @param end End of the header lines.
+ * @param options Set to the values found.
+ * @return 0 on success, -1 if there are too many.
+ */
+static int find_connection_options(const char *headers, const char *end, connection_options_t *options) {
+    options->count = 0;
+    for (const char *line = headers; line < end;) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL) eol = end;
+        const char *value = http_header_value(line, eol - line, "Connection");
+        if (value != NULL) {
+            if (options->count == MAX_CONNECTION_HEADERS) return -1;
+            options->value[options->count] = value;
+            options->end[options->count++] = eol;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+static bool is_hop_by_hop(const char *line, size_t len, const connection_options_t *options) {
+    for (size_t i = 0; i < sizeof(hop_by_hop) / sizeof(hop_by_hop[0]); ++i) {
+        if (http_header_value(line, len, hop_by_hop[i]) != NULL) return true;
+    }
+    const char *colon = memchr(line, ':', len);
+    if (colon == NULL) return false;
+    for (size_t i = 0; i < options->count; ++i) {
+        if (http_has_token(options->value[i], options->end[i], line, colon - line)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Appends formatted text to a buffer.
+ * @return 0 on success, -1 if it doesn't fit.
+ */
+static int append(char *out, size_t cap, size_t *len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out + *len, cap - *len, format, args);
+    va_end(args);
+    if (n < 0 || (size_t) n >= cap - *len) return -1;
+    *len += n;
+    return 0;
+}
+
+int proxy_parse_backend(char *arg, backend_t *backend) {
+    char *eq = strchr(arg, '=');
+    if (arg[0] != '/' || eq == NULL) return -1;
+    *eq = '\0';
+    backend->name = eq + 1;
+    /** "/" and "/api/" are stored as "" and "/api" */
+    size_t prefix_len = strlen(arg);
+    while (prefix_len > 0 && arg[prefix_len - 1] == '/') arg[--prefix_len] = '\0';
+    backend->prefix = arg;
+    backend->prefix_len = prefix_len;
+
+    /** HOST:PORT, an IPv6 address is written in brackets */
+    char host[256];
+    const char *port = strrchr(backend->name, ':');
+    if (port == NULL || port == backend->name || port[1] == '\0') return -1;
+    const char *host_start = backend->name;
+    size_t host_len = port - backend->name;
+    if (host_start[0] == '[' && host_len >= 2 && host_start[host_len - 1] == ']') {
+        host_start++;
+        host_len -= 2;
+    }
+    if (host_len == 0 || host_len >= sizeof(host)) return -1;
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port + 1, &hints, &ai) != 0) return -1;
+    memcpy(&backend->addr, ai->ai_addr, ai->ai_addrlen);
+    backend->addr_len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+int proxy_route(const backend_t *backends, size_t count, const char *path) {
+    int best = -1;
+    for (size_t i = 0; i < count; ++i) {
+        size_t len = backends[i].prefix_len;
+        if (strncmp(path, backends[i].prefix, len) != 0) continue;
+        if (path[len] != '\0' && path[len] != '/') continue;
+        if (best < 0 || len > backends[best].prefix_len) best = (int) i;
+    }
+    return best;
+}
+
+void upstream_pool_init(upstream_pool_t *pool) {
+    memset(pool, 0, sizeof(upstream_pool_t));
+}
+
+void upstream_pool_free(upstream_pool_t *pool) {
+    for (size_t i = 0; i < PROXY_MAX_BACKENDS; ++i) {
+        for (size_t j = 0; j < pool->idle_count[i]; ++j) close(pool->idle[i][j]);
+        pool->idle_count[i] = 0;
+    }
+}
+
+int upstream_acquire(upstream_pool_t *pool, const backend_t *backends, int index, bool *reused) {
+    /** The most recently used connection first, it is the least likely to have been closed by the backend */
+    while (pool->idle_count[index] > 0) {
+        int fd = pool->idle[index][--pool->idle_count[index]];
+        char c;
+        ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            *reused = true;
+            pool->reused++;
+            return fd;
+        }
+        /** Closed by the backend, or it sent something nobody asked for */
+        close(fd);
+    }
+
+    *reused = false;
+    const backend_t *backend = &backends[index];
+    int fd = socket(backend->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    /** Heads are sent with a single call, there is nothing to gain by delaying them */
+    int optval = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    if (connect(fd, (const struct sockaddr *) &backend->addr, backend->addr_len) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    pool->opened++;
+    return fd;
+}
+
+void upstream_release(upstream_pool_t *pool, int index, int fd) {
+    if (pool->idle_count[index] == PROXY_MAX_IDLE) {
+        close(fd);
+        return;
+    }
+    pool->idle[index][pool->idle_count[index]++] = fd;
+}
+
+ssize_t proxy_request_head(char *out, size_t cap, const char *method, const char *target, const char *headers,
+                           const char *client, proxy_request_t *request) {
+    memset(request, 0, sizeof(proxy_request_t));
+    connection_options_t options;
+    if (find_connection_options(headers, headers + strlen(headers), &options) < 0) return -1;
+    bool has_length = false;
+    size_t len = 0;
+    if (append(out, cap, &len, "%s %s HTTP/1.1\r\n", method, target) < 0) return -1;
+    for (const char *line = headers; *line != '\0';) {
+        const char *eol = strstr(line, "\r\n");
+        size_t line_len = eol != NULL ? (size_t) (eol - line) : strlen(line);
+        const char *value;
+        if ((value = http_header_value(line, line_len, "Content-Length")) != NULL) {
+            /** The backend must find the same end of the body, identical duplicates are forwarded once */
+            long long length = http_content_length(value, line + line_len);
+            if (length < 0 || (has_length && length != request->content_length)) return -1;
+            if (has_length) line_len = 0;
+            request->content_length = length;
+            has_length = true;
+        } else if ((value = http_header_value(line, line_len, "Transfer-Encoding")) != NULL) {
+            request->chunked = true;
+        } else if ((value = http_header_value(line, line_len, "Connection")) != NULL) {
+            if (http_has_token(value, line + line_len, "close", strlen("close"))) request->close = true;
+        } else if ((value = http_header_value(line, line_len, "Expect")) != NULL) {
+            /** Answered by the server itself, the backend gets the body right away */
+            request->expect_continue = strncasecmp(value, "100-continue", strlen("100-continue")) == 0;
+            line_len = 0;
+        }
+        if (line_len > 0 && !is_hop_by_hop(line, line_len, &options)) {
+            if (append(out, cap, &len, "%.*s\r\n", (int) line_len, line) < 0) return -1;
+        }
+        if (eol == NULL) break;
+        line = eol + 2;
+    }
+    /** A body framed both ways ends in different places for different parsers */
+    if (has_length && request->chunked) return -1;
+    if (append(out, cap, &len, "X-Forwarded-For: %s\r\nConnection: keep-alive\r\n\r\n", client) < 0) return -1;
+    return (ssize_t) len;
+}
+
+ssize_t proxy_response_head(char *out, size_t cap, const char *head, size_t head_len, bool keep_alive) {
+    const char *end = head + head_len - 2;
+    const char *eol = memchr(head, '\n', head_len);
+    connection_options_t options;
+    if (find_connection_options(eol + 1, end, &options) < 0) return -1;
+    size_t len = 0;
+    /** Status line without "HTTP/1.x" */
+    if (append(out, cap, &len, "HTTP/1.1%.*s\n", (int) (eol - head - 8), head + 8) < 0) return -1;
+    for (const char *line = eol + 1; line < end; line = eol + 1) {
+        eol = memchr(line, '\n', end - line);
+        size_t line_len = eol - line;
+        if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+        if (is_hop_by_hop(line, line_len, &options)) continue;
+        if (append(out, cap, &len, "%.*s\r\n", (int) line_len, line) < 0) return -1;
+    }
+    if (append(out, cap, &len, "Connection: %s\r\n\r\n", keep_alive ? "keep-alive" : "close") < 0) return -1;
+    return (ssize_t) len;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file proxy.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Backends of the reverse proxy and the pool of kept alive connections to them.
+ * @details Requests whose path starts with a configured prefix (-P PREFIX=HOST:PORT) are forwarded to that backend
+ * instead of being served from DOC_ROOT, the longest matching prefix wins. The event loop of the server drives the
+ * forwarding, this module resolves the backends, rewrites the request and response heads (hop-by-hop headers like
+ * Connection are replaced, X-Forwarded-For is added) and keeps the connections to the backends alive.
+ *
+ * Every event loop owns a pool of idle upstream connections per backend. A finished response puts its connection
+ * back and the next request to the backend takes it, so a busy backend is not connected to for every request. A
+ * pooled connection which the backend closed in the meantime is noticed before it is used.
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/** Backends that can be configured */
+#define PROXY_MAX_BACKENDS 16
+/** Idle connections kept per backend, further ones are closed */
+#define PROXY_MAX_IDLE 32
+/** Buffer for the forwarded request head and for the response of the backend, its head has to fit in */
+#define PROXY_BUFF_SIZE (16 * 1024)
+
+/** A backend requests are forwarded to */
+typedef struct {
+    /** Path prefix without trailing slash, "" for the root */
+    char *prefix;
+    size_t prefix_len;
+    /** Address as given, e.g. "127.0.0.1:9000" */
+    char *name;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+} backend_t;
+
+/** Idle connections of one event loop, indexed like the backends */
+typedef struct {
+    int idle[PROXY_MAX_BACKENDS][PROXY_MAX_IDLE];
+    size_t idle_count[PROXY_MAX_BACKENDS];
+    /** Statistics for the shutdown report */
+    unsigned long long opened;
+    unsigned long long reused;
+} upstream_pool_t;
+
+/** Properties of a forwarded request, parsed while its head is rewritten */
+typedef struct {
+    /** Content-Length of the request body, 0 if there is none */
+    long long content_length;
+    /** True if the body uses chunked transfer coding, which isn't forwarded */
+    bool chunked;
+    /** True if the Connection header of the client has the "close" option */
+    bool close;
+    /** True if the client waits for "100 Continue" before sending the body */
+    bool expect_continue;
+} proxy_request_t;
+
+/**
+ * @brief Parses and resolves a backend given as PREFIX=HOST:PORT, e.g. "/api=127.0.0.1:9000".
+ * @param arg Argument of -P, modified in place and referenced by the backend.
+ * @param backend Backend to be filled.
+ * @return 0 on success, -1 if the argument is malformed or the host can't be resolved.
+ */
+int proxy_parse_backend(char *arg, backend_t *backend);
+
+/**
+ * @brief Finds the backend of a request path.
+ * @details A prefix matches whole path segments only, "/api" matches "/api" and "/api/users" but not "/apis".
+ *
+ * @param backends Configured backends.
+ * @param count Amount of backends.
+ * @param path Normalized request path.
+ * @return Index of the backend with the longest matching prefix, -1 if the path isn't proxied.
+ */
+int proxy_route(const backend_t *backends, size_t count, const char *path);
+
+/**
+ * @brief Sets up an empty pool.
+ * @param pool Pool to be initialized, freed with upstream_pool_free().
+ */
+void upstream_pool_init(upstream_pool_t *pool);
+
+/**
+ * @brief Closes all idle connections of a pool.
+ * @param pool Pool from upstream_pool_init().
+ */
+void upstream_pool_free(upstream_pool_t *pool);
+
+/**
+ * @brief Gets a connection to a backend, a pooled one if it is still open or a new one.
+ * @details New connections are non-blocking and may still be connecting, sending on them fails with EAGAIN until
+ * they are established.
+ *
+ * @param pool Pool of the event loop.
+ * @param backends Configured backends.
+ * @param index Index of the backend.
+ * @param reused Set to true if the connection came from the pool.
+ * @return Socket, -1 on errors.
+ */
+int upstream_acquire(upstream_pool_t *pool, const backend_t *backends, int index, bool *reused);
+
+/**
+ * @brief Puts a connection whose response is complete back into the pool, or closes it if the pool is full.
+ * @param pool Pool of the event loop.
+ * @param index Index of the backend.
+ * @param fd Socket, no longer watched by the event loop.
+ */
+void upstream_release(upstream_pool_t *pool, int index, int fd);
+
+/**
+ * @brief Builds the head of the request to the backend.
+ * @details Hop-by-hop headers of the client are dropped, including those named in its Connection header,
+ * X-Forwarded-For is added and the connection is kept alive. Content-Length has to be plain digits, duplicates have
+ * to agree and it can't come with Transfer-Encoding, otherwise the backend might see a different end of the body
+ * and take the rest for another request.
+ *
+ * @param out Buffer for the head.
+ * @param cap Size of the buffer.
+ * @param method Method of the request.
+ * @param target Request target as sent by the client.
+ * @param headers Header lines of the client, separated by CRLF and null-terminated.
+ * @param client Address of the client.
+ * @param request Set to the properties of the request found among the headers.
+ * @return Length of the head, -1 if it doesn't fit or a header is malformed.
+ */
+ssize_t proxy_request_head(char *out, size_t cap, const char *method, const char *target, const char *headers,
+                           const char *client, proxy_request_t *request);
+
+/**
+ * @brief Builds the head of the response to the client from the head of the backend.
+ * @details The status line is sent as HTTP/1.1, hop-by-hop headers of the backend, including those named in its
+ * Connection header, are replaced by the Connection header of the client connection.
+ *
+ * @param out Buffer for the head.
+ * @param cap Size of the buffer.
+ * @param head Response head of the backend.
+ * @param head_len Length of the head including the empty line.
+ * @param keep_alive True if the client connection stays open after the response.
+ * @return Length of the head, -1 if it doesn't fit or has too many Connection headers.
+ */
+ssize_t proxy_response_head(char *out, size_t cap, const char *head, size_t head_len, bool keep_alive);
+
+#endif
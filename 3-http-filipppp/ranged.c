@@ -0,0 +1,636 @@
+/**
+ * @file ranged.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+/** fallocate is Linux specific */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "ranged.h"
+#include "http_response.h"
+#include "compression.h"
+#include "http_io.h"
+
+/** Events fetched per epoll_wait() */
+#define RANGED_EVENTS 16
+/** Longest ETag or Last-Modified value kept, a longer one isn't used for resuming */
+#define RANGED_VALIDATOR_MAX 256
+/** Length of a part in the state file: first and last byte and the bytes done, fixed width so it can be overwritten */
+#define RANGED_STATE_LINE 63
+
+typedef enum {
+    part_done = 0,
+    part_connecting = 1,
+    part_writing = 2,
+    part_headers = 3,
+    part_body = 4,
+    /** Gave up after its retries */
+    part_failed = 5
+} part_state_e;
+
+/** A byte range of the file with its connection */
+typedef struct {
+    /** First and last byte of the part in the file */
+    long long first;
+    long long last;
+    /** Bytes of the part which are in the file already */
+    long long done;
+    /** Value of done in the state file */
+    long long saved;
+    /** Position of the line of the part in the state file */
+    off_t state_offset;
+    int fd;
+    /** Events registered with epoll, 0 if the fd isn't registered */
+    unsigned int events;
+    part_state_e state;
+    int retries;
+    char *request;
+    size_t request_len;
+    size_t written;
+    http_response_t res;
+    io_buffer_t in;
+} part_t;
+
+typedef struct {
+    const ranged_options_t *options;
+    int epoll_fd;
+    int out_fd;
+    int state_fd;
+    char *state_path;
+    /** Size of the file and its ETag or Last-Modified, empty if the server sent neither */
+    long long size;
+    char validator[RANGED_VALIDATOR_MAX];
+    /** Value of the If-Range header, a strong ETag or Last-Modified, empty if there is no strong validator */
+    char if_range[RANGED_VALIDATOR_MAX];
+    part_t *parts;
+    size_t count;
+    /** Parts which are still being downloaded */
+    size_t active;
+    /** First error, NULL while everything goes well */
+    const char *error;
+} ranged_t;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, off_t offset) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, ptr, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        ptr += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void report(ranged_t *r, const char *error) {
+    const ranged_options_t *options = r->options;
+    fprintf(options->errors, "[%s] Error: %s: %s \n", options->name, options->path, error);
+}
+
+static int open_socket(const ranged_options_t *options, bool nonblocking) {
+    int fd = socket(options->addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, options->addr, options->addr_len) < 0 && !(nonblocking && errno == EINPROGRESS)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Parses "bytes FIRST-LAST/SIZE" of a Content-Range header, "bytes * /SIZE" leaves first and last at -1.
+ */
+static int parse_content_range(const char *value, size_t len, long long *first, long long *last, long long *size) {
+    char range[64];
+    if (value == NULL || len >= sizeof(range)) return -1;
+    memcpy(range, value, len);
+    range[len] = '\0';
+    *first = *last = -1;
+    char tail;
+    if (sscanf(range, "bytes %lld-%lld/%lld%c", first, last, size, &tail) == 3) return 0;
+    if (sscanf(range, "bytes */%lld%c", size, &tail) == 1) return 0;
+    return -1;
+}
+
+/**
+ * @brief Saves a body which isn't split into parts, the server sent the whole file.
+ * @param in Receive buffer holding the response head and the start of the body.
+ * @param head Length of the response head.
+ */
+static int save_whole(ranged_t *r, int fd, io_buffer_t *in, size_t head, http_response_t *res) {
+    if (res->encoding != enc_identity) {
+        report(r, "unexpected Content-Encoding");
+        return -1;
+    }
+    r->out_fd = open(r->options->file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (r->out_fd < 0) {
+        report(r, "couldn't open file");
+        return -1;
+    }
+    size_t off = head;
+    for (;;) {
+        int ret = 0;
+        for (;;) {
+            size_t used, data_len;
+            const char *data;
+            ret = http_response_body(res, in->data + off, in->len - off, &used, &data, &data_len);
+            if (ret < 0 || (data_len > 0 && io_write_all(r->out_fd, data, data_len) < 0)) {
+                report(r, ret < 0 ? "protocol error" : "couldn't write file");
+                return -1;
+            }
+            off += used;
+            if (ret > 0 || used == 0) break;
+        }
+        if (ret > 0) return 0;
+        io_buffer_consume(in, off);
+        off = 0;
+        if (*r->options->interrupted) {
+            report(r, "interrupted");
+            return -1;
+        }
+        ssize_t n = io_buffer_read(in, fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0 && res->framing == framing_close) return 0;
+        if (n <= 0 || in->len == in->cap) {
+            report(r, n <= 0 ? "connection closed before the response was complete" : "protocol error");
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Copies a header value into a validator, which stays empty if there is none or it is too long.
+ */
+static void copy_validator(char *validator, const char *value, size_t len) {
+    validator[0] = '\0';
+    if (value == NULL || len >= RANGED_VALIDATOR_MAX) return;
+    memcpy(validator, value, len);
+    validator[len] = '\0';
+}
+
+/**
+ * @brief Requests the first byte, which tells the size of the file and whether the server supports ranges.
+ * @details A server without range support sends the whole file instead, which is saved right away.
+ * @return 1 if the file has to be downloaded in parts, 0 if it has been saved already, -1 on errors.
+ */
+static int probe(ranged_t *r, io_buffer_t *in) {
+    const ranged_options_t *options = r->options;
+    int fd = open_socket(options, false);
+    if (fd < 0) {
+        report(r, "couldn't create connection");
+        return -1;
+    }
+    char request[strlen(options->path) + strlen(options->host) + 64];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=0-0\r\n\r\n",
+                               options->path, options->host);
+    if (io_write_all(fd, request, request_len) < 0) {
+        report(r, "couldn't send request");
+        close(fd);
+        return -1;
+    }
+
+    http_response_t res;
+    ssize_t head = 0;
+    while (head == 0) {
+        ssize_t n = io_buffer_read(in, fd);
+        if (n < 0 && errno == EINTR && !*options->interrupted) continue;
+        if (n <= 0) break;
+        head = http_response_head(&res, in->data, in->len, false);
+        if (head == 0 && in->len == in->cap) head = -1;
+    }
+    if (head <= 0) {
+        report(r, head < 0 ? "protocol error" : "connection closed before the response was complete");
+        close(fd);
+        return -1;
+    }
+
+    int ret = -1;
+    size_t value_len;
+    long long first, last;
+    const char *range = http_response_header(in->data, head, "Content-Range", &value_len);
+    if (res.status == 200) {
+        ret = save_whole(r, fd, in, head, &res);
+    } else if (res.status == 206 || res.status == 416) {
+        if (parse_content_range(range, value_len, &first, &last, &r->size) < 0 || r->size < 0
+            || (res.status == 416 && r->size != 0)) {
+            report(r, "invalid Content-Range");
+        } else {
+            size_t etag_len, modified_len;
+            const char *etag = http_response_header(in->data, head, "ETag", &etag_len);
+            const char *modified = http_response_header(in->data, head, "Last-Modified", &modified_len);
+            /** Any ETag tells whether a resumed download still belongs to the same file */
+            copy_validator(r->validator, etag != NULL ? etag : modified, etag != NULL ? etag_len : modified_len);
+            /** If-Range only accepts strong validators, a weak ETag would get the whole file on every request */
+            if (etag != NULL && etag_len >= 2 && etag[0] == 'W' && etag[1] == '/') etag = NULL;
+            copy_validator(r->if_range, etag != NULL ? etag : modified, etag != NULL ? etag_len : modified_len);
+            ret = 1;
+        }
+    } else {
+        char error[32];
+        snprintf(error, sizeof(error), "status %d", res.status);
+        report(r, error);
+    }
+    close(fd);
+    return ret;
+}
+
+static int save_part(ranged_t *r, part_t *p) {
+    char line[RANGED_STATE_LINE + 1];
+    snprintf(line, sizeof(line), "%020lld %020lld %020lld\n", p->first, p->last, p->done);
+    if (pwrite_all(r->state_fd, line, RANGED_STATE_LINE, p->state_offset) < 0) return -1;
+    p->saved = p->done;
+    return 0;
+}
+
+/**
+ * @brief Takes over the parts of an earlier attempt if its state file belongs to the same file on the server.
+ * @return True if the download is resumed.
+ */
+static bool load_state(ranged_t *r) {
+    FILE *f = fopen(r->state_path, "r");
+    if (f == NULL) return false;
+    char validator[RANGED_VALIDATOR_MAX + 2];
+    long long size;
+    bool ok = fscanf(f, "%lld", &size) == 1 && fgetc(f) == '\n' && fgets(validator, sizeof(validator), f) != NULL;
+    validator[strcspn(validator, "\n")] = '\0';
+    ok = ok && size == r->size && strcmp(validator, r->validator) == 0;
+
+    size_t cap = 0;
+    long long next = 0;
+    off_t offset = ftell(f);
+    part_t p;
+    while (ok && fscanf(f, "%lld %lld %lld\n", &p.first, &p.last, &p.done) == 3) {
+        /** Parts have to cover the file without gaps */
+        if (p.first != next || p.last < p.first || p.done < 0 || p.done > p.last - p.first + 1) {
+            ok = false;
+            break;
+        }
+        next = p.last + 1;
+        if (r->count == cap) {
+            cap = cap == 0 ? 8 : cap * 2;
+            part_t *parts = realloc(r->parts, cap * sizeof(part_t));
+            if (parts == NULL) {
+                ok = false;
+                break;
+            }
+            r->parts = parts;
+        }
+        p.saved = p.done;
+        p.state_offset = offset + (off_t) r->count * RANGED_STATE_LINE;
+        r->parts[r->count++] = p;
+    }
+    fclose(f);
+
+    struct stat st;
+    ok = ok && next == r->size && r->count > 0;
+    if (ok) r->out_fd = open(r->options->file, O_RDWR | O_CLOEXEC);
+    ok = ok && r->out_fd >= 0 && fstat(r->out_fd, &st) == 0 && st.st_size == r->size;
+    if (ok) r->state_fd = open(r->state_path, O_RDWR | O_CLOEXEC);
+    if (!ok || r->state_fd < 0) {
+        if (r->out_fd >= 0) close(r->out_fd);
+        r->out_fd = -1;
+        free(r->parts);
+        r->parts = NULL;
+        r->count = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Splits the file into parts, preallocates it and writes a new state file.
+ */
+static int create_state(ranged_t *r) {
+    r->out_fd = open(r->options->file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (r->out_fd < 0) {
+        report(r, "couldn't open file");
+        return -1;
+    }
+    /** Parts are written out of order, reserving the blocks keeps the file from fragmenting */
+    if (fallocate(r->out_fd, 0, 0, r->size) < 0 && ftruncate(r->out_fd, r->size) < 0) {
+        report(r, "couldn't preallocate file");
+        return -1;
+    }
+
+    long long count = r->size / RANGED_MIN_PART;
+    if (count > (long long) r->options->parts) count = (long long) r->options->parts;
+    if (count < 1) count = 1;
+    r->parts = calloc(count, sizeof(part_t));
+    if (r->parts == NULL) {
+        report(r, "out of memory");
+        return -1;
+    }
+    r->count = count;
+
+    r->state_fd = open(r->state_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    char head[RANGED_VALIDATOR_MAX + 32];
+    int head_len = snprintf(head, sizeof(head), "%lld\n%s\n", r->size, r->validator);
+    if (r->state_fd < 0 || io_write_all(r->state_fd, head, head_len) < 0) {
+        report(r, "couldn't write state file");
+        return -1;
+    }
+    for (size_t i = 0; i < r->count; ++i) {
+        part_t *p = &r->parts[i];
+        p->first = r->size * (long long) i / count;
+        p->last = r->size * (long long) (i + 1) / count - 1;
+        p->state_offset = head_len + (off_t) i * RANGED_STATE_LINE;
+        if (save_part(r, p) < 0) {
+            report(r, "couldn't write state file");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Changes the events a connection waits for, without a syscall if they stay the same.
+ */
+static int part_watch(ranged_t *r, part_t *p, unsigned int events) {
+    if (p->events == events) return 0;
+    struct epoll_event ev = {.events = events, .data.ptr = p};
+    if (epoll_ctl(r->epoll_fd, p->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, p->fd, &ev) < 0) return -1;
+    p->events = events;
+    return 0;
+}
+
+static void part_close(part_t *p) {
+    if (p->fd >= 0) close(p->fd);
+    p->fd = -1;
+    p->events = 0;
+}
+
+/**
+ * @brief Requests the rest of a part over a new connection.
+ */
+static int part_start(ranged_t *r, part_t *p) {
+    const ranged_options_t *options = r->options;
+    const char *if_range = r->if_range[0] != '\0' ? "If-Range: " : "";
+    const char *fmt = "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%lld-%lld\r\n%s%s%s\r\n";
+    long long first = p->first + p->done;
+    int len = snprintf(NULL, 0, fmt, options->path, options->host, first, p->last, if_range, r->if_range,
+                       *if_range != '\0' ? "\r\n" : "");
+    char *request = realloc(p->request, len + 1);
+    if (request == NULL) return -1;
+    p->request = request;
+    snprintf(p->request, len + 1, fmt, options->path, options->host, first, p->last, if_range, r->if_range,
+             *if_range != '\0' ? "\r\n" : "");
+    p->request_len = len;
+    p->written = 0;
+    io_buffer_consume(&p->in, p->in.len);
+
+    p->fd = open_socket(options, true);
+    if (p->fd < 0 || part_watch(r, p, EPOLLOUT) < 0) {
+        part_close(p);
+        return -1;
+    }
+    p->state = part_connecting;
+    return 0;
+}
+
+/**
+ * @brief Gives up on the current connection of a part, the part is requested again from where it stopped.
+ */
+static void part_fail(ranged_t *r, part_t *p, const char *error) {
+    part_close(p);
+    if (p->done != p->saved) save_part(r, p);
+    while (p->retries < RANGED_RETRIES) {
+        p->retries++;
+        if (part_start(r, p) == 0) return;
+    }
+    if (r->error == NULL) r->error = error;
+    p->state = part_failed;
+    r->active--;
+}
+
+static void part_finish(ranged_t *r, part_t *p) {
+    part_close(p);
+    p->state = part_done;
+    r->active--;
+    if (save_part(r, p) < 0 && r->error == NULL) r->error = "couldn't write state file";
+}
+
+/**
+ * @brief Parses what has been received so far and writes the body data at its offset.
+ * @return 1 if the part is complete, 0 if more data is needed and -1 on errors, with error set.
+ */
+static int parse_part(ranged_t *r, part_t *p, const char **error) {
+    size_t off = 0;
+    if (p->state == part_headers) {
+        ssize_t head = http_response_head(&p->res, p->in.data, p->in.len, false);
+        if (head == 0 && p->in.len < p->in.cap) return 0;
+        size_t len;
+        long long first, last, size;
+        const char *range = head > 0 ? http_response_header(p->in.data, head, "Content-Range", &len) : NULL;
+        if (head <= 0) {
+            *error = "protocol error";
+            return -1;
+        }
+        if (p->res.status != 206 || p->res.encoding != enc_identity || range == NULL
+            || parse_content_range(range, len, &first, &last, &size) < 0 || first != p->first + p->done
+            || last != p->last || size != r->size) {
+            /** The file changed on the server or the server stopped supporting ranges, retrying won't help */
+            p->retries = RANGED_RETRIES;
+            *error = "server didn't send the requested range, the file may have changed";
+            return -1;
+        }
+        off = head;
+        p->state = part_body;
+    }
+    for (;;) {
+        size_t used, data_len;
+        const char *data;
+        int ret = http_response_body(&p->res, p->in.data + off, p->in.len - off, &used, &data, &data_len);
+        if (ret < 0) {
+            *error = "protocol error";
+            return -1;
+        }
+        if (data_len > 0) {
+            if (pwrite_all(r->out_fd, data, data_len, p->first + p->done) < 0) {
+                p->retries = RANGED_RETRIES;
+                *error = "couldn't write file";
+                return -1;
+            }
+            p->done += data_len;
+            if (p->done - p->saved >= RANGED_STATE_INTERVAL) save_part(r, p);
+        }
+        off += used;
+        if (ret > 0) return 1;
+        if (used == 0) break;
+    }
+    io_buffer_consume(&p->in, off);
+    return 0;
+}
+
+static void part_write(ranged_t *r, part_t *p) {
+    int ret = io_send(p->fd, p->request, p->request_len, &p->written);
+    if (ret == 0) {
+        if (part_watch(r, p, EPOLLOUT) < 0) part_fail(r, p, "couldn't wait for the connection");
+        return;
+    }
+    if (ret < 0) {
+        part_fail(r, p, "couldn't send request");
+        return;
+    }
+    p->state = part_headers;
+    if (part_watch(r, p, EPOLLIN) < 0) part_fail(r, p, "couldn't wait for the connection");
+}
+
+static void part_read(ranged_t *r, part_t *p) {
+    for (;;) {
+        ssize_t n = io_buffer_read(&p->in, p->fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            part_fail(r, p, "connection closed before the response was complete");
+            return;
+        }
+        const char *error = NULL;
+        int ret = parse_part(r, p, &error);
+        if (ret < 0) {
+            part_fail(r, p, error);
+            return;
+        }
+        if (ret > 0) {
+            part_finish(r, p);
+            return;
+        }
+    }
+}
+
+static void part_event(ranged_t *r, part_t *p) {
+    switch (p->state) {
+        case part_connecting: {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+                part_fail(r, p, "couldn't create connection");
+                return;
+            }
+            p->state = part_writing;
+            part_write(r, p);
+            break;
+        }
+        case part_writing:
+            part_write(r, p);
+            break;
+        case part_headers:
+        case part_body:
+            part_read(r, p);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Downloads all parts which aren't done yet.
+ */
+static void run_parts(ranged_t *r) {
+    for (size_t i = 0; i < r->count; ++i) {
+        part_t *p = &r->parts[i];
+        p->fd = -1;
+        p->state = part_done;
+        if (p->done == p->last - p->first + 1) continue;
+        if (io_buffer_init(&p->in, RANGED_BUFF_SIZE) < 0) {
+            r->error = "out of memory";
+            return;
+        }
+        r->active++;
+        p->state = part_connecting;
+        if (part_start(r, p) < 0) part_fail(r, p, "couldn't create connection");
+    }
+
+    struct epoll_event events[RANGED_EVENTS];
+    long last_progress = now_ms();
+    while (r->active > 0) {
+        if (*r->options->interrupted) {
+            r->error = "interrupted";
+            break;
+        }
+        long timeout = RANGED_STALL_MS - (now_ms() - last_progress);
+        int n = timeout > 0 ? epoll_wait(r->epoll_fd, events, RANGED_EVENTS, (int) timeout) : 0;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            r->error = n == 0 ? "timed out" : "epoll_wait failed";
+            break;
+        }
+        last_progress = now_ms();
+        for (int i = 0; i < n; ++i) part_event(r, events[i].data.ptr);
+    }
+}
+
+static void free_ranged(ranged_t *r) {
+    for (size_t i = 0; r->parts != NULL && i < r->count; ++i) {
+        part_t *p = &r->parts[i];
+        /** Whatever arrived until now is in the file, so it is part of the state to resume from */
+        if (r->state_fd >= 0 && p->done != p->saved) save_part(r, p);
+        part_close(p);
+        free(p->request);
+        io_buffer_free(&p->in);
+    }
+    free(r->parts);
+    if (r->out_fd >= 0) close(r->out_fd);
+    if (r->state_fd >= 0) close(r->state_fd);
+    if (r->epoll_fd >= 0) close(r->epoll_fd);
+    free(r->state_path);
+}
+
+int ranged_run(const ranged_options_t *options) {
+    ranged_t r = {options, epoll_create1(EPOLL_CLOEXEC), -1, -1};
+    r.state_path = malloc(strlen(options->file) + strlen(RANGED_STATE_SUFFIX) + 1);
+    io_buffer_t in;
+    if (io_buffer_init(&in, RANGED_BUFF_SIZE) < 0 || r.epoll_fd < 0 || r.state_path == NULL) {
+        report(&r, "couldn't set up the download");
+        io_buffer_free(&in);
+        free_ranged(&r);
+        return -1;
+    }
+    strcpy(r.state_path, options->file);
+    strcat(r.state_path, RANGED_STATE_SUFFIX);
+
+    int ret = probe(&r, &in);
+    io_buffer_free(&in);
+    if (ret <= 0) {
+        /** The whole file came with the probe, a state file of an earlier attempt is useless now */
+        if (ret == 0) unlink(r.state_path);
+        free_ranged(&r);
+        return ret;
+    }
+
+    if (!load_state(&r) && create_state(&r) < 0) {
+        free_ranged(&r);
+        return -1;
+    }
+    run_parts(&r);
+    if (r.error != NULL) {
+        report(&r, r.error);
+        fprintf(options->errors, "[%s] The download is resumed from %s when run again. \n", options->name,
+                r.state_path);
+        free_ranged(&r);
+        return -1;
+    }
+    unlink(r.state_path);
+    free_ranged(&r);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file ranged.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Download of one large file as several byte ranges over parallel connections.
+ * @details A probe request for the first byte tells the size of the file and whether the server supports ranges at
+ * all, a server without range support answers with the whole file, which is then simply saved. Otherwise the file is
+ * preallocated and split into parts, every part is requested with its own Range header over its own connection and
+ * written with pwrite() at its offset, all from a single epoll loop.
+ *
+ * The progress of every part is kept in a state file next to the output (FILE.ranges). A download which failed or was
+ * interrupted is resumed from there by running it again, as long as the file on the server still has the same size and
+ * validator (ETag or Last-Modified). The state file is removed once the download is complete.
+ */
+
+#ifndef RANGED_H
+#define RANGED_H
+
+#include <stdio.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+/** Smallest part, smaller files are split into fewer parts */
+#define RANGED_MIN_PART (1024 * 1024)
+/** Size of the receive buffer of a connection, the response headers have to fit in */
+#define RANGED_BUFF_SIZE (64 * 1024)
+/** Time without any progress on any connection after which the download fails */
+#define RANGED_STALL_MS 30000
+/** Bytes a part advances between two updates of the state file */
+#define RANGED_STATE_INTERVAL (4 * 1024 * 1024)
+/** How often a part is requested again after its connection failed */
+#define RANGED_RETRIES 3
+/** Appended to the output file for the name of the state file */
+#define RANGED_STATE_SUFFIX ".ranges"
+
+/** What to download */
+typedef struct {
+    /** Address of the server */
+    const struct sockaddr *addr;
+    socklen_t addr_len;
+    /** Value of the Host header */
+    const char *host;
+    /** Request target, starting with '/' */
+    const char *path;
+    /** File the body is written to */
+    const char *file;
+    /** Parallel connections, the file is split into as many parts */
+    size_t parts;
+    /** Set by a signal handler to stop the download, it is then resumable */
+    volatile sig_atomic_t *interrupted;
+    /** Stream errors are reported to, prefixed with name */
+    FILE *errors;
+    const char *name;
+} ranged_options_t;
+
+/**
+ * @brief Downloads the file, resuming an earlier attempt if its state file matches.
+ * @param options What to download.
+ * @return 0 on success, -1 on errors, in both cases after an interruption the state file is kept for resuming.
+ */
+int ranged_run(const ranged_options_t *options);
+
+#endif
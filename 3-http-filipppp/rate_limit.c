@@ -0,0 +1,80 @@
+/**
+ * @file rate_limit.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rate_limit.h"
+
+/** Tokens are counted in thousandths, so slow rates still refill between requests */
+#define TOKEN 1000u
+
+int rate_limiter_init(rate_limiter_t *limiter, uint32_t rate, uint32_t burst) {
+    memset(limiter, 0, sizeof(rate_limiter_t));
+    limiter->slots = calloc(RATE_LIMIT_SLOTS, sizeof(rate_bucket_t));
+    if (limiter->slots == NULL) return -1;
+    limiter->rate = rate;
+    limiter->burst = burst;
+    limiter->refill_ms = (uint32_t) (((uint64_t) burst * TOKEN + rate - 1) / rate);
+    return 0;
+}
+
+void rate_limiter_free(rate_limiter_t *limiter) {
+    free(limiter->slots);
+    limiter->slots = NULL;
+}
+
+static uint32_t hash_addr(const unsigned char addr[16]) {
+    /** FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 16; ++i) hash = (hash ^ addr[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Finds the bucket of an address, or the slot for a new one.
+ * @return Bucket, its used flag is false if it has to be set up.
+ */
+static rate_bucket_t *find_bucket(rate_limiter_t *limiter, const unsigned char addr[16], uint32_t now) {
+    rate_bucket_t *free_slot = NULL;
+    rate_bucket_t *oldest = NULL;
+    uint32_t start = hash_addr(addr);
+    for (uint32_t i = 0; i < RATE_LIMIT_PROBES; ++i) {
+        rate_bucket_t *bucket = &limiter->slots[(start + i) & (RATE_LIMIT_SLOTS - 1)];
+        if (bucket->used && memcmp(bucket->addr, addr, 16) == 0) return bucket;
+        /** A bucket full again is as good as none */
+        bool expired = !bucket->used || now - bucket->stamp >= limiter->refill_ms;
+        if (expired && free_slot == NULL) free_slot = bucket;
+        if (oldest == NULL || now - bucket->stamp > now - oldest->stamp) oldest = bucket;
+    }
+    if (free_slot == NULL) {
+        free_slot = oldest;
+        limiter->evicted++;
+    }
+    free_slot->used = false;
+    return free_slot;
+}
+
+long rate_limiter_take(rate_limiter_t *limiter, const unsigned char addr[16], long now_ms) {
+    uint32_t now = (uint32_t) now_ms;
+    uint64_t capacity = (uint64_t) limiter->burst * TOKEN;
+    rate_bucket_t *bucket = find_bucket(limiter, addr, now);
+    if (!bucket->used) {
+        memcpy(bucket->addr, addr, 16);
+        bucket->tokens = (uint32_t) capacity;
+        bucket->stamp = now;
+        bucket->used = true;
+    }
+
+    uint64_t tokens = bucket->tokens + (uint64_t) (now - bucket->stamp) * limiter->rate;
+    bucket->tokens = (uint32_t) (tokens < capacity ? tokens : capacity);
+    bucket->stamp = now;
+    if (bucket->tokens >= TOKEN) {
+        bucket->tokens -= TOKEN;
+        return 0;
+    }
+    limiter->limited++;
+    return (long) ((TOKEN - bucket->tokens + limiter->rate - 1) / limiter->rate);
+}
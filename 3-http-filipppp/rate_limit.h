@@ -0,0 +1,76 @@
+/**
+ * @file rate_limit.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Token bucket rate limiting per client address.
+ * @details Every client address has a bucket holding up to BURST tokens which refills with RATE tokens per second, a
+ * request takes one token and is rejected if there is none. So a client can send BURST requests at once and RATE per
+ * second in the long run, one aggressive client can't keep the event loop busy for everybody else.
+ *
+ * The buckets live in a fixed open addressing table of RATE_LIMIT_SLOTS slots, an address is looked for in the
+ * RATE_LIMIT_PROBES slots after its hash. A bucket which has been full again for a while behaves exactly like a new one,
+ * so its slot is simply reused: entries expire without any sweeping. If all probed slots are in use, the bucket which
+ * was touched longest ago is dropped. The table belongs to one event loop and is not thread-safe.
+ */
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Slots of the table, a power of two */
+#define RATE_LIMIT_SLOTS 4096
+/** Slots probed per lookup */
+#define RATE_LIMIT_PROBES 8
+
+/** Bucket of one client */
+typedef struct {
+    /** IPv6 address of the client, IPv4 addresses are mapped */
+    unsigned char addr[16];
+    /** Tokens in thousandths */
+    uint32_t tokens;
+    /** Time of the last refill in ms, truncated to 32 bit */
+    uint32_t stamp;
+    bool used;
+} rate_bucket_t;
+
+/** Buckets of one event loop */
+typedef struct {
+    rate_bucket_t *slots;
+    /** Tokens added per second and size of a bucket */
+    uint32_t rate;
+    uint32_t burst;
+    /** Time in ms an empty bucket needs to fill up, a bucket untouched for longer is free */
+    uint32_t refill_ms;
+    /** Statistics for the shutdown report */
+    unsigned long long limited;
+    unsigned long long evicted;
+} rate_limiter_t;
+
+/**
+ * @brief Allocates an empty table.
+ * @param limiter Limiter to be initialized, freed with rate_limiter_free().
+ * @param rate Requests per second a client may send in the long run, at least 1.
+ * @param burst Requests a client may send at once, at least 1.
+ * @return 0 on success, -1 if the table can't be allocated.
+ */
+int rate_limiter_init(rate_limiter_t *limiter, uint32_t rate, uint32_t burst);
+
+/**
+ * @brief Frees the table.
+ * @param limiter Limiter from rate_limiter_init(), or zeroed.
+ */
+void rate_limiter_free(rate_limiter_t *limiter);
+
+/**
+ * @brief Takes a token for a request of a client.
+ * @param limiter Limiter of the event loop.
+ * @param addr IPv6 address of the client, IPv4 addresses are mapped.
+ * @param now_ms Current time in ms.
+ * @return 0 if the request may be served, otherwise the ms until the client has a token again.
+ */
+long rate_limiter_take(rate_limiter_t *limiter, const unsigned char addr[16], long now_ms);
+
+#endif
@@ -6,54 +6,411 @@
 * @brief Acts as a webserver which servers a specific directory to the network.
 * @details Is able to server binary files, with appropriate mime-types and compression if needed.
 *
+* Connections are handled by a non-blocking epoll event loop. Every connection is a small state machine (read the
+* request headers, then write the response) so a slow client only occupies its own connection and not the server.
+* Connections are kept alive between requests unless the client asks to close them.
+* Limits for the amount of connections, the header size and the time a client may take protect the server from bursts
+* and slow clients, connections beyond the limit are answered with 503 instead of piling up. All timeouts live in one
+* timing wheel per event loop.
+*
+* SIGINT and SIGTERM drain the server: it stops accepting, closes idle connections and finishes the responses in
+* flight within a grace period. SIGHUP restarts the server without refusing a single connection: the listening socket
+* is passed to a new process (LISTEN_FDS, like systemd socket activation) and this process drains.
+*
+* With -a every response is written to an access log by a background thread, the event loop only queues the entry.
+* With -L directories without an index file are answered with a listing, rendered once and cached until inotify
+* reports a change.
+* Request paths are decoded and normalized, files are opened relative to the document root and can't escape it. Open
+* files are cached per path.
+* With -M the server exposes its request counters and latency histograms at the given path in Prometheus format.
+* With -B the files of an asset bundle (see pack.c) are served from one mapping with prebuilt headers.
+* With -P it acts as a reverse proxy, requests below a path prefix are forwarded to a backend over kept alive upstream
+* connections which the event loop pools and drives like its client connections.
+* With -R every client address gets a token bucket, requests beyond its rate are answered with 429. Writable
+* connections are served round robin, each gets at most WRITE_QUANTUM bytes per turn, so big downloads can't starve
+* small responses.
+* The server listens on IPv6 and IPv4 with one dual-stack socket, -T tunes its TCP options (Nagle, deferred accept,
+* fast open, buffer sizes and busy polling), accepted connections inherit them. With -U it also (or, without -p, only)
+* listens on a Unix domain socket, e.g. for a proxy on the same host, whose connections are served the same way.
+* Clients may speak HTTP/2 over cleartext (see h2.c), either with prior knowledge or by upgrading an HTTP/1.1 request,
+* the streams of such a connection are answered by the same request handling as HTTP/1.1 requests.
+*
 */
 
+/** splice is Linux specific */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <signal.h>
 #include <time.h>
 #include <zlib.h>
-#include <assert.h>
+#include <stddef.h>
+#include "compression.h"
+#include "timer_wheel.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "dir_listing.h"
+#include "path_cache.h"
+#include "http_response.h"
+#include "proxy.h"
+#include "mime.h"
+#include "bundle.h"
+#include "rate_limit.h"
+#include "http_io.h"
+#include "h2.h"
 
-/** Buffer size constant  for binary reading and writing */
-#define BUFF_SIZE 128
+/** Buffer size constant for the response headers of a connection */
+#define HEADER_BUFF_SIZE 1024
+/** Maximum amount of bytes sent with one sendfile() call, so one big file can't stall the event loop */
+#define SENDFILE_CHUNK (256 * 1024)
+/** Body bytes a connection may send per loop iteration before the other writable connections get their turn */
+#define WRITE_QUANTUM (512 * 1024)
+/** Receive buffer of HTTP/2 connections, holds several frames of the biggest size */
+#define H2_IN_SIZE (64 * 1024)
+/** Amount of events handled per epoll_wait() call */
+#define MAX_EVENTS 64
+/** Resolution of the timing wheel in milliseconds */
+#define TIMER_TICK_MS 100
+
+/** Default limits, can be changed with the command line options */
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_MAX_CONNECTIONS 1024
+#define DEFAULT_MAX_HEADER_BYTES 8192
+#define DEFAULT_READ_TIMEOUT 10
+#define DEFAULT_WRITE_TIMEOUT 30
+#define DEFAULT_IDLE_TIMEOUT 5
+#define DEFAULT_GRACE_PERIOD 10
+/** Listening socket passed on by a restart or by systemd socket activation */
+#define LISTEN_FDS_START 3
 
 static char *prog_name;
 
 /** HTTP status codes for responses */
 typedef enum {
     accepted = 200,
+    no_content = 204,
+    partial_content = 206,
+    moved_permanently = 301,
     malformed_req = 400,
     unsupported_method = 501,
-    ressource_not_found = 404
+    ressource_not_found = 404,
+    request_timeout = 408,
+    range_not_satisfiable = 416,
+    misdirected_request = 421,
+    too_many_requests = 429,
+    header_too_large = 431,
+    internal_error = 500,
+    bad_gateway = 502,
+    service_unavailable = 503,
+    gateway_timeout = 504
 } status_e;
 
 /** Stop variable for interrupts */
 sig_atomic_t volatile stop = false;
+/** Set by SIGHUP, hands the listening socket to a new process */
+sig_atomic_t volatile restart = false;
 
 /** Global variables parsed from the CLI */
+/** TCP options of the listening socket, 0 leaves the default of the kernel except for nodelay */
+typedef struct {
+    /** Disables Nagle's algorithm, on by default */
+    int nodelay;
+    /** Seconds the kernel waits for the request before the connection is accepted */
+    int defer_accept;
+    /** Queue length for TCP Fast Open connections, whose request arrives with the SYN */
+    int fastopen;
+    /** Socket buffer sizes in bytes */
+    int sndbuf;
+    int rcvbuf;
+    /** Microseconds to busy poll the device queue on blocking reads, needs CAP_NET_ADMIN above the sysctl */
+    int busy_poll;
+} tcp_options_t;
+
+/** Options settable with -T NAME[=VALUE] */
+static const struct {
+    const char *name;
+    int level;
+    int optname;
+    size_t offset;
+} tcp_option_names[] = {
+        {"nodelay",      IPPROTO_TCP, TCP_NODELAY,      offsetof(tcp_options_t, nodelay)},
+        {"defer_accept", IPPROTO_TCP, TCP_DEFER_ACCEPT, offsetof(tcp_options_t, defer_accept)},
+        {"fastopen",     IPPROTO_TCP, TCP_FASTOPEN,     offsetof(tcp_options_t, fastopen)},
+        {"sndbuf",       SOL_SOCKET,  SO_SNDBUF,        offsetof(tcp_options_t, sndbuf)},
+        {"rcvbuf",       SOL_SOCKET,  SO_RCVBUF,        offsetof(tcp_options_t, rcvbuf)},
+        {"busy_poll",    SOL_SOCKET,  SO_BUSY_POLL,     offsetof(tcp_options_t, busy_poll)}
+};
+
 typedef struct {
+    /** TCP port, NULL if only the Unix socket is listened on */
     char *port;
     char *default_file;
     char *doc_root;
+    int compress_level;
+    size_t compress_min_size;
+    int backlog;
+    int max_connections;
+    size_t max_header_bytes;
+    /** Timeouts in seconds */
+    int read_timeout;
+    int write_timeout;
+    int idle_timeout;
+    /** Seconds in-flight responses may take after a shutdown or restart */
+    int grace_period;
+    /** Access log file, NULL if disabled */
+    char *access_log;
+    /** Path of the metrics endpoint, e.g. "/__metrics", NULL if disabled */
+    char *metrics_path;
+    /** True if directories without an index file are listed */
+    bool listings;
+    /** Arguments for re-executing the server on SIGHUP */
+    char **argv;
+    /** Backends of the reverse proxy */
+    backend_t backends[PROXY_MAX_BACKENDS];
+    size_t backend_count;
+    /** Asset bundle whose files are served before DOC_ROOT is looked at, NULL if none */
+    char *bundle;
+    tcp_options_t tcp;
+    /** Requests per second and burst allowed per client address, 0 disables rate limiting */
+    uint32_t rate;
+    uint32_t burst;
+    /** Path of the Unix domain socket, NULL if none is listened on */
+    char *unix_path;
 } options_t;
 
 
 /** Metadata for a request */
 typedef struct {
-    FILE *file;
+    /** File descriptor of the body, owned by file */
+    int fd;
+    cached_file_t *file;
     status_e status;
     char *mime;
-    bool gzip;
+    bool compressible;
+    size_t size;
+    /** Path of the file, needed to look up precompressed variants */
+    char *path;
+    /** Parsed Accept-Encoding header of the request */
+    accept_encoding_t accepted;
+    /** Content-Encoding chosen by negotiate_encoding() */
+    encoding_e encoding;
+    /** True if file is a precompressed variant, e.g. index.html.gz, which is sent as is */
+    bool precompressed;
+    /** False if the client sent "Connection: close" */
+    bool keep_alive;
+    /** Method, target and protocol of the request line for the access log, they point into the input buffer */
+    char *method;
+    char *target;
+    const char *protocol;
+    /** True if the metrics endpoint was requested, the body is generated instead of read from a file */
+    bool metrics;
+    /** True if a directory listing is sent, path is the directory then */
+    bool listing;
+    /** Single byte range of the Range header, range_first is -1 for the last range_last bytes and range_last is -1 if
+     * the range reaches to the end of the file */
+    bool range;
+    long long range_first;
+    long long range_last;
+    /** File of the asset bundle, sent from its mapping with its prebuilt headers */
+    const bundle_entry_t *packed;
+    /** True for HEAD, the headers of the GET response are sent without its body */
+    bool head;
 } response_t;
 
+/** States of a connection in the event loop */
+typedef enum {
+    conn_reading = 0,
+    conn_writing = 1,
+    /** The request is forwarded to a backend, the upstream state tells how far */
+    conn_proxying = 2,
+    /** Closed while its events may still be pending, freed at the end of the loop iteration */
+    conn_closed = 3,
+    /** Speaks HTTP/2, the session serves any number of requests at once */
+    conn_h2 = 4
+} conn_state_e;
+
+/** Progress of a request forwarded to a backend */
+typedef enum {
+    upstream_request = 0,
+    upstream_request_body = 1,
+    upstream_response_head = 2,
+    upstream_response = 3
+} upstream_state_e;
+
+/** The backend side of a proxied request */
+typedef struct {
+    upstream_state_e state;
+    int backend;
+    /** Socket to the backend, -1 if there is none */
+    int fd;
+    /** True if the socket came from the pool, it may have been closed by the backend in the meantime */
+    bool reused;
+    /** Events registered for the client and the backend socket, hung_up is set once the backend socket is dead */
+    uint32_t client_events;
+    uint32_t events;
+    bool registered;
+    bool hung_up;
+    /** Rewritten request head, later the rewritten response head */
+    char *head;
+    size_t head_len;
+    size_t head_pos;
+    /** Request body bytes which arrived with the head and follow it in the input buffer, and those still unread */
+    size_t body_offset;
+    size_t body_buffered;
+    long long body_left;
+    bool body_spliced;
+    /** Response of the backend, buff[sent..parsed) is checked against the framing and waits for the client */
+    char *buff;
+    size_t len;
+    size_t parsed;
+    size_t sent;
+    http_response_t res;
+    bool head_request;
+    bool complete;
+    /** Pipe for splicing bodies between the sockets, piped bytes are in it */
+    int pipe[2];
+    size_t piped;
+} upstream_t;
+
+/** A client connection and the progress of its request */
+typedef struct connection {
+    int fd;
+    conn_state_e state;
+    /** Address of the client for the access log */
+    char client[INET6_ADDRSTRLEN];
+    /** Address of the client as IPv6 address, IPv4 ones mapped, the key of its token bucket */
+    unsigned char addr[16];
+    /** False for clients of the Unix socket, which have no address and aren't rate limited */
+    bool limited;
+    /** Time in us at which the first byte of the current request arrived */
+    long started_us;
+    /** Body bytes of the current response sent so far */
+    unsigned long long body_bytes;
+    /** Request headers, max_header_bytes big */
+    io_buffer_t in;
+    /** Length of the current request in the input buffer, pipelined requests follow it */
+    size_t request_len;
+    /** Amount of requests served on this connection */
+    unsigned long requests;
+    /** Response headers which still have to be sent */
+    char out[HEADER_BUFF_SIZE];
+    size_t out_len;
+    size_t out_pos;
+    response_t response;
+    /** Whether a body follows the headers */
+    bool has_body;
+    /** Body generated in memory, e.g. the metrics, sent instead of a file */
+    char *body;
+    /** True if the body points into the mapped asset bundle */
+    bool bundled;
+    /** Cached directory listing the body belongs to, NULL if the body is owned by the connection */
+    listing_t *listing;
+    /** Body sent as is with sendfile() */
+    off_t file_offset;
+    size_t file_remaining;
+    /** Body compressed on the fly, chunk is the pending output of the compressor */
+    compressor_t *comp;
+    unsigned char *chunk;
+    size_t chunk_len;
+    size_t chunk_pos;
+    /** Compressed bodies are sent with chunked transfer coding on kept alive connections */
+    bool chunked;
+    bool last_chunk;
+    char chunk_head[24];
+    upstream_t upstream;
+    /** HTTP/2 side of the connection, NULL while it speaks HTTP/1.1 */
+    struct h2_conn *h2;
+    /** Idle, header-read or send-stall timeout, depending on the state */
+    wheel_timer_t timer;
+    struct connection *prev;
+    struct connection *next;
+} connection_t;
+
+/** Gets the connection of an expired timer */
+#define CONN_OF_TIMER(t) ((connection_t *) ((char *) (t) - offsetof(connection_t, timer)))
+
+/** Event loop with all of its connections */
+typedef struct {
+    int epfd;
+    /** Listening sockets, -1 if not listened on or closed, the Unix one is marked with a pointer to unixfd */
+    int listenfd;
+    int unixfd;
+    /** True once a new process took over the listening sockets, the Unix socket file then stays in place */
+    bool handed_over;
+    options_t *options;
+    compressor_pool_t compressors;
+    timer_wheel_t timers;
+    /** Doubly linked list of all open connections, needed to close the idle ones when draining */
+    connection_t *connections;
+    int active;
+    /** Set once the server stops accepting, with the time in ms at which the remaining connections are dropped */
+    bool draining;
+    long drain_deadline;
+    /** Counters and latencies of this loop, also used for the shutdown report */
+    metrics_t metrics;
+    /** Rendered directory listings, its inotify instance is marked with a pointer to it in epoll */
+    listing_cache_t listings;
+    /** Mapped asset bundle, its map is NULL if none is served */
+    bundle_t bundle;
+    /** Resolved paths below the document root with their open files */
+    path_cache_t files;
+    /** Ring of this loop in the access log, NULL if logging is disabled */
+    access_ring_t *log_ring;
+    /** Sockets to the backends have their own epoll instance, which is marked with a pointer to upstreams */
+    int upstream_epfd;
+    upstream_pool_t upstreams;
+    /** Connections closed during the current loop iteration, linked by next */
+    connection_t *closed;
+    /** Token buckets per client address, slots is NULL without rate limiting */
+    rate_limiter_t limiter;
+} worker_t;
+
+/** HTTP/2 connection, the argument of the session callbacks */
+typedef struct h2_conn {
+    h2_session_t session;
+    worker_t *worker;
+    connection_t *conn;
+    /** Events registered for the socket */
+    uint32_t events;
+} h2_conn_t;
+
+/** Response of an HTTP/2 stream, the per-request fields of a connection */
+typedef struct {
+    /** Request head, method and target of the response point into it */
+    char *head;
+    response_t response;
+    long started_us;
+    unsigned long long body_bytes;
+    char *body;
+    bool bundled;
+    listing_t *listing;
+    /** Part of the file or of the body in memory which is still to be sent */
+    off_t file_offset;
+    size_t file_remaining;
+    compressor_t *comp;
+    unsigned char *chunk;
+    size_t chunk_len;
+    size_t chunk_pos;
+} h2_exchange_t;
+
 /**
  * @brief Prints the usage with an extra error message.
  * @details Also terminates the program, so everything should be free'd and closed before calling this method.
@@ -64,13 +421,17 @@ static void print_usage(char *str) {
     if (str != NULL) {
         fprintf(stderr, "[%s] Error: %s\n", prog_name, str);
     }
-    fprintf(stderr, "[%s] Usage: %s [-p PORT] [ -i INDEX ] DOC_ROOT\n", prog_name, prog_name);
+    fprintf(stderr, "[%s] Usage: %s [-p PORT] [ -i INDEX ] [-l LEVEL] [-m MIN_SIZE] [-b BACKLOG] [-c MAX_CONNS] "
+                    "[-H MAX_HEADER_BYTES] [-r READ_TIMEOUT] [-w WRITE_TIMEOUT] "
+                    "[-k IDLE_TIMEOUT] [-g GRACE_PERIOD] [-a ACCESS_LOG] "
+                    "[-M METRICS_PATH] [-P PREFIX=HOST:PORT]... [-B BUNDLE] [-T NAME[=VALUE]]... "
+                    "[-R RATE[:BURST]] [-U SOCKET_PATH] [-L] DOC_ROOT\n", prog_name, prog_name);
     exit(EXIT_FAILURE);
 }
 
 /**
  * @brief Converts enum values to Standart HTTP Codes.
- * @details Only 200, 400, 404, 500 and 501 are implemented. 500 is the default if no match is found.
+ * @details Only 200, 204, 206, 301, 400, 404, 408, 416, 421, 429, 431, 500, 501, 502, 503 and 504 are implemented. 500 is the default if no match is found.
  * @param status Status enum to be converted.
  * @return String representation according to the Standart HTTP Protocol for the status code passed to the method.
  */
@@ -78,17 +439,105 @@ static char *status_to_str(status_e status) {
     switch (status) {
         case accepted:
             return "200 OK";
+        case no_content:
+            return "204 No Content";
+        case partial_content:
+            return "206 Partial Content";
+        case moved_permanently:
+            return "301 Moved Permanently";
         case malformed_req:
             return "400 Bad Request";
         case unsupported_method:
             return "501 Not implemented";
         case ressource_not_found:
             return "404 Not Found";
+        case request_timeout:
+            return "408 Request Timeout";
+        case range_not_satisfiable:
+            return "416 Range Not Satisfiable";
+        case misdirected_request:
+            return "421 Misdirected Request";
+        case too_many_requests:
+            return "429 Too Many Requests";
+        case header_too_large:
+            return "431 Request Header Fields Too Large";
+        case bad_gateway:
+            return "502 Bad Gateway";
+        case service_unavailable:
+            return "503 Service Unavailable";
+        case gateway_timeout:
+            return "504 Gateway Timeout";
         default:
             return "500 Internal Server Error";
     }
 }
 
+/**
+ * @brief Parses a numeric option and exits with the usage if it is invalid.
+ * @param str Argument of the option.
+ * @param min Smallest allowed value.
+ * @param max Biggest allowed value.
+ * @param error Error message printed with the usage.
+ * @return Parsed value.
+ */
+static long parse_number(char *str, long min, long max, char *error) {
+    char *endptr;
+    errno = 0;
+    long val = strtol(str, &endptr, 10);
+    if (errno != 0 || endptr == str || *endptr != '\0' || val < min || val > max) print_usage(error);
+    return val;
+}
+
+/**
+ * @brief Parses a TCP option given as NAME or NAME=VALUE, e.g. "defer_accept=5", a bare NAME sets it to 1.
+ * @param arg Argument of -T, modified in place.
+ * @param tcp TCP options to be set.
+ * @return 0 on success, -1 if the name is unknown or the value isn't a positive integer.
+ */
+static int parse_tcp_option(char *arg, tcp_options_t *tcp) {
+    char *value = strchr(arg, '=');
+    if (value != NULL) *value++ = '\0';
+    long val = 1;
+    if (value != NULL) {
+        char *endptr;
+        errno = 0;
+        val = strtol(value, &endptr, 10);
+        if (errno != 0 || endptr == value || *endptr != '\0' || val < 0 || val > INT_MAX) return -1;
+    }
+    for (size_t i = 0; i < sizeof(tcp_option_names) / sizeof(tcp_option_names[0]); ++i) {
+        if (strcmp(arg, tcp_option_names[i].name) == 0) {
+            *(int *) ((char *) tcp + tcp_option_names[i].offset) = (int) val;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Parses the rate limit given as RATE or RATE:BURST, the burst defaults to the rate.
+ * @param arg Argument of -R.
+ * @param options Options whose rate and burst are set.
+ * @return 0 on success, -1 if the values aren't in the range 1-1000000.
+ */
+static int parse_rate(char *arg, options_t *options) {
+    char *endptr;
+    errno = 0;
+    long rate = strtol(arg, &endptr, 10);
+    long burst = rate;
+    if (errno == 0 && *endptr == ':') {
+        char *burst_str = endptr + 1;
+        burst = strtol(burst_str, &endptr, 10);
+        if (endptr == burst_str) return -1;
+    }
+    if (errno != 0 || endptr == arg || *endptr != '\0' || rate < 1 || rate > 1000000 || burst < 1 ||
+        burst > 1000000) {
+        return -1;
+    }
+    options->rate = (uint32_t) rate;
+    options->burst = (uint32_t) burst;
+    return 0;
+}
+
 /**
  * @brief Handles arguments.
  * @details Everything is handled as stated in the exercise.
@@ -107,18 +556,19 @@ static void handle_args(int argc, char **argv, options_t *options) {
     /** Flags for port and index so we can handle errors like double pos. args */
     bool p_set = false;
     bool i_set = false;
+    char *endptr;
+    long val;
 
     /** Parse all command line options and arguments */
     int c;
     opterr = 0;
-    while ((c = getopt(argc, argv, "p:i:")) != -1) {
+    while ((c = getopt(argc, argv, "p:i:l:m:b:c:H:r:w:k:g:a:M:P:B:T:R:U:L")) != -1) {
         switch (c) {
             case 'p':
                 if (p_set) print_usage("The positional argument -p is only allowed once.");
                 p_set = true;
 
-                char *endptr;
-                long val = strtol(optarg, &endptr, 10);
+                val = strtol(optarg, &endptr, 10);
                 if ((errno == ERANGE && (val == LONG_MAX || val == LONG_MIN))
                     || (errno != 0 && val == 0)) {
                     print_usage("Error converting port to number.");
@@ -136,14 +586,102 @@ static void handle_args(int argc, char **argv, options_t *options) {
                 i_set = true;
                 options->default_file = optarg;
                 break;
+            case 'l':
+                options->compress_level = (int) parse_number(optarg, 0, 9,
+                                                             "The positional argument -l must be a compression level in the range: (0-9)");
+                break;
+            case 'm':
+                options->compress_min_size = (size_t) parse_number(optarg, 0, LONG_MAX,
+                                                                   "The positional argument -m must be a positive amount of bytes.");
+                break;
+            case 'b':
+                options->backlog = (int) parse_number(optarg, 1, INT_MAX,
+                                                      "The positional argument -b must be a positive integer.");
+                break;
+            case 'c':
+                options->max_connections = (int) parse_number(optarg, 1, INT_MAX,
+                                                              "The positional argument -c must be a positive integer.");
+                break;
+            case 'H':
+                options->max_header_bytes = (size_t) parse_number(optarg, 64, INT_MAX,
+                                                                  "The positional argument -H must be at least 64 bytes.");
+                break;
+            case 'r':
+                options->read_timeout = (int) parse_number(optarg, 1, INT_MAX / 1000,
+                                                           "The positional argument -r must be a positive amount of seconds.");
+                break;
+            case 'w':
+                options->write_timeout = (int) parse_number(optarg, 1, INT_MAX / 1000,
+                                                            "The positional argument -w must be a positive amount of seconds.");
+                break;
+            case 'k':
+                options->idle_timeout = (int) parse_number(optarg, 0, INT_MAX / 1000,
+                                                           "The positional argument -k must be an amount of seconds.");
+                break;
+            case 'g':
+                options->grace_period = (int) parse_number(optarg, 0, INT_MAX / 1000,
+                                                           "The positional argument -g must be an amount of seconds.");
+                break;
+            case 'a':
+                options->access_log = optarg;
+                break;
+            case 'L':
+                options->listings = true;
+                break;
+            case 'M':
+                if (optarg[0] != '/') print_usage("The positional argument -M must be a path starting with /.");
+                options->metrics_path = optarg;
+                break;
+            case 'P':
+                if (options->backend_count == PROXY_MAX_BACKENDS) print_usage("Too many backends given with -P.");
+                if (proxy_parse_backend(optarg, &options->backends[options->backend_count]) < 0) {
+                    print_usage("The positional argument -P must be PREFIX=HOST:PORT with a resolvable host.");
+                }
+                options->backend_count++;
+                break;
+            case 'B':
+                options->bundle = optarg;
+                break;
+            case 'T':
+                if (parse_tcp_option(optarg, &options->tcp) < 0) {
+                    print_usage("The positional argument -T must be nodelay, defer_accept, fastopen, sndbuf, rcvbuf or "
+                                "busy_poll, optionally followed by =VALUE.");
+                }
+                break;
+            case 'R':
+                if (parse_rate(optarg, options) < 0) {
+                    print_usage("The positional argument -R must be RATE or RATE:BURST, both in the range: (1-1000000)");
+                }
+                break;
+            case 'U':
+                if (optarg[0] == '\0' || strlen(optarg) >= sizeof(((struct sockaddr_un *) NULL)->sun_path)) {
+                    print_usage("The positional argument -U must be a path of at most 107 characters.");
+                }
+                options->unix_path = optarg;
+                break;
             case '?':
                 if (optopt == 'p') print_usage("The positional argument -p must be followed by an integer. (0-65535)");
                 if (optopt == 'i') print_usage("The positional argument -i must be followed by a string.");
+                if (optopt == 'l') print_usage("The positional argument -l must be followed by an integer. (0-9)");
+                if (optopt == 'a') print_usage("The positional argument -a must be followed by a file or -.");
+                if (optopt == 'M') print_usage("The positional argument -M must be followed by a path.");
+                if (optopt == 'P') print_usage("The positional argument -P must be followed by PREFIX=HOST:PORT.");
+                if (optopt == 'B') print_usage("The positional argument -B must be followed by a bundle file.");
+                if (optopt == 'T') print_usage("The positional argument -T must be followed by NAME[=VALUE].");
+                if (optopt == 'R') print_usage("The positional argument -R must be followed by RATE[:BURST].");
+                if (optopt == 'U') print_usage("The positional argument -U must be followed by a socket path.");
+                if (optopt == 'm' || optopt == 'b' || optopt == 'c' || optopt == 'H' || optopt == 'r'
+                    || optopt == 'w' || optopt == 'k' || optopt == 'g')
+                    print_usage("The positional arguments -m, -b, -c, -H, -r, -w, -k and -g must be followed by an "
+                                "integer.");
             default:
                 print_usage("Unknown options received.");
         }
     }
 
+    /** A Unix socket replaces the TCP port unless a port is given as well */
+    if (options->unix_path != NULL && !p_set) options->port = NULL;
+
     /** Parse DOC_ROOT */
     options->doc_root = argv[optind];
     if (options->doc_root == NULL) print_usage("DOC_ROOT missing as argument.");
@@ -152,25 +690,66 @@ static void handle_args(int argc, char **argv, options_t *options) {
     }
 }
 
+/**
+ * @brief Sets the O_NONBLOCK flag of a file descriptor.
+ * @param fd File descriptor.
+ * @return -1 on errors.
+ */
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @brief Applies the TCP options to a listening socket, connections accepted from it inherit them.
+ * @details Also applied to an inherited socket, so a restart with other options takes effect.
+ * @param fd Listening socket.
+ * @param tcp TCP options from handle_args().
+ * @return 0 on success, -1 if an option can't be set, e.g. busy_poll without the needed capability.
+ */
+static int tune_socket(int fd, const tcp_options_t *tcp) {
+    for (size_t i = 0; i < sizeof(tcp_option_names) / sizeof(tcp_option_names[0]); ++i) {
+        int val = *(const int *) ((const char *) tcp + tcp_option_names[i].offset);
+        /** nodelay is turned off explicitly, an inherited socket may have it on */
+        if (val == 0 && tcp_option_names[i].optname != TCP_NODELAY) continue;
+        if (setsockopt(fd, tcp_option_names[i].level, tcp_option_names[i].optname, &val, sizeof(val)) < 0) {
+            fprintf(stderr, "[%s] Error: couldn't set TCP option %s \n", prog_name, tcp_option_names[i].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /**
  * @brief Creates socket but as a server.
- * @details Same as in the client but you have to add bind() and listen()
+ * @details Same as in the client but you have to add bind() and listen(). The socket is non-blocking, since it is
+ * polled by the event loop. It listens on all addresses as a dual-stack IPv6 socket, so IPv4 clients connect to it
+ * as well, and falls back to IPv4 on hosts without IPv6.
  * @param options Parsed options from handle_args();
  * @return Status code of the creation process.
  */
 static int create_socket(options_t *options) {
-    struct addrinfo hints, *ai;
+    struct addrinfo hints, *ai = NULL;
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
 
-    int res = getaddrinfo(NULL, options->port, &hints, &ai);
-    if (res != 0) {
-        fprintf(stderr, "[%s] Error: getaddrinfo: %s \n", prog_name, gai_strerror(res));
-        return -1;
+    int families[] = {AF_INET6, AF_INET};
+    int sockfd = -1;
+    for (size_t i = 0; i < sizeof(families) / sizeof(families[0]) && sockfd < 0; ++i) {
+        hints.ai_family = families[i];
+        int res = getaddrinfo(NULL, options->port, &hints, &ai);
+        if (res != 0) {
+            fprintf(stderr, "[%s] Error: getaddrinfo: %s \n", prog_name, gai_strerror(res));
+            return -1;
+        }
+        sockfd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sockfd < 0) {
+            freeaddrinfo(ai);
+            ai = NULL;
+        }
     }
-
-    int sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
     if (sockfd < 0) {
         fprintf(stderr, "[%s] Error: couldn't create socket \n", prog_name);
         return -1;
@@ -179,52 +758,154 @@ static int create_socket(options_t *options) {
     /** Server can use old port faster, normally you'd have to wat a minute again to start up the server again */
     int optval = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    /** Accept IPv4 clients as mapped addresses, whatever the system default is */
+    optval = 0;
+    if (ai->ai_family == AF_INET6) setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval));
 
     if (bind(sockfd, ai->ai_addr, ai->ai_addrlen) < 0) {
         fprintf(stderr, "[%s] Error: couldn't bind socket \n", prog_name);
         freeaddrinfo(ai);
+        close(sockfd);
+        return -1;
+    }
+    freeaddrinfo(ai);
+
+    /** Buffer sizes and fast open have to be set before listen() to take effect */
+    if (tune_socket(sockfd, &options->tcp) < 0) {
+        close(sockfd);
         return -1;
     }
 
-    /** N = 5 amount of requests before not being queued anymore */
-    if (listen(sockfd, 5) < 0) {
+    /** Amount of connections queued by the kernel before the event loop accepts them */
+    if (listen(sockfd, options->backlog) < 0) {
         fprintf(stderr, "[%s] Error: couldn't listen to socket \n", prog_name);
-        freeaddrinfo(ai);
+        close(sockfd);
         return -1;
     }
+    return sockfd;
+}
 
-    freeaddrinfo(ai);
+/**
+ * @brief Checks whether a Unix socket file was left behind by a server which is gone.
+ * @param addr Address of the socket.
+ * @return True if nobody accepts connections on it anymore.
+ */
+static bool unix_socket_stale(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) < 0 || !S_ISSOCK(st.st_mode)) return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    bool stale = connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) < 0 && errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+/**
+ * @brief Creates the Unix domain socket the server listens on.
+ * @details Same as create_socket() with a path instead of a port. A socket file of a crashed server is replaced,
+ * one a running server listens on or any other file is not. Its permissions follow the umask.
+ * @param options Parsed options from handle_args();
+ * @return Socket or -1 on errors.
+ */
+static int create_unix_socket(options_t *options) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, options->unix_path);
+    if (unix_socket_stale(&addr)) unlink(addr.sun_path);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        fprintf(stderr, "[%s] Error: couldn't create socket \n", prog_name);
+        return -1;
+    }
+    if (bind(sockfd, (const struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't bind socket %s \n", prog_name, options->unix_path);
+        close(sockfd);
+        return -1;
+    }
+    if (listen(sockfd, options->backlog) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't listen to socket %s \n", prog_name, options->unix_path);
+        close(sockfd);
+        unlink(options->unix_path);
+        return -1;
+    }
     return sockfd;
 }
 
 /**
- * @brief Gets file size from FILE stream.
- * @param f File of which the size should be determined.
- * @return Size of file stream.
+ * @brief Gets the address of a client as IPv6 address, IPv4 addresses are mapped.
+ * @param addr Address from accept().
+ * @param out Buffer for the 16 bytes of the address, zeroed for other families.
+ */
+static void client_key(const struct sockaddr_storage *addr, unsigned char out[16]) {
+    memset(out, 0, 16);
+    if (addr->ss_family == AF_INET) {
+        out[10] = out[11] = 0xff;
+        memcpy(out + 12, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+    } else if (addr->ss_family == AF_INET6) {
+        memcpy(out, &((const struct sockaddr_in6 *) addr)->sin6_addr, 16);
+    }
+}
+
+/**
+ * @brief Formats the address of a client, IPv4 clients of the dual-stack socket are shown as IPv4 addresses.
+ * @param addr Address from accept().
+ * @param out Buffer of at least INET6_ADDRSTRLEN bytes.
  */
-static size_t get_file_size(FILE *f) {
-    fseek(f, 0L, SEEK_END);
-    size_t sz = ftell(f);
-    fseek(f, 0L, SEEK_SET);
-    return sz;
+static void format_client(const struct sockaddr_storage *addr, char *out) {
+    if (addr->ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *) addr)->sin_addr, out, INET6_ADDRSTRLEN);
+    } else if (addr->ss_family == AF_INET6) {
+        const struct in6_addr *in6 = &((const struct sockaddr_in6 *) addr)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(in6)) inet_ntop(AF_INET, &in6->s6_addr[12], out, INET6_ADDRSTRLEN);
+        else inet_ntop(AF_INET6, in6, out, INET6_ADDRSTRLEN);
+    }
 }
 
 /**
  * @brief Sets the MIME-Type for a request.
- * @details Handles only js, css and html files and accordingly only their MIME-Type is set.
- * @param ext File extension parsed out with the dot.
+ * @details Looks the extension up with mime_lookup(). Unknown types get no MIME-Type and are sent uncompressed like
+ * application/octet-stream, compressing binary data on the fly costs time without making it smaller.
+ * @param path Path of the file.
  * @param request Request where the MIME-Type should be set if one is found.
  */
-static void set_mime_type(char *ext, response_t *request) {
-    if (strcmp(ext, ".html") == 0 || strcmp(ext, ".htm") == 0) {
-        request->mime = "text/html";
-    } else if (strcmp(ext, ".css") == 0) {
-        request->mime = "text/css";
-    } else if (strcmp(ext, ".js") == 0) {
-        request->mime = "application/javascript";
-    } else {
-        request->mime = NULL;
-    }
+static void set_mime_type(const char *path, response_t *request) {
+    const mime_entry_t *type = mime_lookup(path);
+    request->mime = type != NULL ? type->mime : NULL;
+    request->compressible = type != NULL && type->compressible;
+}
+
+/**
+ * @brief Current time of the monotonic clock in microseconds.
+ * @return Time in us.
+ */
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/**
+ * @brief Current time of the monotonic clock in milliseconds.
+ * @return Time in ms.
+ */
+static long now_ms(void) {
+    return now_us() / 1000L;
+}
+
+/**
+ * @brief Builds the file system path of a normalized request path.
+ * @param doc_root Document root without trailing slash.
+ * @param path Normalized path starting with '/'.
+ * @return Path allocated with malloc(), NULL if out of memory.
+ */
+static char *join_path(const char *doc_root, const char *path) {
+    char *joined = malloc(strlen(doc_root) + strlen(path) + 1);
+    if (joined == NULL) return NULL;
+    strcpy(joined, doc_root);
+    strcat(joined, path);
+    return joined;
 }
 
 /**
@@ -232,268 +913,2291 @@ static void set_mime_type(char *ext, response_t *request) {
  * @details There are three things to be checked. The first line of the request should contain following headers:
  * METHOD REQ_PATH HTTP_VERSION
  *
- * In order to be a valid request, method has to be GET, req_path present and at least an '/' as character and the
- * HTTP_VERSIION has to match the version 1.1.
+ * In order to be a valid request, method has to be GET, HEAD or OPTIONS, req_path present and at least an '/' as
+ * character and the HTTP_VERSIION has to match the version 1.1. OPTIONS is answered for the whole server, so its
+ * target isn't looked at and "*" is accepted.
  *
- * @param conn_file Socket-file from the client.
- * @param options Options parsed by handle_args().
+ * @param request_line First line of the request, null-terminated. Is modified by strtok_r().
+ * @param worker Event loop with the options and the path cache.
  * @return Request with the correct metadata.
  */
-static response_t validate_request(FILE *conn_file, options_t *options) {
+static response_t validate_request(char *request_line, worker_t *worker) {
+    options_t *options = worker->options;
     response_t response;
-    response.gzip = false;
-
-    /** Read first line and check if request is valid */
-    char *buffer = NULL;
-    size_t buff_size = 0;
-    if (getline(&buffer, &buff_size, conn_file) == -1) {
-        fprintf(stderr, "[%s] Error: couldn't get first line of http response \n", prog_name);
-        free(buffer);
-        response.status = malformed_req;
-        return response;
-    }
+    response.fd = -1;
+    response.file = NULL;
+    response.path = NULL;
+    response.mime = NULL;
+    response.compressible = false;
+    response.size = 0;
+    response.encoding = enc_identity;
+    response.precompressed = false;
+    response.keep_alive = true;
+    response.method = NULL;
+    response.target = NULL;
+    response.protocol = NULL;
+    response.metrics = false;
+    response.listing = false;
+    response.range = false;
+    response.packed = NULL;
+    response.head = false;
+    /** No Accept-Encoding header means any encoding is acceptable, but we only compress if asked to */
+    parse_accept_encoding("identity", &response.accepted);
 
     /** Extract all properties for the first line of the headers */
-    char *method = strtok(buffer, " ");
-    char *relative_path = strtok(NULL, " ");
-    char *http_version = strtok(NULL, " ");
+    char *saveptr;
+    char *method = strtok_r(request_line, " ", &saveptr);
+    char *relative_path = strtok_r(NULL, " ", &saveptr);
+    char *http_version = strtok_r(NULL, " ", &saveptr);
     if (method == NULL || relative_path == NULL || http_version == NULL) {
         fprintf(stderr, "[%s] Error: Request malformed \n", prog_name);
-        free(buffer);
         response.status = malformed_req;
         return response;
     }
+    response.method = method;
+    response.target = relative_path;
+    response.protocol = http_version;
 
     /** Check if criteria described above is being met */
-    if (strncmp(method, "GET", strlen("GET")) != 0) {
-        fprintf(stderr, "[%s] Error: Not a GET response \n", prog_name);
-        free(buffer);
+    response.head = strcmp(method, "HEAD") == 0;
+    bool options_req = strcmp(method, "OPTIONS") == 0;
+    if (strcmp(method, "GET") != 0 && !response.head && !options_req) {
+        fprintf(stderr, "[%s] Error: Method not supported \n", prog_name);
         response.status = unsupported_method;
         return response;
     }
     if (strncmp(http_version, "HTTP/1.1", strlen("HTTP/1.1")) != 0) {
         fprintf(stderr, "[%s] Error: Not a valid HTTP version \n", prog_name);
-        free(buffer);
         response.status = malformed_req;
         return response;
     }
+    if (options_req) {
+        response.status = no_content;
+        return response;
+    }
     if (strlen(relative_path) < 1) {
         fprintf(stderr, "[%s] Error: Not a valid request path \n", prog_name);
-        free(buffer);
         response.status = malformed_req;
         return response;
     }
 
-    /** Get path for file to be read */
-    char path[strlen(options->doc_root) + strlen(relative_path) + strlen(options->default_file) + 1];
-    strcpy(path, options->doc_root);
-    strcat(path, relative_path);
-    if (relative_path[strlen(relative_path) - 1] == '/') {
-        strcat(path, options->default_file);
+    /** Decode and normalize the target, nothing outside of DOC_ROOT can be requested */
+    size_t target_len = strlen(relative_path);
+    char normalized[target_len + strlen(options->default_file) + 2];
+    if (normalize_path(relative_path, normalized, target_len + 2) < 0) {
+        fprintf(stderr, "[%s] Error: Request path is malformed or outside of DOC_ROOT \n", prog_name);
+        response.status = malformed_req;
+        return response;
     }
-    /** Extract extension and set MIME-Type if possible */
-    char *ext_ptr = strchr(path, '.');
-    if (ext_ptr != NULL) {
-        set_mime_type(ext_ptr, &response);
-    } else {
-        response.mime = NULL;
+
+    /** Metrics endpoint, a query string is ignored */
+    if (options->metrics_path != NULL && strcmp(normalized, options->metrics_path) == 0) {
+        response.status = accepted;
+        response.metrics = true;
+        response.mime = "text/plain; version=0.0.4";
+        return response;
+    }
+
+    bool dir_target = normalized[strlen(normalized) - 1] == '/';
+    if (dir_target) {
+        strcat(normalized, options->default_file);
+    }
+    /** Packed files need no file system access at all */
+    if (worker->bundle.map != NULL && (response.packed = bundle_find(&worker->bundle, normalized)) != NULL) {
+        response.status = accepted;
+        return response;
     }
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
+    set_mime_type(normalized, &response);
+
+    /** HEAD only needs the size, a file that isn't cached yet isn't opened for it */
+    bool hit;
+    cached_file_t *file = response.head ? path_cache_stat(&worker->files, normalized, now_ms(), &hit)
+                                        : path_cache_open(&worker->files, normalized, now_ms(), &hit);
+    metrics_record_cache(&worker->metrics, cache_path, hit);
+    if (file == NULL || !file->regular) {
+        /** Directory without index file, or a directory whose trailing slash is missing so relative links break */
+        bool is_dir = false;
+        if (options->listings && !dir_target) {
+            is_dir = file != NULL && file->dir;
+        } else if (options->listings) {
+            normalized[strlen(normalized) - strlen(options->default_file)] = '\0';
+            cached_file_t *dir = path_cache_open(&worker->files, normalized, now_ms(), &hit);
+            is_dir = dir != NULL && dir->dir;
+            path_cache_release(dir);
+        }
+        path_cache_release(file);
+
+        if (is_dir) {
+            response.status = dir_target ? accepted : moved_permanently;
+            response.listing = dir_target;
+            response.mime = "text/html; charset=utf-8";
+            response.compressible = false;
+            response.path = join_path(options->doc_root, normalized);
+            return response;
+        }
         fprintf(stderr, "[%s] Error: couldn't open resource \n", prog_name);
-        free(buffer);
         response.status = ressource_not_found;
         return response;
     }
 
-    /** Set metadata and cleanup */
+    /** Set metadata */
     response.status = accepted;
     response.file = file;
-    free(buffer);
+    response.fd = file->fd;
+    response.size = file->size;
+    response.path = join_path(options->doc_root, normalized);
     return response;
 }
 
+/**
+ * @brief Parses the value of a Range header.
+ * @details Only a single range is supported, several ranges or invalid ones are ignored and the whole file is sent,
+ * which is what a server without range support would do as well.
+ * @param value Header value after the colon.
+ * @param response Response where the range is stored.
+ */
+static void parse_range(const char *value, response_t *response) {
+    value += strspn(value, " \t");
+    if (strncasecmp(value, "bytes=", strlen("bytes=")) != 0) return;
+    value += strlen("bytes=");
+
+    long long first = -1;
+    long long last = -1;
+    char *endptr;
+    if (*value != '-') {
+        if (*value < '0' || *value > '9') return;
+        errno = 0;
+        first = strtoll(value, &endptr, 10);
+        if (errno != 0 || *endptr != '-') return;
+        value = endptr;
+    }
+    value++;
+    if (*value >= '0' && *value <= '9') {
+        errno = 0;
+        last = strtoll(value, &endptr, 10);
+        if (errno != 0) return;
+        value = endptr;
+    } else if (first < 0) {
+        return;
+    }
+    value += strspn(value, " \t");
+    if (*value != '\0' || (first >= 0 && last >= 0 && last < first)) return;
+
+    response->range = true;
+    response->range_first = first;
+    response->range_last = last;
+}
 
 /**
- * @brief Reads from a file and writes it to the output.
- * @param read_file Stream to be read from.
- * @param output Stream to be written to.
- * @return status code
+ * @brief Checks whether the connection stays open after a request.
+ * @details Runs before anything else looks at the request, so error responses know it as well. The server never
+ * reads request bodies of its own, a request announcing one ends the connection, otherwise the body would be taken
+ * for the next request.
+ *
+ * @param headers Header lines, null-terminated.
+ * @return False if the client asked to close the connection or sent a body.
  */
-static int read_and_write(FILE *read_file, FILE *output) {
-    char buffer[BUFF_SIZE];
-    size_t read;
-    while ((read = fread(buffer, 1, BUFF_SIZE, read_file)) > 0) {
-        fwrite(buffer, 1, read, output);
+static bool request_keep_alive(const char *headers) {
+    for (const char *line = headers; *line != '\0';) {
+        const char *eol = strstr(line, "\r\n");
+        if (eol == NULL) eol = line + strlen(line);
+        const char *value;
+        if ((value = http_header_value(line, eol - line, "Connection")) != NULL) {
+            if (http_has_token(value, eol, "close", strlen("close"))) return false;
+        } else if ((value = http_header_value(line, eol - line, "Content-Length")) != NULL) {
+            if (http_content_length(value, eol) != 0) return false;
+        } else if (http_header_value(line, eol - line, "Transfer-Encoding") != NULL) {
+            return false;
+        }
+        line = *eol != '\0' ? eol + 2 : eol;
     }
-    return 0;
+    return true;
 }
 
 /**
- * @brief Reads from a file and writes it to the output.
- * @details Uses zlib to compress in gzip format. Must be compressed accordingly in the client.
- * @param source Stream to be read from.
- * @param dest Stream to be written to.
- * @return status code
+ * @brief Parses the request headers after the request line.
+ * @details Only Accept-Encoding, Range and If-Range are of interest, everything else is skipped.
+ * @param headers Header lines, null-terminated.
+ * @param response Response where the parsed values are stored.
  */
-static int read_and_write_compress(FILE *source, FILE *dest) {
-    /** Create zstream to pass metadata to zlib routines */
-    z_stream zs;
-    zs.zalloc = Z_NULL;
-    zs.zfree = Z_NULL;
-    zs.opaque = Z_NULL;
-    /** MAX_WBITS | 16 for Gzip */
-    int status = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS | 16, 8, Z_DEFAULT_STRATEGY);
-    if (status != Z_OK) {
-        fprintf(stderr, "[%s] Error: couldn't deflateInit2() \n", prog_name);
-        return -1;
+static void parse_headers(char *headers, response_t *response) {
+    char *line = headers;
+    bool if_range = false;
+    while (line != NULL && *line != '\0') {
+        char *next = strstr(line, "\r\n");
+        if (next != NULL) *next = '\0';
+        size_t len = next != NULL ? (size_t) (next - line) : strlen(line);
+        const char *value;
+        if ((value = http_header_value(line, len, "Accept-Encoding")) != NULL) {
+            parse_accept_encoding(value, &response->accepted);
+        } else if ((value = http_header_value(line, len, "Range")) != NULL) {
+            parse_range(value, response);
+        } else if (http_header_value(line, len, "If-Range") != NULL) {
+            if_range = true;
+        }
+        line = next != NULL ? next + 2 : NULL;
     }
+    /** Files have no validators here, so an If-Range condition never holds and the whole file is sent */
+    if (if_range) response->range = false;
+}
 
-    Bytef in[BUFF_SIZE];
-    Bytef out[BUFF_SIZE];
-    unsigned int size_deflate;
-    int flush;
-    /** Outer loop reads in BUFF_SIZE chunks from the source */
-    do {
-        /** Amount of ready files (normally BUFF_SIZE if all is read) */
-        zs.avail_in = fread(in, 1, BUFF_SIZE, source);
-        if (ferror(source)) {
-            deflateEnd(&zs);
-            fprintf(stderr, "[%s] Error: couldn't read from source properly \n", prog_name);
-            return Z_ERRNO;
-        }
-        /** Set buffer array where avail_in bytes are ready to be read */
-        zs.next_in = in;
-        /** Check if flush is necessary since its eof */
-        flush = feof(source) ? Z_FINISH : Z_NO_FLUSH;
-        /** Run deflate until there are no bytes anymore on newly read bytes */
-        do {
-            /** Set buffer we created before and set the size */
-            zs.avail_out = BUFF_SIZE;
-            zs.next_out = out;
-            /** Deflate to output buffer */
-            status = deflate(&zs, flush);
-            assert(status != Z_STREAM_ERROR); /** Shouldn't happen */
-            /** How many bytes were written? BUFF_SIZE - empty space left */
-            size_deflate = BUFF_SIZE - zs.avail_out;
-            if (fwrite(out, 1, size_deflate, dest) != size_deflate || ferror(dest)) {
-                deflateEnd(&zs);
-                fprintf(stderr, "[%s] Error: couldn't write to destination \n", prog_name);
-                return Z_ERRNO;
-            }
-        } while (zs.avail_out == 0);
-    } while (flush != Z_FINISH);
+/**
+ * @brief Turns the requested range into offsets of the file.
+ * @param response Response of a file with a parsed range.
+ * @return False if the range starts behind the end of the file.
+ */
+static bool resolve_range(response_t *response) {
+    long long size = (long long) response->size;
+    if (response->range_first < 0) {
+        if (response->range_last == 0 || size == 0) return false;
+        response->range_first = response->range_last < size ? size - response->range_last : 0;
+        response->range_last = size - 1;
+    } else {
+        if (response->range_first >= size) return false;
+        if (response->range_last < 0 || response->range_last >= size) response->range_last = size - 1;
+    }
+    response->status = partial_content;
+    return true;
+}
+
+/**
+ * @brief Chooses the Content-Encoding of a response.
+ * @details Encodings are ranked by the q-value of the client, on equal q-values zstd is preferred over brotli over
+ * gzip. Precompressed variants next to the file (index.html.zst, index.html.br, index.html.gz) win over compressing
+ * on the fly since they cost nothing per request, so they are searched first. If a variant is found, the file of the
+ * response is replaced by it.
+ *
+ * @param response Response with an opened file and the parsed Accept-Encoding header.
+ * @param worker Event loop, its path cache remembers missing variants and its compressors decide if compressing on
+ * the fly is worth it.
+ */
+static void negotiate_encoding(response_t *response, worker_t *worker) {
+    /** Sort encodings by q-value, insertion sort is fine for three entries */
+    encoding_e order[ENCODING_COUNT - 1];
+    int count = 0;
+    for (int enc = ENCODING_COUNT - 1; enc > enc_identity; --enc) {
+        int q = accept_encoding_q(&response->accepted, enc);
+        if (q <= 0) continue;
+        int i = count++;
+        while (i > 0 && accept_encoding_q(&response->accepted, order[i - 1]) < q) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = enc;
+    }
+
+    /** Precompressed variants */
+    for (int i = 0; i < count && response->path != NULL; ++i) {
+        const char *path = response->path + strlen(worker->options->doc_root);
+        const char *ext = encoding_extension(order[i]);
+        char variant[strlen(path) + strlen(ext) + 1];
+        strcpy(variant, path);
+        strcat(variant, ext);
+        bool hit;
+        cached_file_t *file = response->head ? path_cache_stat(&worker->files, variant, now_ms(), &hit)
+                                             : path_cache_open(&worker->files, variant, now_ms(), &hit);
+        metrics_record_cache(&worker->metrics, cache_path, hit);
+        if (file == NULL || !file->regular) {
+            path_cache_release(file);
+            continue;
+        }
+        path_cache_release(response->file);
+        response->file = file;
+        response->fd = file->fd;
+        response->size = file->size;
+        response->encoding = order[i];
+        response->precompressed = true;
+        return;
+    }
 
-    deflateEnd(&zs);
-    return Z_OK;
+    /** Compression on the fly, identity is still the fallback if the client refused it */
+    if (!compressor_should_compress(&worker->compressors, response->compressible, response->size)) return;
+    for (int i = 0; i < count; ++i) {
+        if (encoding_available(order[i])) {
+            response->encoding = order[i];
+            return;
+        }
+    }
 }
 
 /**
- * @brief Reads and skips all unnecessary data so that we can continue replying to the request
- * @param conn_file File to be skipped through.
+ * @brief Takes method and target of a request which is refused before validate_request() looks at it.
+ * @details Splits the request line in place like validate_request(), so the access log still names the request.
+ * @param response Response of the refused request.
+ * @param request_line Null-terminated request line.
  */
-static void dump_read_data(FILE *conn_file, response_t *response) {
-    size_t buff_size = 0;
-    char *buff = NULL;
-    while (getline(&buff, &buff_size, conn_file) != -1) {
-        if (strncmp(buff, "Accept-Encoding:", strlen("Accept-Encoding:")) == 0) {
-            char *token = strtok(buff, " ,;");
-            do {
-                if (strstr(token, "gzip") != NULL) {
-                    response->gzip = true;
-                }
-            } while ((token = strtok(NULL, " ,;")) != NULL);
+static void set_request_line(response_t *response, char *request_line) {
+    char *saveptr;
+    response->method = strtok_r(request_line, " ", &saveptr);
+    response->target = response->method != NULL ? strtok_r(NULL, " ", &saveptr) : NULL;
+    response->protocol = response->target != NULL ? strtok_r(NULL, " ", &saveptr) : NULL;
+}
 
+/**
+ * @brief Records a finished or failed response in the metrics and the access log.
+ * @details Only copies the access log entry into the ring of the worker, formatting and writing happen in the
+ * background.
+ *
+ * @param worker Event loop.
+ * @param client Address of the client.
+ * @param response Response with status and request line, NULL for connections shed before reading a request.
+ * @param bytes Body bytes sent.
+ * @param started_us Time in us at which the request arrived.
+ */
+static void record_response(worker_t *worker, const char *client, const response_t *response,
+                            unsigned long long bytes, long started_us) {
+    long latency_us = now_us() - started_us;
+    int status = response != NULL ? (int) response->status : service_unavailable;
+    metrics_record_request(&worker->metrics, status, bytes, latency_us);
+    if (response != NULL && response->status == accepted && response->encoding != enc_identity) {
+        metrics_record_cache(&worker->metrics, cache_precompressed, response->precompressed);
+        if (!response->precompressed && !response->head) {
+            metrics_record_compression(&worker->metrics, response->size, bytes);
+        }
+    }
+
+    if (worker->log_ring == NULL) return;
+    access_entry_t entry;
+    entry.time = time(NULL);
+    strncpy(entry.client, client, sizeof(entry.client) - 1);
+    entry.client[sizeof(entry.client) - 1] = '\0';
+    entry.method[0] = '\0';
+    entry.target[0] = '\0';
+    entry.protocol[0] = '\0';
+    if (response != NULL && response->method != NULL && response->target != NULL) {
+        strncpy(entry.method, response->method, sizeof(entry.method) - 1);
+        entry.method[sizeof(entry.method) - 1] = '\0';
+        strncpy(entry.target, response->target, sizeof(entry.target) - 1);
+        entry.target[sizeof(entry.target) - 1] = '\0';
+        if (response->protocol != NULL) {
+            strncpy(entry.protocol, response->protocol, sizeof(entry.protocol) - 1);
+            entry.protocol[sizeof(entry.protocol) - 1] = '\0';
         }
-        if (strcmp(buff, "\r\n") == 0) break;
     }
-    free(buff);
+    entry.status = status;
+    entry.bytes = bytes;
+    entry.latency_us = latency_us;
+    access_log_push(worker->log_ring, &entry);
 }
 
-/** Signal handler */
-void handle_signal() { stop = true; }
+/**
+ * @brief Formats the current time for the Date header.
+ * @param buff Buffer of at least 100 bytes.
+ */
+static void format_date(char *buff) {
+    time_t tmi;
+    struct tm utc_time;
+    time(&tmi);
+    gmtime_r(&tmi, &utc_time);
+    /** RFC-822 time expression */
+    strftime(buff, 100, "%a, %d %b %y %T %Z", &utc_time);
+}
 
 /**
-* @brief Main entry point
-* @details Main function. Options are created and default settings are set.
-*
-* @param argc
-* @param argv
-* @return exit code
-*/
-int main(int argc, char **argv) {
-    options_t options = {"8080", "index.html"};
-    handle_args(argc, argv, &options);
+ * @brief Adds a new connection to the event loop.
+ * @param worker Event loop.
+ * @param fd Accepted, non-blocking socket.
+ * @param client Address of the client.
+ * @return Connection or NULL on errors, the socket is closed in this case.
+ */
+static connection_t *conn_open(worker_t *worker, int fd, const char *client) {
+    connection_t *conn = calloc(1, sizeof(connection_t));
+    if (conn == NULL || io_buffer_init(&conn->in, worker->options->max_header_bytes) < 0) {
+        free(conn);
+        close(fd);
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->state = conn_reading;
+    conn->response.fd = -1;
+    conn->upstream.fd = -1;
+    conn->upstream.pipe[0] = conn->upstream.pipe[1] = -1;
+    strcpy(conn->client, client);
+    conn->started_us = now_us();
+    timer_init(&conn->timer);
 
-    int sockfd = create_socket(&options);
-    if (sockfd == -1) {
-        exit(EXIT_FAILURE);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        io_buffer_free(&conn->in);
+        free(conn);
+        close(fd);
+        return NULL;
     }
 
-    /** Handle interrupts */
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_signal;
-    sigaction(SIGINT, &sa, NULL);
+    timer_schedule(&worker->timers, &conn->timer, worker->options->read_timeout * 1000L);
+    conn->next = worker->connections;
+    if (worker->connections != NULL) worker->connections->prev = conn;
+    worker->connections = conn;
+    worker->active++;
+    metrics_set_connections(&worker->metrics, worker->active);
+    return conn;
+}
 
-    while (!stop) {
-        /** Accept a request and handle it */
-        int connfd = accept(sockfd, NULL, NULL);
-        if (connfd < 0) {
-            if (errno == EINTR) continue;
-            fprintf(stderr, "[%s] Error: couldn't accept connection on socket. Exiting.. \n", prog_name);
-            continue;
-        }
+/**
+ * @brief Frees the in-memory body of a connection or gives back its cached listing.
+ * @param conn Connection.
+ */
+static void conn_release_body(connection_t *conn) {
+    if (conn->listing != NULL) listing_release(conn->listing);
+    else if (!conn->bundled) free(conn->body);
+    conn->listing = NULL;
+    conn->body = NULL;
+    conn->bundled = false;
+}
 
-        /** Open socket-file to client and read request from it */
-        FILE *conn_file = fdopen(connfd, "r+");
-        if (conn_file == NULL) {
-            fprintf(stderr, "[%s] Error: couldn't oppen connection file for request. Exiting.. \n", prog_name);
-            continue;
-        }
-        response_t request = validate_request(conn_file, &options);
-
-        /** Create response for request */
-        char buff[100];
-        time_t tmi;
-        struct tm *utcTime;
-        time(&tmi);
-        utcTime = gmtime(&tmi);
-        /** RFC-822 time expression */
-        strftime(buff, 100, "%a, %d %b %y %T %Z", utcTime);
-
-        /** Skip through content so we can reply to request */
-        dump_read_data(conn_file, &request);
-        /** Send response */
-        if (request.status == 200) {
-            fprintf(conn_file, "HTTP/1.1 %s\r\nDate: %s\r\nContent-Length: %zu\r\nConnection: close\r\n",
-                    status_to_str(request.status), buff,
-                    get_file_size(request.file));
-            if (request.mime != NULL) {
-                fprintf(conn_file, "Content-Type: %s\r\n", request.mime);
-            }
-            if (request.gzip) {
-                fprintf(conn_file, "Content-Encoding: gzip\r\n");
-            }
-            fprintf(conn_file, "\r\n");
+/**
+ * @brief Closes the socket to the backend of a connection or puts it back into the pool.
+ * @param worker Event loop.
+ * @param conn Connection.
+ * @param reuse True if the response has been completely received, so the socket can serve the next request.
+ */
+static void upstream_close(worker_t *worker, connection_t *conn, bool reuse) {
+    upstream_t *up = &conn->upstream;
+    if (up->fd < 0) return;
+    if (up->registered) epoll_ctl(worker->upstream_epfd, EPOLL_CTL_DEL, up->fd, NULL);
+    if (reuse) upstream_release(&worker->upstreams, up->backend, up->fd);
+    else close(up->fd);
+    up->fd = -1;
+    up->events = 0;
+    up->registered = false;
+    up->hung_up = false;
+}
 
+/**
+ * @brief Closes a connection and frees everything it holds.
+ * @details The connection itself is only freed at the end of the loop iteration, events of the current batch may
+ * still point to it.
+ *
+ * @param worker Event loop.
+ * @param conn Connection to be closed.
+ */
+static void conn_close(worker_t *worker, connection_t *conn) {
+    timer_cancel(&worker->timers, &conn->timer);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else worker->connections = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    worker->active--;
+    metrics_set_connections(&worker->metrics, worker->active);
 
-            int status = request.gzip ? read_and_write_compress(request.file, conn_file) : read_and_write(request.file,
-                                                                                                          conn_file);
-            if (status == -1) {
-                fprintf(stderr, "[%s] Error: Couldn't write to client. \n", prog_name);
-            }
-            fflush(conn_file);
-            fclose(request.file);
-        } else {
-            fprintf(conn_file, "HTTP/1.1 %s\r\nDate: %s\r\nConnection: close\r\n\r\n", status_to_str(request.status),
-                    buff);
-            fflush(conn_file);
-        }
-        fclose(conn_file);
+    /** Closing the socket also removes it from the epoll set */
+    close(conn->fd);
+    path_cache_release(conn->response.file);
+    free(conn->response.path);
+    compressor_release(conn->comp);
+    conn_release_body(conn);
+    io_buffer_free(&conn->in);
+    upstream_close(worker, conn, false);
+    if (conn->upstream.pipe[0] >= 0) {
+        close(conn->upstream.pipe[0]);
+        close(conn->upstream.pipe[1]);
     }
+    free(conn->upstream.head);
+    free(conn->upstream.buff);
+    if (conn->h2 != NULL) {
+        /** Streams still open are recorded as far as they got */
+        h2_session_free(&conn->h2->session);
+        free(conn->h2);
+        conn->h2 = NULL;
+    }
+
+    conn->state = conn_closed;
+    conn->next = worker->closed;
+    worker->closed = conn;
+}
+
+/**
+ * @brief Frees the connections closed during the last loop iteration.
+ * @param worker Event loop.
+ */
+static void free_closed(worker_t *worker) {
+    while (worker->closed != NULL) {
+        connection_t *conn = worker->closed;
+        worker->closed = conn->next;
+        free(conn);
+    }
+}
+
+/**
+ * @brief Registers the events a connection waits for.
+ * @param worker Event loop.
+ * @param conn Connection.
+ * @param events EPOLLIN or EPOLLOUT.
+ */
+static void conn_watch(worker_t *worker, connection_t *conn, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+/**
+ * @brief Switches a connection from reading to writing.
+ * @param worker Event loop.
+ * @param conn Connection with the response headers in out.
+ */
+static void conn_start_writing(worker_t *worker, connection_t *conn) {
+    conn->state = conn_writing;
+    conn->out_pos = 0;
+    timer_schedule(&worker->timers, &conn->timer, worker->options->write_timeout * 1000L);
+    conn_watch(worker, conn, EPOLLOUT);
+}
 
-    /** Cleanup */
-    close(sockfd);
+/**
+ * @brief Formats the head of a response without body, e.g. for errors.
+ * @details 301, 416, 429 and the 204 of OPTIONS get the header they need: Location with the slash appended to the
+ * target, Content-Range with the size of the file, Retry-After with wait_ms in seconds and Allow.
+ *
+ * @param out Buffer of HEADER_BUFF_SIZE bytes.
+ * @param status Status code.
+ * @param response Response with target, size and keep_alive.
+ * @param wait_ms Time until a rate limited client may send requests again.
+ * @return Length of the head, -1 if it doesn't fit.
+ */
+static int format_empty_head(char *out, status_e status, const response_t *response, long wait_ms) {
+    char extra[HEADER_BUFF_SIZE] = "";
+    if (status == moved_permanently) {
+        /** The slash belongs before the query string */
+        int path_len = (int) strcspn(response->target, "?");
+        snprintf(extra, sizeof(extra), "Location: %.*s/%s\r\n", path_len, response->target,
+                 response->target + path_len);
+    } else if (status == range_not_satisfiable) {
+        snprintf(extra, sizeof(extra), "Content-Range: bytes */%zu\r\n", response->size);
+    } else if (status == too_many_requests) {
+        snprintf(extra, sizeof(extra), "Retry-After: %ld\r\n", (wait_ms + 999) / 1000);
+    } else if (status == no_content) {
+        snprintf(extra, sizeof(extra), "Allow: GET, HEAD, OPTIONS\r\n");
+    }
+    char date[100];
+    format_date(date);
+    int len = snprintf(out, HEADER_BUFF_SIZE, "HTTP/1.1 %s\r\nDate: %s\r\n%s"
+                                              "Content-Length: 0\r\nConnection: %s\r\n\r\n",
+                       status_to_str(status), date, extra, response->keep_alive ? "keep-alive" : "close");
+    return len < HEADER_BUFF_SIZE ? len : -1;
+}
+
+/**
+ * @brief Prepares a response without body, see format_empty_head().
+ * @details The connection stays open if the request allows it, only after a request that couldn't be parsed or
+ * framed, a timeout, when shedding load and while draining it is closed.
+ *
+ * @param worker Event loop.
+ * @param conn Connection to answer.
+ * @param status Status code.
+ * @param wait_ms Time until a rate limited client may send requests again.
+ */
+static void respond_empty(worker_t *worker, connection_t *conn, status_e status, long wait_ms) {
+    response_t *response = &conn->response;
+    if (status == malformed_req || status == request_timeout || status == header_too_large ||
+        status == service_unavailable || worker->draining) {
+        response->keep_alive = false;
+    }
+    int len = format_empty_head(conn->out, status, response, wait_ms);
+    if (len < 0) {
+        /** Redirect to a target too long for the headers */
+        status = ressource_not_found;
+        len = format_empty_head(conn->out, status, response, wait_ms);
+    }
+    conn->out_len = len;
+    conn->has_body = false;
+    response->status = status;
+    conn_start_writing(worker, conn);
+}
+
+/**
+ * @brief Prepares a response without body, e.g. for errors.
+ * @param worker Event loop.
+ * @param conn Connection to answer.
+ * @param status Status code.
+ */
+static void respond_status(worker_t *worker, connection_t *conn, status_e status) {
+    respond_empty(worker, conn, status, 0);
+}
+
+/**
+ * @brief Finds the backend a request is forwarded to.
+ * @param worker Event loop with the configured backends.
+ * @param request_line First line of the request, null-terminated, not modified.
+ * @return Index of the backend, -1 if the request is served from DOC_ROOT.
+ */
+static int route_request(worker_t *worker, const char *request_line) {
+    options_t *options = worker->options;
+    const char *target = strchr(request_line, ' ');
+    if (options->backend_count == 0 || target == NULL) return -1;
+    target++;
+    size_t target_len = strcspn(target, " ");
+    char raw[target_len + 1];
+    memcpy(raw, target, target_len);
+    raw[target_len] = '\0';
+    /** A malformed path is rejected by validate_request() */
+    char normalized[target_len + 2];
+    if (normalize_path(raw, normalized, target_len + 2) < 0) return -1;
+    return proxy_route(options->backends, options->backend_count, normalized);
+}
+
+/**
+ * @brief Chooses the variant of a file of the asset bundle and formats its head.
+ * @details The variant in the best accepted encoding is chosen, identity if the client accepts none of the packed
+ * ones. Ranges are ignored, the whole file is sent like by a server without range support.
+ *
+ * @param worker Event loop with the mapped bundle.
+ * @param response Response with the packed entry, its encoding tells the chosen variant afterwards.
+ * @param out Buffer of HEADER_BUFF_SIZE bytes.
+ * @return Length of the head.
+ */
+static int format_packed_head(worker_t *worker, response_t *response, char *out) {
+    const bundle_entry_t *packed = response->packed;
+    encoding_e best = enc_identity;
+    int best_q = 0;
+    for (int enc = enc_gzip; enc < ENCODING_COUNT; ++enc) {
+        int q = accept_encoding_q(&response->accepted, enc);
+        /** Later encodings win ties */
+        if (packed->variants[enc].head_len > 0 && q > 0 && q >= best_q) {
+            best = enc;
+            best_q = q;
+        }
+    }
+    const bundle_variant_t *variant = &packed->variants[best];
+    if (worker->draining) response->keep_alive = false;
+    response->encoding = best;
+    response->precompressed = true;
+    response->size = variant->body_len;
+
+    char date[100];
+    format_date(date);
+    return snprintf(out, HEADER_BUFF_SIZE, "HTTP/1.1 %s\r\nDate: %s\r\nConnection: %s\r\n%.*s",
+                    status_to_str(accepted), date, response->keep_alive ? "keep-alive" : "close",
+                    (int) variant->head_len, worker->bundle.map + variant->head_offset);
+}
+
+/**
+ * @brief Answers with a file of the asset bundle, the body is sent from the mapping as is.
+ * @param worker Event loop with the mapped bundle.
+ * @param conn Connection whose response has the packed entry.
+ */
+static void respond_packed(worker_t *worker, connection_t *conn) {
+    response_t *response = &conn->response;
+    conn->out_len = format_packed_head(worker, response, conn->out);
+    conn->body = (char *) worker->bundle.map + response->packed->variants[response->encoding].body_offset;
+    conn->bundled = true;
+    conn->has_body = !response->head;
+    conn_start_writing(worker, conn);
+}
+
+/**
+ * @brief Prepares the body of a validated GET or HEAD response: generated bodies, the range and the encoding.
+ * @param worker Event loop.
+ * @param response Response from validate_request() with the parsed headers.
+ * @param body Set to a body in memory, the metrics or a cached listing, NULL for files.
+ * @param listing Set to the cached listing the body belongs to.
+ * @param comp Set to the compressor if the body is compressed on the fly.
+ * @return accepted, or the status to answer with instead.
+ */
+static status_e prepare_body(worker_t *worker, response_t *response, char **body, listing_t **listing,
+                             compressor_t **comp) {
+    if (response->metrics) {
+        /** Formatted now, so the body is a consistent snapshot and its length is known */
+        metrics_t *workers[] = {&worker->metrics};
+        *body = metrics_format(workers, 1, &response->size);
+        if (*body == NULL) return internal_error;
+    }
+    if (response->listing) {
+        bool hit;
+        *listing = listing_get(&worker->listings, response->path, response->path + strlen(worker->options->doc_root),
+                               &hit);
+        if (*listing == NULL) return internal_error;
+        metrics_record_cache(&worker->metrics, cache_listing, hit);
+        /** Sent straight from the cached page, nothing is copied per request */
+        *body = (*listing)->html;
+        response->size = (*listing)->len;
+    }
+    /** A draining server closes every connection after its current response */
+    if (worker->draining) response->keep_alive = false;
+    /** Ranges are served from the file as is, they would be meaningless for a body compressed on the fly */
+    if (*body != NULL) response->range = false;
+    if (response->range && !resolve_range(response)) return range_not_satisfiable;
+    if (*body == NULL && !response->range) negotiate_encoding(response, worker);
+
+    /** HEAD announces the compressed response without producing it */
+    if (response->encoding != enc_identity && !response->precompressed && !response->head) {
+        *comp = compressor_acquire(&worker->compressors, response->encoding);
+        /** Fall back to the uncompressed file rather than failing the request */
+        if (*comp == NULL) response->encoding = enc_identity;
+    }
+    return accepted;
+}
+
+/**
+ * @brief Formats the head of a response with body.
+ * @param out Buffer of HEADER_BUFF_SIZE bytes.
+ * @param response Response after prepare_body().
+ * @param in_memory True if the body is in memory, such bodies have no ranges.
+ * @param chunked True if the body is sent with chunked transfer coding.
+ * @return Length of the head.
+ */
+static int format_head(char *out, const response_t *response, bool in_memory, bool chunked) {
+    bool on_the_fly = response->encoding != enc_identity && !response->precompressed;
+    char date[100];
+    format_date(date);
+    int len = snprintf(out, HEADER_BUFF_SIZE, "HTTP/1.1 %s\r\nDate: %s\r\nConnection: %s\r\n",
+                       status_to_str(response->status), date, response->keep_alive ? "keep-alive" : "close");
+    if (response->range) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len,
+                        "Content-Length: %lld\r\nContent-Range: bytes %lld-%lld/%zu\r\n",
+                        response->range_last - response->range_first + 1, response->range_first, response->range_last,
+                        response->size);
+    } else if (!on_the_fly) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len, "Content-Length: %zu\r\n", response->size);
+    } else if (chunked) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len, "Transfer-Encoding: chunked\r\n");
+    }
+    if (response->mime != NULL) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len, "Content-Type: %s\r\n", response->mime);
+    }
+    if (response->encoding != enc_identity) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len, "Content-Encoding: %s\r\n",
+                        encoding_name(response->encoding));
+    }
+    if (response->compressible) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len, "Vary: Accept-Encoding\r\n");
+    }
+    if (!in_memory && response->encoding == enc_identity) {
+        len += snprintf(out + len, HEADER_BUFF_SIZE - len, "Accept-Ranges: bytes\r\n");
+    }
+    len += snprintf(out + len, HEADER_BUFF_SIZE - len, "\r\n");
+    return len;
+}
+
+/**
+ * @brief Finds the HTTP2-Settings of a request asking to upgrade to HTTP/2 ("Upgrade: h2c").
+ * @param head Request head.
+ * @param len Length of the head.
+ * @param settings_len Set to the length of the value.
+ * @return Value of HTTP2-Settings, NULL if the request doesn't ask for the upgrade.
+ */
+static const char *h2_upgrade_settings(const char *head, size_t len, size_t *settings_len) {
+    const char *settings = NULL;
+    bool upgrade = false;
+    const char *line = strstr(head, "\r\n") + 2;
+    while (line < head + len) {
+        const char *next = strstr(line, "\r\n");
+        size_t line_len = next - line;
+        const char *value;
+        if ((value = http_header_value(line, line_len, "Upgrade")) != NULL) {
+            upgrade = strncasecmp(value, "h2c", 3) == 0 && strchr(" \t,\r", value[3]) != NULL;
+        } else if ((value = http_header_value(line, line_len, "HTTP2-Settings")) != NULL) {
+            settings = value;
+            *settings_len = strcspn(value, " \t\r");
+        }
+        line = next + 2;
+    }
+    return upgrade ? settings : NULL;
+}
+
+/** Defined with the rest of the proxy, which needs the write path */
+static void start_proxy(worker_t *worker, connection_t *conn, int backend, char *headers);
+/** Defined with the rest of HTTP/2 */
+static bool start_h2(worker_t *worker, connection_t *conn, const char *upgrade);
+
+/**
+ * @brief Builds the response for a completely received request.
+ * @param worker Event loop.
+ * @param conn Connection with the request in its input buffer.
+ */
+static void prepare_response(worker_t *worker, connection_t *conn) {
+    conn->request_len = io_buffer_head(&conn->in);
+    /** The request of an upgrade to HTTP/2 is answered on stream 1, requests for a backend stay with HTTP/1.1 */
+    size_t settings_len;
+    const char *settings = h2_upgrade_settings(conn->in.data, conn->request_len, &settings_len);
+    if (settings != NULL && !worker->draining && route_request(worker, conn->in.data) < 0) {
+        char upgrade[settings_len + 1];
+        memcpy(upgrade, settings, settings_len);
+        upgrade[settings_len] = '\0';
+        if (start_h2(worker, conn, upgrade)) return;
+    }
+
+    /** Split request line and header lines, the request ends with the empty line */
+    conn->in.data[conn->request_len - 2] = '\0';
+    char *headers = strstr(conn->in.data, "\r\n");
+    *headers = '\0';
+    headers += 2;
+    conn->requests++;
+    bool keep_alive = request_keep_alive(headers);
+
+    if (worker->limiter.slots != NULL && conn->limited) {
+        long wait_ms = rate_limiter_take(&worker->limiter, conn->addr, now_ms());
+        if (wait_ms > 0) {
+            /** Closing would only make the client reconnect at once, which costs more than refusing a request */
+            conn->response.keep_alive = keep_alive;
+            set_request_line(&conn->response, conn->in.data);
+            respond_empty(worker, conn, too_many_requests, wait_ms);
+            return;
+        }
+    }
+
+    int backend = route_request(worker, conn->in.data);
+    if (backend >= 0) {
+        start_proxy(worker, conn, backend, headers);
+        return;
+    }
+
+    response_t *response = &conn->response;
+    *response = validate_request(conn->in.data, worker);
+    response->keep_alive = keep_alive;
+    if (response->status != accepted && response->status != no_content) {
+        respond_status(worker, conn, response->status);
+        return;
+    }
+    parse_headers(headers, response);
+    if (response->status == no_content) {
+        respond_status(worker, conn, no_content);
+        return;
+    }
+    if (response->packed != NULL) {
+        respond_packed(worker, conn);
+        return;
+    }
+    status_e status = prepare_body(worker, response, &conn->body, &conn->listing, &conn->comp);
+    if (status != accepted) {
+        respond_status(worker, conn, status);
+        return;
+    }
+
+    /** The compressed size is unknown while streaming, so either chunks or the closed connection delimit the body */
+    conn->chunked = response->encoding != enc_identity && !response->precompressed && response->keep_alive;
+    conn->last_chunk = false;
+    /** The terminating chunk of the previous response on this connection must not be sent again */
+    conn->chunk_head[0] = '\0';
+    conn->out_len = format_head(conn->out, response, conn->body != NULL, conn->chunked);
+    conn->has_body = !response->head;
+    conn->file_offset = response->range ? response->range_first : 0;
+    conn->file_remaining = response->range ? (size_t) (response->range_last - response->range_first + 1)
+                                           : response->size;
+    conn_start_writing(worker, conn);
+}
+
+/**
+ * @brief Reads request headers until the empty line is found.
+ * @param worker Event loop.
+ * @param conn Connection in reading state.
+ * @return False if the connection has been closed.
+ */
+static bool handle_read(worker_t *worker, connection_t *conn) {
+    while (conn->in.len < conn->in.cap) {
+        size_t received = conn->in.len;
+        ssize_t n = io_buffer_read(&conn->in, conn->fd);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            conn_close(worker, conn);
+            return false;
+        }
+        if (n == 0) {
+            /** Client closed the connection before sending a complete request */
+            conn_close(worker, conn);
+            return false;
+        }
+
+        /** First bytes of a request on a kept alive connection, the idle timeout becomes the header timeout */
+        if (received == 0 && conn->requests > 0) {
+            conn->started_us = now_us();
+            timer_schedule(&worker->timers, &conn->timer, worker->options->read_timeout * 1000L);
+        }
+
+        /** A client with prior knowledge of HTTP/2 starts with the preface instead of a request */
+        size_t preface_len = conn->in.len < H2_PREFACE_LEN ? conn->in.len : H2_PREFACE_LEN;
+        if (conn->requests == 0 && memcmp(conn->in.data, H2_PREFACE, preface_len) == 0) {
+            if (preface_len < H2_PREFACE_LEN) continue;
+            if (!start_h2(worker, conn, NULL)) {
+                conn_close(worker, conn);
+                return false;
+            }
+            return conn->state != conn_closed;
+        }
+
+        /** The search for the empty line continues where the previous read left it */
+        if (io_buffer_head(&conn->in) > 0) {
+            prepare_response(worker, conn);
+            return true;
+        }
+    }
+
+    fprintf(stderr, "[%s] Error: Request headers exceed %zu bytes \n", prog_name, conn->in.cap);
+    respond_status(worker, conn, header_too_large);
+    return true;
+}
+
+/**
+ * @brief Sends the pending compressor output of a connection, framed as a chunk if needed.
+ * @param conn Connection with chunk, chunk_len and chunk_pos set.
+ * @return Same as io_sendv().
+ */
+static int send_chunk(connection_t *conn) {
+    if (!conn->chunked) return io_send(conn->fd, conn->chunk, conn->chunk_len, &conn->chunk_pos);
+    struct iovec parts[3] = {
+            {conn->chunk_head, strlen(conn->chunk_head)},
+            {conn->chunk,      conn->chunk_len},
+            {"\r\n",           conn->chunk_len > 0 ? 2 : 0}
+    };
+    return io_sendv(conn->fd, parts, 3, &conn->chunk_pos, 0);
+}
+
+/**
+ * @brief Writes as much of the response as the socket takes.
+ * @param worker Event loop.
+ * @param conn Connection in writing state.
+ * @return 1 if the response is complete, 0 if the socket is full and -1 on errors.
+ */
+static int write_response(worker_t *worker, connection_t *conn) {
+    if (conn->has_body && conn->body != NULL) {
+        /** Headers and a body in memory leave with one call, a small response in a single segment */
+        struct iovec parts[2] = {{conn->out, conn->out_len}, {conn->body, conn->response.size}};
+        size_t before = conn->out_pos > conn->out_len ? conn->out_pos - conn->out_len : 0;
+        int status = io_sendv(conn->fd, parts, 2, &conn->out_pos, 0);
+        conn->body_bytes += (conn->out_pos > conn->out_len ? conn->out_pos - conn->out_len : 0) - before;
+        return status;
+    }
+    /** Headers followed by a file are held back until sendfile() fills the segment with the start of the body */
+    struct iovec head = {conn->out, conn->out_len};
+    bool file_follows = conn->has_body && conn->comp == NULL && conn->file_remaining > 0;
+    int status = io_sendv(conn->fd, &head, 1, &conn->out_pos, file_follows ? MSG_MORE : 0);
+    if (status != 1 || !conn->has_body) return status;
+
+    /** Leaving with 0 while the socket is still writable lets level-triggered epoll report it again after the others */
+    unsigned long long quantum_end = conn->body_bytes + WRITE_QUANTUM;
+    if (conn->comp == NULL) {
+        /** Plain file, the kernel copies it straight from the page cache to the socket */
+        while (conn->file_remaining > 0) {
+            if (conn->body_bytes >= quantum_end) return 0;
+            size_t count = conn->file_remaining < SENDFILE_CHUNK ? conn->file_remaining : SENDFILE_CHUNK;
+            ssize_t n = sendfile(conn->fd, conn->response.fd, &conn->file_offset, count);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                return -1;
+            }
+            /** File shrunk while sending, the promised Content-Length can't be kept anymore */
+            if (n == 0) return -1;
+            conn->file_remaining -= n;
+            conn->body_bytes += n;
+        }
+        return 1;
+    }
+
+    /** Compressed on the fly, send the pending chunk before compressing the next one */
+    for (;;) {
+        status = send_chunk(conn);
+        if (status != 1 || conn->last_chunk) return status;
+        if (conn->body_bytes >= quantum_end) return 0;
+        ssize_t n = compressor_next(conn->comp, conn->response.fd, &conn->chunk);
+        if (n < 0) return -1;
+        if (n == 0 && !conn->chunked) return 1;
+        /** The empty chunk terminates a chunked body */
+        conn->last_chunk = n == 0;
+        conn->chunk_len = n;
+        conn->body_bytes += n;
+        conn->chunk_pos = 0;
+        snprintf(conn->chunk_head, sizeof(conn->chunk_head), n > 0 ? "%zx\r\n" : "0\r\n\r\n", (size_t) n);
+    }
+}
+
+/**
+ * @brief Prepares a kept alive connection for its next request.
+ * @details Pipelined requests which are already in the input buffer are moved to its beginning and handled right away.
+ *
+ * @param worker Event loop.
+ * @param conn Connection whose response is complete.
+ * @return False if the connection has been closed.
+ */
+static bool conn_reuse(worker_t *worker, connection_t *conn) {
+    path_cache_release(conn->response.file);
+    free(conn->response.path);
+    compressor_release(conn->comp);
+    conn_release_body(conn);
+    memset(&conn->response, 0, sizeof(conn->response));
+    conn->response.fd = -1;
+    conn->comp = NULL;
+    conn->chunk = NULL;
+    conn->chunk_len = conn->chunk_pos = 0;
+    conn->out_len = conn->out_pos = 0;
+    conn->body_bytes = 0;
+
+    io_buffer_consume(&conn->in, conn->request_len);
+    conn->request_len = 0;
+    conn->state = conn_reading;
+
+    if (conn->in.len > 0) {
+        /** Pipelined request, it has been waiting since it arrived but its latency counts from now */
+        conn->started_us = now_us();
+        timer_schedule(&worker->timers, &conn->timer, worker->options->read_timeout * 1000L);
+        if (io_buffer_head(&conn->in) > 0) {
+            prepare_response(worker, conn);
+            return true;
+        }
+    } else {
+        timer_schedule(&worker->timers, &conn->timer, worker->options->idle_timeout * 1000L);
+    }
+    conn_watch(worker, conn, EPOLLIN);
+    return true;
+}
+
+/**
+ * @brief Handles a writable connection.
+ * @param worker Event loop.
+ * @param conn Connection in writing state.
+ */
+static void handle_write(worker_t *worker, connection_t *conn) {
+    int status = write_response(worker, conn);
+    if (status < 0) {
+        fprintf(stderr, "[%s] Error: Couldn't write to client. \n", prog_name);
+        record_response(worker, conn->client, &conn->response, conn->body_bytes, conn->started_us);
+        conn_close(worker, conn);
+    } else if (status == 1) {
+        record_response(worker, conn->client, &conn->response, conn->body_bytes, conn->started_us);
+        if (conn->response.keep_alive && !worker->draining) conn_reuse(worker, conn);
+        else conn_close(worker, conn);
+    } else {
+        /** The client is still reading, so the send-stall timeout starts again */
+        timer_schedule(&worker->timers, &conn->timer, worker->options->write_timeout * 1000L);
+    }
+}
+
+/**
+ * @brief Frees the response of an HTTP/2 stream.
+ * @param ex Response.
+ */
+static void h2_exchange_free(h2_exchange_t *ex) {
+    path_cache_release(ex->response.file);
+    free(ex->response.path);
+    compressor_release(ex->comp);
+    if (ex->listing != NULL) listing_release(ex->listing);
+    else if (!ex->bundled) free(ex->body);
+    free(ex->head);
+    free(ex);
+}
+
+/**
+ * @brief Answers the request of an HTTP/2 stream, the way prepare_response() answers one of HTTP/1.1.
+ * @details Requests for a backend get a 421, the proxy only speaks HTTP/1.1 with clients.
+ */
+static void h2_on_request(void *arg, h2_stream_t *stream, char *head, size_t len) {
+    h2_conn_t *h2 = arg;
+    worker_t *worker = h2->worker;
+    connection_t *conn = h2->conn;
+    h2_exchange_t *ex = calloc(1, sizeof(h2_exchange_t));
+    if (ex == NULL) {
+        static const char failed[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        free(head);
+        h2_respond(&h2->session, stream, failed, sizeof(failed) - 1, false);
+        return;
+    }
+    ex->head = head;
+    ex->started_us = now_us();
+    ex->response.fd = -1;
+    stream->data = ex;
+    conn->requests++;
+
+    response_t *response = &ex->response;
+    status_e status = len > 0 ? accepted : header_too_large;
+    long wait_ms = 0;
+    char *headers = NULL;
+    if (status == accepted) {
+        head[len - 2] = '\0';
+        headers = strstr(head, "\r\n");
+        *headers = '\0';
+        headers += 2;
+    }
+    if (status == accepted && worker->limiter.slots != NULL && conn->limited) {
+        wait_ms = rate_limiter_take(&worker->limiter, conn->addr, now_ms());
+        if (wait_ms > 0) status = too_many_requests;
+    }
+    if (status == accepted && route_request(worker, head) >= 0) status = misdirected_request;
+    if (status == too_many_requests || status == misdirected_request) set_request_line(response, head);
+    if (status == accepted) {
+        *response = validate_request(head, worker);
+        status = response->status;
+    }
+    if (status == accepted) parse_headers(headers, response);
+
+    char out[HEADER_BUFF_SIZE];
+    if (status == accepted && response->packed != NULL) {
+        int head_len = format_packed_head(worker, response, out);
+        ex->body = (char *) worker->bundle.map + response->packed->variants[response->encoding].body_offset;
+        ex->bundled = true;
+        ex->file_remaining = response->size;
+        h2_respond(&h2->session, stream, out, head_len, !response->head && ex->file_remaining > 0);
+        return;
+    }
+    if (status == accepted) status = prepare_body(worker, response, &ex->body, &ex->listing, &ex->comp);
+    if (status != accepted) {
+        /** Also the 204 of OPTIONS */
+        int head_len = format_empty_head(out, status, response, wait_ms);
+        if (head_len < 0) {
+            status = ressource_not_found;
+            head_len = format_empty_head(out, status, response, wait_ms);
+        }
+        response->status = status;
+        h2_respond(&h2->session, stream, out, head_len, false);
+        return;
+    }
+
+    /** The end of the stream delimits the body, compressed ones need no chunks */
+    int head_len = format_head(out, response, ex->body != NULL, false);
+    ex->file_offset = response->range ? response->range_first : 0;
+    ex->file_remaining = response->range ? (size_t) (response->range_last - response->range_first + 1)
+                                         : response->size;
+    h2_respond(&h2->session, stream, out, head_len, !response->head && (ex->file_remaining > 0 || ex->comp != NULL));
+}
+
+/**
+ * @brief Produces the next part of the body of an HTTP/2 stream, from memory, the file or the compressor.
+ */
+static ssize_t h2_on_body(void *arg, h2_stream_t *stream, unsigned char *buff, size_t max, bool *end) {
+    (void) arg;
+    h2_exchange_t *ex = stream->data;
+    ssize_t n;
+    if (ex->comp != NULL) {
+        /** The output of the compressor is passed on in pieces as big as the windows allow */
+        if (ex->chunk_pos == ex->chunk_len) {
+            n = compressor_next(ex->comp, ex->response.fd, &ex->chunk);
+            if (n <= 0) {
+                *end = n == 0;
+                return n;
+            }
+            ex->chunk_len = n;
+            ex->chunk_pos = 0;
+        }
+        n = ex->chunk_len - ex->chunk_pos < max ? ex->chunk_len - ex->chunk_pos : max;
+        memcpy(buff, ex->chunk + ex->chunk_pos, n);
+        ex->chunk_pos += n;
+    } else {
+        size_t count = ex->file_remaining < max ? ex->file_remaining : max;
+        if (ex->body != NULL) {
+            memcpy(buff, ex->body + ex->file_offset, count);
+            n = count;
+        } else {
+            do {
+                n = pread(ex->response.fd, buff, count, ex->file_offset);
+            } while (n < 0 && errno == EINTR);
+            /** File shrunk while sending, the promised Content-Length can't be kept anymore */
+            if (n <= 0) return -1;
+        }
+        ex->file_offset += n;
+        ex->file_remaining -= n;
+        *end = ex->file_remaining == 0;
+    }
+    ex->body_bytes += n;
+    return n;
+}
+
+/**
+ * @brief Records and frees the response of a finished or reset HTTP/2 stream.
+ */
+static void h2_on_close(void *arg, h2_stream_t *stream) {
+    h2_conn_t *h2 = arg;
+    h2_exchange_t *ex = stream->data;
+    if (ex == NULL) return;
+    /** The head handed over by h2.c is written as HTTP/1.1, but the request came over HTTP/2 */
+    if (ex->response.method != NULL) ex->response.protocol = "HTTP/2.0";
+    record_response(h2->worker, h2->conn->client, &ex->response, ex->body_bytes, ex->started_us);
+    h2_exchange_free(ex);
+}
+
+static const h2_callbacks_t h2_callbacks = {h2_on_request, h2_on_body, h2_on_close};
+
+/**
+ * @brief Sends what the session of an HTTP/2 connection has to send and waits for the events it needs next.
+ * @details The connection is closed after a connection error and, once GOAWAY is sent, as soon as its last stream
+ * is done.
+ *
+ * @param worker Event loop.
+ * @param conn Connection in HTTP/2 state.
+ */
+static void h2_flush(worker_t *worker, connection_t *conn) {
+    h2_conn_t *h2 = conn->h2;
+    int status = h2_session_send(&h2->session, conn->fd, WRITE_QUANTUM);
+    bool idle = h2_session_idle(&h2->session);
+    if (status < 0 || h2->session.failed || (idle && h2->session.goaway)) {
+        conn_close(worker, conn);
+        return;
+    }
+    uint32_t events = status == 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    if (events != h2->events) {
+        conn_watch(worker, conn, events);
+        h2->events = events;
+    }
+    /** An idle connection waits for its next request, a busy one for the client to read */
+    int timeout = idle ? worker->options->idle_timeout : worker->options->write_timeout;
+    timer_schedule(&worker->timers, &conn->timer, timeout * 1000L);
+}
+
+/**
+ * @brief Passes received bytes to the session of an HTTP/2 connection.
+ * @param conn Connection in HTTP/2 state.
+ */
+static void h2_receive(connection_t *conn) {
+    ssize_t used = h2_session_receive(&conn->h2->session, (unsigned char *) conn->in.data, conn->in.len);
+    /** After errors the session only sends its GOAWAY, h2_flush() closes the connection */
+    if (used > 0) io_buffer_consume(&conn->in, used);
+}
+
+/**
+ * @brief Switches a connection to HTTP/2, after the preface or for an upgrade request.
+ * @details The request of an upgrade becomes stream 1 and is answered after the 101 response. Frames are bigger than
+ * request heads, so the input moves to a bigger buffer.
+ *
+ * @param worker Event loop.
+ * @param conn Connection in reading state, with the preface or the upgrade request in its input buffer.
+ * @param upgrade Value of HTTP2-Settings of the upgrade request, NULL after the preface.
+ * @return False if the connection can't switch, it is unchanged then.
+ */
+static bool start_h2(worker_t *worker, connection_t *conn, const char *upgrade) {
+    h2_conn_t *h2 = calloc(1, sizeof(h2_conn_t));
+    io_buffer_t in;
+    if (h2 == NULL || io_buffer_init(&in, conn->in.cap > H2_IN_SIZE ? conn->in.cap : H2_IN_SIZE) < 0) {
+        free(h2);
+        return false;
+    }
+    size_t head_len = conn->request_len;
+    char *head = upgrade != NULL ? malloc(head_len + 1) : NULL;
+    if ((upgrade != NULL && head == NULL) ||
+        h2_session_init(&h2->session, &h2_callbacks, h2, worker->options->max_header_bytes, upgrade) < 0) {
+        free(head);
+        io_buffer_free(&in);
+        free(h2);
+        return false;
+    }
+    h2->worker = worker;
+    h2->conn = conn;
+    h2->events = EPOLLIN;
+    if (head != NULL) {
+        memcpy(head, conn->in.data, head_len);
+        head[head_len] = '\0';
+        io_buffer_consume(&conn->in, head_len);
+        conn->request_len = 0;
+    }
+    memcpy(in.data, conn->in.data, conn->in.len + 1);
+    in.len = conn->in.len;
+    io_buffer_free(&conn->in);
+    conn->in = in;
+    conn->h2 = h2;
+    conn->state = conn_h2;
+
+    if (head != NULL) h2_session_upgrade(&h2->session, head, head_len);
+    h2_receive(conn);
+    h2_flush(worker, conn);
+    return true;
+}
+
+/**
+ * @brief Handles the events of an HTTP/2 connection.
+ * @details Reads once per event, so a client flooding the connection can't hold up the others.
+ *
+ * @param worker Event loop.
+ * @param conn Connection in HTTP/2 state.
+ * @param events Events reported by epoll.
+ */
+static void handle_h2(worker_t *worker, connection_t *conn, uint32_t events) {
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        ssize_t n = io_buffer_read(&conn->in, conn->fd);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            conn_close(worker, conn);
+            return;
+        }
+        if (n > 0) h2_receive(conn);
+    }
+    h2_flush(worker, conn);
+}
+
+/**
+ * @brief Registers the events a proxied connection waits for on both of its sockets.
+ * @param worker Event loop.
+ * @param conn Connection in proxying state.
+ * @param client_events Events of the client socket, 0 while only the backend is waited for.
+ * @param events Events of the backend socket, 0 while only the client is waited for.
+ */
+static void proxy_watch(worker_t *worker, connection_t *conn, uint32_t client_events, uint32_t events) {
+    upstream_t *up = &conn->upstream;
+    if (client_events != up->client_events) {
+        conn_watch(worker, conn, client_events);
+        up->client_events = client_events;
+    }
+    if (up->fd < 0 || up->hung_up || events == up->events) return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = conn;
+    if (epoll_ctl(worker->upstream_epfd, up->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, up->fd, &ev) == 0) {
+        up->registered = true;
+        up->events = events;
+    }
+}
+
+/**
+ * @brief Creates the pipe for splicing bodies of a proxied connection, if it has none yet.
+ * @param up Backend side of the connection.
+ * @return False on errors.
+ */
+static bool upstream_pipe(upstream_t *up) {
+    if (up->pipe[0] >= 0) return true;
+    if (pipe2(up->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        up->pipe[0] = up->pipe[1] = -1;
+        return false;
+    }
+    fcntl(up->pipe[0], F_SETPIPE_SZ, SENDFILE_CHUNK);
+    return true;
+}
+
+/**
+ * @brief Gives up on a proxied request because of the backend.
+ * @details The client gets the status if nothing of the response has been sent yet, otherwise its connection is
+ * closed, which is all a client can still notice of a broken response.
+ *
+ * @param worker Event loop.
+ * @param conn Connection in proxying state.
+ * @param status Status for the client.
+ */
+static void proxy_fail(worker_t *worker, connection_t *conn, status_e status) {
+    fprintf(stderr, "[%s] Error: Request to backend %s failed \n", prog_name,
+            worker->options->backends[conn->upstream.backend].name);
+    upstream_close(worker, conn, false);
+    if (conn->upstream.state != upstream_response) {
+        /** The rest of the request body would be taken for the next request */
+        if (conn->upstream.body_left > 0) conn->response.keep_alive = false;
+        respond_status(worker, conn, status);
+        return;
+    }
+    record_response(worker, conn->client, &conn->response, conn->body_bytes, conn->started_us);
+    conn_close(worker, conn);
+}
+
+/**
+ * @brief Drops a proxied request whose client is gone.
+ * @param worker Event loop.
+ * @param conn Connection in proxying state.
+ */
+static void proxy_drop(worker_t *worker, connection_t *conn) {
+    record_response(worker, conn->client, &conn->response, conn->body_bytes, conn->started_us);
+    conn_close(worker, conn);
+}
+
+/**
+ * @brief Checks whether repeating a request has the same effect as sending it once (RFC 9110, 9.2.2).
+ * @param method Method of the request.
+ * @return True for GET, HEAD, OPTIONS, PUT and DELETE.
+ */
+static bool is_idempotent(const char *method) {
+    static const char *methods[] = {"GET", "HEAD", "OPTIONS", "PUT", "DELETE"};
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+        if (strcmp(method, methods[i]) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Sends the request again over a new connection after a pooled one failed.
+ * @details A backend may close an idle connection just when it is taken from the pool. Nothing has been received
+ * then and the request can be repeated, unless its body has already been taken from the client. A request which
+ * failed while it was sent never reached the backend completely, one that was sent completely may have been
+ * processed before the connection broke, so it is only repeated if it is idempotent.
+ *
+ * @param worker Event loop.
+ * @param conn Connection in proxying state.
+ * @param sent True if the whole request had been sent.
+ * @return True if the request is sent again.
+ */
+static bool proxy_retry(worker_t *worker, connection_t *conn, bool sent) {
+    upstream_t *up = &conn->upstream;
+    if (!up->reused || up->body_spliced || up->len > 0) return false;
+    if (sent && !is_idempotent(conn->response.method)) return false;
+    upstream_close(worker, conn, false);
+    up->fd = upstream_acquire(&worker->upstreams, worker->options->backends, up->backend, &up->reused);
+    if (up->fd < 0) return false;
+    up->state = upstream_request;
+    up->head_pos = 0;
+    return true;
+}
+
+/**
+ * @brief Sends the request head and the body bytes which arrived with it to the backend.
+ * @return 1 if the next step follows, 0 if the connection waits or has been answered.
+ */
+static int proxy_send_request(worker_t *worker, connection_t *conn) {
+    upstream_t *up = &conn->upstream;
+    struct iovec parts[2] = {
+            {up->head,                     up->head_len},
+            {conn->in.data + up->body_offset, up->body_buffered}
+    };
+    int status = io_sendv(up->fd, parts, 2, &up->head_pos, 0);
+    if (status == 0) {
+        /** Also the case while a new connection is still being established */
+        proxy_watch(worker, conn, 0, EPOLLOUT);
+        return 0;
+    }
+    if (status < 0) {
+        if (proxy_retry(worker, conn, false)) return 1;
+        proxy_fail(worker, conn, bad_gateway);
+        return 0;
+    }
+    up->state = up->body_left > 0 ? upstream_request_body : upstream_response_head;
+    return 1;
+}
+
+/**
+ * @brief Splices the rest of the request body from the client to the backend.
+ * @return 1 if the next step follows, 0 if the connection waits or has been answered.
+ */
+static int proxy_send_body(worker_t *worker, connection_t *conn) {
+    upstream_t *up = &conn->upstream;
+    if (!upstream_pipe(up)) {
+        proxy_fail(worker, conn, internal_error);
+        return 0;
+    }
+    while (up->body_left > 0 || up->piped > 0) {
+        ssize_t n;
+        if (up->piped == 0) {
+            size_t count = up->body_left < SENDFILE_CHUNK ? (size_t) up->body_left : SENDFILE_CHUNK;
+            n = splice(conn->fd, NULL, up->pipe[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                proxy_watch(worker, conn, EPOLLIN, 0);
+                return 0;
+            }
+            if (n <= 0) {
+                proxy_drop(worker, conn);
+                return 0;
+            }
+            up->piped = n;
+            up->body_left -= n;
+            up->body_spliced = true;
+        }
+        n = splice(up->pipe[0], NULL, up->fd, NULL, up->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            proxy_watch(worker, conn, 0, EPOLLOUT);
+            return 0;
+        }
+        if (n <= 0) {
+            proxy_fail(worker, conn, bad_gateway);
+            return 0;
+        }
+        up->piped -= n;
+    }
+    up->state = upstream_response_head;
+    return 1;
+}
+
+/**
+ * @brief Receives the response head of the backend and rewrites it for the client.
+ * @return 1 if the next step follows, 0 if the connection waits or has been answered.
+ */
+static int proxy_receive_head(worker_t *worker, connection_t *conn) {
+    upstream_t *up = &conn->upstream;
+    ssize_t head_len;
+    for (;;) {
+        head_len = up->len > 0 ? http_response_head(&up->res, up->buff, up->len, up->head_request) : 0;
+        if (head_len > 0 && up->res.status >= 100 && up->res.status < 200) {
+            /** Interim responses aren't relayed, a client expecting 100 Continue got it already */
+            up->len -= head_len;
+            memmove(up->buff, up->buff + head_len, up->len);
+            continue;
+        }
+        if (head_len != 0) break;
+        if (up->len == PROXY_BUFF_SIZE) {
+            head_len = -1;
+            break;
+        }
+        ssize_t n = recv(up->fd, up->buff + up->len, PROXY_BUFF_SIZE - up->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            proxy_watch(worker, conn, 0, EPOLLIN);
+            return 0;
+        }
+        if (n <= 0) {
+            if (proxy_retry(worker, conn, true)) return 1;
+            head_len = -1;
+            break;
+        }
+        up->len += n;
+    }
+
+    response_t *response = &conn->response;
+    /** A body ended by closing the connection can only be relayed the same way */
+    response->keep_alive = response->keep_alive && !worker->draining && up->res.framing != framing_close;
+    ssize_t len = head_len > 0 ? proxy_response_head(up->head, PROXY_BUFF_SIZE, up->buff, head_len,
+                                                     response->keep_alive) : -1;
+    if (len < 0) {
+        proxy_fail(worker, conn, bad_gateway);
+        return 0;
+    }
+    response->status = up->res.status;
+    up->head_len = len;
+    up->head_pos = 0;
+    up->parsed = up->sent = head_len;
+    up->complete = false;
+    up->state = upstream_response;
+    return 1;
+}
+
+/**
+ * @brief Splices a body framed by its length or by the end of the connection from the backend to the client.
+ * @param worker Event loop.
+ * @param conn Connection whose receive buffer has been relayed completely.
+ * @return 1 if the body is complete, 0 if a socket isn't ready, -1 if the client and -2 if the backend failed.
+ */
+static int proxy_splice(worker_t *worker, connection_t *conn) {
+    upstream_t *up = &conn->upstream;
+    bool length = up->res.framing == framing_length;
+    if (!upstream_pipe(up)) return -2;
+    for (;;) {
+        ssize_t n;
+        if (up->piped > 0) {
+            n = splice(up->pipe[0], NULL, conn->fd, NULL, up->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                proxy_watch(worker, conn, EPOLLOUT, 0);
+                return 0;
+            }
+            if (n <= 0) return -1;
+            up->piped -= n;
+            conn->body_bytes += n;
+            continue;
+        }
+        if (length && up->res.remaining == 0) return 1;
+        size_t count = length && up->res.remaining < SENDFILE_CHUNK ? (size_t) up->res.remaining : SENDFILE_CHUNK;
+        n = splice(up->fd, NULL, up->pipe[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            proxy_watch(worker, conn, 0, EPOLLIN);
+            return 0;
+        }
+        if (n == 0 && !length) return 1;
+        if (n <= 0) return -2;
+        up->piped += n;
+        if (length) up->res.remaining -= n;
+    }
+}
+
+/**
+ * @brief Completes a proxied request, the backend connection goes back into the pool if it can serve another one.
+ * @param worker Event loop.
+ * @param conn Connection whose response has been relayed completely.
+ */
+static void proxy_finish(worker_t *worker, connection_t *conn) {
+    upstream_t *up = &conn->upstream;
+    /** Bytes after the end of the response would be taken for the next response */
+    upstream_close(worker, conn, up->res.keep_alive && !up->hung_up && up->parsed == up->len);
+    record_response(worker, conn->client, &conn->response, conn->body_bytes, conn->started_us);
+    if (conn->response.keep_alive && !worker->draining) conn_reuse(worker, conn);
+    else conn_close(worker, conn);
+}
+
+/**
+ * @brief Relays the response head and body from the backend to the client.
+ * @details Received bytes are checked against the framing before they are passed on, so the end of the body is
+ * known. Bodies with a length or without any framing are spliced once nothing is buffered anymore, chunked ones go
+ * through the buffer.
+ *
+ * @return Always 0, the connection waits or is done.
+ */
+static int proxy_relay(worker_t *worker, connection_t *conn) {
+    upstream_t *up = &conn->upstream;
+    int status = io_send(conn->fd, up->head, up->head_len, &up->head_pos);
+    while (status == 1) {
+        if (up->sent < up->parsed) {
+            size_t pos = up->sent;
+            status = io_send(conn->fd, up->buff, up->parsed, &up->sent);
+            conn->body_bytes += up->sent - pos;
+            continue;
+        }
+        /** Spliced bytes still in the pipe are counted by the framing already */
+        if (up->piped > 0) {
+            status = proxy_splice(worker, conn);
+            up->complete = status == 1;
+            continue;
+        }
+        if (up->complete) {
+            proxy_finish(worker, conn);
+            return 0;
+        }
+
+        size_t consumed, data_len;
+        const char *data;
+        int ret = http_response_body(&up->res, up->buff + up->parsed, up->len - up->parsed, &consumed, &data,
+                                     &data_len);
+        if (ret < 0) {
+            status = -2;
+            break;
+        }
+        up->parsed += consumed;
+        up->complete = ret == 1;
+        if (consumed > 0 || up->complete) continue;
+
+        /** Everything checked is relayed, an incomplete chunk header moves to the front */
+        up->len -= up->sent;
+        memmove(up->buff, up->buff + up->sent, up->len);
+        up->parsed -= up->sent;
+        up->sent = 0;
+        if (up->len == 0 && up->res.framing != framing_chunked) {
+            status = proxy_splice(worker, conn);
+            up->complete = status == 1;
+            continue;
+        }
+        if (up->len == PROXY_BUFF_SIZE) {
+            status = -2;
+            break;
+        }
+        ssize_t n = recv(up->fd, up->buff + up->len, PROXY_BUFF_SIZE - up->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            proxy_watch(worker, conn, 0, EPOLLIN);
+            return 0;
+        }
+        if (n <= 0) {
+            status = -2;
+            break;
+        }
+        up->len += n;
+    }
+
+    if (status == 0) {
+        /** proxy_splice() registered its own events */
+        if (up->sent < up->parsed || up->head_pos < up->head_len) proxy_watch(worker, conn, EPOLLOUT, 0);
+    } else if (status == -2) {
+        proxy_fail(worker, conn, bad_gateway);
+    } else {
+        proxy_drop(worker, conn);
+    }
+    return 0;
+}
+
+/**
+ * @brief Advances a proxied request as far as its sockets allow.
+ * @param worker Event loop.
+ * @param conn Connection in proxying state.
+ */
+static void proxy_pump(worker_t *worker, connection_t *conn) {
+    int status = 1;
+    while (status == 1) {
+        switch (conn->upstream.state) {
+            case upstream_request:
+                status = proxy_send_request(worker, conn);
+                break;
+            case upstream_request_body:
+                status = proxy_send_body(worker, conn);
+                break;
+            case upstream_response_head:
+                status = proxy_receive_head(worker, conn);
+                break;
+            default:
+                status = proxy_relay(worker, conn);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Forwards a completely received request head to a backend.
+ * @details Body bytes which arrived with the head are sent along with it, the rest of the body is spliced from the
+ * client to the backend. Chunked request bodies aren't supported and get a 501.
+ *
+ * @param worker Event loop.
+ * @param conn Connection with the request line in its input buffer.
+ * @param backend Index of the backend.
+ * @param headers Header lines of the request.
+ */
+static void start_proxy(worker_t *worker, connection_t *conn, int backend, char *headers) {
+    response_t *response = &conn->response;
+    memset(response, 0, sizeof(response_t));
+    response->fd = -1;
+    response->encoding = enc_identity;
+    /** Until the request is forwarded, its body is still unread */
+    response->keep_alive = request_keep_alive(headers);
+    upstream_t *up = &conn->upstream;
+    up->backend = backend;
+    up->state = upstream_request;
+
+    char *saveptr;
+    char *method = strtok_r(conn->in.data, " ", &saveptr);
+    char *target = strtok_r(NULL, " ", &saveptr);
+    char *http_version = strtok_r(NULL, " ", &saveptr);
+    if (method == NULL || target == NULL || http_version == NULL ||
+        strncmp(http_version, "HTTP/1.1", strlen("HTTP/1.1")) != 0) {
+        fprintf(stderr, "[%s] Error: Request malformed \n", prog_name);
+        respond_status(worker, conn, malformed_req);
+        return;
+    }
+    response->method = method;
+    response->target = target;
+    response->protocol = http_version;
+
+    if ((up->head == NULL && (up->head = malloc(PROXY_BUFF_SIZE)) == NULL) ||
+        (up->buff == NULL && (up->buff = malloc(PROXY_BUFF_SIZE)) == NULL)) {
+        respond_status(worker, conn, internal_error);
+        return;
+    }
+    proxy_request_t request;
+    ssize_t head_len = proxy_request_head(up->head, PROXY_BUFF_SIZE, method, target, headers, conn->client, &request);
+    if (head_len < 0 || request.chunked) {
+        fprintf(stderr, "[%s] Error: Request can't be forwarded \n", prog_name);
+        respond_status(worker, conn, head_len < 0 ? malformed_req : unsupported_method);
+        return;
+    }
+    response->keep_alive = !request.close && !worker->draining;
+
+    /** Body bytes which arrived with the head belong to this request, pipelined requests follow them */
+    size_t buffered = conn->in.len - conn->request_len;
+    up->body_offset = conn->request_len;
+    up->body_buffered = (long long) buffered < request.content_length ? buffered : (size_t) request.content_length;
+    up->body_left = request.content_length - (long long) up->body_buffered;
+    up->body_spliced = false;
+    conn->request_len += up->body_buffered;
+
+    up->head_len = head_len;
+    up->head_pos = 0;
+    up->len = up->parsed = up->sent = 0;
+    up->piped = 0;
+    up->head_request = strcmp(method, "HEAD") == 0;
+    up->complete = false;
+    /** Unknown after a previous response, so the first proxy_watch() registers the client socket again */
+    up->client_events = EPOLLIN | EPOLLOUT;
+    conn->state = conn_proxying;
+    timer_schedule(&worker->timers, &conn->timer, worker->options->write_timeout * 1000L);
+    up->fd = upstream_acquire(&worker->upstreams, worker->options->backends, backend, &up->reused);
+    if (up->fd < 0) {
+        proxy_fail(worker, conn, bad_gateway);
+        return;
+    }
+    if (request.expect_continue && up->body_left > 0) {
+        /** Best effort, a client which gets no answer sends its body after a short wait anyway */
+        static const char go_on[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(conn->fd, go_on, sizeof(go_on) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    proxy_pump(worker, conn);
+}
+
+/**
+ * @brief Handles events of a proxied connection on either of its sockets.
+ * @param worker Event loop.
+ * @param conn Connection in proxying state.
+ * @param events Events which occurred.
+ * @param upstream True if they occurred on the socket to the backend.
+ */
+static void handle_proxy(worker_t *worker, connection_t *conn, uint32_t events, bool upstream) {
+    upstream_t *up = &conn->upstream;
+    if (!upstream && (events & (EPOLLERR | EPOLLHUP))) {
+        proxy_drop(worker, conn);
+        return;
+    }
+    if (upstream && (events & (EPOLLERR | EPOLLHUP)) && up->registered) {
+        /** Reported until the socket is closed, what is left in it can be read without waiting */
+        epoll_ctl(worker->upstream_epfd, EPOLL_CTL_DEL, up->fd, NULL);
+        up->registered = false;
+        up->events = 0;
+        up->hung_up = true;
+    }
+    /** Any progress starts the stall timeout again */
+    timer_schedule(&worker->timers, &conn->timer, worker->options->write_timeout * 1000L);
+    proxy_pump(worker, conn);
+}
+
+/**
+ * @brief Handles the ready sockets to backends.
+ * @param worker Event loop whose upstream epoll instance became readable.
+ */
+static void handle_upstreams(worker_t *worker) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(worker->upstream_epfd, events, MAX_EVENTS, 0);
+    for (int i = 0; i < n; ++i) {
+        connection_t *conn = events[i].data.ptr;
+        if (conn->state == conn_proxying) handle_proxy(worker, conn, events[i].events, true);
+    }
+}
+
+/**
+ * @brief Answers a connection over the limit with 503 and closes it.
+ * @details The answer is sent without waiting, a connection which doesn't take it is simply closed.
+ * @param fd Accepted socket.
+ */
+static void shed_connection(int fd) {
+    static const char overload[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n"
+                                   "Connection: close\r\n\r\n";
+    send(fd, overload, sizeof(overload) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
+
+/**
+ * @brief Accepts all pending connections of a listening socket.
+ * @param worker Event loop.
+ * @param listenfd The TCP or the Unix socket.
+ */
+static void accept_connections(worker_t *worker, int listenfd) {
+    for (;;) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        int connfd = accept4(listenfd, (struct sockaddr *) &addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "[%s] Error: couldn't accept connection on socket. \n", prog_name);
+            }
+            return;
+        }
+        char client[INET6_ADDRSTRLEN] = "-";
+        format_client(&addr, client);
+
+        if (worker->active >= worker->options->max_connections) {
+            metrics_add(&worker->metrics.shed, 1);
+            shed_connection(connfd);
+            record_response(worker, client, NULL, 0, now_us());
+            continue;
+        }
+        connection_t *conn = conn_open(worker, connfd, client);
+        if (conn != NULL) {
+            client_key(&addr, conn->addr);
+            conn->limited = addr.ss_family != AF_UNIX;
+        }
+    }
+}
+
+/**
+ * @brief Drops all connections whose timer expired.
+ * @details Clients which haven't sent their request in time get a 408, requests whose backend doesn't answer in time
+ * a 504. Idle kept alive connections and stalled writes are closed right away, the latter are still recorded.
+ * @param worker Event loop.
+ */
+static void expire_connections(worker_t *worker) {
+    wheel_timer_t expired;
+    timer_wheel_advance(&worker->timers, now_ms(), &expired);
+    wheel_timer_t *timer;
+    while ((timer = timer_wheel_pop_expired(&expired)) != NULL) {
+        connection_t *conn = CONN_OF_TIMER(timer);
+        metrics_add(&worker->metrics.timed_out, 1);
+        bool proxied = conn->state == conn_proxying && conn->upstream.state != upstream_response;
+        if (proxied || (conn->state == conn_reading && (conn->in.len > 0 || conn->requests == 0))) {
+            respond_status(worker, conn, proxied ? gateway_timeout : request_timeout);
+            /** One attempt to deliver the 408 or 504, the connection is closed in any case */
+            size_t pos = 0;
+            io_send(conn->fd, conn->out, conn->out_len, &pos);
+            record_response(worker, conn->client, &conn->response, 0, conn->started_us);
+        } else if (conn->state == conn_writing || conn->state == conn_proxying) {
+            /** A response that stalled is logged with the body bytes that made it out */
+            record_response(worker, conn->client, &conn->response, conn->body_bytes, conn->started_us);
+        }
+        conn_close(worker, conn);
+    }
+}
+
+/**
+ * @brief Stops accepting and closes all idle connections.
+ * @details Connections which are reading a request or writing a response may finish within the grace period.
+ * @param worker Event loop.
+ */
+static void start_draining(worker_t *worker) {
+    worker->draining = true;
+    worker->drain_deadline = now_ms() + worker->options->grace_period * 1000L;
+    if (worker->listenfd >= 0) {
+        close(worker->listenfd);
+        worker->listenfd = -1;
+    }
+    if (worker->unixfd >= 0) {
+        close(worker->unixfd);
+        worker->unixfd = -1;
+        /** Nobody would accept connections on the file anymore, unless a new process took it over */
+        if (!worker->handed_over) unlink(worker->options->unix_path);
+    }
+
+    connection_t *conn = worker->connections;
+    while (conn != NULL) {
+        connection_t *next = conn->next;
+        if (conn->state == conn_reading && conn->in.len == 0 && conn->requests > 0) {
+            conn_close(worker, conn);
+        } else if (conn->state == conn_h2) {
+            /** HTTP/2 clients are told with GOAWAY, the streams they already opened are still answered */
+            h2_session_shutdown(&conn->h2->session);
+            h2_flush(worker, conn);
+        }
+        conn = next;
+    }
+    fprintf(stderr, "[%s] Draining %d connections \n", prog_name, worker->active);
+}
+
+/**
+ * @brief Finds the executable a restart runs, the same way execvp() would.
+ * @details Done before forking, since searching PATH allocates and isn't safe between fork() and exec.
+ * @param name argv[0] of this process.
+ * @param out Buffer for the path.
+ * @param cap Size of out.
+ * @return 0 on success, -1 if no executable was found.
+ */
+static int find_executable(const char *name, char *out, size_t cap) {
+    if (strchr(name, '/') != NULL) {
+        if (strlen(name) >= cap) return -1;
+        strcpy(out, name);
+        return 0;
+    }
+    const char *dirs = getenv("PATH");
+    if (dirs == NULL) dirs = "/usr/local/bin:/usr/bin:/bin";
+    while (*dirs != '\0') {
+        size_t dir_len = strcspn(dirs, ":");
+        int len = snprintf(out, cap, "%.*s%s%s", (int) dir_len, dirs, dir_len > 0 ? "/" : "", name);
+        if (len > 0 && (size_t) len < cap && access(out, X_OK) == 0) return 0;
+        dirs += dir_len;
+        if (*dirs == ':') dirs++;
+    }
+    return -1;
+}
+
+/**
+ * @brief Writes a pid as decimal digits, snprintf() isn't async-signal-safe.
+ * @param out Buffer with room for at least 11 characters.
+ * @param pid Process id.
+ */
+static void format_pid(char *out, pid_t pid) {
+    char digits[16];
+    int len = 0;
+    unsigned long value = (unsigned long) pid;
+    do {
+        digits[len++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (len > 0) *out++ = digits[--len];
+    *out = '\0';
+}
+
+/**
+ * @brief Starts a new server process which takes over the listening sockets.
+ * @details The sockets are passed from fd 3 on with LISTEN_FDS and LISTEN_PID set, the same way systemd passes
+ * sockets, so the kernel keeps queueing connections while the new process starts up and nothing is refused. The new
+ * process is executed from argv[0], so a freshly deployed binary is picked up. The access log writer thread may hold
+ * the stdio or environment lock while forking, so the executable, environment and error message are all prepared
+ * before fork() and the child only uses async-signal-safe calls.
+ *
+ * @param worker Event loop with the listening sockets.
+ * @return 0 if the new process has been started, -1 on errors.
+ */
+static int spawn_successor(worker_t *worker) {
+    char path[PATH_MAX];
+    if (find_executable(worker->options->argv[0], path, sizeof(path)) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't find %s for restart \n", prog_name, worker->options->argv[0]);
+        return -1;
+    }
+    char exec_error[PATH_MAX + 64];
+    int error_len = snprintf(exec_error, sizeof(exec_error), "[%s] Error: couldn't execute %s for restart \n",
+                             prog_name, path);
+    if (error_len < 0 || (size_t) error_len >= sizeof(exec_error)) error_len = (int) strlen(exec_error);
+
+    int fds[2];
+    int count = 0;
+    if (worker->listenfd >= 0) fds[count++] = worker->listenfd;
+    if (worker->unixfd >= 0) fds[count++] = worker->unixfd;
+
+    /** The environment without inherited LISTEN_ variables, LISTEN_PID is filled in by the child */
+    size_t env_count = 0;
+    while (environ[env_count] != NULL) env_count++;
+    char **envp = malloc((env_count + 3) * sizeof(char *));
+    if (envp == NULL) {
+        fprintf(stderr, "[%s] Error: couldn't prepare the environment for restart \n", prog_name);
+        return -1;
+    }
+    size_t env_len = 0;
+    for (size_t i = 0; i < env_count; ++i) {
+        if (strncmp(environ[i], "LISTEN_PID=", strlen("LISTEN_PID=")) == 0 ||
+            strncmp(environ[i], "LISTEN_FDS=", strlen("LISTEN_FDS=")) == 0) {
+            continue;
+        }
+        envp[env_len++] = environ[i];
+    }
+    char listen_pid[32] = "LISTEN_PID=";
+    char listen_fds[32];
+    snprintf(listen_fds, sizeof(listen_fds), "LISTEN_FDS=%d", count);
+    envp[env_len++] = listen_pid;
+    envp[env_len++] = listen_fds;
+    envp[env_len] = NULL;
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0 || max_fd > 65536) max_fd = 65536;
+
+    pid_t pid = fork();
+    if (pid != 0) {
+        free(envp);
+        if (pid < 0) {
+            fprintf(stderr, "[%s] Error: couldn't fork for restart \n", prog_name);
+            return -1;
+        }
+        fprintf(stderr, "[%s] Restarting, listening socket handed to pid %d \n", prog_name, (int) pid);
+        return 0;
+    }
+
+    /** Child: move the sockets to fd 3 and 4 and close everything else, via copies above both so none is overwritten */
+    for (int i = 0; i < count; ++i) {
+        if ((fds[i] = fcntl(fds[i], F_DUPFD, LISTEN_FDS_START + 2)) < 0) _exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (dup2(fds[i], LISTEN_FDS_START + i) < 0) _exit(EXIT_FAILURE);
+    }
+    for (long fd = LISTEN_FDS_START + count; fd < max_fd; ++fd) close((int) fd);
+
+    format_pid(listen_pid + strlen("LISTEN_PID="), getpid());
+    execve(path, worker->options->argv, envp);
+    ssize_t written = write(STDERR_FILENO, exec_error, (size_t) error_len);
+    (void) written;
+    _exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Takes over the listening sockets passed on by a restart or by systemd.
+ * @details They are told apart by their address family.
+ * @param tcpfd Set to the TCP socket, -1 if none was passed to this process.
+ * @param unixfd Set to the Unix socket, -1 if none was passed to this process.
+ */
+static void inherited_sockets(int *tcpfd, int *unixfd) {
+    *tcpfd = *unixfd = -1;
+    char *listen_pid = getenv("LISTEN_PID");
+    char *listen_fds = getenv("LISTEN_FDS");
+    if (listen_pid == NULL || listen_fds == NULL) return;
+    long count = strtol(listen_fds, NULL, 10);
+    if (strtol(listen_pid, NULL, 10) != getpid() || count < 1) return;
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+
+    for (int fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + count && fd < LISTEN_FDS_START + 2; ++fd) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        if (getsockname(fd, (struct sockaddr *) &addr, &addr_len) < 0) continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (set_nonblocking(fd) < 0) continue;
+        if (addr.ss_family == AF_UNIX && *unixfd < 0) *unixfd = fd;
+        else if (addr.ss_family != AF_UNIX && *tcpfd < 0) *tcpfd = fd;
+    }
+}
+
+/**
+ * @brief Runs the event loop until the server is stopped and all connections are drained.
+ * @param worker Event loop with an opened epoll instance and listening socket.
+ */
+static void run_worker(worker_t *worker) {
+    struct epoll_event events[MAX_EVENTS];
+
+    for (;;) {
+        if (restart) {
+            restart = false;
+            if (!worker->draining && spawn_successor(worker) == 0) {
+                worker->handed_over = true;
+                stop = true;
+            }
+        }
+        if (stop && !worker->draining) start_draining(worker);
+        if (worker->draining && (worker->active == 0 || now_ms() >= worker->drain_deadline)) break;
+
+        /** Sleep until the next tick of the timing wheel, or forever if no timer is pending */
+        int timeout = timer_wheel_timeout(&worker->timers, now_ms());
+        if (worker->draining) {
+            long left = worker->drain_deadline - now_ms();
+            if (timeout < 0 || left < timeout) timeout = left > 0 ? (int) left : 0;
+        }
+        int n = epoll_wait(worker->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "[%s] Error: epoll_wait failed \n", prog_name);
+            break;
+        }
+        /** Advance the wheel before new timers are scheduled, after an idle period it still stands at the tick the
+         * loop fell asleep at and the timeouts of new connections would already be over */
+        expire_connections(worker);
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == NULL) {
+                if (worker->listenfd >= 0) accept_connections(worker, worker->listenfd);
+                continue;
+            }
+            if (events[i].data.ptr == &worker->unixfd) {
+                if (worker->unixfd >= 0) accept_connections(worker, worker->unixfd);
+                continue;
+            }
+            if (events[i].data.ptr == &worker->listings) {
+                listing_cache_process(&worker->listings);
+                continue;
+            }
+            if (events[i].data.ptr == &worker->upstreams) {
+                handle_upstreams(worker);
+                continue;
+            }
+            connection_t *conn = events[i].data.ptr;
+            if (conn->state == conn_reading) {
+                handle_read(worker, conn);
+            } else if (conn->state == conn_proxying) {
+                handle_proxy(worker, conn, events[i].events, false);
+            } else if (conn->state == conn_writing) {
+                handle_write(worker, conn);
+            } else if (conn->state == conn_h2) {
+                handle_h2(worker, conn, events[i].events);
+            }
+        }
+        free_closed(worker);
+    }
+}
+
+/** Signal handler */
+void handle_signal() { stop = true; }
+
+/** Signal handler for SIGHUP */
+void handle_restart() { restart = true; }
+
+/**
+* @brief Main entry point
+* @details Main function. Options are created and default settings are set.
+*
+* @param argc
+* @param argv
+* @return exit code
+*/
+int main(int argc, char **argv) {
+    options_t options = {"8080", "index.html", NULL, Z_DEFAULT_COMPRESSION, COMPRESS_DEFAULT_MIN_SIZE,
+                         DEFAULT_BACKLOG, DEFAULT_MAX_CONNECTIONS, DEFAULT_MAX_HEADER_BYTES, DEFAULT_READ_TIMEOUT,
+                         DEFAULT_WRITE_TIMEOUT, DEFAULT_IDLE_TIMEOUT, DEFAULT_GRACE_PERIOD, NULL, NULL, false, argv};
+    /** Responses are written whole, Nagle's algorithm would only hold back their last segment */
+    options.tcp.nodelay = 1;
+    handle_args(argc, argv, &options);
+
+    /** Take over the sockets of the previous process on a restart, otherwise create them */
+    int sockfd, unixfd;
+    inherited_sockets(&sockfd, &unixfd);
+    if (sockfd >= 0 && tune_socket(sockfd, &options.tcp) < 0) {
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    if (sockfd == -1 && options.port != NULL && (sockfd = create_socket(&options)) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    if (unixfd == -1 && options.unix_path != NULL && (unixfd = create_unix_socket(&options)) == -1) {
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    access_log_t access_log;
+    if (options.access_log != NULL && access_log_open(&access_log, options.access_log) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't open access log %s \n", prog_name, options.access_log);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    /** Handle interrupts, without SA_RESTART so epoll_wait() returns */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = handle_restart;
+    sigaction(SIGHUP, &sa, NULL);
+    /** Clients closing early must not kill the server */
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    /** Set up the event loop, the TCP socket is marked with a NULL pointer */
+    worker_t worker;
+    memset(&worker, 0, sizeof(worker));
+    worker.listenfd = sockfd;
+    worker.unixfd = unixfd;
+    worker.options = &options;
+    worker.upstream_epfd = -1;
+    upstream_pool_init(&worker.upstreams);
+    compressor_pool_init(&worker.compressors, options.compress_level, options.compress_min_size);
+    timer_wheel_init(&worker.timers, now_ms(), TIMER_TICK_MS);
+    worker.epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    bool watched = worker.epfd >= 0 && (sockfd < 0 || epoll_ctl(worker.epfd, EPOLL_CTL_ADD, sockfd, &ev) == 0);
+    ev.data.ptr = &worker.unixfd;
+    if (!watched || (unixfd >= 0 && epoll_ctl(worker.epfd, EPOLL_CTL_ADD, unixfd, &ev) < 0)) {
+        fprintf(stderr, "[%s] Error: couldn't set up epoll \n", prog_name);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    if (path_cache_init(&worker.files, options.doc_root) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't open DOC_ROOT %s \n", prog_name, options.doc_root);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    listing_cache_init(&worker.listings);
+    if (options.rate > 0 && rate_limiter_init(&worker.limiter, options.rate, options.burst) < 0) {
+        fprintf(stderr, "[%s] Error: couldn't allocate the rate limiter \n", prog_name);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    if (options.bundle != NULL) {
+        if (bundle_open(&worker.bundle, options.bundle) < 0) {
+            fprintf(stderr, "[%s] Error: couldn't map bundle %s \n", prog_name, options.bundle);
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "[%s] Serving %u files from bundle %s \n", prog_name, worker.bundle.header->count,
+                options.bundle);
+    }
+    if (options.listings && worker.listings.inotify_fd >= 0) {
+        ev.data.ptr = &worker.listings;
+        epoll_ctl(worker.epfd, EPOLL_CTL_ADD, worker.listings.inotify_fd, &ev);
+    }
+    if (options.backend_count > 0) {
+        worker.upstream_epfd = epoll_create1(EPOLL_CLOEXEC);
+        ev.data.ptr = &worker.upstreams;
+        if (worker.upstream_epfd < 0 || epoll_ctl(worker.epfd, EPOLL_CTL_ADD, worker.upstream_epfd, &ev) < 0) {
+            fprintf(stderr, "[%s] Error: couldn't set up epoll for the backends \n", prog_name);
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (options.access_log != NULL) {
+        worker.log_ring = access_log_add_ring(&access_log);
+        if (worker.log_ring == NULL || access_log_start(&access_log) < 0) {
+            fprintf(stderr, "[%s] Error: couldn't start the access log writer \n", prog_name);
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    run_worker(&worker);
+
+    /** Cleanup, connections still open after the grace period are dropped */
+    if (worker.active > 0) {
+        fprintf(stderr, "[%s] Grace period over, dropping %d connections \n", prog_name, worker.active);
+    }
+    while (worker.connections != NULL) {
+        conn_close(&worker, worker.connections);
+    }
+    free_closed(&worker);
+    if (worker.metrics.shed > 0 || worker.metrics.timed_out > 0) {
+        fprintf(stderr, "[%s] Shed %llu connections with 503, %llu timed out\n", prog_name, worker.metrics.shed,
+                worker.metrics.timed_out);
+    }
+    if (worker.metrics.latency.count > 0) {
+        fprintf(stderr, "[%s] Latency p50 %lluus, p99 %lluus, p99.9 %lluus over %llu requests\n", prog_name,
+                histogram_quantile(&worker.metrics.latency, 0.5), histogram_quantile(&worker.metrics.latency, 0.99),
+                histogram_quantile(&worker.metrics.latency, 0.999), worker.metrics.latency.count);
+    }
+    if (options.access_log != NULL) access_log_close(&access_log, stderr, prog_name);
+    if (worker.upstreams.opened > 0) {
+        fprintf(stderr, "[%s] Opened %llu connections to backends, reused them %llu times\n", prog_name,
+                worker.upstreams.opened, worker.upstreams.reused);
+    }
+    if (worker.limiter.limited > 0) {
+        fprintf(stderr, "[%s] Rate limited %llu requests, %llu buckets evicted\n", prog_name, worker.limiter.limited,
+                worker.limiter.evicted);
+    }
+    compressor_report(&worker.compressors, stderr, prog_name);
+    compressor_pool_free(&worker.compressors);
+    listing_cache_free(&worker.listings);
+    path_cache_free(&worker.files);
+    bundle_close(&worker.bundle);
+    rate_limiter_free(&worker.limiter);
+    upstream_pool_free(&worker.upstreams);
+    if (worker.upstream_epfd >= 0) close(worker.upstream_epfd);
+    close(worker.epfd);
+    if (worker.listenfd >= 0) close(worker.listenfd);
+    if (worker.unixfd >= 0) close(worker.unixfd);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,143 @@
+/**
+ * @file timer_wheel.c
+ * @author filipppp
+ * @date 18.10.2026
+ */
+
+#include <stdlib.h>
+#include "timer_wheel.h"
+
+/** Timeouts beyond the range of all wheels are clamped to it */
+#define TW_MAX_TICKS ((1UL << (TW_BITS * TW_LEVELS)) - 1)
+
+static void list_init(wheel_timer_t *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+static void list_append(wheel_timer_t *head, wheel_timer_t *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(wheel_timer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/**
+ * @brief Puts a timer into the slot matching its expiry tick.
+ */
+static void wheel_insert(timer_wheel_t *tw, wheel_timer_t *timer) {
+    unsigned long expires = timer->expires;
+    /** Already expired timers run with the next processed tick */
+    if ((long) (expires - tw->current) < 0) expires = tw->current;
+    unsigned long delta = expires - tw->current;
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1UL << (TW_BITS * (level + 1)))) level++;
+    size_t slot = (expires >> (TW_BITS * level)) & TW_MASK;
+    list_append(&tw->slots[level][slot], timer);
+}
+
+/**
+ * @brief Moves all timers of a slot of a higher wheel into the lower wheels.
+ * @return Index of the cascaded slot, the next wheel has to cascade too if it is 0.
+ */
+static size_t cascade(timer_wheel_t *tw, int level) {
+    size_t index = (tw->current >> (TW_BITS * level)) & TW_MASK;
+    wheel_timer_t *head = &tw->slots[level][index];
+    wheel_timer_t *timer = head->next;
+    list_init(head);
+    while (timer != head) {
+        wheel_timer_t *next = timer->next;
+        wheel_insert(tw, timer);
+        timer = next;
+    }
+    return index;
+}
+
+void timer_wheel_init(timer_wheel_t *tw, long now_ms, long tick_ms) {
+    for (int level = 0; level < TW_LEVELS; ++level) {
+        for (int slot = 0; slot < TW_SLOTS; ++slot) {
+            list_init(&tw->slots[level][slot]);
+        }
+    }
+    tw->current = 0;
+    tw->start_ms = now_ms;
+    tw->tick_ms = tick_ms;
+    tw->count = 0;
+}
+
+void timer_init(wheel_timer_t *timer) {
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->expires = 0;
+}
+
+bool timer_pending(const wheel_timer_t *timer) {
+    return timer->next != NULL;
+}
+
+void timer_schedule(timer_wheel_t *tw, wheel_timer_t *timer, long timeout_ms) {
+    if (timer_pending(timer)) {
+        list_unlink(timer);
+        tw->count--;
+    }
+    unsigned long ticks = timeout_ms <= 0 ? 0 : (timeout_ms + tw->tick_ms - 1) / tw->tick_ms;
+    if (ticks > TW_MAX_TICKS) ticks = TW_MAX_TICKS;
+    timer->expires = tw->current + ticks;
+    wheel_insert(tw, timer);
+    tw->count++;
+}
+
+void timer_cancel(timer_wheel_t *tw, wheel_timer_t *timer) {
+    if (!timer_pending(timer)) return;
+    list_unlink(timer);
+    tw->count--;
+}
+
+void timer_wheel_advance(timer_wheel_t *tw, long now_ms, wheel_timer_t *expired) {
+    list_init(expired);
+    if (now_ms < tw->start_ms) return;
+    unsigned long target = (now_ms - tw->start_ms) / tw->tick_ms;
+
+    while ((long) (target - tw->current) >= 0) {
+        /** Nothing to cascade or expire, so idle periods are skipped instead of walked tick by tick */
+        if (tw->count == 0) {
+            tw->current = target + 1;
+            break;
+        }
+
+        size_t index = tw->current & TW_MASK;
+        if (index == 0) {
+            for (int level = 1; level < TW_LEVELS && cascade(tw, level) == 0; ++level);
+        }
+
+        wheel_timer_t *head = &tw->slots[0][index];
+        while (head->next != head) {
+            wheel_timer_t *timer = head->next;
+            list_unlink(timer);
+            tw->count--;
+            list_append(expired, timer);
+        }
+        tw->current++;
+    }
+}
+
+wheel_timer_t *timer_wheel_pop_expired(wheel_timer_t *expired) {
+    if (expired->next == expired) return NULL;
+    wheel_timer_t *timer = expired->next;
+    list_unlink(timer);
+    return timer;
+}
+
+int timer_wheel_timeout(const timer_wheel_t *tw, long now_ms) {
+    if (tw->count == 0) return -1;
+    long next = tw->start_ms + (long) tw->current * tw->tick_ms;
+    return next <= now_ms ? 0 : (int) (next - now_ms);
+}
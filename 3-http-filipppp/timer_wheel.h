@@ -0,0 +1,107 @@
+/**
+ * @file timer_wheel.h
+ * @author filipppp
+ * @date 18.10.2026
+ *
+ * @brief Hierarchical timing wheel for connection timeouts.
+ * @details Timers are kept in TW_LEVELS wheels of TW_SLOTS slots each. The first wheel holds the timers which expire
+ * within the next TW_SLOTS ticks, every further wheel covers TW_SLOTS times the range of the previous one. Whenever
+ * the first wheel wraps around, the matching slot of the next wheel is cascaded down. Scheduling, rescheduling and
+ * cancelling a timer are O(1) list operations, so 100k connections cost nothing until their timeout actually fires.
+ *
+ * The wheel doesn't need its own timer: the event loop passes timer_wheel_timeout() to epoll_wait() and calls
+ * timer_wheel_advance() after every wakeup.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+
+/** A timer, embedded into the object it belongs to */
+typedef struct wheel_timer {
+    struct wheel_timer *prev;
+    struct wheel_timer *next;
+    /** Tick in which the timer expires */
+    unsigned long expires;
+} wheel_timer_t;
+
+/** The wheel, every slot is a circular list with a sentinel */
+typedef struct {
+    wheel_timer_t slots[TW_LEVELS][TW_SLOTS];
+    /** Next tick to be processed */
+    unsigned long current;
+    long start_ms;
+    long tick_ms;
+    size_t count;
+} timer_wheel_t;
+
+/**
+ * @brief Sets up an empty wheel.
+ * @param tw Wheel to be initialized.
+ * @param now_ms Current time of a monotonic clock in ms.
+ * @param tick_ms Resolution of the wheel, timeouts are rounded up to it.
+ */
+void timer_wheel_init(timer_wheel_t *tw, long now_ms, long tick_ms);
+
+/**
+ * @brief Marks a timer as not scheduled, has to be called before the timer is used.
+ * @param timer Timer to be initialized.
+ */
+void timer_init(wheel_timer_t *timer);
+
+/**
+ * @brief Checks if a timer is scheduled.
+ * @param timer Timer.
+ * @return True if the timer is in the wheel.
+ */
+bool timer_pending(const wheel_timer_t *timer);
+
+/**
+ * @brief Schedules a timer, a pending timer is rescheduled.
+ * @param tw Wheel.
+ * @param timer Timer.
+ * @param timeout_ms Time from now after which the timer expires.
+ */
+void timer_schedule(timer_wheel_t *tw, wheel_timer_t *timer, long timeout_ms);
+
+/**
+ * @brief Removes a timer from the wheel, does nothing if it is not pending.
+ * @param tw Wheel.
+ * @param timer Timer.
+ */
+void timer_cancel(timer_wheel_t *tw, wheel_timer_t *timer);
+
+/**
+ * @brief Processes all ticks up to now.
+ * @details Expired timers are moved to the expired list, the caller takes them out one by one with
+ * timer_wheel_pop_expired(). They are not pending anymore and can be scheduled again right away.
+ *
+ * @param tw Wheel.
+ * @param now_ms Current time of a monotonic clock in ms.
+ * @param expired Sentinel of the list for expired timers, initialized by this function.
+ */
+void timer_wheel_advance(timer_wheel_t *tw, long now_ms, wheel_timer_t *expired);
+
+/**
+ * @brief Takes the next timer from an expired list.
+ * @param expired Sentinel filled by timer_wheel_advance().
+ * @return Timer or NULL if the list is empty.
+ */
+wheel_timer_t *timer_wheel_pop_expired(wheel_timer_t *expired);
+
+/**
+ * @brief Time until the next tick has to be processed.
+ * @param tw Wheel.
+ * @param now_ms Current time of a monotonic clock in ms.
+ * @return Timeout in ms for epoll_wait(), -1 if no timer is pending.
+ */
+int timer_wheel_timeout(const timer_wheel_t *tw, long now_ms);
+
+#endif